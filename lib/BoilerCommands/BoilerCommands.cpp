@@ -0,0 +1,403 @@
+#include "BoilerCommands.h"
+
+#include <stdio.h>
+
+#include "MqttMessages.h"
+
+const char* const CONTROL_TRIGGER_NAMES[4] = {"sensors", "home", "command", "timer"};
+uint8_t controlTriggers = CONTROL_TRIGGER_COMMAND;  // Первый пересчет сразу после старта
+unsigned long controlDeadline = 0;
+unsigned long controlEvaluations = 0;
+unsigned long controlDecisions = 0;
+uint8_t lastControlTrigger = 0;
+
+float setpoint = 60.0;
+SensorFilter sensorFilters[SENSOR_CHANNEL_COUNT];
+TemperatureHistory homeHistory = {{0}, 0, 0, 0, false};
+unsigned long lastHomeTempUpdate = 0;
+
+unsigned long lastManualControlTime = 0;
+unsigned long coalFeedingStartTime = 0;
+bool fanStateBeforeCoalFeeding = false;
+
+bool sensorsRelayState = true;
+bool sensorsResetPending = false;
+unsigned long sensorsResetStartTime = 0;
+
+// Время текущего прохода loop() - для scheduleControlAt(), который
+// BoilerControl вызывает без now
+static unsigned long controlNow = 0;
+// Время входящего MQTT-сообщения - для обработчиков таблицы MQTT_COMMANDS
+static unsigned long mqttCommandTime = 0;
+
+// ============ Пересчет управления ============
+void requestControlEvaluation(uint8_t trigger) {
+  controlTriggers |= trigger;
+}
+
+// Пересчет по таймеру не позже момента at (прошедшие сроки игнорируются)
+void scheduleControlAt(unsigned long at) {
+  if ((long)(at - controlNow) <= 0) {
+    return;
+  }
+  if (controlDeadline == 0 || (long)(at - controlDeadline) < 0) {
+    controlDeadline = at;
+  }
+}
+
+void evaluateControl(unsigned long now) {
+  uint8_t trigger = controlTriggers;
+  controlTriggers = 0;
+  controlDeadline = 0;
+  lastControlTrigger = trigger;
+  controlEvaluations++;
+  controlNow = now;
+
+  bool prevFan = fanState;
+  bool prevPump = pumpState;
+  uint8_t prevSystemState = systemState;
+  uint8_t prevComfortState = comfortState;
+
+  runBoilerControl(now);
+
+  // Страховочный пересчет, даже если событий не было
+  scheduleControlAt(now + CONTROL_MAX_IDLE_MS);
+
+  if (fanState != prevFan || pumpState != prevPump ||
+      systemState != prevSystemState || comfortState != prevComfortState) {
+    controlDecisions++;
+    onControlDecision(now, trigger);
+  }
+}
+
+void serviceControl(unsigned long now) {
+  controlNow = now;
+  // Смена флагов режима (энкодер, Serial, API, таймаут ручного управления) - тоже событие
+  static uint8_t lastControlInputs = 0xFF;
+  uint8_t controlInputs = (systemEnabled ? 0x01 : 0) | (manualFanControl ? 0x02 : 0) |
+                          (manualPumpControl ? 0x04 : 0) | (workMode == 1 ? 0x08 : 0) |
+                          (coalFeedingActive ? 0x10 : 0) | (ignitionInProgress ? 0x20 : 0) |
+                          (boilerExtinguished ? 0x40 : 0);
+  if (controlInputs != lastControlInputs) {
+    lastControlInputs = controlInputs;
+    controlTriggers |= CONTROL_TRIGGER_COMMAND;
+  }
+  if (controlDeadline != 0 && (long)(now - controlDeadline) >= 0) {
+    controlDeadline = 0;
+    controlTriggers |= CONTROL_TRIGGER_TIMER;
+  }
+
+  // Вентилятор, насос, розжиг - только когда что-то изменилось
+  if (controlTriggers != 0) {
+    evaluateControl(now);
+  }
+}
+
+// ============ Команды ============
+bool applyWorkMode(int newMode, unsigned long now) {
+  if (newMode == 1 && !isHomeTempSensorValid(now)) {
+    return false;
+  }
+  workMode = newMode;
+  // Сброс состояний при переключении
+  comfortState = COMFORT_WAIT;
+  comfortStateStartTime = 0;
+  homeTempAtStateStart = 0.0;
+  heatingStartTime = 0;
+
+  onCommandSave(COMMAND_SAVE_WORK_MODE);
+  return true;
+}
+
+static void logRelayCommand(const char* name, bool state, bool manual) {
+  char line[64];
+  snprintf(line, sizeof(line), "%s%s: %s", manual ? "[Инженерное] " : "", name, state ? "ВКЛ" : "ВЫКЛ");
+  onControlLog(line);
+}
+
+void applyFanControl(bool state, bool manual, unsigned long now) {
+  fanState = state;
+  onCommandRelay(COMMAND_RELAY_FAN, state);
+  manualFanControl = manual;
+  if (manual) {
+    lastManualControlTime = now;
+  }
+  logRelayCommand("Вентилятор", state, manual);
+}
+
+void applyPumpControl(bool state, bool manual, unsigned long now) {
+  pumpState = state;
+  onCommandRelay(COMMAND_RELAY_PUMP, state);
+  manualPumpControl = manual;
+  if (manual) {
+    lastManualControlTime = now;
+  }
+  logRelayCommand("Насос", state, manual);
+}
+
+void applySensorsRelay(bool on, bool reset, unsigned long now) {
+  sensorsRelayState = on;
+  onCommandRelay(COMMAND_RELAY_SENSORS, on);
+  // Включение реле обратно - в loop() прошивки через SENSORS_RESET_DELAY
+  sensorsResetPending = !on && reset;
+  if (sensorsResetPending) {
+    sensorsResetStartTime = now;
+  }
+  logRelayCommand("[Реле датчиков] Питание", on, false);
+}
+
+bool applySystemEnabled(bool enabled) {
+  systemEnabled = enabled;
+  bool saved = onCommandSave(COMMAND_SAVE_SYSTEM);
+  if (!enabled) {
+    fanState = false;
+    pumpState = false;
+    onCommandRelay(COMMAND_RELAY_FAN, false);
+    onCommandRelay(COMMAND_RELAY_PUMP, false);
+    resetControlTimers();
+    onControlLog("Система выключена - реле отключены, таймеры сброшены");
+  }
+  return saved;
+}
+
+void resetControlTimers() {
+  fanStartTime = 0;
+  heatingStartTime = 0;
+  coalFeedingStartTime = 0;
+  ignitionStartTime = 0;
+  sensorsResetStartTime = 0;
+  lastManualControlTime = 0;
+  lastHomeTempUpdate = 0;
+  lastPumpRunTime = 0;
+  coalBurnedCheckStart = 0;
+  lastFanToggleTime = 0;
+  maxTempDuringFan = 0.0;
+  boilerExtinguished = false;
+  ignitionInProgress = false;
+  coalFeedingActive = false;
+  sensorsResetPending = false;
+  systemState = STATE_IDLE;
+}
+
+bool requestIgnition(unsigned long now) {
+  if (boilerExtinguished || systemState == STATE_EXTINGUISHED || systemState == STATE_IGNITION_FAILED) {
+    startIgnition(now);
+    return true;
+  }
+  return false;
+}
+
+void startCoalFeeding(unsigned long now) {
+  if (coalFeedingActive) {
+    return;  // Уже активен
+  }
+  coalFeedingActive = true;
+  coalFeedingStartTime = now;
+  fanStateBeforeCoalFeeding = fanState;
+
+  // Выключаем вентилятор
+  fanState = false;
+  onControlFanRelay(false);
+
+  onCommandPublish("coalFeeding", "1");
+  onCoalFeedingChanged(true);
+}
+
+void stopCoalFeeding() {
+  if (!coalFeedingActive) {
+    return;  // Не активен
+  }
+  coalFeedingActive = false;
+
+  // Вентилятор остается как есть - дальше решает автоматика; выключенная
+  // система держит его выключенным
+  if (!systemEnabled) {
+    fanState = false;
+  }
+  onControlFanRelay(fanState);
+
+  onCommandPublish("coalFeeding", "0");
+  onCoalFeedingChanged(false);
+}
+
+void checkCoalFeeding(unsigned long now) {
+  if (coalFeedingActive && now - coalFeedingStartTime >= COAL_FEEDING_TIMEOUT) {
+    stopCoalFeeding();
+  }
+}
+
+void checkManualControlTimeout(unsigned long now) {
+  if (lastManualControlTime == 0 || now - lastManualControlTime <= MANUAL_CONTROL_TIMEOUT) {
+    return;
+  }
+  // Возврат к автоматическому управлению
+  if (manualFanControl) {
+    manualFanControl = false;
+    onControlLog("[Реле] Ручное управление вентилятором отключено (таймаут 2 мин)");
+  }
+  if (manualPumpControl) {
+    manualPumpControl = false;
+    onControlLog("[Реле] Ручное управление насосом отключено (таймаут 2 мин)");
+  }
+  lastManualControlTime = 0;
+}
+
+void onAutoSettingsChanged(const AutoSettings& old) {
+  if (autoSettings.setpoint != old.setpoint) {
+    // Уставка изменилась - сбрасываем таймеры переключения вентилятора
+    lastFanToggleTime = 0;
+    lastFanToggleTemp = supplyTemp;
+    onControlLog("[Auto] Setpoint changed - resetting fan toggle timers");
+  }
+  setpoint = autoSettings.setpoint;
+}
+
+// Комфорт переключился в Авто в BoilerControl
+void onControlWorkModeFallback() {
+  onCommandSave(COMMAND_SAVE_WORK_MODE);
+}
+
+// ============ Входящие MQTT ============
+// Обработчик получает payload видом на буфер клиента - без String и кучи.
+// Команды с retain приходят заново при каждом переподключении, поэтому
+// неизменившееся значение не сбрасывает состояние и не пишется во флеш
+bool dispatchMqttCommand(MqttCommandRegistry& registry, const char* topic, const uint8_t* payload,
+                         unsigned int length, unsigned long now) {
+  mqttCommandTime = now;
+  const MqttCommand* command = registry.dispatch(topic, payload, length);
+  if (command == nullptr) {
+    return false;
+  }
+  // Данные других устройств (ESP01) - отдельное событие, остальное - команды
+  requestControlEvaluation(command->scope == MQTT_COMMAND_ABSOLUTE ? CONTROL_TRIGGER_HOME : CONTROL_TRIGGER_COMMAND);
+  return true;
+}
+
+// Уставка Авто: "<prefix>/setpoint/set" в пределах AUTO_SETTINGS_LIMITS
+void onMqttSetpoint(MqttBytes payload) {
+  float newSetpoint;
+  if (!payload.toFloat(newSetpoint) || !settingNumberAllowed(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), "setpoint", newSetpoint) ||
+      newSetpoint == autoSettings.setpoint) {
+    return;
+  }
+  AutoSettings old = autoSettings;
+  autoSettings.setpoint = newSetpoint;
+  if (onCommandSave(COMMAND_SAVE_AUTO)) {
+    onAutoSettingsChanged(old);
+  } else {
+    autoSettings = old;
+  }
+}
+
+// Сброс питания датчиков: "1|on|reset" - выключить реле и включить через
+// SENSORS_RESET_DELAY, "0|off" - выключить
+void onMqttSensorsReset(MqttBytes payload) {
+  if (payload.isAny("1|on|reset")) {
+    applySensorsRelay(false, true, mqttCommandTime);
+    onControlLog("[MQTT] Sensors reset command received");
+  } else if (payload.isAny("0|off")) {
+    applySensorsRelay(false, false, mqttCommandTime);
+    onControlLog("[MQTT] Sensors relay off command received");
+  }
+}
+
+// Запуск розжига: "1|on|start"
+void onMqttIgnitionStart(MqttBytes payload) {
+  if (payload.isAny("1|on|start")) {
+    startIgnition(mqttCommandTime);
+    onControlLog("[MQTT] Ignition start command received");
+  }
+}
+
+// Режим работы: "0|auto" или "1|comfort"; ответ - "<prefix>/simple/workMode"
+void onMqttWorkMode(MqttBytes payload) {
+  int newMode;
+  if (payload.isAny("0|auto")) {
+    newMode = 0;
+  } else if (payload.isAny("1|comfort")) {
+    newMode = 1;
+  } else {
+    return;
+  }
+  if (newMode != workMode && !applyWorkMode(newMode, mqttCommandTime)) {
+    onControlLog("[MQTT] Work mode command rejected: home temp sensor offline");
+  }
+  onCommandPublish("simple/workMode", workMode == 1 ? "1" : "0");
+}
+
+// Подброс угля: "1|on|start" - начать, "0|off|stop" - прервать
+// (ответ "<prefix>/coalFeeding" публикуют startCoalFeeding/stopCoalFeeding)
+void onMqttCoalFeeding(MqttBytes payload) {
+  if (payload.isAny("1|on|start")) {
+    startCoalFeeding(mqttCommandTime);
+  } else if (payload.isAny("0|off|stop")) {
+    stopCoalFeeding();
+  }
+}
+
+// Вентилятор: "1|on", "0|off" - ручное управление (как инженерное в веб-интерфейсе,
+// снимается через MANUAL_CONTROL_TIMEOUT), "auto" - вернуть автоматике
+void onMqttFan(MqttBytes payload) {
+  if (payload.isAny("1|on")) {
+    applyFanControl(true, true, mqttCommandTime);
+  } else if (payload.isAny("0|off")) {
+    applyFanControl(false, true, mqttCommandTime);
+  } else if (payload.is("auto")) {
+    manualFanControl = false;
+    onControlLog("[MQTT] Fan returned to automatic control");
+  }
+}
+
+// Целевая температура дома (режим Комфорт) в пределах COMFORT_SETTINGS_LIMITS;
+// ответ - "<prefix>/simple/targetHomeTemp"
+void onMqttComfortTarget(MqttBytes payload) {
+  float target;
+  if (!payload.toFloat(target) || !settingNumberAllowed(SETTINGS_LIMITS(COMFORT_SETTINGS_LIMITS), "targetHomeTemp", target)) {
+    return;
+  }
+  if (target != comfortSettings.targetHomeTemp) {
+    ComfortSettings old = comfortSettings;
+    comfortSettings.targetHomeTemp = target;
+    if (onCommandSave(COMMAND_SAVE_COMFORT)) {
+      onComfortSettingsChanged(old);
+    } else {
+      comfortSettings = old;
+    }
+  }
+  char value[16];
+  snprintf(value, sizeof(value), "%.1f", comfortSettings.targetHomeTemp);
+  onCommandPublish("simple/targetHomeTemp", value);
+}
+
+// Температура в доме от ESP01
+void onEsp01Temperature(MqttBytes payload) {
+  float newHomeTemp;
+  if (!payload.toFloat(newHomeTemp)) {
+    return;
+  }
+  // Валидация диапазона (-50..50) выполняется фильтром канала
+  if (sensorFilters[SENSOR_HOME].process(newHomeTemp, mqttCommandTime) == FILTER_ACCEPTED) {
+    homeTemp = sensorFilters[SENSOR_HOME].value();
+    lastHomeTempUpdate = mqttCommandTime;
+    addToHistory(&homeHistory, homeTemp, mqttCommandTime);
+  }
+}
+
+// LWT статус датчика температуры дома
+void onEsp01Status(MqttBytes payload) {
+  if (payload.is("online")) {
+    homeTempSensorLWTOnline = true;
+    onControlLog("[MQTT] Home temperature sensor LWT: online");
+  } else if (payload.is("offline")) {
+    homeTempSensorLWTOnline = false;
+    onControlLog("[MQTT] Home temperature sensor LWT: offline");
+    // Если режим Комфорт и датчик стал offline, переключаемся на Авто и сохраняем
+    if (workMode == 1) {
+      onControlLog("[MQTT] Switching from Comfort to Auto mode due to sensor offline");
+      workMode = 0;
+      comfortState = COMFORT_WAIT;
+      comfortStateStartTime = 0;
+      onCommandSave(COMMAND_SAVE_WORK_MODE);
+    }
+  }
+}
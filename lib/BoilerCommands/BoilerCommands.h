@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "BoilerControl.h"
+#include "EepromLayout.h"
+#include "MqttCommands.h"
+#include "SensorFilter.h"
+#include "SettingsLimits.h"
+
+// Обвязка BoilerControl, общая для прошивки и хост-сборок tools/hostsim:
+// команды HTTP/MQTT над состоянием управления (режим работы, реле, подброс
+// угля, включение системы), обработчики таблицы MQTT_COMMANDS и событийный
+// пересчет управления из loop(). Как и BoilerControl, не зависит от Arduino:
+// время - параметром now, а GPIO, EEPROM и очередь MQTT остаются в
+// приложении (раздел "Реализуются приложением").
+
+// ============ Пересчет управления ============
+// Управление пересчитывается не на каждом проходе loop(), а по событиям:
+// новые показания датчиков, температура дома, команда или истекший таймер
+enum ControlTrigger : uint8_t {
+  CONTROL_TRIGGER_SENSORS = 0x01,  // Прочитаны датчики
+  CONTROL_TRIGGER_HOME = 0x02,     // Температура/LWT датчика дома от ESP01
+  CONTROL_TRIGGER_COMMAND = 0x04,  // HTTP/MQTT команда, энкодер, Serial, смена режима
+  CONTROL_TRIGGER_TIMER = 0x08     // Наступил срок (таймаут, интервал, страховочный пересчет)
+};
+extern const char* const CONTROL_TRIGGER_NAMES[4];
+const unsigned long CONTROL_MAX_IDLE_MS = 10000;  // Страховочный пересчет не реже раза в 10 с
+
+extern uint8_t controlTriggers;  // Накопленные причины пересчета
+extern unsigned long controlDeadline;  // Ближайший срок пересчета по таймеру (0 - нет)
+extern unsigned long controlEvaluations;
+extern unsigned long controlDecisions;
+extern uint8_t lastControlTrigger;
+
+// Запрос пересчета управления (из обработчиков событий)
+void requestControlEvaluation(uint8_t trigger);
+// Пересчет вентилятора, насоса и розжига; решение (смена реле или
+// состояния) уходит в onControlDecision()
+void evaluateControl(unsigned long now);
+// Проход loop(): смена флагов режима и истекший таймер - тоже события;
+// пересчет - только если что-то изменилось
+void serviceControl(unsigned long now);
+
+// ============ Состояние команд ============
+extern float setpoint;  // Действующая уставка Авто (экран, API)
+extern SensorFilter sensorFilters[SENSOR_CHANNEL_COUNT];  // Каналы фильтрации показаний
+extern TemperatureHistory homeHistory;
+extern unsigned long lastHomeTempUpdate;  // Время последнего показания дома от ESP01
+
+extern unsigned long lastManualControlTime;  // Время последнего ручного управления (0 - нет)
+const unsigned long MANUAL_CONTROL_TIMEOUT = 2 * 60 * 1000;  // Ручное управление снимается через 2 минуты
+
+extern unsigned long coalFeedingStartTime;  // Время начала подброса угля
+extern bool fanStateBeforeCoalFeeding;  // Состояние вентилятора до подброса угля
+const unsigned long COAL_FEEDING_TIMEOUT = 30 * 60 * 1000;  // Автозавершение, если подброс забыли выключить
+
+extern bool sensorsRelayState;  // Реле питания датчиков (true = включено)
+extern bool sensorsResetPending;  // Ждем автоматического включения реле датчиков
+extern unsigned long sensorsResetStartTime;  // Время начала ожидания сброса
+
+// ============ Команды ============
+// Смена режима работы (0 - Авто, 1 - Комфорт) со сбросом состояний Комфорта.
+// false - Комфорт невозможен: датчик температуры дома offline
+bool applyWorkMode(int newMode, unsigned long now);
+// Реле вентилятора/насоса; manual - инженерное управление, автоматика не
+// трогает реле MANUAL_CONTROL_TIMEOUT
+void applyFanControl(bool state, bool manual, unsigned long now);
+void applyPumpControl(bool state, bool manual, unsigned long now);
+// Реле питания датчиков; reset - выключить и включить снова (сброс зависших DS18B20)
+void applySensorsRelay(bool on, bool reset, unsigned long now);
+// Включение/выключение системы; при выключении реле отключаются, таймеры
+// управления сбрасываются. false - не удалось сохранить во флеш
+bool applySystemEnabled(bool enabled);
+// Таймеры и флаги управления (выключение системы, старт выключенной)
+void resetControlTimers();
+// Розжиг только из состояния "погас"/ошибки розжига; false - недоступен
+bool requestIgnition(unsigned long now);
+void startCoalFeeding(unsigned long now);
+void stopCoalFeeding();
+// Автозавершение подброса и таймаут ручного управления (из loop())
+void checkCoalFeeding(unsigned long now);
+void checkManualControlTimeout(unsigned long now);
+// Последствия смены настроек Авто (old - прежние) для работающего регулирования
+void onAutoSettingsChanged(const AutoSettings& old);
+
+// Входящее MQTT-сообщение по таблице MQTT_COMMANDS (обработчики - здесь
+// же) и запрос пересчета. false - тема не из таблицы
+bool dispatchMqttCommand(MqttCommandRegistry& registry, const char* topic, const uint8_t* payload,
+                         unsigned int length, unsigned long now);
+
+// ============ Реализуются приложением ============
+enum CommandRelay : uint8_t { COMMAND_RELAY_FAN, COMMAND_RELAY_PUMP, COMMAND_RELAY_SENSORS };
+enum CommandSave : uint8_t { COMMAND_SAVE_WORK_MODE, COMMAND_SAVE_SYSTEM, COMMAND_SAVE_AUTO, COMMAND_SAVE_COMFORT };
+
+// Запись реле: включено - HIGH, выключено - по инженерным настройкам логики реле
+void onCommandRelay(CommandRelay relay, bool on);
+// Состояние "<prefix>/<suffix>" в MQTT (если MQTT включен)
+void onCommandPublish(const char* suffix, const char* payload);
+// Сохранение во флеш; false - запись не удалась
+bool onCommandSave(CommandSave what);
+// Подброс угля начат/закончен (экран, модель котла)
+void onCoalFeedingChanged(bool active);
+// Решение управления: сменились реле или состояние, trigger - причины пересчета
+void onControlDecision(unsigned long now, uint8_t trigger);
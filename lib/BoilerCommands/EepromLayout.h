@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// Раскладка EEPROM. JSON-блок занимает 4 байта длины + текст не длиннее
+// EEPROM_*_MAX_LEN; static_assert ниже проверяет, что каждый блок кончается
+// до начала следующего. Общая с хост-сборками tools/hostsim: стенд пишет
+// тот же образ, поэтому дамп EEPROM с устройства подходит ему как есть.
+// До 1024 байт раскладка прежняя; все, что выше, при EEPROM_SIZE 1024 никогда
+// не сохранялось, поэтому эти адреса переложены без миграции
+#define EEPROM_SIZE 6144
+#define EEPROM_MAGIC 0xAA
+#define EEPROM_ADDR_MAGIC 0
+#define EEPROM_ADDR_AUTO 1
+#define EEPROM_AUTO_MAX_LEN 195
+#define EEPROM_ADDR_MQTT 200
+#define EEPROM_MQTT_MAX_LEN 196
+#define EEPROM_ADDR_SENSORS 400
+#define EEPROM_SENSORS_MAX_LEN 196
+#define EEPROM_ADDR_SYSTEM 600
+#define EEPROM_ADDR_WIFI 700
+#define EEPROM_WIFI_MAX_LEN 196
+#define EEPROM_ADDR_NTP_LEGACY 800  // Прежнее место NTP: его затирал блок WiFi длиннее 96 байт
+#define EEPROM_ADDR_FILTERS 900  // Настройки фильтров датчиков (5 каналов по 18 байт)
+#define EEPROM_ADDR_ML 1000
+#define EEPROM_ML_MAX_LEN 96
+#define EEPROM_ADDR_RELAY 1100
+#define EEPROM_RELAY_MAX_LEN 96
+#define EEPROM_ADDR_WORKMODE 1200
+#define EEPROM_ADDR_BOOT_COUNT 1250
+#define EEPROM_ADDR_UPDATE 1300
+#define EEPROM_UPDATE_MAX_LEN 196
+#define EEPROM_ADDR_COMFORT 1500  // 13 полей, до 400 байт
+#define EEPROM_COMFORT_MAX_LEN 396
+#define EEPROM_ADDR_NTP 1900
+#define EEPROM_NTP_MAX_LEN 96
+#define EEPROM_ADDR_BOOT_LOG 2000  // Журнал перезагрузок (50 записей по 32 байта = 1600 байт)
+#define BOOT_LOG_MAX_ENTRIES 50
+#define BOOT_LOG_ENTRY_SIZE 32  // Размер одной записи
+#define EEPROM_ADDR_EVENT_LOG 3600  // Журнал событий (30 записей по 80 байт = 2400 байт)
+#define EEPROM_ADDR_FAN_STATS 6000  // Статистика работы вентилятора (около 50 байт)
+
+// Блок [addr, addr + size) не заходит на следующий. Блоки с записями
+// фиксированного размера проверяются рядом с объявлением структур
+#define EEPROM_BLOB_SIZE(maxLen) (4 + (maxLen))
+#define EEPROM_REGION_FITS(addr, size, next) \
+  static_assert((addr) + (size) <= (next), #addr " заходит на " #next)
+EEPROM_REGION_FITS(EEPROM_ADDR_MAGIC, 1, EEPROM_ADDR_AUTO);
+EEPROM_REGION_FITS(EEPROM_ADDR_AUTO, EEPROM_BLOB_SIZE(EEPROM_AUTO_MAX_LEN), EEPROM_ADDR_MQTT);
+EEPROM_REGION_FITS(EEPROM_ADDR_MQTT, EEPROM_BLOB_SIZE(EEPROM_MQTT_MAX_LEN), EEPROM_ADDR_SENSORS);
+EEPROM_REGION_FITS(EEPROM_ADDR_SENSORS, EEPROM_BLOB_SIZE(EEPROM_SENSORS_MAX_LEN), EEPROM_ADDR_SYSTEM);
+EEPROM_REGION_FITS(EEPROM_ADDR_SYSTEM, sizeof(bool), EEPROM_ADDR_WIFI);
+EEPROM_REGION_FITS(EEPROM_ADDR_WIFI, EEPROM_BLOB_SIZE(EEPROM_WIFI_MAX_LEN), EEPROM_ADDR_FILTERS);
+EEPROM_REGION_FITS(EEPROM_ADDR_ML, EEPROM_BLOB_SIZE(EEPROM_ML_MAX_LEN), EEPROM_ADDR_RELAY);
+EEPROM_REGION_FITS(EEPROM_ADDR_RELAY, EEPROM_BLOB_SIZE(EEPROM_RELAY_MAX_LEN), EEPROM_ADDR_WORKMODE);
+EEPROM_REGION_FITS(EEPROM_ADDR_WORKMODE, sizeof(int), EEPROM_ADDR_BOOT_COUNT);
+EEPROM_REGION_FITS(EEPROM_ADDR_BOOT_COUNT, sizeof(uint32_t), EEPROM_ADDR_UPDATE);
+EEPROM_REGION_FITS(EEPROM_ADDR_UPDATE, EEPROM_BLOB_SIZE(EEPROM_UPDATE_MAX_LEN), EEPROM_ADDR_COMFORT);
+EEPROM_REGION_FITS(EEPROM_ADDR_COMFORT, EEPROM_BLOB_SIZE(EEPROM_COMFORT_MAX_LEN), EEPROM_ADDR_NTP);
+EEPROM_REGION_FITS(EEPROM_ADDR_NTP, EEPROM_BLOB_SIZE(EEPROM_NTP_MAX_LEN), EEPROM_ADDR_BOOT_LOG);
+EEPROM_REGION_FITS(EEPROM_ADDR_BOOT_LOG, BOOT_LOG_MAX_ENTRIES * BOOT_LOG_ENTRY_SIZE, EEPROM_ADDR_EVENT_LOG);
@@ -0,0 +1,146 @@
+#include "SettingsLimits.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "BoilerControl.h"
+#include "MqttCommands.h"
+#include "PayloadWriter.h"
+#include "SensorFilter.h"
+
+#define TABLE_COUNT(table) (uint8_t)(sizeof(table) / sizeof(table[0]))
+
+const SettingsFieldLimit AUTO_SETTINGS_LIMITS[] = {
+  {"setpoint", false, 40, 80}, {"minTemp", false, 30, 60}, {"maxTemp", false, 60, 90},
+  {"hysteresis", false, 0.5, 10}, {"inertiaTemp", false, 40, 70}, {"inertiaTime", false, 1, 60},
+  {"overheatTemp", false, 70, 90}, {"heatingTimeout", false, 10, 120}
+};
+const uint8_t AUTO_SETTINGS_LIMITS_COUNT = TABLE_COUNT(AUTO_SETTINGS_LIMITS);
+
+const SettingsFieldLimit COMFORT_SETTINGS_LIMITS[] = {
+  {"targetHomeTemp", false, 20, 28}, {"minBoilerTemp", false, 40, 80}, {"maxBoilerTemp", false, 40, 80},
+  {"waitTemp", false, 50, 80}, {"catchUpTemp", false, 20, 28}, {"waitCoolingTime", false, 5, 30},
+  {"waitAfterHeating1Time", false, 10, 60}, {"waitAfterReductionTime", false, 10, 60},
+  {"inertiaCheckInterval", false, 1, 15}, {"hysteresisOn", false, 0.1, 2}, {"hysteresisOff", false, 0.1, 2},
+  {"hysteresisBoiler", false, 0.5, 5}, {"warningTemp", false, 80, 90}
+};
+const uint8_t COMFORT_SETTINGS_LIMITS_COUNT = TABLE_COUNT(COMFORT_SETTINGS_LIMITS);
+
+const SettingsFieldLimit MQTT_SETTINGS_LIMITS[] = {
+  {"server", true, 0, 64}, {"port", false, 1, 65535}, {"user", true, 0, 32}, {"password", true, 0, 32},
+  {"prefix", true, 1, MQTT_COMMAND_PREFIX_MAX}, {"tempInterval", false, 1, 3600}, {"stateInterval", false, 1, 3600},
+  {"stateFormat", false, PAYLOAD_JSON, PAYLOAD_MSGPACK}
+};
+const uint8_t MQTT_SETTINGS_LIMITS_COUNT = TABLE_COUNT(MQTT_SETTINGS_LIMITS);
+
+const SettingsFieldLimit NTP_SETTINGS_LIMITS[] = {
+  {"server", true, 0, 40}, {"timezone", false, -12, 14}, {"updateInterval", false, 60, 86400}
+};
+const uint8_t NTP_SETTINGS_LIMITS_COUNT = TABLE_COUNT(NTP_SETTINGS_LIMITS);
+
+const SettingsFieldLimit ML_SETTINGS_LIMITS[] = {
+  {"publishInterval", false, 5, 300}, {"format", false, PAYLOAD_JSON, PAYLOAD_MSGPACK}
+};
+const uint8_t ML_SETTINGS_LIMITS_COUNT = TABLE_COUNT(ML_SETTINGS_LIMITS);
+
+const SettingsFieldLimit UPDATE_SETTINGS_LIMITS[] = {
+  {"checkInterval", false, 1, 168}
+};
+const uint8_t UPDATE_SETTINGS_LIMITS_COUNT = TABLE_COUNT(UPDATE_SETTINGS_LIMITS);
+
+const SettingsFieldLimit WIFI_SETTINGS_LIMITS[] = {
+  {"primarySSID", true, 0, 32}, {"primaryPassword", true, 0, 63},
+  {"backupSSID", true, 0, 32}, {"backupPassword", true, 0, 63}
+};
+const uint8_t WIFI_SETTINGS_LIMITS_COUNT = TABLE_COUNT(WIFI_SETTINGS_LIMITS);
+
+const SettingsFieldLimit SENSOR_MAPPING_LIMITS[] = {
+  {"supply", true, 0, 24}, {"return", true, 0, 24}, {"boiler", true, 0, 24}, {"outside", true, 0, 24}
+};
+const uint8_t SENSOR_MAPPING_LIMITS_COUNT = TABLE_COUNT(SENSOR_MAPPING_LIMITS);
+
+// Поля одного канала /api/sensors/filters (SensorFilterConfig)
+const SettingsFieldLimit SENSOR_FILTER_LIMITS[] = {
+  {"medianWindow", false, 1, SENSOR_FILTER_MAX_MEDIAN}, {"maxRate", false, 0, 10},
+  {"smoother", false, SMOOTHER_NONE, SMOOTHER_KALMAN}, {"emaAlpha", false, 0.01, 1},
+  {"kalmanQ", false, 0.0001, 10}, {"kalmanR", false, 0.001, 100}
+};
+const uint8_t SENSOR_FILTER_LIMITS_COUNT = TABLE_COUNT(SENSOR_FILTER_LIMITS);
+
+const SettingsFieldLimit* findSettingsLimit(const SettingsFieldLimit* limits, uint8_t count, const char* key) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (strcmp(limits[i].key, key) == 0) {
+      return &limits[i];
+    }
+  }
+  return nullptr;
+}
+
+bool settingNumberValid(const SettingsFieldLimit& limit, float number) {
+  return !isnan(number) && number >= limit.minValue && number <= limit.maxValue;
+}
+
+bool settingNumberAllowed(const SettingsFieldLimit* limits, uint8_t count, const char* key, float number) {
+  const SettingsFieldLimit* limit = findSettingsLimit(limits, count, key);
+  return limit != nullptr && !limit->isString && settingNumberValid(*limit, number);
+}
+
+// Порядок полей - как в JSON настроек (GET, EEPROM)
+const SettingsFieldValue AUTO_SETTINGS_VALUES[] = {
+  {"setpoint", &autoSettings.setpoint, nullptr},
+  {"minTemp", &autoSettings.minTemp, nullptr},
+  {"maxTemp", &autoSettings.maxTemp, nullptr},
+  {"hysteresis", &autoSettings.hysteresis, nullptr},
+  {"inertiaTemp", &autoSettings.inertiaTemp, nullptr},
+  {"inertiaTime", nullptr, &autoSettings.inertiaTime},
+  {"overheatTemp", &autoSettings.overheatTemp, nullptr},
+  {"heatingTimeout", nullptr, &autoSettings.heatingTimeout}
+};
+const uint8_t AUTO_SETTINGS_VALUES_COUNT = TABLE_COUNT(AUTO_SETTINGS_VALUES);
+
+const SettingsFieldValue COMFORT_SETTINGS_VALUES[] = {
+  {"targetHomeTemp", &comfortSettings.targetHomeTemp, nullptr},
+  {"minBoilerTemp", &comfortSettings.minBoilerTemp, nullptr},
+  {"maxBoilerTemp", &comfortSettings.maxBoilerTemp, nullptr},
+  {"waitTemp", &comfortSettings.waitTemp, nullptr},
+  {"catchUpTemp", &comfortSettings.catchUpTemp, nullptr},
+  {"waitCoolingTime", nullptr, &comfortSettings.waitCoolingTime},
+  {"waitAfterHeating1Time", nullptr, &comfortSettings.waitAfterHeating1Time},
+  {"waitAfterReductionTime", nullptr, &comfortSettings.waitAfterReductionTime},
+  {"inertiaCheckInterval", nullptr, &comfortSettings.inertiaCheckInterval},
+  {"hysteresisOn", &comfortSettings.hysteresisOn, nullptr},
+  {"hysteresisOff", &comfortSettings.hysteresisOff, nullptr},
+  {"hysteresisBoiler", &comfortSettings.hysteresisBoiler, nullptr},
+  {"warningTemp", &comfortSettings.warningTemp, nullptr}
+};
+const uint8_t COMFORT_SETTINGS_VALUES_COUNT = TABLE_COUNT(COMFORT_SETTINGS_VALUES);
+
+float getSettingsFieldValue(const SettingsFieldValue& field) {
+  return field.floatValue != nullptr ? *field.floatValue : (float)*field.intValue;
+}
+
+void setSettingsFieldValue(const SettingsFieldValue& field, float value) {
+  if (field.floatValue != nullptr) {
+    *field.floatValue = value;
+  } else {
+    *field.intValue = (int)value;
+  }
+}
+
+const char* applySettingsNumbers(const SettingsFieldLimit* limits, uint8_t limitCount,
+                                 const SettingsFieldValue* values, uint8_t valueCount,
+                                 SettingsNumberLookup lookup, void* context) {
+  float value;
+  for (uint8_t i = 0; i < valueCount; i++) {
+    if (lookup(values[i].key, value, context) &&
+        !settingNumberAllowed(limits, limitCount, values[i].key, value)) {
+      return values[i].key;
+    }
+  }
+  for (uint8_t i = 0; i < valueCount; i++) {
+    if (lookup(values[i].key, value, context)) {
+      setSettingsFieldValue(values[i], value);
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+// Пределы полей настроек - одна таблица на группу для проверки POST, команд
+// MQTT и загрузки из EEPROM: что принято по сети, то же и переживает
+// перезагрузку. Без ArduinoJson: проверку значений JSON (тип, длина строки)
+// делает прошивка, воспроизведение трасс tools/hostsim берет те же таблицы.
+struct SettingsFieldLimit {
+  const char* key;
+  bool isString;
+  float minValue;  // Для строк - пределы длины
+  float maxValue;
+};
+
+// Таблица и число ее полей - аргументы функций ниже и в прошивке
+#define SETTINGS_LIMITS(table) table, table##_COUNT
+
+extern const SettingsFieldLimit AUTO_SETTINGS_LIMITS[];
+extern const uint8_t AUTO_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit COMFORT_SETTINGS_LIMITS[];
+extern const uint8_t COMFORT_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit MQTT_SETTINGS_LIMITS[];
+extern const uint8_t MQTT_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit NTP_SETTINGS_LIMITS[];
+extern const uint8_t NTP_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit ML_SETTINGS_LIMITS[];
+extern const uint8_t ML_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit UPDATE_SETTINGS_LIMITS[];
+extern const uint8_t UPDATE_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit WIFI_SETTINGS_LIMITS[];
+extern const uint8_t WIFI_SETTINGS_LIMITS_COUNT;
+extern const SettingsFieldLimit SENSOR_MAPPING_LIMITS[];
+extern const uint8_t SENSOR_MAPPING_LIMITS_COUNT;
+extern const SettingsFieldLimit SENSOR_FILTER_LIMITS[];
+extern const uint8_t SENSOR_FILTER_LIMITS_COUNT;
+
+const SettingsFieldLimit* findSettingsLimit(const SettingsFieldLimit* limits, uint8_t count, const char* key);
+bool settingNumberValid(const SettingsFieldLimit& limit, float number);
+// Число для поля key: поле есть в таблице и значение в его пределах
+bool settingNumberAllowed(const SettingsFieldLimit* limits, uint8_t count, const char* key, float number);
+
+// Поля Авто и Комфорта - только числа: ключ и переменная в autoSettings /
+// comfortSettings. По этим таблицам прошивка собирает и разбирает JSON
+// настроек, а воспроизведение трасс применяет HTTP-команды
+struct SettingsFieldValue {
+  const char* key;
+  float* floatValue;  // nullptr - целое поле (минуты)
+  int* intValue;
+};
+
+#define SETTINGS_VALUES(table) table, table##_COUNT
+
+extern const SettingsFieldValue AUTO_SETTINGS_VALUES[];
+extern const uint8_t AUTO_SETTINGS_VALUES_COUNT;
+extern const SettingsFieldValue COMFORT_SETTINGS_VALUES[];
+extern const uint8_t COMFORT_SETTINGS_VALUES_COUNT;
+
+float getSettingsFieldValue(const SettingsFieldValue& field);
+void setSettingsFieldValue(const SettingsFieldValue& field, float value);
+
+// Поиск числа по ключу в теле команды (разбор - у вызывающего)
+typedef bool (*SettingsNumberLookup)(const char* key, float& value, void* context);
+
+// Как POST настроек в прошивке: сначала проверка всех полей по пределам,
+// при ошибке не меняется ничего. Возвращает имя неверного поля или nullptr
+const char* applySettingsNumbers(const SettingsFieldLimit* limits, uint8_t limitCount,
+                                 const SettingsFieldValue* values, uint8_t valueCount,
+                                 SettingsNumberLookup lookup, void* context);
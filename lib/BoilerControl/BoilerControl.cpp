@@ -0,0 +1,741 @@
+#include "BoilerControl.h"
+
+#include <math.h>
+#include <stdio.h>
+
+const SystemStateInfo SYSTEM_STATES[SYSTEM_STATE_COUNT] = {
+  {"IDLE", "IDLE", "Ожидание"},
+  {"HEATING", "HEATING", "Разогрев"},
+  {"HEATING_TIMEOUT", "ТАЙМАУТ", "Таймаут разогрева"},
+  {"COAL_BURNED", "ПРОГОРЕЛ", "Уголь прогорел"},
+  {"OVERHEAT", "OVERHEAT", "Перегрев"},
+  {"HIGH_TEMP", "ВЫСОКАЯ", "Высокая температура"},
+  {"КОТЕЛ_ПОГАС", "ПОГАС", "Котел погас"},
+  {"РОЗЖИГ", "РОЗЖИГ", "Розжиг"},
+  {"ОШИБКА_РОЗЖИГА", "ОШИБКА", "Ошибка розжига"},
+  {"Ожидание", "Ожидание", "Ожидание"},
+  {"Разогрев 1", "Разогрев 1", "Разогрев 1"},
+  {"Ожидание охлаждения", "Ожидание охлаждения", "Ожидание охлаждения"},
+  {"Ожидание прогрева", "Ожидание прогрева", "Ожидание прогрева"},
+  {"Разогрев 2", "Разогрев 2", "Разогрев 2"},
+  {"Комфорт", "Комфорт", "Комфорт"},
+  {"Поддержание", "Поддержание", "Поддержание"}
+};
+
+const char* const COMFORT_STATE_NAMES[COMFORT_STATE_COUNT] = {
+  "WAIT", "HEATING_1", "WAIT_COOLING", "WAIT_HEATING", "HEATING_2", "COMFORT", "MAINTAIN", "OVERHEAT"
+};
+
+const char* const WORK_MODE_NAMES[2] = {"auto", "comfort"};
+
+AutoSettings autoSettings;
+ComfortSettings comfortSettings;
+
+float supplyTemp = 0.0;
+float outdoorTemp = 0.0;
+float homeTemp = 0.0;
+bool homeTempSensorLWTOnline = false;
+TemperatureHistory supplyHistory = {{0}, 0, 0, 0, false};
+bool systemEnabled = true;
+bool manualFanControl = false;
+bool manualPumpControl = false;
+bool coalFeedingActive = false;
+int workMode = 0;
+
+bool fanState = false;
+bool pumpState = false;
+SystemState systemState = STATE_IDLE;
+
+unsigned long lastFanToggleTime = 0;
+float lastFanToggleTemp = 0;
+unsigned long heatingStartTime = 0;
+unsigned long lastPumpRunTime = 0;
+unsigned long coalBurnedCheckStart = 0;
+
+unsigned long fanStartTime = 0;
+float maxTempDuringFan = 0.0;
+bool boilerExtinguished = false;
+
+bool ignitionInProgress = false;
+unsigned long ignitionStartTime = 0;
+float ignitionStartTemp = 0.0;
+
+ComfortState comfortState = COMFORT_WAIT;
+unsigned long comfortStateStartTime = 0;
+float homeTempAtStateStart = 0.0;
+
+// Строка диагностики с форматированием
+static void controlLogf(const char* format, float a, float b = 0.0) {
+  char line[192];
+  snprintf(line, sizeof(line), format, a, b);
+  onControlLog(line);
+}
+
+// Функция добавления значения в историю
+void addToHistory(TemperatureHistory* history, float newValue, unsigned long now) {
+  history->values[history->index] = newValue;
+  history->index = (history->index + 1) % TEMP_HISTORY_SIZE;
+  if (history->count < TEMP_HISTORY_SIZE) {
+    history->count++;
+  }
+  history->lastUpdate = now;
+  history->isValid = true;
+}
+
+// Функция определения тренда температуры
+int getTemperatureTrend(const TemperatureHistory* history) {
+  if (history->count < TEMP_TREND_SAMPLES || !history->isValid) {
+    return 0; // Недостаточно данных или невалидные данные
+  }
+
+  // Берем последние TEMP_TREND_SAMPLES значений для анализа
+  int samples = history->count < TEMP_TREND_SAMPLES ? history->count : TEMP_TREND_SAMPLES;
+  float firstHalf = 0, secondHalf = 0;
+
+  // Первая половина (старые значения) - первые samples/2 значений
+  int firstCount = samples / 2;
+  for (int i = 0; i < firstCount; i++) {
+    int idx = (history->index - samples + i + TEMP_HISTORY_SIZE) % TEMP_HISTORY_SIZE;
+    firstHalf += history->values[idx];
+  }
+  firstHalf /= firstCount;
+
+  // Вторая половина (новые значения) - последние samples/2 значений
+  int secondCount = samples - firstCount;
+  for (int i = firstCount; i < samples; i++) {
+    int idx = (history->index - samples + i + TEMP_HISTORY_SIZE) % TEMP_HISTORY_SIZE;
+    secondHalf += history->values[idx];
+  }
+  secondHalf /= secondCount;
+
+  float diff = secondHalf - firstHalf;
+
+  if (diff > TEMP_CHANGE_THRESHOLD) {
+    return 1; // Рост
+  } else if (diff < -TEMP_CHANGE_THRESHOLD) {
+    return -1; // Падение
+  }
+
+  return 0; // Стабильно
+}
+
+// Функция запуска розжига
+void startIgnition(unsigned long now) {
+  if (boilerExtinguished || systemState == STATE_EXTINGUISHED) {
+    boilerExtinguished = false;
+    ignitionInProgress = true;
+    ignitionStartTime = now;
+    ignitionStartTemp = supplyTemp;
+    fanStartTime = 0;
+    maxTempDuringFan = 0.0;
+    fanState = true;
+    onControlFanRelay(true);
+    systemState = STATE_IGNITION;
+
+    char details[50];
+    snprintf(details, sizeof(details), "Температура: %.1f°C", ignitionStartTemp);
+    onControlEvent("IGNITION_STARTED", "boiler_ignition_started", details);
+
+    onControlLog("[Котел] Розжиг начат по нажатию кнопки");
+  }
+}
+
+// Проверка погасания котла
+void checkBoilerExtinguished(unsigned long now) {
+  if (!fanState || boilerExtinguished) {
+    return;
+  }
+
+  // Если вентилятор только что включился
+  if (fanStartTime == 0) {
+    fanStartTime = now;
+    maxTempDuringFan = supplyTemp;
+    return;
+  }
+
+  // Обновляем максимальную температуру
+  if (supplyTemp > maxTempDuringFan) {
+    maxTempDuringFan = supplyTemp;
+  }
+
+  // Проверяем время работы вентилятора
+  unsigned long fanWorkTime = now - fanStartTime;
+
+  if (fanWorkTime >= BOILER_EXTINGUISHED_CHECK_TIME) {
+    // Проверяем тренд температуры
+    int trend = getTemperatureTrend(&supplyHistory);
+
+    // Если температура падает
+    if (trend == -1) {
+      float tempDrop = maxTempDuringFan - supplyTemp;
+
+      // Если температура упала на заданное значение
+      if (tempDrop >= BOILER_EXTINGUISHED_TEMP_DROP) {
+        boilerExtinguished = true;
+        fanState = false;
+        onControlFanRelay(false);
+        systemState = STATE_EXTINGUISHED;
+
+        char details[50];
+        snprintf(details, sizeof(details), "Падение: %.1f°C за %.1fч", tempDrop, fanWorkTime / 3600000.0);
+        onControlEvent("BOILER_EXTINGUISHED", "boiler_extinguished", details);
+
+        controlLogf("[Котел] Обнаружено погасание! Вентилятор отключен. Падение температуры: %.2f°C", tempDrop);
+      }
+    }
+  }
+}
+
+// Проверка прогресса розжига
+void checkIgnitionProgress(unsigned long now) {
+  if (!ignitionInProgress) {
+    return;
+  }
+
+  unsigned long ignitionElapsed = now - ignitionStartTime;
+  float tempIncrease = supplyTemp - ignitionStartTemp;
+
+  // Проверяем успешность розжига
+  if (tempIncrease >= IGNITION_TEMP_INCREASE) {
+    // Розжиг успешен
+    ignitionInProgress = false;
+    systemState = STATE_HEATING;
+    heatingStartTime = now;
+    fanStartTime = now;
+    maxTempDuringFan = supplyTemp;
+
+    char details[50];
+    snprintf(details, sizeof(details), "Успех за %lu мин, +%.1f°C", ignitionElapsed / 60000, tempIncrease);
+    onControlEvent("IGNITION_SUCCESS", "boiler_ignition_success", details);
+
+    controlLogf("[Котел] Розжиг успешен! Температура повысилась на %.2f°C", tempIncrease);
+    return;
+  }
+
+  // Проверяем таймаут (10-20 минут в зависимости от начальной температуры)
+  unsigned long timeout = (ignitionStartTemp < 30.0) ? IGNITION_TIMEOUT_MAX : IGNITION_TIMEOUT_MIN;
+
+  if (ignitionElapsed >= timeout) {
+    // Розжиг неудачен
+    ignitionInProgress = false;
+    fanState = false;
+    onControlFanRelay(false);
+    systemState = STATE_IGNITION_FAILED;
+    boilerExtinguished = true;
+
+    char details[50];
+    snprintf(details, sizeof(details), "Таймаут %lu мин, +%.1f°C", timeout / 60000, tempIncrease);
+    onControlEvent("IGNITION_FAILED", "boiler_ignition_failed", details);
+
+    controlLogf("[Котел] Розжиг неудачен! Таймаут. Температура повысилась только на %.2f°C", tempIncrease);
+  }
+}
+
+// Проверка валидности датчика температуры дома
+bool isHomeTempSensorValid(unsigned long now) {
+  (void)now;
+  // Сначала проверяем LWT статус - если offline, датчик невалиден
+  if (!homeTempSensorLWTOnline) {
+    return false;
+  }
+
+  // Если LWT online, разрешаем режим комфорт, даже если температура еще не получена
+  // Это позволяет включить режим комфорт сразу после появления датчика в сети
+  // Проверку температуры и таймаута используем только как дополнительную информацию
+
+  return true;
+}
+
+// ============ Автомат режима "Комфорт" ============
+// Каждый такт: действие текущего состояния (управление вентилятором по температуре котла),
+// затем переходы по таблице в порядке объявления - срабатывает первый, чей guard истинен.
+// Переходы из COMFORT_ANY проверяются до действия состояния.
+
+// Контекст одного такта
+struct ComfortContext {
+  unsigned long now;
+  unsigned long stateElapsed;  // Минуты в текущем состоянии
+  float intermediateTemp;      // Середина между min и max температурой котла
+  float maintainTemp;          // Адаптивная температура котла для поддержания
+};
+
+typedef bool (*ComfortGuard)(const ComfortContext& ctx);
+typedef void (*ComfortAction)(const ComfortContext& ctx);
+
+// Что сбрасывается при входе в целевое состояние
+#define COMFORT_ENTER_TIMER 0x01  // comfortStateStartTime = now
+#define COMFORT_ENTER_HOME 0x02   // homeTempAtStateStart = homeTemp
+
+struct ComfortStateInfo {
+  SystemState label;   // Значение systemState в этом состоянии
+  ComfortAction tick;  // Действие на каждом такте (может быть nullptr)
+};
+
+struct ComfortTransition {
+  ComfortState from;
+  ComfortGuard guard;
+  ComfortAction action;  // Выполняется при переходе (может быть nullptr)
+  ComfortState to;
+  uint8_t enterFlags;
+};
+
+// --- Действия состояний ---
+static void comfortTickWait(const ComfortContext&) {
+  fanState = false;
+}
+
+static void comfortTickHeating1(const ComfortContext& ctx) {
+  if (supplyTemp < ctx.intermediateTemp && !boilerExtinguished) {
+    fanState = true;
+    if (fanStartTime == 0) {
+      fanStartTime = ctx.now;
+      maxTempDuringFan = supplyTemp;
+    }
+  }
+}
+
+// Удержание котла около waitTemp в паузах между разогревами
+static void comfortTickHoldBoiler(const ComfortContext&) {
+  if (supplyTemp < 63.0) {
+    fanState = true;
+  } else if (supplyTemp >= comfortSettings.waitTemp) {
+    fanState = false;
+  }
+}
+
+static void comfortTickHeating2(const ComfortContext&) {
+  if (supplyTemp < comfortSettings.maxBoilerTemp) {
+    fanState = true;
+  }
+}
+
+static void comfortTickComfort(const ComfortContext& ctx) {
+  float comfortLow = ctx.intermediateTemp - comfortSettings.hysteresisBoiler;
+  float comfortHigh = ctx.intermediateTemp + comfortSettings.hysteresisBoiler;
+  if (supplyTemp < comfortLow) {
+    fanState = true;
+  } else if (supplyTemp >= comfortHigh) {
+    fanState = false;
+  }
+}
+
+static void comfortTickMaintain(const ComfortContext& ctx) {
+  // Если температура дома уже выше целевой с гистерезисом выключения, выключаем вентилятор
+  if (homeTemp >= (comfortSettings.targetHomeTemp + comfortSettings.hysteresisOff)) {
+    fanState = false;
+    return;
+  }
+  // Поддержание температуры котла в диапазоне
+  float maintainLow = ctx.maintainTemp - comfortSettings.hysteresisBoiler;
+  float maintainHigh = ctx.maintainTemp + comfortSettings.hysteresisBoiler;
+  if (supplyTemp < maintainLow) {
+    fanState = true;
+  } else if (supplyTemp >= maintainHigh) {
+    fanState = false;
+  }
+}
+
+// --- Условия переходов ---
+static bool comfortGuardOverheat(const ComfortContext&) {
+  return supplyTemp >= comfortSettings.warningTemp;
+}
+
+static bool comfortGuardOverheatCleared(const ComfortContext&) {
+  return supplyTemp < comfortSettings.warningTemp;
+}
+
+static bool comfortGuardHomeBelowTarget(const ComfortContext&) {
+  return homeTemp < (comfortSettings.targetHomeTemp - comfortSettings.hysteresisOn);
+}
+
+static bool comfortGuardHomeReachedTarget(const ComfortContext&) {
+  return homeTemp >= comfortSettings.targetHomeTemp;
+}
+
+static bool comfortGuardIntermediateReached(const ComfortContext& ctx) {
+  return supplyTemp >= ctx.intermediateTemp;
+}
+
+static bool comfortGuardMaxReached(const ComfortContext&) {
+  return supplyTemp >= comfortSettings.maxBoilerTemp;
+}
+
+static bool comfortGuardCooledToWait(const ComfortContext& ctx) {
+  return ctx.stateElapsed >= (unsigned long)comfortSettings.waitCoolingTime &&
+         supplyTemp <= comfortSettings.waitTemp && supplyTemp >= 60.0;
+}
+
+static bool comfortGuardCooledTooMuch(const ComfortContext& ctx) {
+  return ctx.stateElapsed >= (unsigned long)comfortSettings.waitCoolingTime && supplyTemp < 55.0;
+}
+
+static bool comfortGuardHomeResponded(const ComfortContext& ctx) {
+  return ctx.stateElapsed >= (unsigned long)comfortSettings.waitAfterHeating1Time &&
+         (homeTemp - homeTempAtStateStart >= 0.5 || homeTemp >= comfortSettings.catchUpTemp);
+}
+
+static bool comfortGuardHomeNotResponded(const ComfortContext& ctx) {
+  return ctx.stateElapsed >= (unsigned long)comfortSettings.waitAfterHeating1Time;
+}
+
+// Проверка инерции дома - раз в inertiaCheckInterval минут
+static bool comfortInertiaCheckDue(const ComfortContext& ctx) {
+  return ctx.stateElapsed > 0 && comfortSettings.inertiaCheckInterval > 0 &&
+         ctx.stateElapsed % comfortSettings.inertiaCheckInterval == 0;
+}
+
+static bool comfortGuardInertiaHomeCold(const ComfortContext& ctx) {
+  return comfortInertiaCheckDue(ctx) && homeTemp < 23.0;
+}
+
+static bool comfortGuardInertiaNoGain(const ComfortContext& ctx) {
+  return comfortInertiaCheckDue(ctx) && ctx.stateElapsed >= (unsigned long)comfortSettings.waitAfterReductionTime &&
+         homeTemp - homeTempAtStateStart < 0.3;
+}
+
+// --- Действия переходов ---
+static void comfortActionOverheat(const ComfortContext&) {
+  fanState = false;
+  systemState = STATE_OVERHEAT;
+}
+
+static void comfortActionOverheatCleared(const ComfortContext&) {
+  onControlLog("[Comfort] Восстановление после перегрева");
+}
+
+static void comfortActionFanOn(const ComfortContext&) {
+  fanState = true;
+}
+
+static void comfortActionFanOff(const ComfortContext&) {
+  fanState = false;
+}
+
+// --- Таблицы ---
+static const ComfortStateInfo COMFORT_STATES[COMFORT_STATE_COUNT] = {
+  {STATE_COMFORT_WAIT, comfortTickWait},                  // COMFORT_WAIT
+  {STATE_COMFORT_HEATING_1, comfortTickHeating1},         // COMFORT_HEATING_1
+  {STATE_COMFORT_WAIT_COOLING, comfortTickHoldBoiler},    // COMFORT_WAIT_COOLING
+  {STATE_COMFORT_WAIT_HEATING, comfortTickHoldBoiler},    // COMFORT_WAIT_HEATING
+  {STATE_COMFORT_HEATING_2, comfortTickHeating2},         // COMFORT_HEATING_2
+  {STATE_COMFORT_COMFORT, comfortTickComfort},            // COMFORT_COMFORT
+  {STATE_COMFORT_MAINTAIN, comfortTickMaintain},          // COMFORT_MAINTAIN
+  {STATE_OVERHEAT, nullptr}                               // COMFORT_OVERHEAT
+};
+
+static const ComfortTransition COMFORT_TRANSITIONS[] = {
+  {COMFORT_ANY, comfortGuardOverheat, comfortActionOverheat, COMFORT_OVERHEAT, 0},
+  {COMFORT_OVERHEAT, comfortGuardOverheatCleared, comfortActionOverheatCleared, COMFORT_WAIT, COMFORT_ENTER_TIMER},
+  {COMFORT_WAIT, comfortGuardHomeBelowTarget, nullptr, COMFORT_HEATING_1, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_HEATING_1, comfortGuardIntermediateReached, comfortActionFanOff, COMFORT_WAIT_COOLING, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_WAIT_COOLING, comfortGuardCooledToWait, nullptr, COMFORT_WAIT_HEATING, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_WAIT_COOLING, comfortGuardCooledTooMuch, nullptr, COMFORT_HEATING_1, COMFORT_ENTER_TIMER},
+  {COMFORT_WAIT_HEATING, comfortGuardHomeResponded, nullptr, COMFORT_COMFORT, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_WAIT_HEATING, comfortGuardHomeNotResponded, nullptr, COMFORT_HEATING_2, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_HEATING_2, comfortGuardMaxReached, comfortActionFanOff, COMFORT_WAIT_HEATING, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_COMFORT, comfortGuardHomeReachedTarget, comfortActionFanOff, COMFORT_MAINTAIN, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_COMFORT, comfortGuardInertiaHomeCold, nullptr, COMFORT_HEATING_1, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_COMFORT, comfortGuardInertiaNoGain, nullptr, COMFORT_HEATING_2, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+  {COMFORT_MAINTAIN, comfortGuardHomeBelowTarget, comfortActionFanOn, COMFORT_HEATING_1, COMFORT_ENTER_TIMER | COMFORT_ENTER_HOME},
+};
+static const int COMFORT_TRANSITION_COUNT = sizeof(COMFORT_TRANSITIONS) / sizeof(COMFORT_TRANSITIONS[0]);
+
+// Выполнение перехода, если есть подходящий из состояния from. true - переход выполнен
+static bool runComfortTransitions(uint8_t from, const ComfortContext& ctx) {
+  for (int i = 0; i < COMFORT_TRANSITION_COUNT; i++) {
+    const ComfortTransition& t = COMFORT_TRANSITIONS[i];
+    if (t.from != from || !t.guard(ctx)) {
+      continue;
+    }
+    if (t.action != nullptr) {
+      t.action(ctx);
+    }
+    comfortState = t.to;
+    if (t.enterFlags & COMFORT_ENTER_TIMER) comfortStateStartTime = ctx.now;
+    if (t.enterFlags & COMFORT_ENTER_HOME) homeTempAtStateStart = homeTemp;
+    return true;
+  }
+  return false;
+}
+
+// Выход из режима "Комфорт" в "Авто"
+static void comfortFallbackToAuto() {
+  workMode = 0;
+  onControlWorkModeFallback();
+  comfortState = COMFORT_WAIT;
+  comfortStateStartTime = 0;
+  homeTempAtStateStart = 0.0;
+}
+
+// При изменении целевой температуры сбрасываем счетчики ожиданий
+void onComfortSettingsChanged(const ComfortSettings& old) {
+  bool targetHomeTempChanged = fabsf(old.targetHomeTemp - comfortSettings.targetHomeTemp) > 0.1;
+  if (targetHomeTempChanged && workMode == 1) {
+    comfortStateStartTime = 0;
+    homeTempAtStateStart = homeTemp;
+    // Если температура уже достигла целевой, переходим в MAINTAIN
+    if (homeTemp >= comfortSettings.targetHomeTemp) {
+      comfortState = COMFORT_MAINTAIN;
+    } else {
+      comfortState = COMFORT_WAIT;
+    }
+  }
+}
+
+// Функция управления режимом "Комфорт"
+void handleComfortMode(unsigned long now) {
+  // Проверка наличия температуры в доме - если датчик offline, переключаемся на режим Авто
+  if (!isHomeTempSensorValid(now)) {
+    onControlLog("[Comfort] Home temperature sensor offline, switching to Auto mode");
+    comfortFallbackToAuto();
+    return;
+  }
+
+  ComfortContext ctx;
+  ctx.now = now;
+  ctx.stateElapsed = (comfortStateStartTime == 0) ? 0 : (now - comfortStateStartTime) / 60000;
+  ctx.intermediateTemp = (comfortSettings.minBoilerTemp + comfortSettings.maxBoilerTemp) / 2.0;
+  // Переходы зависят от минут в состоянии - пересчет на границе следующей минуты
+  if (comfortStateStartTime != 0) {
+    scheduleControlAt(comfortStateStartTime + (ctx.stateElapsed + 1) * 60000);
+  }
+  // Адаптивная температура поддержания
+  if (homeTemp < comfortSettings.targetHomeTemp) {
+    ctx.maintainTemp = comfortSettings.minBoilerTemp + 3.0;
+  } else {
+    ctx.maintainTemp = comfortSettings.minBoilerTemp + 7.0;
+  }
+
+  // Защита от перегрева и другие переходы из любого состояния
+  if (!runComfortTransitions(COMFORT_ANY, ctx)) {
+    const ComfortStateInfo& info = COMFORT_STATES[comfortState];
+    systemState = info.label;
+    if (info.tick != nullptr) {
+      info.tick(ctx);
+    }
+    runComfortTransitions(comfortState, ctx);
+  }
+  // Вентилятор остановлен - следующий запуск проверяется на погасание с нуля,
+  // как в Авто: иначе максимум прошлого разогрева выглядит падением температуры
+  if (!fanState) {
+    fanStartTime = 0;
+    maxTempDuringFan = 0.0;
+  }
+
+  // Проверка погасания котла в режиме Комфорт (только если не в режиме розжига)
+  if (!ignitionInProgress && !boilerExtinguished && fanState) {
+    checkBoilerExtinguished(now);
+    // Если котел погас, переключаемся в режим Авто
+    if (boilerExtinguished) {
+      comfortFallbackToAuto();
+    }
+  }
+}
+
+// Режим "Авто": вентилятор по уставке с гистерезисом, таймаут разогрева,
+// прогорание угля, перегрев и погасание
+static void runAutoMode(unsigned long now) {
+  // Включаем вентилятор, если температура подачи ниже (уставка - гистерезис)
+  // Выключаем, если температура достигла (уставка + гистерезис)
+  if (supplyTemp <= 0) {  // Только если есть показания датчика
+    return;
+  }
+
+  // Управление вентилятором
+  // Защита от частых переключений
+  unsigned long timeSinceLastToggle = (lastFanToggleTime == 0) ? 999999 : now - lastFanToggleTime;
+  float tempDelta = fabsf(supplyTemp - lastFanToggleTemp);
+
+  // Проверяем условия для включения/выключения с защитой от дребезга
+  bool shouldTurnOn = !fanState &&
+                      supplyTemp < (autoSettings.setpoint - autoSettings.hysteresis) &&
+                      (timeSinceLastToggle >= FAN_TOGGLE_MIN_INTERVAL_MS || lastFanToggleTime == 0) &&
+                      (tempDelta >= FAN_TOGGLE_MIN_TEMP_DELTA || lastFanToggleTime == 0);
+
+  bool shouldTurnOff = fanState &&
+                       supplyTemp >= (autoSettings.setpoint + autoSettings.hysteresis) &&
+                       (timeSinceLastToggle >= FAN_TOGGLE_MIN_INTERVAL_MS || lastFanToggleTime == 0) &&
+                       (tempDelta >= FAN_TOGGLE_MIN_TEMP_DELTA || lastFanToggleTime == 0);
+
+  if (shouldTurnOn && !boilerExtinguished) {
+    fanState = true;
+    systemState = STATE_HEATING;
+    heatingStartTime = now;  // Запоминаем время начала разогрева
+    fanStartTime = now;  // Запоминаем время начала работы вентилятора
+    maxTempDuringFan = supplyTemp;  // Инициализируем максимальную температуру
+    lastFanToggleTime = now;
+    lastFanToggleTemp = supplyTemp;
+    onControlFanCycle();
+  } else if (shouldTurnOff) {
+    heatingStartTime = 0;  // Сбрасываем таймер разогрева
+    fanState = false;
+    systemState = STATE_IDLE;
+    fanStartTime = 0;  // Сбрасываем таймер работы вентилятора
+    maxTempDuringFan = 0.0;  // Сбрасываем максимальную температуру
+    lastFanToggleTime = now;
+    lastFanToggleTemp = supplyTemp;
+  }
+  // Повторная проверка, когда истечет защитный интервал переключения
+  if (lastFanToggleTime != 0 && now - lastFanToggleTime < FAN_TOGGLE_MIN_INTERVAL_MS) {
+    scheduleControlAt(lastFanToggleTime + FAN_TOGGLE_MIN_INTERVAL_MS);
+  }
+
+  // 3. Проверка таймаута разогрева
+  if (heatingStartTime > 0 && fanState) {
+    scheduleControlAt(heatingStartTime + (unsigned long)autoSettings.heatingTimeout * 60000);
+    unsigned long heatingElapsed = (now - heatingStartTime) / 60000;  // минуты
+    if (heatingElapsed >= (unsigned long)autoSettings.heatingTimeout) {
+      // "Уголь прогорел" уточняет причину таймаута - не перебиваем его,
+      // иначе состояние скачет между ними на каждом пересчете
+      if (supplyTemp < autoSettings.setpoint - 5 && systemState != STATE_COAL_BURNED) {
+        systemState = STATE_HEATING_TIMEOUT;
+      }
+    }
+  }
+
+  // 4. Обнаружение прогорания угля (проверяем реже, чтобы не нагружать систему)
+  static unsigned long lastCoalBurnedCheck = 0;
+  if (fanState && supplyTemp > 0 && (now - lastCoalBurnedCheck > 60000 || now < lastCoalBurnedCheck)) {  // Раз в минуту
+    lastCoalBurnedCheck = now;
+    int trend = getTemperatureTrend(&supplyHistory);
+    if (trend == -1) {  // Падение температуры
+      if (coalBurnedCheckStart == 0) {
+        coalBurnedCheckStart = now;
+      }
+      unsigned long coalElapsed = now - coalBurnedCheckStart;
+      if (coalElapsed > COAL_BURNED_CHECK_TIME) {
+        systemState = STATE_COAL_BURNED;
+      }
+    } else {
+      coalBurnedCheckStart = 0;  // Сбрасываем если температура не падает
+    }
+  } else if (!fanState) {
+    coalBurnedCheckStart = 0;
+  }
+  if (fanState) {
+    scheduleControlAt(lastCoalBurnedCheck + 60001);
+  }
+
+  // 5. Защита от перегрева
+  if (supplyTemp >= autoSettings.overheatTemp) {
+    fanState = false;
+    systemState = STATE_OVERHEAT;
+    controlLogf("[Безопасность] Перегрев! Температура %.2f >= %.2f", supplyTemp, autoSettings.overheatTemp);
+  } else if (systemState == STATE_OVERHEAT && supplyTemp < autoSettings.overheatTemp) {
+    // Восстановление из состояния перегрева
+    systemState = STATE_IDLE;
+    onControlLog("[Безопасность] Восстановление после перегрева");
+  }
+
+  // 6. Предупреждение о высокой температуре (maxTemp)
+  if (supplyTemp >= autoSettings.maxTemp && supplyTemp < autoSettings.overheatTemp) {
+    if (systemState != STATE_HEATING_TIMEOUT && systemState != STATE_COAL_BURNED && systemState != STATE_OVERHEAT) {
+      systemState = STATE_HIGH_TEMP;
+    }
+  }
+
+  // 7. Проверка погасания котла (только если не в режиме розжига)
+  if (!ignitionInProgress && !boilerExtinguished) {
+    checkBoilerExtinguished(now);
+  }
+}
+
+// Автоматическое управление насосом
+static void runPumpControl(unsigned long now) {
+  bool shouldPumpRun = false;
+
+  // Проверяем уличную температуру для определения режима работы насоса
+  bool outdoorTempValid = (outdoorTemp > -50.0 && outdoorTemp < 150.0);
+  bool outdoorTempBelowZero = outdoorTempValid && outdoorTemp < 0.0;
+
+  if (supplyTemp > 0) {  // Только если есть показания датчика подачи
+    // Логика работы насоса:
+    // 1. Если уличная температура < 0°C - насос на постоянке
+    // 2. Если датчик уличной температуры в ошибке - насос на постоянке
+    // 3. Если уличная температура >= 0°C - насос от 45°C
+
+    if (!outdoorTempValid || outdoorTempBelowZero) {
+      // Насос на постоянке (уличная < 0°C или датчик в ошибке)
+      shouldPumpRun = true;
+    } else {
+      // Насос от 45°C (уличная >= 0°C)
+      if (fanState) {
+        // Если вентилятор работает, насос должен работать
+        shouldPumpRun = true;
+      } else if (supplyTemp >= autoSettings.minTemp) {
+        // Если температура выше минимальной, насос работает для циркуляции
+        shouldPumpRun = true;
+      }
+    }
+  } else {
+    // Если датчик подачи в ошибке - насос на постоянке
+    shouldPumpRun = true;
+  }
+
+  // Защита от застоя насоса - периодическое включение (только когда насос простаивает)
+  if (!shouldPumpRun && !pumpState) {
+    unsigned long timeSinceLastRun = now - lastPumpRunTime;
+    if (timeSinceLastRun > PUMP_ANTI_STAGNATION_INTERVAL) {
+      // Включаем насос на 2 минуты для предотвращения застоя
+      shouldPumpRun = true;
+      lastPumpRunTime = now;
+    }
+  }
+
+  if (shouldPumpRun && !pumpState) {
+    pumpState = true;
+    lastPumpRunTime = now;
+  } else if (!shouldPumpRun && pumpState) {
+    // Проверяем, не идет ли защита от застоя
+    unsigned long pumpRunTime = now - lastPumpRunTime;
+    if (pumpRunTime >= PUMP_ANTI_STAGNATION_DURATION) {
+      pumpState = false;
+    }
+    // Иначе еще идет защита от застоя - не выключаем
+  }
+  // Следующая проверка защиты от застоя
+  scheduleControlAt(lastPumpRunTime + (pumpState ? PUMP_ANTI_STAGNATION_DURATION : PUMP_ANTI_STAGNATION_INTERVAL) + 1);
+}
+
+void runBoilerControl(unsigned long now) {
+  // Управление вентилятором с учетом подброса угля
+  if (coalFeedingActive) {
+    // Во время подброса угля вентилятор должен быть выключен
+    if (fanState) {
+      fanState = false;
+      onControlFanRelay(false);
+    }
+  } else if (systemEnabled && !manualFanControl) {
+    // Автоматическое управление вентилятором
+    static int lastWorkMode = -1;
+    if (lastWorkMode != workMode) {
+      // Переключение режима - сброс состояний
+      comfortState = COMFORT_WAIT;
+      comfortStateStartTime = 0;
+      homeTempAtStateStart = 0.0;
+      heatingStartTime = 0;
+      lastWorkMode = workMode;
+    }
+
+    if (workMode == 1) {
+      // Режим "Комфорт" - управление по температуре в доме
+      handleComfortMode(now);
+    } else {
+      // Режим "Авто" - стандартная логика
+      runAutoMode(now);
+    }
+  }
+
+  // Проверка прогресса розжига (для всех режимов)
+  if (ignitionInProgress) {
+    checkIgnitionProgress(now);
+    if (ignitionInProgress) {
+      scheduleControlAt(ignitionStartTime + ((ignitionStartTemp < 30.0) ? IGNITION_TIMEOUT_MAX : IGNITION_TIMEOUT_MIN));
+    }
+  }
+
+  // Автоматическое управление насосом
+  if (systemEnabled && !manualPumpControl) {
+    runPumpControl(now);
+  }
+}
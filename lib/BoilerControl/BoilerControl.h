@@ -0,0 +1,197 @@
+#pragma once
+
+#include <stdint.h>
+
+// Логика управления котлом: вентилятор и насос в режиме "Авто", автомат
+// режима "Комфорт", розжиг и обнаружение погасания/прогорания.
+// Не зависит от Arduino: время передается параметром now (мс, как millis()),
+// поэтому одинаково работает в прошивке и в хост-сборках tools/ на
+// виртуальных часах.
+//
+// Состояние и входы - глобальные переменные модуля (прошивка читает и
+// меняет их напрямую). Реле, журнал событий, EEPROM и Serial остаются в
+// приложении: модуль вызывает функции из раздела "Реализуются приложением".
+
+// ============ Состояние системы ============
+// Имя для API/MQTT (веб-интерфейс переводит по нему), короткое имя для
+// нижней строки дисплея и русская подпись
+enum SystemState : uint8_t {
+  STATE_IDLE,
+  STATE_HEATING,
+  STATE_HEATING_TIMEOUT,
+  STATE_COAL_BURNED,
+  STATE_OVERHEAT,
+  STATE_HIGH_TEMP,
+  STATE_EXTINGUISHED,
+  STATE_IGNITION,
+  STATE_IGNITION_FAILED,
+  STATE_COMFORT_WAIT,
+  STATE_COMFORT_HEATING_1,
+  STATE_COMFORT_WAIT_COOLING,
+  STATE_COMFORT_WAIT_HEATING,
+  STATE_COMFORT_HEATING_2,
+  STATE_COMFORT_COMFORT,
+  STATE_COMFORT_MAINTAIN,
+  SYSTEM_STATE_COUNT
+};
+
+struct SystemStateInfo {
+  const char* apiName;
+  const char* shortName;
+  const char* label;
+};
+
+extern const SystemStateInfo SYSTEM_STATES[SYSTEM_STATE_COUNT];
+
+// Состояния режима "Комфорт"
+enum ComfortState : uint8_t {
+  COMFORT_WAIT,
+  COMFORT_HEATING_1,
+  COMFORT_WAIT_COOLING,
+  COMFORT_WAIT_HEATING,
+  COMFORT_HEATING_2,
+  COMFORT_COMFORT,
+  COMFORT_MAINTAIN,
+  COMFORT_OVERHEAT,
+  COMFORT_STATE_COUNT,
+  COMFORT_ANY = 0xFF  // Источник перехода "из любого состояния"
+};
+// Имена для API и MQTT (веб-интерфейс переводит их по этим строкам)
+extern const char* const COMFORT_STATE_NAMES[COMFORT_STATE_COUNT];
+
+// ============ Настройки ============
+// Настройки Авто (заглушки)
+struct AutoSettings {
+  float setpoint = 60.0;
+  float minTemp = 45.0;
+  float maxTemp = 75.0;
+  float hysteresis = 2.0;
+  float inertiaTemp = 55.0;
+  int inertiaTime = 10;
+  float overheatTemp = 77.0;
+  int heatingTimeout = 30;
+};
+
+// Настройки режима "Комфорт"
+struct ComfortSettings {
+  float targetHomeTemp = 24.0;  // Целевая температура в доме (°C)
+  float minBoilerTemp = 45.0;  // Минимальная температура котла (°C)
+  float maxBoilerTemp = 75.0;  // Максимальная температура котла (°C)
+  float waitTemp = 65.0;  // Температура ожидания (°C)
+  float catchUpTemp = 23.5;  // Догон до (°C) - начало снижения наддува
+  int waitCoolingTime = 10;  // Время ожидания на промежуточной температуре (минуты)
+  int waitAfterHeating1Time = 20;  // Время ожидания после первого разогрева (минуты)
+  int waitAfterReductionTime = 25;  // Время ожидания после снижения наддува (минуты)
+  int inertiaCheckInterval = 5;  // Интервал проверки инерции (минуты)
+  float hysteresisOn = 0.5;  // Гистерезис включения (°C)
+  float hysteresisOff = 0.3;  // Гистерезис выключения (°C)
+  float hysteresisBoiler = 2.0;  // Гистерезис температуры котла (°C)
+  float warningTemp = 85.0;  // Температура предупреждения (°C)
+};
+
+extern AutoSettings autoSettings;
+extern ComfortSettings comfortSettings;
+
+// ============ История температур (для определения тренда) ============
+const float TEMP_CHANGE_THRESHOLD = 0.01;  // Минимальное изменение для определения тренда (°C)
+const int TEMP_HISTORY_SIZE = 20;  // Размер истории (увеличено с 10 до 20 для более точного анализа)
+const int TEMP_TREND_SAMPLES = 10;  // Количество значений для анализа тренда (увеличено с 5 до 10)
+
+struct TemperatureHistory {
+  float values[TEMP_HISTORY_SIZE];  // История последних 20 значений (увеличено)
+  int index;         // Текущий индекс
+  int count;         // Количество записанных значений
+  unsigned long lastUpdate;  // Время последнего обновления
+  bool isValid;      // Валидность данных (защита от помех)
+};
+
+// Помехи отсекаются раньше - в цепочке фильтров канала (sensorFilters)
+void addToHistory(TemperatureHistory* history, float newValue, unsigned long now);
+// Возвращает: 1 = рост, 0 = стабильно, -1 = падение
+int getTemperatureTrend(const TemperatureHistory* history);
+
+// ============ Константы ============
+// Защита от частых переключений вентилятора
+const unsigned long FAN_TOGGLE_MIN_INTERVAL_MS = 10000;  // Минимальный интервал между переключениями (10 секунд)
+const float FAN_TOGGLE_MIN_TEMP_DELTA = 0.3;  // Минимальное изменение температуры для переключения (0.3°C)
+
+// Константы для защиты от застоя насоса
+const unsigned long PUMP_ANTI_STAGNATION_INTERVAL = 30 * 60 * 1000;  // 30 минут в миллисекундах
+const unsigned long PUMP_ANTI_STAGNATION_DURATION = 2 * 60 * 1000;   // 2 минуты в миллисекундах
+
+// Константы для обнаружения прогорания угля
+const unsigned long COAL_BURNED_CHECK_TIME = 10 * 60 * 1000;  // 10 минут в миллисекундах
+
+// Обнаружение погасания котла
+const unsigned long BOILER_EXTINGUISHED_CHECK_TIME = 60 * 60 * 1000;  // 60 минут в миллисекундах
+const float BOILER_EXTINGUISHED_TEMP_DROP = 5.0;  // Падение температуры на 5°C для определения погасания
+
+// Контроль розжига
+const unsigned long IGNITION_TIMEOUT_MIN = 10 * 60 * 1000;  // 10 минут в миллисекундах (минимальный таймаут)
+const unsigned long IGNITION_TIMEOUT_MAX = 20 * 60 * 1000;  // 20 минут в миллисекундах (максимальный таймаут)
+const float IGNITION_TEMP_INCREASE = 2.0;  // Минимальное повышение температуры для успешного розжига (°C)
+
+// ============ Входы ============
+extern float supplyTemp;
+extern float outdoorTemp;
+extern float homeTemp;  // Температура в доме (получается с MQTT от ESP01)
+extern bool homeTempSensorLWTOnline;  // LWT статус датчика температуры дома
+extern TemperatureHistory supplyHistory;
+extern bool systemEnabled;  // Флаг включения/выключения системы
+extern bool manualFanControl;  // Ручное управление вентилятором
+extern bool manualPumpControl;  // Ручное управление насосом
+extern bool coalFeedingActive;  // Флаг активного подброса угля
+extern int workMode;  // 0 = Авто, 1 = Комфорт
+extern const char* const WORK_MODE_NAMES[2];  // "auto", "comfort" (трасса и API)
+
+// ============ Выходы и внутреннее состояние ============
+extern bool fanState;
+extern bool pumpState;
+extern SystemState systemState;
+
+extern unsigned long lastFanToggleTime;  // Время последнего переключения вентилятора
+extern float lastFanToggleTemp;  // Температура при последнем переключении
+extern unsigned long heatingStartTime;  // Время начала разогрева (для проверки таймаута)
+extern unsigned long lastPumpRunTime;  // Время последнего запуска насоса
+extern unsigned long coalBurnedCheckStart;  // Время начала отслеживания падения температуры
+
+extern unsigned long fanStartTime;  // Время начала работы вентилятора
+extern float maxTempDuringFan;  // Максимальная температура за время работы вентилятора
+extern bool boilerExtinguished;  // Флаг погасания котла
+
+extern bool ignitionInProgress;  // Флаг активного розжига
+extern unsigned long ignitionStartTime;  // Время начала розжига
+extern float ignitionStartTemp;  // Температура при начале розжига
+
+extern ComfortState comfortState;
+extern unsigned long comfortStateStartTime;  // Время входа в текущее состояние
+extern float homeTempAtStateStart;  // Температура дома при входе в состояние
+
+// ============ Управление ============
+// Один пересчет вентилятора, насоса и розжига по текущим входам.
+// Сроки следующих проверок сообщаются через scheduleControlAt()
+void runBoilerControl(unsigned long now);
+
+// Розжиг по кнопке (только из состояния "погас"/ошибки розжига)
+void startIgnition(unsigned long now);
+void checkBoilerExtinguished(unsigned long now);
+void checkIgnitionProgress(unsigned long now);
+bool isHomeTempSensorValid(unsigned long now);
+void handleComfortMode(unsigned long now);
+// Новые настройки Комфорта (old - прежние): при смене целевой температуры
+// машина состояний начинает заново
+void onComfortSettingsChanged(const ComfortSettings& old);
+
+// ============ Реализуются приложением ============
+// Пересчет по таймеру не позже момента at
+void scheduleControlAt(unsigned long at);
+// Немедленная запись реле вентилятора (аварийное отключение, розжиг)
+void onControlFanRelay(bool on);
+// Событие котла: журнал (name) и MQTT "<prefix>/event/<mqttEvent>"
+void onControlEvent(const char* name, const char* mqttEvent, const char* details);
+// Новый цикл разогрева в режиме "Авто" (статистика вентилятора)
+void onControlFanCycle();
+// Комфорт переключился в Авто (датчик дома offline или котел погас): сохранить workMode
+void onControlWorkModeFallback();
+// Строка диагностики (в прошивке - Serial)
+void onControlLog(const char* line);
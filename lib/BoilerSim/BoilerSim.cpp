@@ -0,0 +1,72 @@
+#include "BoilerSim.h"
+
+#include <math.h>
+#include <stdio.h>
+
+void BoilerSim::begin(const BoilerSimParams& params, float startTemp) {
+  _params = params;
+  _state = BoilerSimState();
+  _state.boilerTemp = startTemp;
+  _state.supplyTemp = startTemp;
+  _state.returnTemp = startTemp;
+  _state.houseTemp = startTemp;
+  _state.outdoorTemp = _params.outdoorMeanC;
+}
+
+void BoilerSim::addCoal(float kg) {
+  if (kg > 0.0) {
+    _state.coalKg += kg;
+  }
+}
+
+void BoilerSim::step(float dtSeconds, bool fanOn, bool pumpOn) {
+  // Явный Эйлер устойчив при шаге много меньше постоянной котла (~5 мин)
+  while (dtSeconds > 0.0) {
+    float dt = dtSeconds > 1.0 ? 1.0 : dtSeconds;
+    substep(dt, fanOn, pumpOn);
+    dtSeconds -= dt;
+  }
+}
+
+void BoilerSim::substep(float dt, bool fanOn, bool pumpOn) {
+  BoilerSimState& s = _state;
+  const BoilerSimParams& p = _params;
+
+  s.timeS += dt;
+
+  // Улица: суточное колебание
+  float dayPhase = (float)(fmod(s.timeS, 86400.0) / 86400.0);
+  s.outdoorTemp = p.outdoorMeanC - p.outdoorAmplitudeC * cosf(2.0 * M_PI * (dayPhase - 5.0 / 24.0));
+
+  // Горение: огонь тянется к цели с инерцией, без угля гаснет
+  float fireTarget = (s.coalKg > 0.0) ? (fanOn ? 1.0 : p.idleFireFraction) : 0.0;
+  s.fire += (fireTarget - s.fire) * dt / p.fireTimeConstS;
+  if (s.fire < 0.0) s.fire = 0.0;
+
+  float burnKg = s.fire * p.burnRateFanKgH / 3600.0 * dt;
+  if (burnKg > s.coalKg) burnKg = s.coalKg;
+  s.coalKg -= burnKg;
+  s.coalBurnedKg += burnKg;
+  s.fireKW = (dt > 0.0) ? burnKg * p.coalHeatMJperKg * 1000.0 * p.efficiency / dt : 0.0;
+
+  // Радиаторы: теплообменник с эффективностью 1 - exp(-UA/C)
+  float flow = pumpOn ? p.pumpFlowKWperK : p.gravityFlowKWperK;
+  s.supplyTemp = s.boilerTemp;
+  float effectiveness = 1.0 - expf(-p.radiatorUAKWperK / flow);
+  s.radiatorKW = flow * (s.supplyTemp - s.houseTemp) * effectiveness;
+  s.returnTemp = s.supplyTemp - s.radiatorKW / flow;
+
+  // Котел и дом
+  float boilerLossKW = p.boilerLossKWperK * (s.boilerTemp - s.houseTemp);
+  s.boilerTemp += (s.fireKW - s.radiatorKW - boilerLossKW) * dt / p.boilerCapacityKJperK;
+
+  float houseLossKW = p.houseLossKWperK * (s.houseTemp - s.outdoorTemp);
+  s.houseTemp += (s.radiatorKW + boilerLossKW - houseLossKW) * dt / p.houseCapacityKJperK;
+}
+
+int BoilerSim::formatTrace(char* buf, size_t size, bool fanOn, bool pumpOn) const {
+  const BoilerSimState& s = _state;
+  return snprintf(buf, size, "%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.3f,%.2f,%.2f,%d,%d",
+                  s.timeS, s.outdoorTemp, s.houseTemp, s.supplyTemp, s.returnTemp, s.boilerTemp,
+                  s.coalKg, s.fire, s.fireKW, s.radiatorKW, fanOn ? 1 : 0, pumpOn ? 1 : 0);
+}
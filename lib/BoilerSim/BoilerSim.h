@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Сосредоточенная модель угольного котла, контура отопления и дома.
+// Входы - состояния вентилятора и насоса, выходы - температуры, которые
+// контроллер обычно читает с DS18B20 и получает от ESP01 по MQTT.
+// Не зависит от Arduino: на хосте неделя моделируется за секунды.
+
+struct BoilerSimParams {
+  // Горение
+  float coalLoadKg = 25.0;          // Закладка угля при подбросе, кг
+  float coalHeatMJperKg = 25.0;     // Теплота сгорания угля, МДж/кг
+  float efficiency = 0.7;           // КПД котла
+  float burnRateFanKgH = 4.0;       // Скорость горения при работающем вентиляторе, кг/ч
+  float idleFireFraction = 0.12;    // Тление без наддува (доля от полного горения)
+  float fireTimeConstS = 600.0;     // Инерция разгорания/затухания, с
+  // Котел
+  float boilerCapacityKJperK = 420.0;  // Вода + сталь котла, кДж/К
+  float boilerLossKWperK = 0.02;       // Потери рубашки котла в котельную
+  // Контур отопления (водяной эквивалент расхода, кВт/К)
+  float pumpFlowKWperK = 1.2;       // С насосом
+  float gravityFlowKWperK = 0.15;   // Естественная циркуляция
+  float radiatorUAKWperK = 0.3;     // Теплопередача радиаторов
+  // Дом
+  float houseCapacityKJperK = 25000.0;
+  float houseLossKWperK = 0.4;
+  // Улица: синусоида с минимумом около 5 утра
+  float outdoorMeanC = -8.0;
+  float outdoorAmplitudeC = 5.0;
+};
+
+struct BoilerSimState {
+  double timeS = 0.0;
+  float coalKg = 0.0;
+  float fire = 0.0;          // Интенсивность горения 0..1
+  float boilerTemp = 20.0;   // Температура воды в котле (она же подача)
+  float supplyTemp = 20.0;
+  float returnTemp = 20.0;
+  float houseTemp = 20.0;
+  float outdoorTemp = 0.0;
+  float fireKW = 0.0;        // Тепло от горения в воду
+  float radiatorKW = 0.0;    // Тепло радиаторов в дом
+  double coalBurnedKg = 0.0;  // Всего сожжено с начала моделирования (double: копится недели)
+};
+
+class BoilerSim {
+ public:
+  void begin(const BoilerSimParams& params, float startTemp = 20.0);
+
+  // Шаг модели на dtSeconds (внутри бьется на подшаги не более 1 с)
+  void step(float dtSeconds, bool fanOn, bool pumpOn);
+
+  // Подброс угля: добавляет закладку
+  void addCoal(float kg);
+  void addCoal() { addCoal(_params.coalLoadKg); }
+
+  const BoilerSimState& state() const { return _state; }
+  const BoilerSimParams& params() const { return _params; }
+
+  // Строка трассы в CSV, заголовок - BOILER_SIM_TRACE_HEADER.
+  // Возвращает длину как snprintf
+  int formatTrace(char* buf, size_t size, bool fanOn, bool pumpOn) const;
+
+ private:
+  void substep(float dt, bool fanOn, bool pumpOn);
+
+  BoilerSimParams _params;
+  BoilerSimState _state;
+};
+
+#define BOILER_SIM_TRACE_HEADER "time_s,outdoor,house,supply,return,boiler,coal_kg,fire,fire_kw,radiator_kw,fan,pump"
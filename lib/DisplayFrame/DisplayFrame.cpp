@@ -0,0 +1,45 @@
+#include "DisplayFrame.h"
+
+#include <string.h>
+
+uint8_t displayLineRowsMask(int baseline, int ascent, int descent) {
+  int top = baseline - ascent;
+  int bottom = baseline - descent;
+  if (top < 0) top = 0;
+  if (bottom > DISPLAY_TILE_ROWS * 8 - 1) bottom = DISPLAY_TILE_ROWS * 8 - 1;
+  uint8_t mask = 0;
+  for (int row = top / 8; row <= bottom / 8; row++) {
+    mask |= (1 << row);
+  }
+  return mask;
+}
+
+uint8_t displayDirtyRows(const DisplayModel& model, char lastLines[DISPLAY_LINE_COUNT][DISPLAY_LINE_LENGTH],
+                         const uint8_t lineRows[DISPLAY_LINE_COUNT], bool full) {
+  uint8_t dirtyRows = 0;
+  for (int i = 0; i < DISPLAY_LINE_COUNT; i++) {
+    if (full || strcmp(model.lines[i], lastLines[i]) != 0) {
+      dirtyRows |= lineRows[i];
+      strcpy(lastLines[i], model.lines[i]);
+    }
+  }
+  return dirtyRows;
+}
+
+size_t displaySendDirtyRows(uint8_t dirtyRows, DisplayRowsSender send) {
+  size_t bytes = 0;
+  int row = 0;
+  while (row < DISPLAY_TILE_ROWS) {
+    if (!(dirtyRows & (1 << row))) {
+      row++;
+      continue;
+    }
+    int start = row;
+    while (row < DISPLAY_TILE_ROWS && (dirtyRows & (1 << row))) {
+      row++;
+    }
+    send(start, row - start);
+    bytes += (row - start) * DISPLAY_ROW_BYTES;
+  }
+  return bytes;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Модель экрана и расчет измененных тайловых рядов SSD1306 128x64.
+// Без Arduino и u8g2: прошивка рисует кадр через u8g2, а хостовая проверка
+// tools/displaycheck/display_check.cpp - в свой буфер той же раскладки, и обе
+// решают, что отправлять по шине, одним кодом.
+//
+// Раскладка кадра как у полного буфера u8g2: 8 тайловых рядов по 128 байт,
+// байт - столбец из 8 пикселей ряда (бит 0 - верхний).
+
+#define DISPLAY_WIDTH 128
+#define DISPLAY_TILE_ROWS 8
+#define DISPLAY_ROW_BYTES DISPLAY_WIDTH  // 16 тайлов по 8 байт
+#define DISPLAY_FRAME_BYTES (DISPLAY_TILE_ROWS * DISPLAY_ROW_BYTES)
+
+#define DISPLAY_LINE_COUNT 4
+#define DISPLAY_LINE_LENGTH 24
+
+// Модель экрана: неизменяемый снимок, который управление публикует задаче
+// дисплея. Задача - единственный владелец u8g2 и шины I2C после setup()
+enum DisplayScreen : uint8_t {
+  DISPLAY_SCREEN_MAIN,     // Основной экран: четыре строки DISPLAY_LINES
+  DISPLAY_SCREEN_MESSAGE   // Сообщение (OTA, обновление): lines[0] + прогресс
+};
+struct DisplayModel {
+  DisplayScreen screen;
+  int8_t percent;  // Прогресс для DISPLAY_SCREEN_MESSAGE, -1 - без прогресса
+  char lines[DISPLAY_LINE_COUNT][DISPLAY_LINE_LENGTH];
+};
+
+// Маска тайловых рядов, которые задевает строка с базовой линией baseline
+// (ascent/descent - по всем глифам шрифта, descent отрицательный)
+uint8_t displayLineRowsMask(int baseline, int ascent, int descent);
+
+// Измененные ряды основного экрана: строки, текст которых отличается от
+// lastLines (или все при full), копируются в lastLines
+uint8_t displayDirtyRows(const DisplayModel& model, char lastLines[DISPLAY_LINE_COUNT][DISPLAY_LINE_LENGTH],
+                         const uint8_t lineRows[DISPLAY_LINE_COUNT], bool full);
+
+// Отправка непрерывных участков измененных рядов: send(первый ряд, число рядов).
+// Возвращает байт данных кадра, ушедших по шине
+typedef void (*DisplayRowsSender)(uint8_t tileRow, uint8_t rowCount);
+size_t displaySendDirtyRows(uint8_t dirtyRows, DisplayRowsSender send);
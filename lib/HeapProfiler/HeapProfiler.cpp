@@ -0,0 +1,202 @@
+#include "HeapProfiler.h"
+
+const char* const HEAP_TAG_NAMES[HEAP_TAG_COUNT] = {
+  "none", "ota", "web", "update", "mqtt", "control", "display", "ntp", "sensors", "otherTask"
+};
+
+#ifdef HEAP_PROFILER
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+
+extern "C" {
+void* __real_malloc(size_t size);
+void __real_free(void* ptr);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+}
+
+static_assert((HEAP_PROFILER_SLOTS & (HEAP_PROFILER_SLOTS - 1)) == 0, "HEAP_PROFILER_SLOTS - степень двойки");
+
+// Владелец живого блока: адрес -> размер и метка на момент выделения.
+// Открытая адресация с линейным пробированием, удаление сдвигом следующих
+// записей назад (без "надгробий" - таблица не деградирует со временем)
+struct HeapOwner {
+  uintptr_t ptr;  // 0 - свободная ячейка
+  uint32_t size : 24;
+  uint32_t tag : 8;
+};
+
+static HeapOwner heapOwners[HEAP_PROFILER_SLOTS];
+static uint32_t heapOwnerCount = 0;
+static HeapTagStats heapStats[HEAP_TAG_COUNT];
+static HeapUntrackedStats heapUntracked;
+static volatile HeapTag heapCurrentTag = HEAP_TAG_NONE;
+static TaskHandle_t heapLoopTask = nullptr;
+static portMUX_TYPE heapStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Метка для текущего вызова: области действуют только в задаче loop()
+static inline HeapTag heapActiveTag() {
+  if (heapLoopTask != nullptr && xTaskGetCurrentTaskHandle() != heapLoopTask) {
+    return HEAP_TAG_OTHER_TASK;
+  }
+  return heapCurrentTag;
+}
+
+static inline uint32_t heapOwnerSlot(uintptr_t ptr) {
+  // Блоки выровнены на 4-8 байт - младшие биты отбрасываются, затем перемешивание
+  uint32_t h = (uint32_t)(ptr >> 3) * 2654435761u;
+  return h & (HEAP_PROFILER_SLOTS - 1);
+}
+
+// Вызываются под heapStatsMux
+static bool heapOwnerInsert(uintptr_t ptr, size_t size, HeapTag tag) {
+  // Заполнение не выше 3/4, иначе пробирование становится длинным
+  if (heapOwnerCount >= HEAP_PROFILER_SLOTS / 4 * 3) {
+    return false;
+  }
+  uint32_t i = heapOwnerSlot(ptr);
+  while (heapOwners[i].ptr != 0) {
+    i = (i + 1) & (HEAP_PROFILER_SLOTS - 1);
+  }
+  heapOwners[i].ptr = ptr;
+  heapOwners[i].size = size;
+  heapOwners[i].tag = tag;
+  heapOwnerCount++;
+  return true;
+}
+
+static bool heapOwnerRemove(uintptr_t ptr, HeapOwner& owner) {
+  uint32_t i = heapOwnerSlot(ptr);
+  while (heapOwners[i].ptr != ptr) {
+    if (heapOwners[i].ptr == 0) {
+      return false;  // Блок выделен мимо таблицы (переполнение)
+    }
+    i = (i + 1) & (HEAP_PROFILER_SLOTS - 1);
+  }
+  owner = heapOwners[i];
+  heapOwnerCount--;
+  // Сдвиг назад: запись из цепочки за дыркой переезжает в нее, если дырка
+  // лежит между ее домашней ячейкой и текущим местом
+  uint32_t hole = i;
+  uint32_t j = i;
+  while (true) {
+    j = (j + 1) & (HEAP_PROFILER_SLOTS - 1);
+    if (heapOwners[j].ptr == 0) {
+      break;
+    }
+    uint32_t home = heapOwnerSlot(heapOwners[j].ptr);
+    if (((j - home) & (HEAP_PROFILER_SLOTS - 1)) >= ((j - hole) & (HEAP_PROFILER_SLOTS - 1))) {
+      heapOwners[hole] = heapOwners[j];
+      hole = j;
+    }
+  }
+  heapOwners[hole].ptr = 0;
+  return true;
+}
+
+static void heapRecordAlloc(void* ptr, size_t size) {
+  HeapTag tag = heapActiveTag();
+  portENTER_CRITICAL_SAFE(&heapStatsMux);
+  HeapTagStats& s = heapStats[tag];
+  s.allocCount++;
+  s.allocBytes += size;
+  if (heapOwnerInsert((uintptr_t)ptr, size, tag)) {
+    s.liveBytes += size;
+    if (s.liveBytes > s.peakLiveBytes) s.peakLiveBytes = s.liveBytes;
+  } else {
+    heapUntracked.allocCount++;
+  }
+  portEXIT_CRITICAL_SAFE(&heapStatsMux);
+}
+
+// Освобождение засчитывается метке, под которой блок выделялся
+static void heapRecordFree(void* ptr) {
+  portENTER_CRITICAL_SAFE(&heapStatsMux);
+  HeapOwner owner;
+  if (heapOwnerRemove((uintptr_t)ptr, owner)) {
+    HeapTagStats& s = heapStats[owner.tag];
+    s.freeCount++;
+    s.freeBytes += owner.size;
+    s.liveBytes -= owner.size;
+  } else {
+    heapUntracked.freeCount++;
+  }
+  portEXIT_CRITICAL_SAFE(&heapStatsMux);
+}
+
+extern "C" void* __wrap_malloc(size_t size) {
+  void* ptr = __real_malloc(size);
+  if (ptr != nullptr) {
+    heapRecordAlloc(ptr, heap_caps_get_allocated_size(ptr));
+  }
+  return ptr;
+}
+
+extern "C" void* __wrap_calloc(size_t n, size_t size) {
+  void* ptr = __real_calloc(n, size);
+  if (ptr != nullptr) {
+    heapRecordAlloc(ptr, heap_caps_get_allocated_size(ptr));
+  }
+  return ptr;
+}
+
+extern "C" void* __wrap_realloc(void* ptr, size_t size) {
+  void* result = __real_realloc(ptr, size);
+  if (result != nullptr || size == 0) {
+    // Новый блок (даже на прежнем месте) принадлежит текущей метке
+    if (ptr != nullptr) heapRecordFree(ptr);
+    if (result != nullptr) heapRecordAlloc(result, heap_caps_get_allocated_size(result));
+  }
+  return result;
+}
+
+extern "C" void __wrap_free(void* ptr) {
+  if (ptr != nullptr) {
+    heapRecordFree(ptr);
+  }
+  __real_free(ptr);
+}
+
+void heapProfilerBegin() {
+  heapLoopTask = xTaskGetCurrentTaskHandle();
+}
+
+HeapTag heapProfilerSetTag(HeapTag tag) {
+  HeapTag previous = heapCurrentTag;
+  heapCurrentTag = tag;
+  return previous;
+}
+
+void heapProfilerSnapshot(HeapTagStats* stats) {
+  portENTER_CRITICAL(&heapStatsMux);
+  memcpy(stats, heapStats, sizeof(heapStats));
+  portEXIT_CRITICAL(&heapStatsMux);
+}
+
+HeapUntrackedStats heapProfilerUntracked() {
+  portENTER_CRITICAL(&heapStatsMux);
+  HeapUntrackedStats untracked = heapUntracked;
+  untracked.liveBlocks = heapOwnerCount;
+  portEXIT_CRITICAL(&heapStatsMux);
+  return untracked;
+}
+
+void heapProfilerReset() {
+  portENTER_CRITICAL(&heapStatsMux);
+  // Живые блоки остаются в таблице и при освобождении вычтутся из liveBytes
+  // своей метки, поэтому liveBytes не обнуляется, а пик начинается с него
+  for (int i = 0; i < HEAP_TAG_COUNT; i++) {
+    int32_t live = heapStats[i].liveBytes;
+    memset(&heapStats[i], 0, sizeof(heapStats[i]));
+    heapStats[i].liveBytes = live;
+    heapStats[i].peakLiveBytes = live;
+  }
+  heapUntracked.allocCount = 0;
+  heapUntracked.freeCount = 0;
+  portEXIT_CRITICAL(&heapStatsMux);
+}
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Учет выделений памяти по подсистемам.
+// Включается флагом сборки HEAP_PROFILER вместе с обертками malloc/free
+// (см. README): -DHEAP_PROFILER -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc
+// Без флага HeapScope - пустой объект и ничего не стоит.
+//
+// Подсистема задается областью HEAP_SCOPE(tag) в задаче loop(); выделения из
+// других задач FreeRTOS (WiFi, lwIP) учитываются как HEAP_TAG_OTHER_TASK.
+// Освобождение засчитывается подсистеме, выделившей блок: владелец и размер
+// каждого живого блока хранятся в таблице по адресу (HEAP_PROFILER_SLOTS
+// ячеек по 8 байт в BSS). Блоки, не поместившиеся в таблицу, и free() чужих
+// указателей считаются в HeapUntrackedStats.
+
+#ifndef HEAP_PROFILER_SLOTS
+#define HEAP_PROFILER_SLOTS 2048  // Степень двойки; заполняется не выше 3/4
+#endif
+
+enum HeapTag : uint8_t {
+  HEAP_TAG_NONE = 0,     // loop() вне размеченных этапов, setup()
+  HEAP_TAG_OTA,
+  HEAP_TAG_WEB,
+  HEAP_TAG_UPDATE,
+  HEAP_TAG_MQTT,
+  HEAP_TAG_CONTROL,
+  HEAP_TAG_DISPLAY,
+  HEAP_TAG_NTP,
+  HEAP_TAG_SENSORS,
+  HEAP_TAG_OTHER_TASK,
+  HEAP_TAG_COUNT
+};
+
+extern const char* const HEAP_TAG_NAMES[HEAP_TAG_COUNT];
+
+struct HeapTagStats {
+  uint32_t allocCount;
+  uint32_t freeCount;
+  uint32_t allocBytes;   // Всего выделено байт
+  uint32_t freeBytes;    // Всего освобождено байт
+  int32_t liveBytes;     // Живые блоки метки (сохраняется при сбросе)
+  int32_t peakLiveBytes;
+};
+
+struct HeapUntrackedStats {
+  uint32_t allocCount;  // Таблица владельцев была заполнена
+  uint32_t freeCount;   // Указатель не найден в таблице
+  uint32_t liveBlocks;  // Занято ячеек таблицы
+};
+
+#ifdef HEAP_PROFILER
+
+void heapProfilerBegin();  // Запоминает задачу loop() (вызывать из setup)
+HeapTag heapProfilerSetTag(HeapTag tag);  // Возвращает предыдущую метку
+void heapProfilerSnapshot(HeapTagStats* stats);  // Копия счетчиков (HEAP_TAG_COUNT элементов)
+HeapUntrackedStats heapProfilerUntracked();
+void heapProfilerReset();  // Обнуляет счетчики; живые блоки и их владельцы остаются
+
+class HeapScope {
+ public:
+  explicit HeapScope(HeapTag tag) : _previous(heapProfilerSetTag(tag)) {}
+  ~HeapScope() { heapProfilerSetTag(_previous); }
+  HeapScope(const HeapScope&) = delete;
+  HeapScope& operator=(const HeapScope&) = delete;
+
+ private:
+  HeapTag _previous;
+};
+
+#else
+
+inline void heapProfilerBegin() {}
+
+class HeapScope {
+ public:
+  explicit HeapScope(HeapTag) {}
+};
+
+#endif
+
+#define HEAP_SCOPE_CONCAT2(a, b) a##b
+#define HEAP_SCOPE_CONCAT(a, b) HEAP_SCOPE_CONCAT2(a, b)
+// Метка действует до конца блока; несколько подряд в одной функции - последняя перекрывает
+#define HEAP_SCOPE(tag) HeapScope HEAP_SCOPE_CONCAT(_heapScope, __LINE__)(tag)
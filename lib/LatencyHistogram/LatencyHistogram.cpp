@@ -0,0 +1,45 @@
+#include "LatencyHistogram.h"
+
+#include <math.h>
+
+void LatencyHistogram::record(uint32_t us) {
+  int index = 0;
+  uint32_t v = us;
+  while (v > 1 && index < LATENCY_HISTOGRAM_BUCKETS - 1) {
+    v >>= 1;
+    index++;
+  }
+  _buckets[index]++;
+  _count++;
+  _total += us;
+  if (us > _max) _max = us;
+}
+
+void LatencyHistogram::reset() {
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    _buckets[i] = 0;
+  }
+  _count = 0;
+  _max = 0;
+  _total = 0;
+}
+
+uint32_t LatencyHistogram::percentile(float p) const {
+  if (_count == 0) {
+    return 0;
+  }
+  // Номер значения, которое должно попасть в перцентиль (с округлением вверх)
+  uint32_t rank = (uint32_t)ceilf(p / 100.0 * _count);
+  if (rank < 1) rank = 1;
+  if (rank > _count) rank = _count;
+
+  uint32_t seen = 0;
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    seen += _buckets[i];
+    if (seen >= rank) {
+      uint32_t upper = (i >= 31) ? 0xFFFFFFFF : ((1UL << (i + 1)) - 1);
+      return upper < _max ? upper : _max;
+    }
+  }
+  return _max;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Гистограмма задержек с логарифмическими корзинами (степени двойки, мкс).
+// Корзина i содержит значения [2^i, 2^(i+1)), корзина 0 - значения 0..1 мкс.
+// 27 корзин покрывают до ~134 с. Запись - O(1) без выделения памяти.
+
+#define LATENCY_HISTOGRAM_BUCKETS 27
+
+class LatencyHistogram {
+ public:
+  void record(uint32_t us);
+  void reset();
+
+  uint32_t count() const { return _count; }
+  uint32_t max() const { return _max; }
+  uint64_t total() const { return _total; }
+  // Оценка перцентиля (0..100): верхняя граница корзины, не больше максимума
+  uint32_t percentile(float p) const;
+
+  uint32_t bucket(int i) const { return _buckets[i]; }
+
+ private:
+  uint32_t _buckets[LATENCY_HISTOGRAM_BUCKETS] = {0};
+  uint32_t _count = 0;
+  uint32_t _max = 0;
+  uint64_t _total = 0;
+};
@@ -0,0 +1,172 @@
+#include "MqttCommands.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Числа в командах короткие ("23.5", "-1") - разбор из копии на стеке
+#define MQTT_NUMBER_MAX 15
+
+bool MqttBytes::equals(const char* s) const {
+  return strlen(s) == len && memcmp(data, s, len) == 0;
+}
+
+MqttBytes MqttBytes::trimmed() const {
+  const char* begin = data;
+  const char* end = data + len;
+  while (begin < end && isspace((unsigned char)*begin)) {
+    begin++;
+  }
+  while (end > begin && isspace((unsigned char)end[-1])) {
+    end--;
+  }
+  return {begin, (size_t)(end - begin)};
+}
+
+// Сравнение без учета регистра ASCII с участком [s, s + n)
+static bool equalsIgnoreCase(MqttBytes value, const char* s, size_t n) {
+  if (value.len != n) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (tolower((unsigned char)value.data[i]) != tolower((unsigned char)s[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MqttBytes::is(const char* s) const {
+  return equalsIgnoreCase(trimmed(), s, strlen(s));
+}
+
+bool MqttBytes::isAny(const char* words) const {
+  MqttBytes value = trimmed();
+  while (true) {
+    const char* bar = strchr(words, '|');
+    size_t n = bar != nullptr ? (size_t)(bar - words) : strlen(words);
+    if (equalsIgnoreCase(value, words, n)) {
+      return true;
+    }
+    if (bar == nullptr) {
+      return false;
+    }
+    words = bar + 1;
+  }
+}
+
+// Копия обрезанного значения с завершающим нулем; false - пусто или слишком длинно
+static bool copyNumber(MqttBytes value, char* buf) {
+  value = value.trimmed();
+  if (value.len == 0 || value.len > MQTT_NUMBER_MAX) {
+    return false;
+  }
+  memcpy(buf, value.data, value.len);
+  buf[value.len] = '\0';
+  return true;
+}
+
+bool MqttBytes::toFloat(float& out) const {
+  char buf[MQTT_NUMBER_MAX + 1];
+  if (!copyNumber(*this, buf)) {
+    return false;
+  }
+  char* end = nullptr;
+  float value = strtof(buf, &end);
+  if (end == buf || *end != '\0') {
+    return false;
+  }
+  out = value;
+  return true;
+}
+
+bool MqttBytes::toInt(long& out) const {
+  char buf[MQTT_NUMBER_MAX + 1];
+  if (!copyNumber(*this, buf)) {
+    return false;
+  }
+  char* end = nullptr;
+  long value = strtol(buf, &end, 10);
+  if (end == buf || *end != '\0') {
+    return false;
+  }
+  out = value;
+  return true;
+}
+
+MqttCommandRegistry::MqttCommandRegistry(const MqttCommand* table, size_t count)
+    : _table(table), _count((uint8_t)(count < MQTT_COMMANDS_MAX ? count : MQTT_COMMANDS_MAX)) {
+  for (uint8_t i = 0; i < _count; i++) {
+    size_t len = strlen(_table[i].topic);
+    _topicLen[i] = (uint8_t)(len < 255 ? len : 255);
+  }
+  _prefix[0] = '\0';
+}
+
+bool MqttCommandRegistry::setPrefix(const char* prefix) {
+  size_t len = strlen(prefix);
+  if (len > MQTT_COMMAND_PREFIX_MAX) {
+    _prefix[0] = '\0';
+    _prefixLen = 0;
+    return false;
+  }
+  memcpy(_prefix, prefix, len + 1);
+  _prefixLen = (uint8_t)len;
+  return true;
+}
+
+bool MqttCommandRegistry::topic(size_t i, char* buf, size_t size) const {
+  if (i >= _count) {
+    return false;
+  }
+  const MqttCommand& cmd = _table[i];
+  size_t need = _topicLen[i] + 1;
+  if (cmd.scope == MQTT_COMMAND_PREFIXED) {
+    if (_prefixLen == 0) {
+      return false;  // Без префикса команда не адресована этому котлу
+    }
+    need += _prefixLen + 1;
+  }
+  if (need > size) {
+    return false;
+  }
+  char* p = buf;
+  if (cmd.scope == MQTT_COMMAND_PREFIXED) {
+    memcpy(p, _prefix, _prefixLen);
+    p += _prefixLen;
+    *p++ = '/';
+  }
+  memcpy(p, cmd.topic, _topicLen[i] + 1);
+  return true;
+}
+
+const MqttCommand* MqttCommandRegistry::dispatch(const char* topic, const uint8_t* payload, size_t len) {
+  size_t topicLen = strlen(topic);
+  // Свой префикс проверяется один раз, дальше сравниваются только суффиксы
+  const char* suffix = nullptr;
+  size_t suffixLen = 0;
+  if (_prefixLen > 0 && topicLen > _prefixLen + 1u && topic[_prefixLen] == '/' &&
+      memcmp(topic, _prefix, _prefixLen) == 0) {
+    suffix = topic + _prefixLen + 1;
+    suffixLen = topicLen - _prefixLen - 1;
+  }
+  for (uint8_t i = 0; i < _count; i++) {
+    const MqttCommand& cmd = _table[i];
+    const char* candidate = topic;
+    size_t candidateLen = topicLen;
+    if (cmd.scope == MQTT_COMMAND_PREFIXED) {
+      if (suffix == nullptr) {
+        continue;
+      }
+      candidate = suffix;
+      candidateLen = suffixLen;
+    }
+    if (candidateLen == _topicLen[i] && memcmp(candidate, cmd.topic, candidateLen) == 0) {
+      _dispatched++;
+      cmd.handler({(const char*)payload, len});
+      return &cmd;
+    }
+  }
+  _unknown++;
+  return nullptr;
+}
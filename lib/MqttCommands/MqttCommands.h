@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Разбор входящих MQTT-сообщений по таблице команд без кучи.
+// Таблица задается в прошивке: суффикс топика (после "<prefix>/") или полный
+// топик чужого устройства и обработчик. Длины суффиксов и префикса
+// считаются один раз, сравнение - memcmp по указателю на топик PubSubClient;
+// payload передается обработчику видом на буфер клиента, без копии.
+//
+// Новая команда - строка в таблице; подписка на все топики таблицы
+// делается циклом по topic(i).
+
+#define MQTT_COMMANDS_MAX 16
+#define MQTT_COMMAND_PREFIX_MAX 48
+
+// Вид на байты без копирования; payload MQTT не завершается нулем
+struct MqttBytes {
+  const char* data;
+  size_t len;
+
+  bool equals(const char* s) const;
+  // Без учета регистра (ASCII) и пробелов по краям: "On\n" == "on"
+  bool is(const char* s) const;
+  // Одно из слов через '|': payload.isAny("1|on|start")
+  bool isAny(const char* words) const;
+  MqttBytes trimmed() const;
+  // false - не число целиком (после обрезки пробелов)
+  bool toFloat(float& out) const;
+  bool toInt(long& out) const;
+};
+
+typedef void (*MqttCommandHandler)(MqttBytes payload);
+
+enum MqttCommandScope : uint8_t {
+  MQTT_COMMAND_PREFIXED = 0,  // "<prefix>/<topic>" - команды этому котлу
+  MQTT_COMMAND_ABSOLUTE       // Топик целиком - данные других устройств
+};
+
+struct MqttCommand {
+  const char* topic;
+  MqttCommandHandler handler;
+  MqttCommandScope scope;
+};
+
+class MqttCommandRegistry {
+ public:
+  // table живет все время работы (константа в прошивке); лишнее сверх
+  // MQTT_COMMANDS_MAX отбрасывается
+  MqttCommandRegistry(const MqttCommand* table, size_t count);
+
+  // false - префикс длиннее MQTT_COMMAND_PREFIX_MAX (команды с префиксом не совпадут)
+  bool setPrefix(const char* prefix);
+
+  size_t size() const { return _count; }
+  // Полный топик i-й команды для subscribe; false - не влез в buf
+  bool topic(size_t i, char* buf, size_t size) const;
+
+  // Вызов обработчика команды; nullptr - топик не из таблицы
+  const MqttCommand* dispatch(const char* topic, const uint8_t* payload, size_t len);
+
+  uint32_t dispatched() const { return _dispatched; }
+  uint32_t unknown() const { return _unknown; }
+
+ private:
+  const MqttCommand* _table;
+  uint8_t _count;
+  uint8_t _topicLen[MQTT_COMMANDS_MAX];
+  char _prefix[MQTT_COMMAND_PREFIX_MAX + 1];
+  uint8_t _prefixLen = 0;
+  uint32_t _dispatched = 0;
+  uint32_t _unknown = 0;
+};
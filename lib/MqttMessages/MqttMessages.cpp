@@ -0,0 +1,111 @@
+#include "MqttMessages.h"
+
+static const char* const WORK_MODE_NAMES[] = {"Авто", "Комфорт"};
+
+// Поля <prefix>/state
+void writeStatePayload(PayloadWriter& w, const MqttSnapshot& s) {
+  w.addFloat("supplyTemp", s.supplyTemp);
+  w.addFloat("returnTemp", s.returnTemp);
+  w.addFloat("boilerTemp", s.boilerTemp);
+  w.addFloat("outdoorTemp", s.outdoorTemp);
+  w.addFloat("homeTemp", s.homeTemp);
+  w.addFloat("setpoint", s.setpoint);
+  w.addBool("fan", s.fan);
+  w.addBool("pump", s.pump);
+  w.addBool("systemEnabled", s.systemEnabled);
+  w.addEnum("state", s.systemState, s.names->systemStates, s.names->systemStateCount, s.names->systemStateStride);
+  w.addInt("wifiRSSI", s.wifiRSSI);
+  w.addStatic("wifiSSID", s.wifiSSID);
+  w.addStatic("wifiIP", s.wifiIP);
+  w.addStatic("wifiMAC", s.wifiMAC);
+  w.addUInt("uptime", s.uptimeSec);
+  w.addUInt("freeMem", s.freeMem);
+}
+
+// Поля <prefix>/ml/data - детальная запись для обучения ML модели
+void writeMLPayload(PayloadWriter& w, const MqttSnapshot& s) {
+  // 1. Температуры
+  w.addFloat("supplyTemp", s.supplyTemp);
+  w.addFloat("returnTemp", s.returnTemp);
+  w.addFloat("boilerTemp", s.boilerTemp);
+  w.addFloat("outdoorTemp", s.outdoorTemp);
+  w.addFloat("homeTemp", s.homeTemp);
+  w.addFloat("tempDiff", s.supplyTemp - s.returnTemp);  // Единственное вычисление - разница температур
+
+  // 2. Состояния устройств
+  w.addBool("fan", s.fan);
+  w.addBool("pump", s.pump);
+  w.addBool("systemEnabled", s.systemEnabled);
+  w.addEnum("state", s.systemState, s.names->systemStates, s.names->systemStateCount, s.names->systemStateStride);
+
+  // 2.1. Режим работы
+  w.addInt("workMode", s.workMode);
+  w.addEnum("workModeName", s.workMode == 0 ? 0 : 1, WORK_MODE_NAMES, 2);
+
+  // 2.2. Статус датчика температуры дома: LWT online и температура в допустимом диапазоне
+  bool homeTempValid = s.homeTempSensorLWTOnline && s.homeTemp > 0 && s.homeTemp < 50.0f;
+  w.addBool("homeTempSensorValid", homeTempValid);
+  w.addBool("homeTempSensorLWTOnline", s.homeTempSensorLWTOnline);
+
+  // 2.3. Настройки Comfort режима (если активен; иначе пустое состояние и 0)
+  bool comfortActive = s.workMode == 1;
+  w.addEnum("comfortState", comfortActive ? s.comfortState : s.names->comfortStateCount, s.names->comfortStates,
+            s.names->comfortStateCount);
+  w.addFloat("targetHomeTemp", comfortActive ? s.targetHomeTemp : 0.0f);
+
+  // 3. Настройки Auto режима (для контекста)
+  w.addFloat("setpoint", s.autoSetpoint);
+  w.addFloat("minTemp", s.minTemp);
+  w.addFloat("maxTemp", s.maxTemp);
+  w.addFloat("hysteresis", s.hysteresis);
+  w.addFloat("inertiaTemp", s.inertiaTemp);
+  w.addInt("inertiaTime", s.inertiaTime);
+  w.addFloat("overheatTemp", s.overheatTemp);
+  w.addInt("heatingTimeout", s.heatingTimeout);
+
+  // 4. Подброс угля
+  w.addBool("coalFeedingActive", s.coalFeedingActive);
+  w.addUInt("coalFeedingElapsed", s.coalFeedingActive ? s.coalFeedingElapsedSec : 0);
+
+  // 5. Временные метки
+  w.addUInt("timestamp", s.timestamp);
+  w.addUInt("uptime", s.uptimeSec);
+  w.addString("time", s.time);
+  w.addString("date", s.date);
+
+  // 6. WiFi и сеть
+  w.addInt("wifiRSSI", s.wifiRSSI);
+  w.addStatic("wifiSSID", s.wifiSSID);
+  w.addStatic("wifiIP", s.wifiIP);
+
+  // 7. Системные параметры
+  w.addUInt("freeMem", s.freeMem);
+  w.addUInt("heapSize", s.heapSize);
+
+  // 8. ML настройки (интервал публикации)
+  w.addInt("mlPublishInterval", s.mlPublishInterval);
+
+  // 9. Датчики на обеих шинах и связь
+  w.addInt("sensorCount", s.sensorCountBus1 + s.sensorCountBus2);
+  w.addInt("sensorCountBus1", s.sensorCountBus1);
+  w.addInt("sensorCountBus2", s.sensorCountBus2);
+  w.addBool("mqttConnected", s.mqttConnected);
+}
+
+size_t buildMqttPayload(PayloadFormat format, uint8_t* buf, size_t size, MqttPayloadFill fill, const MqttSnapshot& s) {
+  PayloadWriter writer(format, buf, size);
+  fill(writer, s);
+  return writer.finish();
+}
+
+const MqttCommand MQTT_COMMANDS[MQTT_COMMAND_COUNT] = {
+  {"setpoint/set", onMqttSetpoint, MQTT_COMMAND_PREFIXED},
+  {"sensors/reset", onMqttSensorsReset, MQTT_COMMAND_PREFIXED},
+  {"ignition/start", onMqttIgnitionStart, MQTT_COMMAND_PREFIXED},
+  {"workMode/set", onMqttWorkMode, MQTT_COMMAND_PREFIXED},
+  {"coalFeeding/set", onMqttCoalFeeding, MQTT_COMMAND_PREFIXED},
+  {"fan/set", onMqttFan, MQTT_COMMAND_PREFIXED},
+  {"targetHomeTemp/set", onMqttComfortTarget, MQTT_COMMAND_PREFIXED},
+  {"home/esp01/temperature", onEsp01Temperature, MQTT_COMMAND_ABSOLUTE},
+  {"home/esp01/status", onEsp01Status, MQTT_COMMAND_ABSOLUTE}
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MqttCommands.h"
+#include "PayloadWriter.h"
+
+// Состав MQTT-сообщений прошивки - общий для ESP32 и хостового стенда
+// tools/mqttbench, чтобы замер шел по тем же полям, что и на устройстве:
+//  - поля <prefix>/state и <prefix>/ml/data (одна функция на JSON,
+//    MessagePack и схему) над снимком MqttSnapshot - прошивка заполняет его
+//    из своих переменных перед сборкой, стенд - типичными значениями;
+//  - таблица входящих команд MQTT_COMMANDS. Обработчики объявлены здесь и
+//    определяются приложением (в прошивке - src/main.cpp).
+
+#define MQTT_SNAPSHOT_SSID_MAX 32
+
+// Таблицы имен перечислений - из прошивки, где они заданы вместе с состояниями
+struct MqttEnumNames {
+  const char* const* systemStates;  // Имя первого состояния, следующее - через systemStateStride
+  size_t systemStateStride;
+  uint8_t systemStateCount;
+  const char* const* comfortStates;
+  uint8_t comfortStateCount;
+};
+
+// Значения полей на момент сборки сообщения
+struct MqttSnapshot {
+  const MqttEnumNames* names;
+
+  // Показания и исполнительные устройства
+  float supplyTemp;
+  float returnTemp;
+  float boilerTemp;
+  float outdoorTemp;
+  float homeTemp;  // От ESP01
+  float setpoint;  // Действующая уставка
+  bool fan;
+  bool pump;
+  bool systemEnabled;
+  uint8_t systemState;
+
+  // Режим работы и Комфорт
+  uint8_t workMode;  // 0 = Авто, 1 = Комфорт
+  bool homeTempSensorLWTOnline;
+  uint8_t comfortState;
+  float targetHomeTemp;
+
+  // Настройки Авто
+  float autoSetpoint;
+  float minTemp;
+  float maxTemp;
+  float hysteresis;
+  float inertiaTemp;
+  int32_t inertiaTime;
+  float overheatTemp;
+  int32_t heatingTimeout;
+
+  bool coalFeedingActive;
+  uint32_t coalFeedingElapsedSec;
+
+  // Время: timestamp 0 - NTP не синхронизирован, пустые строки - время неизвестно
+  uint32_t timestamp;
+  uint32_t uptimeSec;
+  char time[9];   // 14:05:09
+  char date[11];  // 21.01.2025
+
+  // Сеть и система
+  int32_t wifiRSSI;
+  char wifiSSID[MQTT_SNAPSHOT_SSID_MAX + 1];
+  char wifiIP[16];
+  char wifiMAC[18];
+  uint32_t freeMem;
+  uint32_t heapSize;
+  int32_t mlPublishInterval;
+  int32_t sensorCountBus1;
+  int32_t sensorCountBus2;
+  bool mqttConnected;
+};
+
+typedef void (*MqttPayloadFill)(PayloadWriter& w, const MqttSnapshot& s);
+
+void writeStatePayload(PayloadWriter& w, const MqttSnapshot& s);
+void writeMLPayload(PayloadWriter& w, const MqttSnapshot& s);
+
+// Сборка записи в заданном кодировании, 0 - не влезла в буфер
+size_t buildMqttPayload(PayloadFormat format, uint8_t* buf, size_t size, MqttPayloadFill fill, const MqttSnapshot& s);
+
+// Входящие: новая команда - строка в таблице и обработчик в приложении;
+// подписка при подключении делается по этой же таблице
+void onMqttSetpoint(MqttBytes payload);
+void onMqttSensorsReset(MqttBytes payload);
+void onMqttIgnitionStart(MqttBytes payload);
+void onMqttWorkMode(MqttBytes payload);
+void onMqttCoalFeeding(MqttBytes payload);
+void onMqttFan(MqttBytes payload);
+void onMqttComfortTarget(MqttBytes payload);
+void onEsp01Temperature(MqttBytes payload);
+void onEsp01Status(MqttBytes payload);
+
+#define MQTT_COMMAND_COUNT 9
+// Константная таблица (инициализируется до конструкторов - ее можно
+// передавать MqttCommandRegistry в глобальном объекте)
+extern const MqttCommand MQTT_COMMANDS[MQTT_COMMAND_COUNT];
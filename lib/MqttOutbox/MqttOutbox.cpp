@@ -0,0 +1,110 @@
+#include "MqttOutbox.h"
+
+#include <string.h>
+
+MqttOutbox::MqttOutbox() {
+  _queues[MQTT_PRIORITY_EVENT].data = _eventData;
+  _queues[MQTT_PRIORITY_EVENT].capacity = MQTT_OUTBOX_EVENT_BYTES;
+  _queues[MQTT_PRIORITY_STATE].data = _stateData;
+  _queues[MQTT_PRIORITY_STATE].capacity = MQTT_OUTBOX_STATE_BYTES;
+  _queues[MQTT_PRIORITY_TELEMETRY].data = _telemetryData;
+  _queues[MQTT_PRIORITY_TELEMETRY].capacity = MQTT_OUTBOX_TELEMETRY_BYTES;
+}
+
+bool MqttOutbox::push(MqttPriority priority, const char* topic, const char* payload, bool retain, uint32_t nowUs) {
+  return push(priority, topic, (const uint8_t*)payload, strlen(payload), retain, nowUs);
+}
+
+bool MqttOutbox::push(MqttPriority priority, const char* topic, const uint8_t* payload, size_t payloadLen,
+                      bool retain, uint32_t nowUs) {
+  Queue& q = _queues[priority];
+  size_t topicLen = strlen(topic);
+  // Выравнивание на 4 - заголовок следующей записи читается напрямую
+  size_t size = (sizeof(Record) + topicLen + 1 + payloadLen + 1 + 3) & ~(size_t)3;
+  if (size > q.capacity) {
+    q.stats.dropped++;
+    return false;
+  }
+  while (q.stats.bytes + size > q.capacity) {
+    dropFront(q);
+    q.stats.dropped++;
+  }
+
+  uint8_t* p = q.data + q.stats.bytes;
+  Record* rec = (Record*)p;
+  rec->size = (uint16_t)size;
+  rec->topicLen = (uint16_t)topicLen;
+  rec->payloadLen = (uint16_t)payloadLen;
+  rec->retain = retain ? 1 : 0;
+  rec->reserved = 0;
+  rec->enqueuedUs = nowUs;
+  memcpy(p + sizeof(Record), topic, topicLen + 1);
+  memcpy(p + sizeof(Record) + topicLen + 1, payload, payloadLen);
+  p[sizeof(Record) + topicLen + 1 + payloadLen] = '\0';
+
+  q.stats.bytes += size;
+  q.stats.depth++;
+  q.stats.queued++;
+  if (q.stats.depth > q.stats.maxDepth) {
+    q.stats.maxDepth = q.stats.depth;
+  }
+  return true;
+}
+
+int MqttOutbox::headQueue() const {
+  for (int i = 0; i < MQTT_PRIORITY_COUNT; i++) {
+    if (_queues[i].stats.depth > 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool MqttOutbox::peek(MqttOutboxMessage& msg) const {
+  int i = headQueue();
+  if (i < 0) {
+    return false;
+  }
+  const uint8_t* p = _queues[i].data;
+  const Record* rec = (const Record*)p;
+  msg.topic = (const char*)(p + sizeof(Record));
+  msg.payload = msg.topic + rec->topicLen + 1;
+  msg.payloadLen = rec->payloadLen;
+  msg.retain = rec->retain != 0;
+  msg.priority = (MqttPriority)i;
+  msg.enqueuedUs = rec->enqueuedUs;
+  return true;
+}
+
+void MqttOutbox::pop() {
+  int i = headQueue();
+  if (i >= 0) {
+    dropFront(_queues[i]);
+  }
+}
+
+void MqttOutbox::dropFront(Queue& q) {
+  uint16_t size = ((const Record*)q.data)->size;
+  memmove(q.data, q.data + size, q.stats.bytes - size);
+  q.stats.bytes -= size;
+  q.stats.depth--;
+}
+
+void MqttOutbox::clear() {
+  for (int i = 0; i < MQTT_PRIORITY_COUNT; i++) {
+    _queues[i].stats.bytes = 0;
+    _queues[i].stats.depth = 0;
+  }
+}
+
+bool MqttOutbox::empty() const {
+  return headQueue() < 0;
+}
+
+size_t MqttOutbox::depth() const {
+  size_t total = 0;
+  for (int i = 0; i < MQTT_PRIORITY_COUNT; i++) {
+    total += _queues[i].stats.depth;
+  }
+  return total;
+}
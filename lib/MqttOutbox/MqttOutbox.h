@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Очередь исходящих сообщений MQTT с классами приоритета.
+// PubSubClient пишет в сокет синхронно и при полном окне TCP держит
+// вызывающего - поэтому публикации кладутся сюда, а loop() досылает их
+// понемногу, пока сокет готов принять данные.
+//
+// У каждого класса свой буфер фиксированного размера: поток телеметрии не
+// вытесняет события. Внутри класса - FIFO; новое сообщение, которому не
+// хватает места, вытесняет самые старые того же класса (счетчик dropped).
+// Выдается первое сообщение самого приоритетного непустого класса.
+//
+// Буфер класса линейный: запись в конец, извлечение с начала со сдвигом
+// остатка - при паре КБ это дешевле кольца с переносом записей.
+
+enum MqttPriority : uint8_t {
+  MQTT_PRIORITY_EVENT = 0,   // Аварийные и технологические события котла
+  MQTT_PRIORITY_STATE,       // Отклик на команды: уставка, подброс угля
+  MQTT_PRIORITY_TELEMETRY,   // Периодические температуры, состояние, ML, профиль
+  MQTT_PRIORITY_COUNT
+};
+
+#define MQTT_OUTBOX_EVENT_BYTES 1024
+#define MQTT_OUTBOX_STATE_BYTES 512
+#define MQTT_OUTBOX_TELEMETRY_BYTES 3072
+
+// Сообщение в голове очереди; указатели действительны до pop()/push()
+struct MqttOutboxMessage {
+  const char* topic;
+  const char* payload;
+  uint16_t payloadLen;
+  bool retain;
+  MqttPriority priority;
+  uint32_t enqueuedUs;  // Время постановки (micros()) - для задержки досылки
+};
+
+struct MqttOutboxClassStats {
+  uint16_t depth = 0;      // Сообщений в очереди
+  uint16_t maxDepth = 0;
+  uint16_t bytes = 0;      // Занято в буфере класса
+  uint32_t queued = 0;
+  uint32_t dropped = 0;    // Вытеснены новыми или не влезли в буфер
+};
+
+class MqttOutbox {
+ public:
+  MqttOutbox();
+
+  // false - сообщение больше буфера класса (учитывается в dropped)
+  bool push(MqttPriority priority, const char* topic, const char* payload, bool retain, uint32_t nowUs);
+  // Двоичный payload (MessagePack): может содержать нулевые байты
+  bool push(MqttPriority priority, const char* topic, const uint8_t* payload, size_t payloadLen,
+            bool retain, uint32_t nowUs);
+  bool peek(MqttOutboxMessage& msg) const;
+  void pop();  // Снять сообщение, выданное peek()
+  void clear();
+
+  bool empty() const;
+  size_t depth() const;
+  const MqttOutboxClassStats& stats(MqttPriority priority) const { return _queues[priority].stats; }
+
+ private:
+  // Заголовок записи, за ним topic\0 и payload\0 (длина payload - из заголовка)
+  struct Record {
+    uint16_t size;  // Запись целиком, с выравниванием
+    uint16_t topicLen;
+    uint16_t payloadLen;
+    uint8_t retain;
+    uint8_t reserved;
+    uint32_t enqueuedUs;
+  };
+
+  struct Queue {
+    uint8_t* data;
+    uint16_t capacity;
+    MqttOutboxClassStats stats;
+  };
+
+  void dropFront(Queue& q);
+  int headQueue() const;
+
+  Queue _queues[MQTT_PRIORITY_COUNT];
+  alignas(4) uint8_t _eventData[MQTT_OUTBOX_EVENT_BYTES];
+  alignas(4) uint8_t _stateData[MQTT_OUTBOX_STATE_BYTES];
+  alignas(4) uint8_t _telemetryData[MQTT_OUTBOX_TELEMETRY_BYTES];
+};
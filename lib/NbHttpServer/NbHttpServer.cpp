@@ -0,0 +1,1025 @@
+#include "NbHttpServer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "NbSocket.h"
+
+static long findBytes(const char* hay, size_t n, const char* needle, size_t m) {
+  if (m == 0 || n < m) {
+    return -1;
+  }
+  const char* p = hay;
+  const char* last = hay + n - m;
+  while (p <= last) {
+    p = (const char*)memchr(p, needle[0], last - p + 1);
+    if (p == nullptr) {
+      return -1;
+    }
+    if (memcmp(p, needle, m) == 0) {
+      return p - hay;
+    }
+    p++;
+  }
+  return -1;
+}
+
+// Поиск подстроки без учета регистра (значения заголовков)
+static const char* findNoCase(const char* s, const char* needle) {
+  size_t m = strlen(needle);
+  for (; *s; s++) {
+    if (strncasecmp(s, needle, m) == 0) {
+      return s;
+    }
+  }
+  return nullptr;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Декодирование %XX (и '+' в параметрах) на месте: результат не длиннее исходной строки
+static void urlDecode(char* s, bool plusAsSpace) {
+  char* out = s;
+  for (char* in = s; *in; in++) {
+    if (*in == '%' && hexValue(in[1]) >= 0 && hexValue(in[2]) >= 0) {
+      *out++ = (char)(hexValue(in[1]) * 16 + hexValue(in[2]));
+      in += 2;
+    } else if (*in == '+' && plusAsSpace) {
+      *out++ = ' ';
+    } else {
+      *out++ = *in;
+    }
+  }
+  *out = 0;
+}
+
+// Значение из заголовков части multipart: от key до первого из stop
+static NbString partParam(const char* headers, const char* key, const char* stop) {
+  const char* p = findNoCase(headers, key);
+  if (p == nullptr) {
+    return NbString();
+  }
+  p += strlen(key);
+  char value[96];
+  size_t len = strcspn(p, stop);
+  if (len >= sizeof(value)) {
+    len = sizeof(value) - 1;
+  }
+  memcpy(value, p, len);
+  value[len] = 0;
+  return NbString(value);
+}
+
+static const char* statusText(int code) {
+  switch (code) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "";
+  }
+}
+
+static HTTPMethod parseMethod(const char* s, bool* ok) {
+  *ok = true;
+  if (strcmp(s, "GET") == 0) return HTTP_GET;
+  if (strcmp(s, "POST") == 0) return HTTP_POST;
+  if (strcmp(s, "HEAD") == 0) return HTTP_HEAD;
+  if (strcmp(s, "PUT") == 0) return HTTP_PUT;
+  if (strcmp(s, "DELETE") == 0) return HTTP_DELETE;
+  if (strcmp(s, "PATCH") == 0) return HTTP_PATCH;
+  if (strcmp(s, "OPTIONS") == 0) return HTTP_OPTIONS;
+  *ok = false;
+  return HTTP_GET;
+}
+
+// ---------------------------------------------------------------------------
+// Жизненный цикл и маршруты
+
+void NbHttpServer::begin() {
+  if (_listenFd >= 0) {
+    return;
+  }
+  _listenFd = nbSocketListen(_port, NBHTTP_MAX_CONNECTIONS * 2);
+}
+
+void NbHttpServer::stop() {
+  for (int i = 0; i < NBHTTP_MAX_CONNECTIONS; i++) {
+    if (_conns[i].fd >= 0) {
+      closeConnection(_conns[i]);
+    }
+  }
+  nbSocketClose(_listenFd);
+  _listenFd = -1;
+}
+
+void NbHttpServer::on(const char* uri, THandlerFunction handler) {
+  on(uri, HTTP_ANY, handler, nullptr);
+}
+
+void NbHttpServer::on(const char* uri, HTTPMethod method, THandlerFunction handler) {
+  on(uri, method, handler, nullptr);
+}
+
+void NbHttpServer::on(const char* uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler) {
+  if (_routeCount >= NBHTTP_MAX_ROUTES) {
+    return;
+  }
+  Route& r = _routes[_routeCount++];
+  r.uri = uri;
+  r.method = method;
+  r.handler = handler;
+  r.uploadHandler = uploadHandler;
+}
+
+NbHttpServer::Route* NbHttpServer::findRoute(const char* uri, HTTPMethod method) {
+  for (int i = 0; i < _routeCount; i++) {
+    Route& r = _routes[i];
+    if ((r.method == HTTP_ANY || r.method == method) && strcmp(r.uri, uri) == 0) {
+      return &r;
+    }
+  }
+  return nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// Цикл событий
+
+void NbHttpServer::handleClient() {
+  if (_listenFd < 0) {
+    return;
+  }
+  unsigned long now = nbMillis();
+  acceptClients(now);
+
+  // Не больше одного обработчика за вызов, соединения по кругу
+  bool dispatched = false;
+  for (int k = 0; k < NBHTTP_MAX_CONNECTIONS; k++) {
+    int i = (_nextSlot + k) % NBHTTP_MAX_CONNECTIONS;
+    Connection& c = _conns[i];
+    if (c.fd < 0) {
+      continue;
+    }
+    if (c.state == CONN_READ || c.state == CONN_UPLOAD) {
+      readAvailable(c, now);
+    }
+    if (c.state == CONN_READ && !dispatched && requestComplete(c)) {
+      dispatch(c);
+      dispatched = true;
+      _nextSlot = (i + 1) % NBHTTP_MAX_CONNECTIONS;
+    }
+    if (c.state == CONN_SEND) {
+      writePending(c, now);
+    }
+    if (c.fd >= 0) {
+      // Свежее время: обработчик мог занять loop, а отметки активности ставятся по ходу
+      checkTimeouts(c, nbMillis());
+    }
+  }
+}
+
+void NbHttpServer::acceptClients(unsigned long now) {
+  while (true) {
+    int slot = -1;
+    for (int i = 0; i < NBHTTP_MAX_CONNECTIONS; i++) {
+      if (_conns[i].fd < 0) {
+        slot = i;
+        break;
+      }
+    }
+    if (slot < 0) {
+      // Все заняты: новый клиент ждет в очереди, пока не найдется кого вытеснить
+      if (!nbSocketPending(_listenFd)) {
+        return;
+      }
+      slot = evictSlot(now);
+      if (slot < 0) {
+        return;
+      }
+    }
+    int fd = nbSocketAccept(_listenFd);
+    if (fd < 0) {
+      return;
+    }
+    Connection& c = _conns[slot];
+    c.fd = fd;
+    c.rxLen = 0;
+    c.lastActivity = now;
+    c.requestStart = now;
+    c.keepAlive = false;
+    resetRequest(c);
+    _stats.accepted++;
+    _stats.active++;
+    if (_stats.active > _stats.maxActive) {
+      _stats.maxActive = _stats.active;
+    }
+  }
+}
+
+// Вытесняется самое старое соединение, которое ничего не отправляет и не
+// загружает: простаивающий keep-alive или недочитанный запрос (slowloris)
+int NbHttpServer::evictSlot(unsigned long now) {
+  int victim = -1;
+  unsigned long victimAge = 0;
+  for (int i = 0; i < NBHTTP_MAX_CONNECTIONS; i++) {
+    Connection& c = _conns[i];
+    if (c.state != CONN_READ) {
+      continue;
+    }
+    bool partial = c.rxLen > 0 || c.headerParsed;
+    unsigned long age = now - (partial ? c.requestStart : c.lastActivity);
+    if (age >= NBHTTP_EVICT_AGE && age >= victimAge) {
+      victim = i;
+      victimAge = age;
+    }
+  }
+  if (victim >= 0) {
+    _stats.evicted++;
+    closeConnection(_conns[victim]);
+  }
+  return victim;
+}
+
+void NbHttpServer::closeConnection(Connection& c) {
+  if (&c == _uploadConn) {
+    abortUpload();
+  }
+  nbSocketClose(c.fd);
+  c.fd = -1;
+  c.state = CONN_FREE;
+  c.rxLen = 0;
+  c.body = NbString();
+  c.source = nullptr;
+  if (_stats.active > 0) {
+    _stats.active--;
+  }
+}
+
+// Подготовка к следующему запросу: конвейерный хвост переносится в начало буфера
+void NbHttpServer::resetRequest(Connection& c) {
+  size_t used = c.headerParsed ? c.requestEnd : 0;
+  if (used > c.rxLen) {
+    used = c.rxLen;
+  }
+  c.rxLen -= used;
+  memmove(c.rx, c.rx + used, c.rxLen);
+  c.state = CONN_READ;
+  c.headerParsed = false;
+  c.chunked = false;
+  c.scanned = 0;
+  c.queryOff = -1;
+  c.bodyOff = 0;
+  c.requestEnd = 0;
+  c.contentLength = 0;
+  c.bodyRemaining = 0;
+  c.headerCount = 0;
+  c.txLen = 0;
+  c.txPos = 0;
+  c.bodyPos = 0;
+  c.requestStart = nbMillis();
+}
+
+void NbHttpServer::readAvailable(Connection& c, unsigned long now) {
+  if (c.rxLen >= NBHTTP_RX_BUFFER) {
+    return;  // Буфер полон: ждем разбора или отправки ответа
+  }
+  size_t space = NBHTTP_RX_BUFFER - c.rxLen;
+  if (c.state == CONN_UPLOAD && space > c.bodyRemaining) {
+    space = c.bodyRemaining;
+  }
+  if (space == 0) {
+    return;
+  }
+  int n = nbSocketRecv(c.fd, c.rx + c.rxLen, space);
+  if (n == 0) {
+    return;
+  }
+  if (n < 0) {
+    if (c.rxLen > 0 || c.state == CONN_UPLOAD) {
+      _stats.errors++;
+    }
+    closeConnection(c);
+    return;
+  }
+  if (c.rxLen == 0 && !c.headerParsed) {
+    c.requestStart = now;
+  }
+  c.rxLen += n;
+  c.lastActivity = now;
+  if (c.state == CONN_UPLOAD) {
+    c.bodyRemaining -= n;
+    processUpload(c);
+  }
+}
+
+void NbHttpServer::checkTimeouts(Connection& c, unsigned long now) {
+  switch (c.state) {
+    case CONN_READ:
+      if (c.rxLen > 0 || c.headerParsed) {
+        if (now - c.requestStart >= NBHTTP_REQUEST_TIMEOUT) {
+          _stats.timeouts++;
+          closeConnection(c);
+        }
+      } else if (now - c.lastActivity >= NBHTTP_IDLE_TIMEOUT) {
+        closeConnection(c);
+      }
+      break;
+    case CONN_UPLOAD:
+      if (now - c.lastActivity >= NBHTTP_UPLOAD_TIMEOUT) {
+        _stats.timeouts++;
+        closeConnection(c);
+      }
+      break;
+    case CONN_SEND:
+      if (now - c.lastActivity >= NBHTTP_SEND_TIMEOUT) {
+        _stats.timeouts++;
+        closeConnection(c);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Разбор запроса
+
+// Заголовки пришли целиком и тело (если влезает) - тоже
+bool NbHttpServer::requestComplete(Connection& c) {
+  if (!c.headerParsed) {
+    size_t from = c.scanned > 3 ? c.scanned - 3 : 0;
+    long end = findBytes(c.rx + from, c.rxLen - from, "\r\n\r\n", 4);
+    if (end < 0) {
+      c.scanned = c.rxLen;
+      if (c.rxLen >= NBHTTP_RX_BUFFER) {
+        respondError(c, 431);
+      }
+      return false;
+    }
+    int error = parseHeaders(c, from + end);
+    c.headerParsed = true;
+    if (error != 0) {
+      respondError(c, error);
+      return false;
+    }
+
+    Route* route = findRoute(c.rx + c.uriOff, c.method);
+    const char* contentType = connHeader(c, "Content-Type");
+    bool multipart = contentType != nullptr && findNoCase(contentType, "multipart/form-data") != nullptr;
+    bool streamed = route != nullptr && route->uploadHandler && multipart;
+    if (!streamed && c.contentLength > (size_t)(NBHTTP_RX_BUFFER - c.bodyOff)) {
+      respondError(c, 413);
+      return false;
+    }
+
+    const char* expect = connHeader(c, "Expect");
+    if (expect != nullptr && strcasecmp(expect, "100-continue") == 0) {
+      static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+      nbSocketSend(c.fd, CONTINUE, sizeof(CONTINUE) - 1);
+    }
+    if (streamed) {
+      beginUpload(c, route);
+      return false;
+    }
+  }
+  return c.rxLen >= c.bodyOff + c.contentLength;
+}
+
+// Строка запроса и заголовки: разделители заменяются на \0, запоминаются смещения
+int NbHttpServer::parseHeaders(Connection& c, size_t end) {
+  char* rx = c.rx;
+  rx[end] = 0;
+  c.bodyOff = end + 4;
+
+  char* line = rx;
+  char* next = strstr(line, "\r\n");
+  if (next != nullptr) {
+    *next = 0;
+    next += 2;
+  }
+  char* uri = strchr(line, ' ');
+  if (uri == nullptr) {
+    return 400;
+  }
+  *uri++ = 0;
+  char* version = strchr(uri, ' ');
+  if (version == nullptr) {
+    return 400;
+  }
+  *version++ = 0;
+  if (strncmp(version, "HTTP/1.", 7) != 0) {
+    return 400;
+  }
+  c.http10 = version[7] == '0';
+  bool known;
+  c.method = parseMethod(line, &known);
+  if (!known) {
+    return 405;
+  }
+  char* query = strchr(uri, '?');
+  if (query != nullptr) {
+    *query++ = 0;
+    c.queryOff = query - rx;
+  }
+  urlDecode(uri, false);
+  c.uriOff = uri - rx;
+
+  c.headerCount = 0;
+  while (next != nullptr && *next) {
+    line = next;
+    next = strstr(line, "\r\n");
+    if (next != nullptr) {
+      *next = 0;
+      next += 2;
+    }
+    char* colon = strchr(line, ':');
+    if (colon == nullptr || c.headerCount >= NBHTTP_MAX_HEADERS) {
+      continue;  // Лишние заголовки не нужны ни одному обработчику
+    }
+    *colon = 0;
+    char* value = colon + 1;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    c.headerName[c.headerCount] = line - rx;
+    c.headerValue[c.headerCount] = value - rx;
+    c.headerCount++;
+  }
+
+  if (connHeader(c, "Transfer-Encoding") != nullptr) {
+    return 411;  // Тело запроса чанками не поддерживается
+  }
+  const char* length = connHeader(c, "Content-Length");
+  c.contentLength = length != nullptr ? strtoul(length, nullptr, 10) : 0;
+  c.requestEnd = c.bodyOff;
+
+  const char* connection = connHeader(c, "Connection");
+  if (c.http10) {
+    c.keepAlive = connection != nullptr && findNoCase(connection, "keep-alive") != nullptr;
+  } else {
+    c.keepAlive = connection == nullptr || findNoCase(connection, "close") == nullptr;
+  }
+  return 0;
+}
+
+const char* NbHttpServer::connHeader(const Connection& c, const char* name) const {
+  for (int i = 0; i < c.headerCount; i++) {
+    if (strcasecmp(c.rx + c.headerName[i], name) == 0) {
+      return c.rx + c.headerValue[i];
+    }
+  }
+  return nullptr;
+}
+
+// Параметры вида a=1&b=2 (строка запроса или тело формы), на месте
+void NbHttpServer::parseArgs(char* s) {
+  while (s != nullptr && *s && _argCount < NBHTTP_MAX_ARGS) {
+    char* amp = strchr(s, '&');
+    if (amp != nullptr) {
+      *amp = 0;
+    }
+    if (*s) {
+      char* eq = strchr(s, '=');
+      char* value = s + strlen(s);  // Без '=' - пустое значение
+      if (eq != nullptr) {
+        *eq = 0;
+        value = eq + 1;
+      }
+      urlDecode(s, true);
+      urlDecode(value, true);
+      _argNames[_argCount] = s;
+      _argValues[_argCount] = value;
+      _argCount++;
+    }
+    s = amp != nullptr ? amp + 1 : nullptr;
+  }
+}
+
+void NbHttpServer::dispatch(Connection& c) {
+  _current = &c;
+  _responded = false;
+  _extraLen = 0;
+  _method = c.method;
+  _uri = c.rx + c.uriOff;
+  _argCount = 0;
+  _stats.requests++;
+
+  if (c.queryOff >= 0) {
+    parseArgs(c.rx + c.queryOff);
+  }
+
+  // Тело завершается \0; конвейерный хвост, если есть, сдвигается на байт
+  // (в rx на байт больше NBHTTP_RX_BUFFER)
+  size_t end = c.bodyOff + c.contentLength;
+  if (c.rxLen > end) {
+    memmove(c.rx + end + 1, c.rx + end, c.rxLen - end);
+    c.rxLen++;
+    c.requestEnd = end + 1;
+  } else {
+    c.requestEnd = end;
+  }
+  c.rx[end] = 0;
+
+  if (c.contentLength > 0) {
+    char* body = c.rx + c.bodyOff;
+    const char* contentType = connHeader(c, "Content-Type");
+    if (contentType != nullptr && findNoCase(contentType, "application/x-www-form-urlencoded") != nullptr) {
+      parseArgs(body);
+    } else if (_argCount < NBHTTP_MAX_ARGS) {
+      // Как в WebServer: тело JSON и прочее - аргумент "plain"
+      _argNames[_argCount] = "plain";
+      _argValues[_argCount] = body;
+      _argCount++;
+    }
+  }
+
+  Route* route = findRoute(_uri, c.method);
+  if (route != nullptr) {
+    route->handler();
+  } else if (_notFound) {
+    _notFound();
+  } else {
+    send(404, "text/plain", "Not Found");
+  }
+  if (!_responded) {
+    send(500, "text/plain", "No response");
+  }
+  _current = nullptr;
+  _argCount = 0;
+}
+
+NbString NbHttpServer::uri() const {
+  return NbString(_current != nullptr ? _uri : "");
+}
+
+int NbHttpServer::findArg(const char* name) const {
+  for (int i = 0; i < _argCount; i++) {
+    if (strcmp(_argNames[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+NbString NbHttpServer::arg(const char* name) const {
+  int i = findArg(name);
+  return i >= 0 ? NbString(_argValues[i]) : NbString();
+}
+
+NbString NbHttpServer::arg(int i) const {
+  return (i >= 0 && i < _argCount) ? NbString(_argValues[i]) : NbString();
+}
+
+NbString NbHttpServer::argName(int i) const {
+  return (i >= 0 && i < _argCount) ? NbString(_argNames[i]) : NbString();
+}
+
+NbString NbHttpServer::header(const char* name) const {
+  const char* value = _current != nullptr ? connHeader(*_current, name) : nullptr;
+  return value != nullptr ? NbString(value) : NbString();
+}
+
+// ---------------------------------------------------------------------------
+// Потоковая загрузка multipart/form-data (прошивка через /update)
+
+void NbHttpServer::beginUpload(Connection& c, Route* route) {
+  if (_uploadConn != nullptr) {
+    respondError(c, 503);  // Две прошивки сразу не пишем
+    return;
+  }
+  const char* contentType = connHeader(c, "Content-Type");
+  const char* b = findNoCase(contentType, "boundary=");
+  if (b == nullptr) {
+    respondError(c, 400);
+    return;
+  }
+  b += 9;
+  if (*b == '"') {
+    b++;
+  }
+  size_t len = strcspn(b, "\"; ");
+  if (len == 0 || len + 4 >= sizeof(_boundary)) {
+    respondError(c, 400);
+    return;
+  }
+  memcpy(_boundary, "\r\n--", 4);
+  memcpy(_boundary + 4, b, len);
+  _boundaryLen = len + 4;
+
+  // Заголовки больше не нужны: в буфере остается только начало тела
+  size_t inBuffer = c.rxLen - c.bodyOff;
+  if (inBuffer > c.contentLength) {
+    inBuffer = c.contentLength;
+  }
+  memmove(c.rx, c.rx + c.bodyOff, inBuffer);
+  c.rxLen = inBuffer;
+  c.bodyRemaining = c.contentLength - inBuffer;
+  c.headerCount = 0;
+  c.bodyOff = 0;
+  c.contentLength = 0;
+  c.keepAlive = false;
+  c.state = CONN_UPLOAD;
+
+  _uploadConn = &c;
+  _uploadRoute = route;
+  _mpState = MP_PREAMBLE;
+  _mpFile = false;
+  processUpload(c);
+}
+
+// Разбор того, что уже лежит в буфере. false - загрузка прервана с ошибкой
+bool NbHttpServer::processUpload(Connection& c) {
+  bool waiting = false;
+  while (!waiting) {
+    switch (_mpState) {
+      case MP_PREAMBLE: {
+        // Первая граница без ведущего \r\n
+        const char* delim = _boundary + 2;
+        size_t delimLen = _boundaryLen - 2;
+        long p = findBytes(c.rx, c.rxLen, delim, delimLen);
+        size_t used = p >= 0 ? p + delimLen : (c.rxLen >= delimLen ? c.rxLen - delimLen + 1 : 0);
+        c.rxLen -= used;
+        memmove(c.rx, c.rx + used, c.rxLen);
+        if (p >= 0) {
+          _mpState = MP_AFTER_DELIM;
+        } else {
+          waiting = true;
+        }
+        break;
+      }
+      case MP_AFTER_DELIM:
+        if (c.rxLen < 2) {
+          waiting = true;
+        } else if (c.rx[0] == '-' && c.rx[1] == '-') {
+          _mpState = MP_DONE;
+        } else if (c.rx[0] == '\r' && c.rx[1] == '\n') {
+          c.rxLen -= 2;
+          memmove(c.rx, c.rx + 2, c.rxLen);
+          _mpState = MP_HEADERS;
+        } else {
+          abortUpload();
+          respondError(c, 400);
+          return false;
+        }
+        break;
+      case MP_HEADERS: {
+        long end = findBytes(c.rx, c.rxLen, "\r\n\r\n", 4);
+        if (end < 0) {
+          if (c.rxLen >= NBHTTP_RX_BUFFER) {
+            abortUpload();
+            respondError(c, 431);
+            return false;
+          }
+          waiting = true;
+          break;
+        }
+        c.rx[end] = 0;
+        // Поля формы без filename не нужны ни одному маршруту - пропускаются
+        _mpFile = findNoCase(c.rx, "filename=\"") != nullptr;
+        if (_mpFile) {
+          _upload.filename = partParam(c.rx, "filename=\"", "\"");
+          _upload.name = partParam(c.rx, "; name=\"", "\"");
+          _upload.type = partParam(c.rx, "Content-Type: ", "\r");
+          _upload.totalSize = 0;
+          _upload.currentSize = 0;
+          _upload.status = UPLOAD_FILE_START;
+          _uploadRoute->uploadHandler();
+        }
+        c.rxLen -= end + 4;
+        memmove(c.rx, c.rx + end + 4, c.rxLen);
+        _mpState = MP_DATA;
+        break;
+      }
+      case MP_DATA: {
+        long p = findBytes(c.rx, c.rxLen, _boundary, _boundaryLen);
+        size_t data = p >= 0 ? p : (c.rxLen >= _boundaryLen ? c.rxLen - _boundaryLen + 1 : 0);
+        emitUploadData(c.rx, data);
+        size_t used = p >= 0 ? p + _boundaryLen : data;
+        c.rxLen -= used;
+        memmove(c.rx, c.rx + used, c.rxLen);
+        if (p >= 0) {
+          if (_mpFile) {
+            if (_upload.currentSize > 0) {
+              _upload.status = UPLOAD_FILE_WRITE;
+              _uploadRoute->uploadHandler();
+              _upload.totalSize += _upload.currentSize;
+              _upload.currentSize = 0;
+            }
+            _upload.status = UPLOAD_FILE_END;
+            _uploadRoute->uploadHandler();
+            _mpFile = false;
+          }
+          _mpState = MP_AFTER_DELIM;
+        } else {
+          waiting = true;
+        }
+        break;
+      }
+      case MP_DONE:
+        c.rxLen = 0;  // Эпилог после последней границы игнорируется
+        waiting = true;
+        break;
+    }
+  }
+
+  if (c.bodyRemaining == 0) {
+    if (_mpState != MP_DONE) {
+      abortUpload();
+      respondError(c, 400);
+      return false;
+    }
+    finishUpload(c);
+  }
+  return true;
+}
+
+void NbHttpServer::emitUploadData(const char* data, size_t len) {
+  if (!_mpFile) {
+    return;
+  }
+  while (len > 0) {
+    size_t room = HTTP_UPLOAD_BUFLEN - _upload.currentSize;
+    size_t n = len < room ? len : room;
+    memcpy(_upload.buf + _upload.currentSize, data, n);
+    _upload.currentSize += n;
+    data += n;
+    len -= n;
+    if (_upload.currentSize == HTTP_UPLOAD_BUFLEN) {
+      _upload.status = UPLOAD_FILE_WRITE;
+      _uploadRoute->uploadHandler();
+      _upload.totalSize += _upload.currentSize;
+      _upload.currentSize = 0;
+    }
+  }
+}
+
+// Тело принято целиком - основной обработчик маршрута формирует ответ
+void NbHttpServer::finishUpload(Connection& c) {
+  Route* route = _uploadRoute;
+  _uploadConn = nullptr;
+  _uploadRoute = nullptr;
+
+  _current = &c;
+  _responded = false;
+  _extraLen = 0;
+  _method = c.method;
+  _uri = route->uri;
+  _argCount = 0;
+  _stats.requests++;
+  route->handler();
+  if (!_responded) {
+    send(500, "text/plain", "No response");
+  }
+  _current = nullptr;
+}
+
+void NbHttpServer::abortUpload() {
+  if (_mpFile && _uploadRoute != nullptr) {
+    _upload.status = UPLOAD_FILE_ABORTED;
+    _uploadRoute->uploadHandler();
+  }
+  _mpFile = false;
+  _uploadConn = nullptr;
+  _uploadRoute = nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// Ответ
+
+// Ответ самого сервера на негодный запрос; соединение закрывается после отправки
+void NbHttpServer::respondError(Connection& c, int code) {
+  _stats.rejected++;
+  Connection* saved = _current;
+  _current = &c;
+  _extraLen = 0;
+  c.keepAlive = false;
+  const char* text = statusText(code);
+  writeHead(code, "text/plain", strlen(text));
+  memcpy(c.tx + c.txLen, text, strlen(text));
+  c.txLen += strlen(text);
+  c.state = CONN_SEND;
+  _current = saved;
+}
+
+// Строка статуса и заголовки в tx текущего соединения
+void NbHttpServer::writeHead(int code, const char* contentType, size_t length) {
+  Connection& c = *_current;
+  char* out = (char*)c.tx;
+  size_t size = NBHTTP_TX_BUFFER;
+  int n = snprintf(out, size, "HTTP/1.1 %d %s\r\n", code, statusText(code));
+  if (contentType != nullptr) {
+    n += snprintf(out + n, size - n, "Content-Type: %s\r\n", contentType);
+  }
+  if (length != NBHTTP_CONTENT_LENGTH_UNKNOWN) {
+    n += snprintf(out + n, size - n, "Content-Length: %u\r\n", (unsigned)length);
+  } else if (c.http10) {
+    c.keepAlive = false;  // HTTP/1.0 не знает chunked - конец тела по закрытию
+  } else {
+    n += snprintf(out + n, size - n, "Transfer-Encoding: chunked\r\n");
+    c.chunked = true;
+  }
+  n += snprintf(out + n, size - n, "Connection: %s\r\n", c.keepAlive ? "keep-alive" : "close");
+  if (_extraLen < size - n - 2) {
+    memcpy(out + n, _extraHeaders, _extraLen);
+    n += _extraLen;
+  }
+  memcpy(out + n, "\r\n", 2);
+  c.txLen = n + 2;
+  c.txPos = 0;
+  c.bodyPos = 0;
+}
+
+void NbHttpServer::sendHeader(const char* name, const NbString& value) {
+  if (_current == nullptr) {
+    return;
+  }
+  // Connection выставляет сам сервер; close от обработчика учитывается
+  if (strcasecmp(name, "Connection") == 0) {
+    if (findNoCase(value.c_str(), "close") != nullptr) {
+      _current->keepAlive = false;
+    }
+    return;
+  }
+  int n = snprintf(_extraHeaders + _extraLen, sizeof(_extraHeaders) - _extraLen, "%s: %s\r\n", name, value.c_str());
+  if (n > 0 && _extraLen + n < sizeof(_extraHeaders)) {
+    _extraLen += n;
+  }
+}
+
+void NbHttpServer::send(int code, const char* contentType, const char* content) {
+  if (_current == nullptr || _responded) {
+    return;
+  }
+  _responded = true;
+  Connection& c = *_current;
+  size_t length = content != nullptr ? strlen(content) : 0;
+  writeHead(code, contentType, length);
+  if (c.method != HTTP_HEAD && length > 0) {
+    // Короткое тело - одним сегментом с заголовками
+    if (length <= NBHTTP_TX_BUFFER - c.txLen) {
+      memcpy(c.tx + c.txLen, content, length);
+      c.txLen += length;
+    } else {
+      c.body = NbString(content);
+    }
+  }
+  c.state = CONN_SEND;
+}
+
+void NbHttpServer::send(int code, const char* contentType, const NbString& content) {
+  if (_current == nullptr || _responded) {
+    return;
+  }
+  Connection& c = *_current;
+  if (content.length() > NBHTTP_TX_BUFFER / 2) {
+    _responded = true;
+    writeHead(code, contentType, content.length());
+    if (c.method != HTTP_HEAD) {
+      c.body = content;  // Длинный ответ держится до отправки
+    }
+    c.state = CONN_SEND;
+    return;
+  }
+  send(code, contentType, content.c_str());
+}
+
+void NbHttpServer::sendChunks(int code, const char* contentType, size_t length, NbHttpChunkSource source) {
+  if (_current == nullptr || _responded) {
+    return;
+  }
+  _responded = true;
+  Connection& c = *_current;
+  writeHead(code, contentType, length);
+  if (c.method != HTTP_HEAD) {
+    c.source = source;
+  }
+  c.state = CONN_SEND;
+}
+
+#ifdef ARDUINO
+size_t NbHttpServer::streamFile(fs::File& file, const char* contentType) {
+  size_t size = file.size();
+  fs::File f = file;  // Копия держит файл открытым, пока идет отправка
+  sendChunks(200, contentType, size, [f](uint8_t* buf, size_t maxLen) mutable -> size_t {
+    return f.available() ? f.read(buf, maxLen) : 0;
+  });
+  return size;
+}
+#endif
+
+void NbHttpServer::flush(unsigned long timeoutMs) {
+  if (_current == nullptr || _current->state != CONN_SEND) {
+    return;
+  }
+  // После flush обработчик обычно надолго занимает loop - соединение не держим
+  Connection& c = *_current;
+  c.keepAlive = false;
+  unsigned long start = nbMillis();
+  while (c.fd >= 0 && c.state == CONN_SEND && nbMillis() - start < timeoutMs) {
+    writePending(c, nbMillis());
+    if (c.fd >= 0 && c.state == CONN_SEND) {
+      nbYield();
+    }
+  }
+}
+
+// Досылка ответа, пока сокет принимает данные
+void NbHttpServer::writePending(Connection& c, unsigned long now) {
+  int refills = 0;
+  while (true) {
+    const uint8_t* data;
+    size_t len;
+    if (c.txPos < c.txLen) {
+      data = c.tx + c.txPos;
+      len = c.txLen - c.txPos;
+    } else if (c.bodyPos < c.body.length()) {
+      data = (const uint8_t*)c.body.c_str() + c.bodyPos;
+      len = c.body.length() - c.bodyPos;
+    } else if (c.source) {
+      if (refills++ >= NBHTTP_REFILLS_PER_LOOP) {
+        return;
+      }
+      refillFromSource(c);
+      continue;
+    } else {
+      finishResponse(c);
+      return;
+    }
+
+    int n = nbSocketSend(c.fd, data, len);
+    if (n < 0) {
+      _stats.errors++;
+      closeConnection(c);
+      return;
+    }
+    if (n == 0) {
+      return;
+    }
+    c.lastActivity = now;
+    if (c.txPos < c.txLen) {
+      c.txPos += n;
+    } else {
+      c.bodyPos += n;
+    }
+  }
+}
+
+// Следующий кусок потока в tx (для chunked - с рамкой); false - поток кончился
+bool NbHttpServer::refillFromSource(Connection& c) {
+  c.txLen = 0;
+  c.txPos = 0;
+  if (!c.chunked) {
+    size_t n = c.source(c.tx, NBHTTP_TX_BUFFER);
+    if (n == 0) {
+      c.source = nullptr;
+      return false;
+    }
+    c.txLen = n;
+    return true;
+  }
+  // "XXX\r\n" + данные + "\r\n"; ведущие нули в размере куска допустимы
+  const size_t prefix = 5;
+  size_t n = c.source(c.tx + prefix, NBHTTP_TX_BUFFER - prefix - 2);
+  if (n == 0) {
+    memcpy(c.tx, "0\r\n\r\n", 5);
+    c.txLen = 5;
+    c.source = nullptr;
+    return true;
+  }
+  char size[prefix + 1];
+  snprintf(size, sizeof(size), "%03X\r\n", (unsigned)n);
+  memcpy(c.tx, size, prefix);
+  memcpy(c.tx + prefix + n, "\r\n", 2);
+  c.txLen = prefix + n + 2;
+  return true;
+}
+
+void NbHttpServer::finishResponse(Connection& c) {
+  c.body = NbString();
+  c.source = nullptr;
+  if (!c.keepAlive) {
+    closeConnection(c);
+    return;
+  }
+  c.lastActivity = nbMillis();
+  resetRequest(c);
+}
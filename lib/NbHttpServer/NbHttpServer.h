@@ -0,0 +1,216 @@
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <FS.h>
+// HTTPMethod, HTTPUpload и UPLOAD_FILE_* - из WebServer.h (его подключает и
+// WiFiManager), чтобы обработчики маршрутов и /update остались прежними
+#include <WebServer.h>
+typedef String NbString;
+#else
+#include <string>
+typedef std::string NbString;
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+#define HTTP_UPLOAD_BUFLEN 1436
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  NbString filename;
+  NbString name;
+  NbString type;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+#endif
+
+// Событийный HTTP-сервер: неблокирующие сокеты, несколько соединений
+// одновременно, у каждого свои таймауты и буферы фиксированного размера.
+// Медленный клиент больше не держит loop(): handleClient() только забирает
+// готовые данные, выполняет не больше одного обработчика за вызов и
+// досылает ответы по мере освобождения буфера сокета.
+//
+// Запрос разбирается на месте в буфере соединения: uri, аргументы и
+// заголовки - указатели в этот буфер. Тело, не влезающее в буфер,
+// принимается только потоком multipart для маршрутов с обработчиком
+// загрузки (/update), остальное получает 413.
+//
+// API повторяет WebServer в той части, что нужна прошивке. Отличие: ответ
+// уходит после возврата из обработчика, поэтому перед долгой блокирующей
+// работой в обработчике нужен flush().
+
+#define NBHTTP_MAX_CONNECTIONS 4
+#define NBHTTP_RX_BUFFER 3072        // Заголовки + тело запроса
+#define NBHTTP_TX_BUFFER 1024        // Заголовки ответа, короткое тело, куски потока
+#define NBHTTP_MAX_ROUTES 80
+#define NBHTTP_MAX_ARGS 16
+#define NBHTTP_MAX_HEADERS 20
+#define NBHTTP_EXTRA_HEADERS 384     // sendHeader() текущего ответа
+#define NBHTTP_REQUEST_TIMEOUT 5000  // Весь запрос с первого байта (защита от slowloris)
+#define NBHTTP_IDLE_TIMEOUT 15000    // Keep-alive без новых запросов
+#define NBHTTP_SEND_TIMEOUT 10000    // Ответ не продвигается
+#define NBHTTP_UPLOAD_TIMEOUT 15000  // Загрузка без новых данных
+#define NBHTTP_EVICT_AGE 1000        // Простаивающее соединение старше - вытесняется новым клиентом
+#define NBHTTP_REFILLS_PER_LOOP 4    // Кусков потока за вызов handleClient (SPIFFS читается небыстро)
+#define NBHTTP_CONTENT_LENGTH_UNKNOWN ((size_t)-1)  // Поток с Transfer-Encoding: chunked
+
+// Источник тела ответа: заполняет buf (не больше maxLen), 0 - конец
+typedef std::function<size_t(uint8_t* buf, size_t maxLen)> NbHttpChunkSource;
+
+struct NbHttpStats {
+  uint32_t accepted = 0;
+  uint32_t requests = 0;
+  uint32_t timeouts = 0;   // Закрыты по таймауту
+  uint32_t rejected = 0;   // 400/413/431/503 от самого сервера
+  uint32_t evicted = 0;    // Вытеснены ради нового клиента
+  uint32_t errors = 0;     // Разрыв со стороны клиента посреди запроса/ответа
+  uint8_t active = 0;
+  uint8_t maxActive = 0;
+};
+
+class NbHttpServer {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit NbHttpServer(uint16_t port = 80) : _port(port) {}
+
+  void begin();
+  void stop();
+  void handleClient();
+
+  // uri хранится указателем - только строковые литералы
+  void on(const char* uri, THandlerFunction handler);
+  void on(const char* uri, HTTPMethod method, THandlerFunction handler);
+  void on(const char* uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler);
+  void onNotFound(THandlerFunction handler) { _notFound = handler; }
+
+  // Текущий запрос (внутри обработчика)
+  HTTPMethod method() const { return _method; }
+  NbString uri() const;
+  NbString arg(const char* name) const;
+  NbString arg(const NbString& name) const { return arg(name.c_str()); }
+  NbString arg(int i) const;
+  NbString argName(int i) const;
+  int args() const { return _argCount; }
+  bool hasArg(const char* name) const { return findArg(name) >= 0; }
+  bool hasArg(const NbString& name) const { return hasArg(name.c_str()); }
+  NbString header(const char* name) const;
+  HTTPUpload& upload() { return _upload; }
+
+  // Ответ на текущий запрос
+  void sendHeader(const char* name, const NbString& value);
+  void send(int code, const char* contentType = nullptr, const NbString& content = NbString());
+  void send(int code, const char* contentType, const char* content);
+  void sendChunks(int code, const char* contentType, size_t length, NbHttpChunkSource source);
+#ifdef ARDUINO
+  size_t streamFile(fs::File& file, const char* contentType);
+#endif
+  // Дослать ответ текущего запроса сейчас (перед блокирующей работой в обработчике)
+  void flush(unsigned long timeoutMs);
+
+  const NbHttpStats& stats() const { return _stats; }
+
+ private:
+  enum ConnState : uint8_t { CONN_FREE, CONN_READ, CONN_UPLOAD, CONN_SEND };
+
+  struct Connection {
+    int fd = -1;
+    ConnState state = CONN_FREE;
+    bool keepAlive = false;
+    bool headerParsed = false;
+    bool http10 = false;
+    bool chunked = false;
+    unsigned long lastActivity = 0;
+    unsigned long requestStart = 0;  // Первый байт текущего запроса
+    // Запрос: смещения в rx после разбора заголовков
+    HTTPMethod method = HTTP_GET;
+    uint16_t uriOff = 0;
+    int16_t queryOff = -1;
+    uint16_t bodyOff = 0;
+    uint16_t requestEnd = 0;         // Начало следующего (конвейерного) запроса
+    size_t contentLength = 0;
+    size_t bodyRemaining = 0;        // Потоковая загрузка: еще не принято из сокета
+    uint8_t headerCount = 0;
+    uint16_t headerName[NBHTTP_MAX_HEADERS];
+    uint16_t headerValue[NBHTTP_MAX_HEADERS];
+    size_t scanned = 0;              // До куда уже искали конец заголовков
+    char rx[NBHTTP_RX_BUFFER + 1];
+    size_t rxLen = 0;
+    // Ответ
+    uint8_t tx[NBHTTP_TX_BUFFER];
+    size_t txLen = 0;
+    size_t txPos = 0;
+    NbString body;
+    size_t bodyPos = 0;
+    NbHttpChunkSource source;
+  };
+
+  struct Route {
+    const char* uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+    THandlerFunction uploadHandler;
+  };
+
+  enum MultipartState : uint8_t { MP_PREAMBLE, MP_AFTER_DELIM, MP_HEADERS, MP_DATA, MP_DONE };
+
+  void acceptClients(unsigned long now);
+  int evictSlot(unsigned long now);
+  void closeConnection(Connection& c);
+  void resetRequest(Connection& c);
+  void readAvailable(Connection& c, unsigned long now);
+  int parseHeaders(Connection& c, size_t end);
+  bool requestComplete(Connection& c);
+  void dispatch(Connection& c);
+  void parseArgs(char* s);
+  int findArg(const char* name) const;
+  Route* findRoute(const char* uri, HTTPMethod method);
+  const char* connHeader(const Connection& c, const char* name) const;
+  void beginUpload(Connection& c, Route* route);
+  bool processUpload(Connection& c);
+  void emitUploadData(const char* data, size_t len);
+  void finishUpload(Connection& c);
+  void abortUpload();
+  void respondError(Connection& c, int code);
+  void writeHead(int code, const char* contentType, size_t length);
+  void writePending(Connection& c, unsigned long now);
+  bool refillFromSource(Connection& c);
+  void finishResponse(Connection& c);
+  void checkTimeouts(Connection& c, unsigned long now);
+
+  uint16_t _port;
+  int _listenFd = -1;
+  Connection _conns[NBHTTP_MAX_CONNECTIONS];
+  uint8_t _nextSlot = 0;
+
+  Route _routes[NBHTTP_MAX_ROUTES];
+  uint8_t _routeCount = 0;
+  THandlerFunction _notFound;
+
+  // Текущий запрос: обработчики выполняются по одному
+  Connection* _current = nullptr;
+  bool _responded = false;
+  const char* _uri = "";
+  HTTPMethod _method = HTTP_GET;
+  const char* _argNames[NBHTTP_MAX_ARGS];
+  const char* _argValues[NBHTTP_MAX_ARGS];
+  int _argCount = 0;
+  char _extraHeaders[NBHTTP_EXTRA_HEADERS];
+  size_t _extraLen = 0;
+
+  // Потоковая загрузка: одна на сервер
+  Connection* _uploadConn = nullptr;
+  Route* _uploadRoute = nullptr;
+  MultipartState _mpState = MP_PREAMBLE;
+  bool _mpFile = false;
+  char _boundary[80];  // "\r\n--" + граница из Content-Type
+  size_t _boundaryLen = 0;
+  HTTPUpload _upload;
+
+  NbHttpStats _stats;
+};
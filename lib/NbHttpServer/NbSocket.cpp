@@ -0,0 +1,140 @@
+#include "NbSocket.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+// Явные имена lwip: в старых ядрах send/recv/close объявлены макросами
+#define NB_SOCKET lwip_socket
+#define NB_SETSOCKOPT lwip_setsockopt
+#define NB_BIND lwip_bind
+#define NB_LISTEN lwip_listen
+#define NB_ACCEPT lwip_accept
+#define NB_FCNTL lwip_fcntl
+#define NB_SELECT lwip_select
+#define NB_RECV lwip_recv
+#define NB_SEND lwip_send
+#define NB_CLOSE lwip_close
+#define NB_SEND_FLAGS 0
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NB_SOCKET socket
+#define NB_SETSOCKOPT setsockopt
+#define NB_BIND bind
+#define NB_LISTEN listen
+#define NB_ACCEPT accept
+#define NB_FCNTL fcntl
+#define NB_SELECT select
+#define NB_RECV recv
+#define NB_SEND send
+#define NB_CLOSE close
+#define NB_SEND_FLAGS MSG_NOSIGNAL  // Без SIGPIPE при разрыве клиентом
+#endif
+
+static bool setNonBlocking(int fd) {
+  int flags = NB_FCNTL(fd, F_GETFL, 0);
+  return flags >= 0 && NB_FCNTL(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+int nbSocketListen(uint16_t port, int backlog) {
+  int fd = NB_SOCKET(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  NB_SETSOCKOPT(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (NB_BIND(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      NB_LISTEN(fd, backlog) < 0 || !setNonBlocking(fd)) {
+    NB_CLOSE(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int nbSocketAccept(int listenFd) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int fd = NB_ACCEPT(listenFd, (struct sockaddr*)&addr, &len);
+  if (fd < 0) {
+    return -1;
+  }
+  if (!setNonBlocking(fd)) {
+    NB_CLOSE(fd);
+    return -1;
+  }
+  // Заголовки и тело уходят отдельными send - без Nagle ответ не ждет ACK
+  int one = 1;
+  NB_SETSOCKOPT(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+bool nbSocketPending(int listenFd) {
+  fd_set readSet;
+  FD_ZERO(&readSet);
+  FD_SET(listenFd, &readSet);
+  struct timeval tv = {0, 0};
+  return NB_SELECT(listenFd + 1, &readSet, NULL, NULL, &tv) > 0;
+}
+
+int nbSocketRecv(int fd, void* buf, size_t len) {
+  int n = NB_RECV(fd, buf, len, 0);
+  if (n > 0) {
+    return n;
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return 0;
+  }
+  return -1;  // 0 от recv - клиент закрыл соединение
+}
+
+int nbSocketSend(int fd, const void* buf, size_t len) {
+  int n = NB_SEND(fd, buf, len, NB_SEND_FLAGS);
+  if (n >= 0) {
+    return n;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+    return 0;
+  }
+  return -1;
+}
+
+void nbSocketClose(int fd) {
+  if (fd >= 0) {
+    NB_CLOSE(fd);
+  }
+}
+
+unsigned long nbMillis() {
+#ifdef ARDUINO
+  return millis();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+#endif
+}
+
+void nbYield() {
+#ifdef ARDUINO
+  delay(1);
+#else
+  usleep(1000);
+#endif
+}
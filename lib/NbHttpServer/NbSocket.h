@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Тонкий слой неблокирующих TCP-сокетов для NbHttpServer.
+// На ESP32 - BSD-сокеты lwip, на Linux - POSIX: сервер собирается на хосте
+// для проверки и нагрузочных тестов. Все сокеты неблокирующие.
+
+// Слушающий сокет на порту, -1 при ошибке
+int nbSocketListen(uint16_t port, int backlog);
+
+// Принять соединение: дескриптор или -1, если очередь пуста
+int nbSocketAccept(int listenFd);
+
+// Есть ли соединения в очереди слушающего сокета
+bool nbSocketPending(int listenFd);
+
+// Прием: > 0 - прочитано байт, 0 - данных пока нет, -1 - соединение закрыто или ошибка
+int nbSocketRecv(int fd, void* buf, size_t len);
+
+// Отправка: >= 0 - принято в буфер сокета, -1 - ошибка
+int nbSocketSend(int fd, const void* buf, size_t len);
+
+void nbSocketClose(int fd);
+
+// Миллисекунды монотонных часов (millis() на ESP32)
+unsigned long nbMillis();
+
+// Короткая пауза в ожидании сокета (delay(1) на ESP32 - отдает время другим задачам)
+void nbYield();
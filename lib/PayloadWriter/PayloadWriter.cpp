@@ -0,0 +1,273 @@
+#include "PayloadWriter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// MessagePack: массив всегда array16 - число элементов известно только в
+// finish(), место под заголовок резервируется заранее
+#define MSGPACK_ARRAY16_HEADER 3
+
+PayloadWriter::PayloadWriter(PayloadFormat format, uint8_t* buf, size_t capacity)
+    : _format(format), _buf(buf), _capacity(capacity) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _len = MSGPACK_ARRAY16_HEADER;
+    _overflow = _capacity < MSGPACK_ARRAY16_HEADER;
+  } else if (_format == PAYLOAD_SCHEMA) {
+    char head[40];
+    snprintf(head, sizeof(head), "{\"version\":%d,\"fields\":[", PAYLOAD_SCHEMA_VERSION);
+    putText(head);
+  } else {
+    put('{');
+  }
+}
+
+void PayloadWriter::put(uint8_t b) {
+  if (_len < _capacity) {
+    _buf[_len++] = b;
+  } else {
+    _overflow = true;
+  }
+}
+
+void PayloadWriter::put(const void* data, size_t len) {
+  if (_len + len <= _capacity) {
+    memcpy(_buf + _len, data, len);
+    _len += len;
+  } else {
+    _overflow = true;
+  }
+}
+
+void PayloadWriter::putText(const char* s) {
+  put(s, strlen(s));
+}
+
+void PayloadWriter::putJsonString(const char* s) {
+  put('"');
+  const char* run = s;  // Начало участка без экранирования
+  for (; *s; s++) {
+    uint8_t c = (uint8_t)*s;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;  // UTF-8 и обычные символы - как есть
+    }
+    put(run, s - run);
+    char esc[8];
+    if (c == '"' || c == '\\') {
+      esc[0] = '\\';
+      esc[1] = (char)c;
+      esc[2] = '\0';
+    } else {
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+    }
+    putText(esc);
+    run = s + 1;
+  }
+  put(run, s - run);
+  put('"');
+}
+
+// Ключ объекта JSON или элемент списка полей схемы
+void PayloadWriter::beginJsonField(const char* key) {
+  if (_fields > 0) {
+    put(',');
+  }
+  _fields++;
+  if (_format == PAYLOAD_JSON) {
+    putJsonString(key);
+    put(':');
+  }
+}
+
+void PayloadWriter::putMsgpackInt(int64_t value) {
+  uint8_t b[9];
+  if (value >= 0) {
+    uint64_t v = (uint64_t)value;
+    if (v < 0x80) {
+      put((uint8_t)v);  // positive fixint
+    } else if (v <= 0xFF) {
+      b[0] = 0xcc; b[1] = (uint8_t)v;
+      put(b, 2);
+    } else if (v <= 0xFFFF) {
+      b[0] = 0xcd; b[1] = (uint8_t)(v >> 8); b[2] = (uint8_t)v;
+      put(b, 3);
+    } else {
+      b[0] = 0xce; b[1] = (uint8_t)(v >> 24); b[2] = (uint8_t)(v >> 16); b[3] = (uint8_t)(v >> 8); b[4] = (uint8_t)v;
+      put(b, 5);
+    }
+  } else if (value >= -32) {
+    put((uint8_t)(int8_t)value);  // negative fixint
+  } else if (value >= -128) {
+    b[0] = 0xd0; b[1] = (uint8_t)(int8_t)value;
+    put(b, 2);
+  } else if (value >= -32768) {
+    uint16_t v = (uint16_t)(int16_t)value;
+    b[0] = 0xd1; b[1] = (uint8_t)(v >> 8); b[2] = (uint8_t)v;
+    put(b, 3);
+  } else {
+    uint32_t v = (uint32_t)(int32_t)value;
+    b[0] = 0xd2; b[1] = (uint8_t)(v >> 24); b[2] = (uint8_t)(v >> 16); b[3] = (uint8_t)(v >> 8); b[4] = (uint8_t)v;
+    put(b, 5);
+  }
+}
+
+void PayloadWriter::putMsgpackString(const char* s) {
+  size_t len = strlen(s);
+  uint8_t b[3];
+  if (len < 32) {
+    put((uint8_t)(0xa0 | len));  // fixstr
+  } else if (len <= 0xFF) {
+    b[0] = 0xd9; b[1] = (uint8_t)len;
+    put(b, 2);
+  } else {
+    b[0] = 0xda; b[1] = (uint8_t)(len >> 8); b[2] = (uint8_t)len;
+    put(b, 3);
+  }
+  put(s, len);
+}
+
+void PayloadWriter::addFloat(const char* key, float value, uint8_t decimals) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _fields++;
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t b[5] = {0xca, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits};
+    put(b, sizeof(b));
+    return;
+  }
+  beginJsonField(key);
+  if (_format == PAYLOAD_SCHEMA) {
+    putJsonString(key);
+  } else if (isnan(value) || isinf(value)) {
+    putText("null");
+  } else {
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%.*f", decimals, value);
+    // Лишние нули дробной части отбрасываются, как в ArduinoJson: 60.0000 -> 60
+    if (n > 0 && n < (int)sizeof(num) && strchr(num, '.') != nullptr) {
+      while (num[n - 1] == '0') {
+        n--;
+      }
+      if (num[n - 1] == '.') {
+        n--;
+      }
+    }
+    put(num, n > 0 ? (size_t)n : 0);
+  }
+}
+
+void PayloadWriter::addInt(const char* key, int32_t value) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _fields++;
+    putMsgpackInt(value);
+    return;
+  }
+  beginJsonField(key);
+  if (_format == PAYLOAD_SCHEMA) {
+    putJsonString(key);
+  } else {
+    char num[12];
+    snprintf(num, sizeof(num), "%ld", (long)value);
+    putText(num);
+  }
+}
+
+void PayloadWriter::addUInt(const char* key, uint32_t value) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _fields++;
+    putMsgpackInt(value);
+    return;
+  }
+  beginJsonField(key);
+  if (_format == PAYLOAD_SCHEMA) {
+    putJsonString(key);
+  } else {
+    char num[12];
+    snprintf(num, sizeof(num), "%lu", (unsigned long)value);
+    putText(num);
+  }
+}
+
+void PayloadWriter::addBool(const char* key, bool value) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _fields++;
+    put((uint8_t)(value ? 0xc3 : 0xc2));
+    return;
+  }
+  beginJsonField(key);
+  if (_format == PAYLOAD_SCHEMA) {
+    putJsonString(key);
+  } else {
+    putText(value ? "true" : "false");
+  }
+}
+
+void PayloadWriter::addString(const char* key, const char* value) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _fields++;
+    putMsgpackString(value);
+    return;
+  }
+  beginJsonField(key);
+  putJsonString(_format == PAYLOAD_SCHEMA ? key : value);
+}
+
+void PayloadWriter::addEnum(const char* key, uint8_t index, const char* const* names, uint8_t count, size_t stride) {
+  if (_format == PAYLOAD_MSGPACK) {
+    _fields++;
+    if (index < count) {
+      putMsgpackInt(index);
+    } else {
+      put((uint8_t)0xc0);  // nil
+    }
+    return;
+  }
+  beginJsonField(key);
+  if (_format == PAYLOAD_JSON) {
+    if (index < count) {
+      putJsonString(*(const char* const*)((const uint8_t*)names + index * stride));
+    } else {
+      putText("\"\"");
+    }
+    return;
+  }
+  putText("{\"name\":");
+  putJsonString(key);
+  putText(",\"values\":[");
+  for (uint8_t i = 0; i < count; i++) {
+    if (i > 0) {
+      put(',');
+    }
+    putJsonString(*(const char* const*)((const uint8_t*)names + i * stride));
+  }
+  putText("]}");
+}
+
+void PayloadWriter::addStatic(const char* key, const char* value) {
+  if (_format == PAYLOAD_MSGPACK) {
+    return;
+  }
+  beginJsonField(key);
+  if (_format == PAYLOAD_JSON) {
+    putJsonString(value);
+    return;
+  }
+  putText("{\"name\":");
+  putJsonString(key);
+  putText(",\"value\":");
+  putJsonString(value);
+  put('}');
+}
+
+size_t PayloadWriter::finish() {
+  if (_format == PAYLOAD_MSGPACK) {
+    if (!_overflow) {
+      _buf[0] = 0xdc;
+      _buf[1] = (uint8_t)(_fields >> 8);
+      _buf[2] = (uint8_t)_fields;
+    }
+  } else {
+    putText(_format == PAYLOAD_SCHEMA ? "]}" : "}");
+  }
+  return _overflow ? 0 : _len;
+}
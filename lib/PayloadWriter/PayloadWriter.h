@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Сериализация MQTT-сообщения в заранее выделенный буфер, без кучи.
+// Одна и та же функция заполнения дает три результата:
+//  - JSON: объект с именами полей (формат по умолчанию);
+//  - MessagePack: массив значений в порядке полей, без имен;
+//    перечисления - номером, неизменные строки (SSID, IP) не передаются;
+//  - схему: JSON со списком полей, значениями перечислений и неизменными
+//    строками - словарь для разбора MessagePack на стороне получателя.
+// Схема и сообщения строятся одним кодом, поэтому не расходятся.
+//
+// Формат схемы:
+//   {"version":1,"fields":["supplyTemp",{"name":"state","values":["idle",...]},
+//    {"name":"wifiSSID","value":"home"},...]}
+// Строка - позиционное поле, объект с values - перечисление (в массиве
+// номер, nil - нет значения), объект с value - неизменное поле (в массиве
+// его нет).
+
+enum PayloadFormat : uint8_t {
+  PAYLOAD_JSON = 0,
+  PAYLOAD_MSGPACK = 1,
+  PAYLOAD_SCHEMA = 2  // Словарь для PAYLOAD_MSGPACK
+};
+
+#define PAYLOAD_SCHEMA_VERSION 1
+
+class PayloadWriter {
+ public:
+  PayloadWriter(PayloadFormat format, uint8_t* buf, size_t capacity);
+
+  // JSON: не больше decimals знаков после точки, NaN - null; MessagePack: float32
+  void addFloat(const char* key, float value, uint8_t decimals = 4);
+  void addInt(const char* key, int32_t value);
+  void addUInt(const char* key, uint32_t value);
+  void addBool(const char* key, bool value);
+  void addString(const char* key, const char* value);
+  // names - первое имя, stride - шаг до следующего (имена внутри массива
+  // структур); index >= count - нет значения ("" в JSON, nil в MessagePack)
+  void addEnum(const char* key, uint8_t index, const char* const* names, uint8_t count,
+               size_t stride = sizeof(const char*));
+  // Строка, которая между сообщениями не меняется: в MessagePack - только в схеме
+  void addStatic(const char* key, const char* value);
+
+  // Длина результата; 0 - не влезло в буфер
+  size_t finish();
+  uint16_t fieldCount() const { return _fields; }
+
+ private:
+  void put(uint8_t b);
+  void put(const void* data, size_t len);
+  void putText(const char* s);
+  void putJsonString(const char* s);
+  void beginJsonField(const char* key);
+  void putMsgpackInt(int64_t value);
+  void putMsgpackString(const char* s);
+
+  PayloadFormat _format;
+  uint8_t* _buf;
+  size_t _capacity;
+  size_t _len = 0;
+  uint16_t _fields = 0;  // Записано полей (для MessagePack - элементов массива)
+  bool _overflow = false;
+};
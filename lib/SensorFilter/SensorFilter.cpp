@@ -0,0 +1,131 @@
+#include "SensorFilter.h"
+
+void SensorFilter::begin(const SensorFilterConfig& config) {
+  _config = config;
+  if (_config.medianWindow < 1) _config.medianWindow = 1;
+  if (_config.medianWindow > SENSOR_FILTER_MAX_MEDIAN) _config.medianWindow = SENSOR_FILTER_MAX_MEDIAN;
+  if (_config.medianWindow % 2 == 0) _config.medianWindow--;  // Только нечетное окно
+  if (_config.emaAlpha <= 0.0 || _config.emaAlpha > 1.0) _config.emaAlpha = 1.0;
+  reset();
+}
+
+void SensorFilter::reset() {
+  _windowIndex = 0;
+  _windowCount = 0;
+  _hasOutput = false;
+  _limited = 0.0;
+  _output = 0.0;
+  _kalmanP = 1.0;
+  _lastMs = 0;
+}
+
+float SensorFilter::median() const {
+  float sorted[SENSOR_FILTER_MAX_MEDIAN];
+  uint8_t n = _windowCount;
+  for (uint8_t i = 0; i < n; i++) {
+    sorted[i] = _window[i];
+  }
+  // Сортировка вставками - окно не больше 7 значений
+  for (uint8_t i = 1; i < n; i++) {
+    float v = sorted[i];
+    int j = i - 1;
+    while (j >= 0 && sorted[j] > v) {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = v;
+  }
+  return sorted[n / 2];
+}
+
+SensorFilterResult SensorFilter::process(float raw, uint32_t nowMs) {
+  // 1. Шлюз диапазона и значений зависания DS18B20
+  if (raw < _config.minValid || raw > _config.maxValid) {
+    rejectedCount++;
+    return FILTER_REJECTED_RANGE;
+  }
+  if ((_config.rejectZero && raw > -0.1 && raw < 0.1) ||
+      (_config.rejectPowerOn && raw > 84.9 && raw < 85.1)) {
+    rejectedCount++;
+    return FILTER_REJECTED_STUCK;
+  }
+
+  // 2. Медиана последних N принятых показаний (убирает одиночные выбросы)
+  _window[_windowIndex] = raw;
+  _windowIndex = (_windowIndex + 1) % _config.medianWindow;
+  if (_windowCount < _config.medianWindow) _windowCount++;
+  float candidate = (_windowCount > 1) ? median() : raw;
+
+  // Первое значение принимаем без ограничений
+  if (!_hasOutput) {
+    _limited = candidate;
+    _output = candidate;
+    _kalmanP = _config.kalmanR;
+    _hasOutput = true;
+    _lastMs = nowMs;
+    acceptedCount++;
+    return FILTER_ACCEPTED;
+  }
+
+  // 3. Ограничение скорости: вместо отбрасывания скачка подтягиваемся к нему
+  float dt = (nowMs - _lastMs) / 1000.0;  // Беззнаковая разность корректна при переполнении
+  _lastMs = nowMs;
+  if (_config.maxRate > 0.0 && dt > 0.0) {
+    float maxDelta = _config.maxRate * dt;
+    if (candidate > _limited + maxDelta) {
+      candidate = _limited + maxDelta;
+      rateLimitedCount++;
+    } else if (candidate < _limited - maxDelta) {
+      candidate = _limited - maxDelta;
+      rateLimitedCount++;
+    }
+  }
+  _limited = candidate;
+
+  // 4. Сглаживание
+  if (_config.smoother == SMOOTHER_EMA) {
+    _output += _config.emaAlpha * (candidate - _output);
+  } else if (_config.smoother == SMOOTHER_KALMAN) {
+    _kalmanP += _config.kalmanQ;
+    float gain = _kalmanP / (_kalmanP + _config.kalmanR);
+    _output += gain * (candidate - _output);
+    _kalmanP *= (1.0 - gain);
+  } else {
+    _output = candidate;
+  }
+
+  acceptedCount++;
+  return FILTER_ACCEPTED;
+}
+
+const char* const SENSOR_CHANNEL_NAMES[SENSOR_CHANNEL_COUNT] = {"supply", "return", "boiler", "outside", "home"};
+
+SensorFilterConfig defaultSensorFilterConfig(int channel) {
+  SensorFilterConfig config;
+  switch (channel) {
+    case SENSOR_SUPPLY:
+      config.maxRate = 1.0;  // Подача меняется быстро, без сглаживания ради реакции вентилятора
+      break;
+    case SENSOR_RETURN:
+      config.maxRate = 2.0;  // Обратка часто "отваливается" - даем быстрее догнать
+      break;
+    case SENSOR_BOILER:
+      config.maxRate = 0.5;
+      config.smoother = SMOOTHER_EMA;
+      break;
+    case SENSOR_OUTDOOR:
+      config.rejectZero = false;  // 0°C на улице - валидное значение
+      config.maxRate = 0.2;
+      config.smoother = SMOOTHER_EMA;
+      break;
+    case SENSOR_HOME:
+      config.minValid = -50.0;
+      config.maxValid = 50.0;
+      config.rejectZero = false;
+      config.rejectPowerOn = false;
+      config.medianWindow = 1;  // Данные приходят с ESP01 редко, медиана только задержит
+      config.maxRate = 0.0;
+      break;
+  }
+  return config;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+// Цепочка фильтров для одного канала температуры:
+// диапазон -> медиана N -> ограничение скорости -> сглаживание (EMA или Калман).
+// Не зависит от Arduino, поэтому одинаково собирается на ESP32 и на хосте.
+
+#define SENSOR_FILTER_MAX_MEDIAN 7
+
+enum SensorSmoother : uint8_t {
+  SMOOTHER_NONE = 0,
+  SMOOTHER_EMA = 1,
+  SMOOTHER_KALMAN = 2
+};
+
+// Результат обработки одного сырого показания
+enum SensorFilterResult : uint8_t {
+  FILTER_ACCEPTED = 0,      // Показание принято, выход обновлен
+  FILTER_REJECTED_RANGE,    // Вне допустимого диапазона
+  FILTER_REJECTED_STUCK     // Значение зависания DS18B20 (0 или 85°C)
+};
+
+struct SensorFilterConfig {
+  // Шлюз диапазона
+  float minValid = -50.0;
+  float maxValid = 150.0;
+  bool rejectZero = true;     // 0.0°C считается зависанием (кроме улицы)
+  bool rejectPowerOn = true;  // 85.0°C - значение DS18B20 после сброса питания
+  // Медиана последних N показаний (1 = выключено, только нечетные до 7)
+  uint8_t medianWindow = 3;
+  // Ограничение скорости изменения выхода, °C/с (0 = выключено)
+  float maxRate = 1.0;
+  // Сглаживание
+  uint8_t smoother = SMOOTHER_NONE;
+  float emaAlpha = 0.3;       // Вес нового значения для EMA (0..1]
+  float kalmanQ = 0.01;       // Шум процесса (°C² за шаг)
+  float kalmanR = 0.25;       // Шум измерения (°C²)
+};
+
+class SensorFilter {
+ public:
+  void begin(const SensorFilterConfig& config);
+  void reset();
+
+  SensorFilterResult process(float raw, uint32_t nowMs);
+
+  bool hasValue() const { return _hasOutput; }
+  float value() const { return _output; }
+  const SensorFilterConfig& config() const { return _config; }
+
+  // Счетчики для диагностики
+  uint32_t acceptedCount = 0;
+  uint32_t rejectedCount = 0;
+  uint32_t rateLimitedCount = 0;
+
+ private:
+  float median() const;
+
+  SensorFilterConfig _config;
+  float _window[SENSOR_FILTER_MAX_MEDIAN] = {0};
+  uint8_t _windowIndex = 0;
+  uint8_t _windowCount = 0;
+  bool _hasOutput = false;
+  float _limited = 0.0;       // Выход ограничителя скорости
+  float _output = 0.0;        // Выход сглаживателя
+  float _kalmanP = 1.0;       // Ковариация ошибки оценки Калмана
+  uint32_t _lastMs = 0;
+};
+
+// Каналы фильтрации показаний прошивки (порядок совпадает с ключами API)
+enum SensorChannel {
+  SENSOR_SUPPLY = 0,
+  SENSOR_RETURN,
+  SENSOR_BOILER,
+  SENSOR_OUTDOOR,
+  SENSOR_HOME,
+  SENSOR_CHANNEL_COUNT
+};
+extern const char* const SENSOR_CHANNEL_NAMES[SENSOR_CHANNEL_COUNT];
+
+// Настройки фильтров по умолчанию для каждого канала
+SensorFilterConfig defaultSensorFilterConfig(int channel);
@@ -0,0 +1,84 @@
+#include "TimeService.h"
+
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+
+// Время до синхронизации - 1970 год; все, что раньше 2020, считаем неустановленным
+#define TIME_SERVICE_VALID_EPOCH 1577836800
+
+TimeService* TimeService::_instance = nullptr;
+
+uint64_t uptimeMillis() {
+  return (uint64_t)esp_timer_get_time() / 1000;
+}
+
+void TimeService::onSync(struct timeval* tv) {
+  if (_instance == nullptr) {
+    return;
+  }
+  _instance->_synced = true;
+  _instance->_syncCount++;
+  _instance->_lastSyncEpoch = tv != nullptr ? tv->tv_sec : time(nullptr);
+}
+
+void TimeService::begin(const char* server, int timezoneHours, uint32_t syncIntervalSec) {
+  stop();
+  _instance = this;
+
+  // POSIX TZ: знак обратный, UTC+3 записывается как "UTC-3"
+  char tz[16];
+  snprintf(tz, sizeof(tz), "UTC%+d", -timezoneHours);
+  setenv("TZ", tz, 1);
+  tzset();
+
+  strncpy(_server, server, sizeof(_server) - 1);
+  _server[sizeof(_server) - 1] = '\0';
+
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, _server);
+  sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);  // Плавная подстройка через adjtime()
+  // Минимальный интервал SNTP - 15 с
+  uint32_t intervalMs = syncIntervalSec < 15 ? 15000 : syncIntervalSec * 1000;
+  sntp_set_sync_interval(intervalMs);
+  sntp_set_time_sync_notification_cb(onSync);
+  sntp_init();
+  _running = true;
+
+  // Время могло сохраниться с прошлой синхронизации (программный сброс)
+  if (time(nullptr) >= TIME_SERVICE_VALID_EPOCH) {
+    _synced = true;
+  }
+  _epoch = 0;
+  loop();
+}
+
+void TimeService::stop() {
+  if (_running) {
+    sntp_stop();
+    _running = false;
+  }
+  _synced = false;
+  _epoch = 0;
+  strcpy(_timeStr, "--:--:--");
+  strcpy(_dateStr, "--.--.----");
+  strcpy(_dateTimeStr, "N/A");
+}
+
+void TimeService::loop() {
+  if (!_synced) {
+    return;
+  }
+  time_t now = time(nullptr);
+  if (now != _epoch && now >= TIME_SERVICE_VALID_EPOCH) {
+    refresh(now);
+  }
+}
+
+void TimeService::refresh(time_t now) {
+  _epoch = now;
+  localtime_r(&now, &_tm);
+  snprintf(_timeStr, sizeof(_timeStr), "%02d:%02d:%02d", _tm.tm_hour, _tm.tm_min, _tm.tm_sec);
+  snprintf(_dateStr, sizeof(_dateStr), "%02d.%02d.%04d", _tm.tm_mday, _tm.tm_mon + 1, _tm.tm_year + 1900);
+  strftime(_dateTimeStr, sizeof(_dateTimeStr), "%Y-%m-%d %H:%M:%S", &_tm);
+}
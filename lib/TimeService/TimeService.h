@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+// Служба времени на SNTP-клиенте ESP-IDF. Синхронизация идет в фоне (задача
+// lwIP), поправки вносятся плавно (SNTP_SYNC_MODE_SMOOTH) - время не прыгает.
+// Разбор локального времени и строки считаются раз в секунду в loop(),
+// потребители (дисплей, MQTT, API, журналы) берут готовое.
+
+// Монотонные миллисекунды с загрузки (esp_timer, 64 бита - не переполняется)
+uint64_t uptimeMillis();
+
+class TimeService {
+ public:
+  // timezoneHours: смещение от UTC в часах (3 = UTC+3)
+  void begin(const char* server, int timezoneHours, uint32_t syncIntervalSec);
+  void stop();
+
+  // Обновление кэша на границе секунды (дешево, если секунда не сменилась)
+  void loop();
+
+  bool isSynced() const { return _synced; }
+  time_t epoch() const { return _epoch; }        // UTC, 0 - время не установлено
+  const struct tm& local() const { return _tm; }
+
+  // Строки для вывода; до синхронизации - прочерки
+  const char* timeString() const { return _timeStr; }          // 14:05:09
+  const char* dateString() const { return _dateStr; }          // 21.01.2025
+  const char* dateTimeString() const { return _dateTimeStr; }  // 2025-01-21 14:05:09
+
+  uint32_t syncCount() const { return _syncCount; }
+  time_t lastSyncEpoch() const { return _lastSyncEpoch; }
+
+ private:
+  static void onSync(struct timeval* tv);
+  static TimeService* _instance;  // Для callback SNTP
+  void refresh(time_t now);
+
+  char _server[64] = {0};  // SNTP хранит указатель - строка должна жить все время
+  bool _running = false;
+  volatile bool _synced = false;
+  volatile uint32_t _syncCount = 0;
+  volatile time_t _lastSyncEpoch = 0;
+  time_t _epoch = 0;
+  struct tm _tm = {};
+  char _timeStr[9] = "--:--:--";
+  char _dateStr[11] = "--.--.----";
+  char _dateTimeStr[20] = "N/A";
+};
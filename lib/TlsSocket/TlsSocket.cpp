@@ -0,0 +1,278 @@
+#include "TlsSocket.h"
+
+#include <errno.h>
+#include <string.h>
+#include <lwip/sockets.h>
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/version.h>
+
+static const char TLS_SOCKET_PERS[] = "esp32-kotel-mqtt";
+
+// Поля сессии в mbedTLS 3 закрыты (MBEDTLS_PRIVATE)
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define TLS_SESSION_FIELD(session, field) (session).MBEDTLS_PRIVATE(field)
+#else
+#define TLS_SESSION_FIELD(session, field) (session).field
+#endif
+
+// Операцию нужно повторить позже: нет данных, окно занято или (TLS 1.3)
+// пришел билет сессии вместо данных приложения
+static bool tlsRetryLater(int ret) {
+  return ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+         || ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+#endif
+      ;
+}
+
+// Транспорт mbedTLS: неблокирующий сокет, "нет данных" - WANT_READ/WANT_WRITE
+int TlsSocketClient::sendCallback(void* ctx, const unsigned char* buf, size_t len) {
+  int fd = *(int*)ctx;
+  int sent = lwip_send(fd, buf, len, MSG_DONTWAIT);
+  if (sent >= 0) {
+    return sent;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+  return (errno == EPIPE || errno == ECONNRESET) ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int TlsSocketClient::recvCallback(void* ctx, unsigned char* buf, size_t len) {
+  int fd = *(int*)ctx;
+  int received = lwip_recv(fd, buf, len, MSG_DONTWAIT);
+  if (received >= 0) {
+    return received;  // 0 - сервер закрыл соединение
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return MBEDTLS_ERR_SSL_WANT_READ;
+  }
+  return errno == ECONNRESET ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+bool TlsSocketClient::begin(int fd, const char* host) {
+  stop();
+  _fd = fd;
+  _lastError = 0;
+  _active = true;
+  mbedtls_ssl_init(&_ssl);
+  mbedtls_ssl_config_init(&_conf);
+  mbedtls_ctr_drbg_init(&_drbg);
+  mbedtls_entropy_init(&_entropy);
+
+  int ret = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy,
+                                  (const unsigned char*)TLS_SOCKET_PERS, sizeof(TLS_SOCKET_PERS) - 1);
+  if (ret == 0) {
+    ret = mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+  }
+  if (ret == 0) {
+    mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+    ret = mbedtls_ssl_setup(&_ssl, &_conf);
+  }
+  if (ret == 0) {
+    ret = mbedtls_ssl_set_hostname(&_ssl, host);
+  }
+  if (ret != 0) {
+    fail(ret);
+    return false;
+  }
+  mbedtls_ssl_set_bio(&_ssl, &_fd, sendCallback, recvCallback, nullptr);
+
+  // Сессия прошлого подключения к тому же серверу - в ClientHello
+  _resumed = false;
+  _sessionOffered = false;
+  if (_sessionSaved && strncmp(_sessionHost, host, sizeof(_sessionHost)) == 0) {
+    _sessionOffered = mbedtls_ssl_set_session(&_ssl, &_session) == 0;
+  }
+  if (!_sessionOffered) {
+    clearSession();
+  }
+  return true;
+}
+
+void TlsSocketClient::clearSession() {
+  mbedtls_ssl_session_free(&_session);
+  mbedtls_ssl_session_init(&_session);
+  _sessionSaved = false;
+  _sessionHost[0] = '\0';
+}
+
+// Рукопожатие закончено: сервер вернул предложенный session ID - сессия
+// возобновлена (для билета ID тоже задает клиент). Новая сессия заменяет старую
+void TlsSocketClient::saveSession() {
+  mbedtls_ssl_session fresh;
+  mbedtls_ssl_session_init(&fresh);
+  if (mbedtls_ssl_get_session(&_ssl, &fresh) != 0) {
+    mbedtls_ssl_session_free(&fresh);
+    clearSession();
+    return;
+  }
+  size_t idLen = TLS_SESSION_FIELD(fresh, id_len);
+  _resumed = _sessionOffered && idLen > 0 && idLen == TLS_SESSION_FIELD(_session, id_len) &&
+             memcmp(TLS_SESSION_FIELD(fresh, id), TLS_SESSION_FIELD(_session, id), idLen) == 0;
+  mbedtls_ssl_session_free(&_session);
+  _session = fresh;  // Буферы (сертификат, билет) переходят к _session
+  _sessionSaved = true;
+  _sessionOffered = false;
+}
+
+TlsHandshakeResult TlsSocketClient::handshakeStep() {
+  if (!_active) {
+    return TLS_HANDSHAKE_FAILED;
+  }
+  if (_handshakeDone) {
+    return TLS_HANDSHAKE_DONE;
+  }
+  int ret = mbedtls_ssl_handshake_step(&_ssl);
+  if (tlsRetryLater(ret)) {
+    return TLS_HANDSHAKE_PENDING;
+  }
+  if (ret != 0) {
+    // Сервер мог отвергнуть предложенную сессию - следующая попытка полная
+    clearSession();
+    fail(ret);
+    return TLS_HANDSHAKE_FAILED;
+  }
+#if MBEDTLS_VERSION_NUMBER >= 0x03020000
+  _handshakeDone = mbedtls_ssl_is_handshake_over(&_ssl);
+#elif MBEDTLS_VERSION_NUMBER >= 0x03000000
+  _handshakeDone = _ssl.MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HANDSHAKE_OVER;
+#else
+  _handshakeDone = _ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER;
+#endif
+  if (!_handshakeDone) {
+    return TLS_HANDSHAKE_PENDING;
+  }
+  saveSession();
+  if (_resumed) {
+    resumedHandshakes++;
+  } else {
+    fullHandshakes++;
+  }
+  return TLS_HANDSHAKE_DONE;
+}
+
+int TlsSocketClient::lastError(char* buf, size_t size) const {
+  if (size > 0) {
+    buf[0] = '\0';
+    if (_lastError != 0) {
+      mbedtls_strerror(_lastError, buf, size);
+    }
+  }
+  return _lastError;
+}
+
+// Ошибка mbedTLS или транспорта: соединение закрывается, код сохраняется
+void TlsSocketClient::fail(int error) {
+  stop();
+  _lastError = error;
+}
+
+size_t TlsSocketClient::write(const uint8_t* buf, size_t size) {
+  if (!connected()) {
+    return 0;
+  }
+  size_t written = 0;
+  unsigned long start = millis();
+  while (written < size) {
+    int ret = mbedtls_ssl_write(&_ssl, buf + written, size - written);
+    if (ret > 0) {
+      written += ret;
+      continue;
+    }
+    if (!tlsRetryLater(ret)) {
+      fail(ret);
+      break;
+    }
+    // Окно отправки заполнено: ждем его освобождения, но не дольше таймаута
+    unsigned long elapsed = millis() - start;
+    if (elapsed >= TLS_SOCKET_WRITE_TIMEOUT_MS) {
+      break;
+    }
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(_fd, &writeSet);
+    unsigned long left = TLS_SOCKET_WRITE_TIMEOUT_MS - elapsed;
+    struct timeval tv = {(long)(left / 1000), (long)(left % 1000) * 1000};
+    lwip_select(_fd + 1, NULL, &writeSet, NULL, &tv);
+  }
+  return written;
+}
+
+int TlsSocketClient::available() {
+  if (!connected()) {
+    return 0;
+  }
+  int pending = _peeked >= 0 ? 1 : 0;
+  // Чтение нулевой длины разбирает пришедшую запись TLS в буфер mbedTLS
+  int ret = mbedtls_ssl_read(&_ssl, nullptr, 0);
+  if (ret < 0 && !tlsRetryLater(ret)) {
+    fail(ret);
+    return pending;
+  }
+  return pending + (int)mbedtls_ssl_get_bytes_avail(&_ssl);
+}
+
+int TlsSocketClient::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsSocketClient::read(uint8_t* buf, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  int offset = 0;
+  if (_peeked >= 0) {
+    buf[0] = (uint8_t)_peeked;
+    _peeked = -1;
+    if (size == 1) {
+      return 1;
+    }
+    offset = 1;
+  }
+  if (!connected()) {
+    return offset > 0 ? offset : -1;
+  }
+  int ret = mbedtls_ssl_read(&_ssl, buf + offset, size - offset);
+  if (ret > 0) {
+    return offset + ret;
+  }
+  if (!tlsRetryLater(ret)) {
+    fail(ret);  // 0 - сервер закрыл соединение
+  }
+  return offset > 0 ? offset : -1;
+}
+
+int TlsSocketClient::peek() {
+  if (_peeked < 0 && available() > 0) {
+    _peeked = read();
+  }
+  return _peeked;
+}
+
+void TlsSocketClient::stop() {
+  if (_active) {
+    if (_handshakeDone) {
+      mbedtls_ssl_close_notify(&_ssl);  // Без ожидания: неблокирующий сокет
+    }
+    mbedtls_ssl_free(&_ssl);
+    mbedtls_ssl_config_free(&_conf);
+    mbedtls_ctr_drbg_free(&_drbg);
+    mbedtls_entropy_free(&_entropy);
+    _active = false;
+  }
+  if (_fd >= 0) {
+    lwip_close(_fd);
+    _fd = -1;
+  }
+  _handshakeDone = false;
+  _peeked = -1;
+}
+
+uint8_t TlsSocketClient::connected() {
+  return _active && _handshakeDone && _fd >= 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+
+// TLS-клиент поверх уже открытого неблокирующего сокета lwip.
+// WiFiClientSecure умеет только сам открыть соединение и провести
+// рукопожатие целиком (блокируя вызывающего); здесь сокет приходит от
+// автомата подключения, а рукопожатие идет по одному шагу mbedTLS за вызов
+// handshakeStep() - ожидание ответа сервера loop() не задерживает.
+// Длинными остаются только шаги с вычислениями (ECDHE, проверка подписи),
+// каждый в своем проходе loop().
+//
+// Сертификат сервера не проверяется (как setInsecure() у WiFiClientSecure).
+// После рукопожатия - обычный Client для PubSubClient.
+//
+// Сессия удачного рукопожатия сохраняется (session ID или билет сервера) и
+// предлагается при следующем begin() с тем же host: сервер, который ее
+// принял, обходится без обмена ключами - переподключение без ECDHE и
+// проверки подписи. Неудачное рукопожатие сессию сбрасывает.
+
+#define TLS_SOCKET_WRITE_TIMEOUT_MS 1000  // Ожидание окна отправки в write()
+#define TLS_SOCKET_HOST_MAX 64  // Длина host, для которого хранится сессия
+
+enum TlsHandshakeResult : uint8_t {
+  TLS_HANDSHAKE_PENDING = 0,  // Ждем данных от сервера или следующего шага
+  TLS_HANDSHAKE_DONE,
+  TLS_HANDSHAKE_FAILED        // Сокет закрыт, причина - lastError()
+};
+
+class TlsSocketClient : public Client {
+ public:
+  TlsSocketClient() { mbedtls_ssl_session_init(&_session); }
+  ~TlsSocketClient() override {
+    stop();
+    clearSession();
+  }
+
+  // Принимает сокет с установленным TCP (закрывается в stop() и при ошибке);
+  // host - имя для SNI. false - не хватило памяти под контексты mbedTLS
+  bool begin(int fd, const char* host);
+  TlsHandshakeResult handshakeStep();
+  bool handshakeDone() const { return _handshakeDone; }
+  // Последнее рукопожатие возобновило сохраненную сессию
+  bool resumed() const { return _resumed; }
+  // Забыть сессию: следующее рукопожатие - полное
+  void clearSession();
+
+  // Счетчики для диагностики
+  uint32_t fullHandshakes = 0;
+  uint32_t resumedHandshakes = 0;
+
+  int fd() const { return _fd; }
+  int lastError(char* buf, size_t size) const;
+
+  // Соединение открывает автомат подключения, не клиент
+  int connect(IPAddress, uint16_t) override { return 0; }
+  int connect(const char*, uint16_t) override { return 0; }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+ private:
+  static int sendCallback(void* ctx, const unsigned char* buf, size_t len);
+  static int recvCallback(void* ctx, unsigned char* buf, size_t len);
+  void fail(int error);
+  void saveSession();
+
+  int _fd = -1;
+  bool _active = false;  // Контексты mbedTLS инициализированы
+  bool _handshakeDone = false;
+  int _lastError = 0;
+  int _peeked = -1;  // Байт, прочитанный peek()
+  bool _resumed = false;
+  bool _sessionSaved = false;  // _session заполнена удачным рукопожатием с _sessionHost
+  bool _sessionOffered = false;  // _session предложена серверу в текущем рукопожатии
+  char _sessionHost[TLS_SOCKET_HOST_MAX + 1] = "";
+  mbedtls_ssl_session _session;
+  mbedtls_ssl_context _ssl;
+  mbedtls_ssl_config _conf;
+  mbedtls_ctr_drbg_context _drbg;
+  mbedtls_entropy_context _entropy;
+};
@@ -0,0 +1,50 @@
+#include "TraceFormat.h"
+
+#include <string.h>
+
+TraceChunker::TraceChunker(TraceType type, const uint8_t* head, size_t headLen, const uint8_t* tail, size_t tailLen)
+    : _type(type), _head(head), _headLen(headLen), _tail(tail), _tailLen(tailLen) {
+  if (_headLen > TRACE_MAX_DATA) {
+    _headLen = TRACE_MAX_DATA;
+  }
+  if (_tailLen > TRACE_MAX_DATA - _headLen) {
+    _tailLen = TRACE_MAX_DATA - _headLen;
+  }
+}
+
+size_t TraceChunker::next(uint8_t* out, uint32_t ms) {
+  size_t total = _headLen + _tailLen;
+  // Пустые данные - одна запись без данных (например, TRACE_BOOT без версии)
+  if (_started && _pos >= total) {
+    return 0;
+  }
+  size_t len = total - _pos;
+  if (len > TRACE_MAX_PAYLOAD) {
+    len = TRACE_MAX_PAYLOAD;
+  }
+  memcpy(out, &ms, 4);
+  out[4] = _started ? TRACE_CONTINUATION : _type;
+  out[5] = (uint8_t)len;
+  uint8_t* p = out + TRACE_RECORD_HEADER;
+  for (size_t i = 0; i < len; i++, _pos++) {
+    p[i] = _pos < _headLen ? _head[_pos] : _tail[_pos - _headLen];
+  }
+  _started = true;
+  return TRACE_RECORD_HEADER + len;
+}
+
+bool traceDecodeRecord(const uint8_t* buf, size_t size, size_t& pos, TraceRecord& record) {
+  if (pos + TRACE_RECORD_HEADER > size) {
+    return false;
+  }
+  memcpy(&record.ms, buf + pos, 4);
+  record.type = buf[pos + 4];
+  record.length = buf[pos + 5];
+  if (record.type < TRACE_BOOT || record.type > TRACE_CONTINUATION ||
+      pos + TRACE_RECORD_HEADER + record.length > size) {
+    return false;
+  }
+  record.data = buf + pos + TRACE_RECORD_HEADER;
+  pos += TRACE_RECORD_HEADER + record.length;
+  return true;
+}
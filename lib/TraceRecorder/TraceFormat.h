@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Формат записей трассы - общий для прошивки (TraceRecorder) и хостовых
+// стендов tools/hostsim, которые пишут и читают те же файлы. Без Arduino.
+//
+// Формат записи (little-endian):
+//   uint32 millis | uint8 тип | uint8 длина | данные (до TRACE_MAX_PAYLOAD)
+// Данные длиннее одной записи (тело POST /api/settings/all, большое
+// MQTT-сообщение) продолжаются следующими записями TRACE_CONTINUATION с тем
+// же временем; общий предел - TRACE_MAX_DATA, остаток обрезается.
+// Расшифровка: tools/trace_decode.py, воспроизведение: tools/hostsim/trace_replay.cpp
+
+#define TRACE_MAX_PAYLOAD 240   // Данные одной записи (длина - uint8)
+#define TRACE_MAX_DATA 2048     // Данные с продолжениями
+#define TRACE_RECORD_HEADER 6
+
+enum TraceType : uint8_t {
+  TRACE_BOOT = 1,      // Старт записи: версия \0 режим работы (auto/comfort)
+  TRACE_SENSORS = 2,   // Сырые показания: int16 x4 (подача, обратка, котел, улица), сотые °C
+  TRACE_MQTT_IN = 3,   // Входящее MQTT: топик \0 сообщение
+  TRACE_HTTP = 4,      // HTTP-команда: uri \0 тело
+  TRACE_RELAY = 5,     // Переключение реле: uint8 пин, uint8 уровень
+  TRACE_STATE = 6,     // Смена состояния: вид (system/comfort/mode) \0 имя
+  TRACE_CONTROL = 7,   // Решение управления: uint8 x5 (причина, вентилятор, насос, systemState, comfortState)
+  TRACE_CONTINUATION = 8  // Продолжение данных предыдущей записи
+};
+
+#define TRACE_SENSOR_NO_VALUE INT16_MIN  // Датчик не назначен (не ответил - -12700, т.е. -127 °C)
+
+// Запись данных в виде физических записей: первая - с типом, следующие -
+// TRACE_CONTINUATION. Данные - из двух частей подряд (для пар: "первая
+// строка\0" и вторая), чтобы не собирать их в отдельный буфер
+class TraceChunker {
+ public:
+  TraceChunker(TraceType type, const uint8_t* head, size_t headLen, const uint8_t* tail = nullptr, size_t tailLen = 0);
+
+  // Следующая запись в out (не меньше TRACE_RECORD_HEADER + TRACE_MAX_PAYLOAD
+  // байт); 0 - данные кончились
+  size_t next(uint8_t* out, uint32_t ms);
+
+ private:
+  TraceType _type;
+  const uint8_t* _head;
+  size_t _headLen;
+  const uint8_t* _tail;
+  size_t _tailLen;
+  size_t _pos = 0;
+  bool _started = false;
+};
+
+// Разбор записи из буфера; false - запись оборвана (сброс питания при записи)
+struct TraceRecord {
+  uint32_t ms;
+  uint8_t type;
+  uint8_t length;
+  const uint8_t* data;
+};
+bool traceDecodeRecord(const uint8_t* buf, size_t size, size_t& pos, TraceRecord& record);
@@ -0,0 +1,115 @@
+#include "TraceRecorder.h"
+
+bool TraceRecorder::begin(fs::FS& fs) {
+  _fs = &fs;
+  _bufferLen = 0;
+  _lastFlush = millis();
+
+  // Продолжаем писать в более новый файл: тот, что не заполнен
+  size_t size0 = 0;
+  size_t size1 = 0;
+  if (_fs->exists(TRACE_FILE_0)) {
+    File f = _fs->open(TRACE_FILE_0, "r");
+    size0 = f.size();
+    f.close();
+  }
+  if (_fs->exists(TRACE_FILE_1)) {
+    File f = _fs->open(TRACE_FILE_1, "r");
+    size1 = f.size();
+    f.close();
+  }
+  if (size0 >= TRACE_FILE_SIZE && size1 < TRACE_FILE_SIZE) {
+    _current = 1;
+    _currentSize = size1;
+  } else {
+    _current = 0;
+    _currentSize = size0;
+  }
+  return true;
+}
+
+void TraceRecorder::record(TraceType type, const uint8_t* data, size_t len) {
+  TraceChunker chunker(type, data, len);
+  writeChunks(chunker);
+}
+
+void TraceRecorder::recordPair(TraceType type, const char* first, const char* second, size_t secondLen) {
+  TraceChunker chunker(type, (const uint8_t*)first, strlen(first) + 1, (const uint8_t*)second, secondLen);
+  writeChunks(chunker);
+}
+
+// Запись с продолжениями: перед каждой частью в буфере должно быть место
+// под полную запись, иначе буфер сбрасывается во флеш
+void TraceRecorder::writeChunks(TraceChunker& chunker) {
+  if (!_enabled || _fs == nullptr) {
+    return;
+  }
+  uint32_t now = millis();
+  while (true) {
+    if (_bufferLen + TRACE_RECORD_HEADER + TRACE_MAX_PAYLOAD > TRACE_BUFFER_SIZE) {
+      flush();
+    }
+    size_t written = chunker.next(_buffer + _bufferLen, now);
+    if (written == 0) {
+      break;
+    }
+    _bufferLen += written;
+  }
+  recordCount++;
+}
+
+void TraceRecorder::loop() {
+  if (_bufferLen > 0 && millis() - _lastFlush >= TRACE_FLUSH_INTERVAL) {
+    flush();
+  }
+}
+
+void TraceRecorder::flush() {
+  _lastFlush = millis();
+  if (_fs == nullptr || _bufferLen == 0) {
+    return;
+  }
+
+  // Текущий файл заполнен - переключаемся на другой и начинаем его заново
+  if (_currentSize + _bufferLen > TRACE_FILE_SIZE) {
+    _current ^= 1;
+    _currentSize = 0;
+    _fs->remove(newerFile());
+  }
+
+  File f = _fs->open(newerFile(), "a");
+  if (!f) {
+    droppedCount++;
+    _bufferLen = 0;
+    return;
+  }
+  _currentSize += f.write(_buffer, _bufferLen);
+  f.close();
+  _bufferLen = 0;
+}
+
+void TraceRecorder::clear() {
+  _bufferLen = 0;
+  if (_fs == nullptr) {
+    return;
+  }
+  _fs->remove(TRACE_FILE_0);
+  _fs->remove(TRACE_FILE_1);
+  _current = 0;
+  _currentSize = 0;
+  recordCount = 0;
+  droppedCount = 0;
+}
+
+size_t TraceRecorder::storedSize() {
+  size_t total = 0;
+  const char* files[2] = {TRACE_FILE_0, TRACE_FILE_1};
+  for (int i = 0; i < 2; i++) {
+    if (_fs != nullptr && _fs->exists(files[i])) {
+      File f = _fs->open(files[i], "r");
+      total += f.size();
+      f.close();
+    }
+  }
+  return total + _bufferLen;
+}
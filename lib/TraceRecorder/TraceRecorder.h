@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "TraceFormat.h"
+
+// Кольцевой журнал трассы во флеше для разбора проблем на объекте.
+// Записи копятся в RAM и сбрасываются во флеш пачками; кольцо - два файла,
+// при заполнении текущего старший перезаписывается.
+// Формат записей и типы - в TraceFormat.h.
+
+#define TRACE_BUFFER_SIZE 1024
+#define TRACE_FILE_SIZE (64 * 1024)  // Размер одного файла кольца
+#define TRACE_FLUSH_INTERVAL 30000   // Сброс буфера во флеш не реже раза в 30 с
+#define TRACE_FILE_0 "/trace0.bin"
+#define TRACE_FILE_1 "/trace1.bin"
+
+class TraceRecorder {
+ public:
+  bool begin(fs::FS& fs);
+
+  void record(TraceType type, const uint8_t* data, size_t len);
+  // Две строки через \0 (топик и сообщение, uri и тело); длинные данные -
+  // с записями-продолжениями, до TRACE_MAX_DATA
+  void recordPair(TraceType type, const char* first, const char* second, size_t secondLen);
+
+  void loop();   // Периодический сброс буфера
+  void flush();
+  void clear();
+
+  bool isEnabled() const { return _enabled; }
+  void setEnabled(bool enabled) { _enabled = enabled; }
+
+  // Файлы кольца в хронологическом порядке (старший первым)
+  const char* olderFile() const { return _current == 0 ? TRACE_FILE_1 : TRACE_FILE_0; }
+  const char* newerFile() const { return _current == 0 ? TRACE_FILE_0 : TRACE_FILE_1; }
+  size_t storedSize();
+
+  uint32_t recordCount = 0;
+  uint32_t droppedCount = 0;  // Потеряно при переполнении буфера
+
+ private:
+  void writeChunks(TraceChunker& chunker);
+
+  fs::FS* _fs = nullptr;
+  bool _enabled = true;
+  uint8_t _current = 0;        // Индекс файла, в который идет запись
+  size_t _currentSize = 0;
+  uint8_t _buffer[TRACE_BUFFER_SIZE];
+  size_t _bufferLen = 0;
+  unsigned long _lastFlush = 0;
+};
@@ -1,7 +1,6 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WiFiManager.h>
-#include <WebServer.h>
 #include <ArduinoJson.h>
 #include <FS.h>
 #include <SPIFFS.h>
@@ -12,48 +11,47 @@
 #include <Update.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
-#include <WiFiUdp.h>
-#include <NTPClient.h>
 #include <HTTPClient.h>
 #include <WiFiClientSecure.h>
 #include <ESPmDNS.h>  // mDNS для доступа по kotel.local
 #include <esp_task_wdt.h>  // Watchdog timer для диагностики
 #include <esp_system.h>  // Для получения причины перезагрузки
+#include <esp_heap_caps.h>  // Статистика кучи для метрики фрагментации
+#include "SensorFilter.h"  // Цепочка фильтров показаний датчиков
+#include "TraceRecorder.h"  // Журнал трассы во флеше для разбора проблем на объекте
+#include "LatencyHistogram.h"  // Гистограммы задержек этапов loop()
+#include "HeapProfiler.h"  // Учет выделений памяти по подсистемам (флаг HEAP_PROFILER)
+#include "TimeService.h"  // SNTP ESP-IDF с плавной подстройкой и кэшем локального времени
+#include "NbHttpServer.h"  // Событийный HTTP-сервер: несколько соединений, неблокирующие сокеты
+#include "MqttOutbox.h"  // Очередь исходящих MQTT с приоритетами
+#include "PayloadWriter.h"  // JSON или MessagePack для state и ml/data
+#include "MqttCommands.h"  // Таблица входящих MQTT-команд, разбор без кучи
+#include "MqttMessages.h"  // Поля state/ml/data и таблица команд (общие с tools/mqttbench)
+#include "TlsSocket.h"  // TLS на готовом сокете, рукопожатие по шагам из loop()
+#include "BoilerControl.h"  // Логика управления котлом (общая с хост-сборками tools/)
+#include "BoilerCommands.h"  // Команды, пределы настроек и раскладка EEPROM (общие с tools/hostsim)
+#include "DisplayFrame.h"  // Модель экрана и измененные тайловые ряды (общие с tools/displaycheck)
+#include <lwip/sockets.h>  // Неблокирующий connect и select() на сокете MQTT
+#include <lwip/dns.h>  // DNS брокера MQTT в фоне
+#include <lwip/tcpip.h>  // tcpip_api_call: вызов DNS lwip из задачи tcpip
+#ifdef BOILER_SIMULATION
+#include "BoilerSim.h"  // Модель котла и дома вместо реальных датчиков
+#endif
 
 #ifdef U8X8_HAVE_HW_I2C
 #include <Wire.h>
 #endif
 
-#define EEPROM_SIZE 1024
-#define EEPROM_MAGIC 0xAA
-#define EEPROM_ADDR_MAGIC 0
-#define EEPROM_ADDR_AUTO 1
-#define EEPROM_ADDR_MQTT 200
-#define EEPROM_ADDR_SENSORS 400
-#define EEPROM_ADDR_SYSTEM 600
-#define EEPROM_ADDR_WIFI 700
-#define EEPROM_ADDR_NTP 800
-#define EEPROM_ADDR_ML 1000
-#define EEPROM_ADDR_RELAY 1100
-#define EEPROM_ADDR_COMFORT 1200
-#define EEPROM_ADDR_WORKMODE 1300
-#define EEPROM_ADDR_UPDATE 1400
-#define EEPROM_ADDR_BOOT_COUNT 1500
-#define EEPROM_ADDR_BOOT_LOG 1600  // Журнал перезагрузок (50 записей по 32 байта = 1600 байт)
-#define BOOT_LOG_MAX_ENTRIES 50
-#define BOOT_LOG_ENTRY_SIZE 32  // Размер одной записи
-#define EEPROM_ADDR_EVENT_LOG 2000  // Журнал событий (30 записей по 80 байт = 2400 байт)
-#define EEPROM_ADDR_FAN_STATS 4400  // Статистика работы вентилятора (около 50 байт)
-
 // Версия прошивки
 #define FIRMWARE_VERSION "4.2.21"
 
 // GitHub репозиторий для обновлений
 #define GITHUB_REPO_OWNER "paha22russ"
 #define GITHUB_REPO_NAME "esp"
-#define GITHUB_VERSION_URL "https://raw.githubusercontent.com/" GITHUB_REPO_OWNER "/" GITHUB_REPO_NAME "/main/version.txt"
-#define GITHUB_FIRMWARE_URL "https://raw.githubusercontent.com/" GITHUB_REPO_OWNER "/" GITHUB_REPO_NAME "/main/firmware.bin"
-#define GITHUB_SPIFFS_URL "https://raw.githubusercontent.com/" GITHUB_REPO_OWNER "/" GITHUB_REPO_NAME "/main/spiffs.bin"
+#define GITHUB_RAW_HOST "raw.githubusercontent.com"
+#define GITHUB_VERSION_URL "https://" GITHUB_RAW_HOST "/" GITHUB_REPO_OWNER "/" GITHUB_REPO_NAME "/main/version.txt"
+#define GITHUB_FIRMWARE_URL "https://" GITHUB_RAW_HOST "/" GITHUB_REPO_OWNER "/" GITHUB_REPO_NAME "/main/firmware.bin"
+#define GITHUB_SPIFFS_URL "https://" GITHUB_RAW_HOST "/" GITHUB_REPO_OWNER "/" GITHUB_REPO_NAME "/main/spiffs.bin"
 
 // Пины подключения
 #define PIN_RELAY_FAN 16
@@ -71,6 +69,41 @@
 // OLED дисплей (SSD1306 128x64, I2C)
 U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0, /* reset=*/ U8X8_PIN_NONE);
 
+// Частота шины I2C дисплея. SSD1306 держит 400 кГц (Fast mode), на длинных
+// проводах можно понизить сборкой с -DDISPLAY_I2C_CLOCK=100000
+#ifndef DISPLAY_I2C_CLOCK
+#define DISPLAY_I2C_CLOCK 400000
+#endif
+
+// Строки экрана: шрифт и базовая линия. По шине отправляются только
+// тайловые ряды (по 8 px) строк, текст которых изменился
+struct DisplayLine {
+  const uint8_t* font;
+  uint8_t baseline;
+};
+const DisplayLine DISPLAY_LINES[DISPLAY_LINE_COUNT] = {
+  {u8g2_font_ncenB18_tr, 25},  // Температура подачи
+  {u8g2_font_ncenB10_tr, 40},  // Уставка
+  {u8g2_font_ncenB10_tr, 55},  // Погасание/розжиг/уголь/время
+  {u8g2_font_6x10_tr, 64}      // Состояние и активный таймер
+};
+
+// Модель экрана (DisplayModel) - в lib/DisplayFrame
+QueueHandle_t displayQueue = NULL;  // Почтовый ящик на одну модель (xQueueOverwrite)
+TaskHandle_t displayTaskHandle = NULL;
+
+// Состояние задачи дисплея
+uint8_t displayLineRows[DISPLAY_LINE_COUNT] = {0};  // Маска тайловых рядов каждой строки
+char displayLastLines[DISPLAY_LINE_COUNT][DISPLAY_LINE_LENGTH];  // Что сейчас на экране
+bool displayFullRedraw = true;  // После заставки/сообщения экран отправляется целиком
+volatile unsigned long displayFrames = 0;
+volatile unsigned long displaySkippedFrames = 0;  // Ничего не изменилось - шина не занималась
+volatile unsigned long displayBytesSent = 0;
+volatile uint32_t displayRenderUs = 0;  // Отрисовка и передача последнего кадра
+volatile uint32_t displayRenderMaxUs = 0;
+
+bool displayRefreshRequested = false;  // Перерисовать в ближайшем проходе loop()
+
 // Переменные для энкодера
 volatile int encoderPosition = 0;
 volatile int lastEncoderState = 0;
@@ -88,11 +121,11 @@ const unsigned long ENCODER_ISR_DEBOUNCE_US = 2000; // Минимальный и
 
 
 WiFiManager wifiManager;
-WebServer server(80);
+NbHttpServer server(80);
 WiFiClient wifiClient;
+TlsSocketClient mqttSecureClient;  // TLS-клиент MQTT (mqttSettings.useTLS)
 PubSubClient mqttClient(wifiClient);
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP);
+TimeService timeService;  // SNTP в фоне, кэш локального времени
 
 // OneWire и DallasTemperature для датчиков DS18B20 (две шины)
 OneWire oneWire1(PIN_DS18B20_1);  // Шина 1: Подача, Обратка
@@ -101,69 +134,101 @@ OneWire oneWire2(PIN_DS18B20_2);  // Шина 2: Котельная, Улица
 DallasTemperature sensors2(&oneWire2);
 
 // Заглушки данных (заменить на реальные функции управления котлом)
-float supplyTemp = 0.0;
+// supplyTemp, outdoorTemp и homeTemp - входы BoilerControl; setpoint и
+// lastHomeTempUpdate - в BoilerCommands
 float returnTemp = 0.0;
 float boilerTemp = 0.0;
-float outdoorTemp = 0.0;
-float homeTemp = 0.0;  // Температура в доме (получается с MQTT от ESP01)
-unsigned long lastHomeTempUpdate = 0;  // Время последнего обновления температуры дома
 const unsigned long HOME_TEMP_TIMEOUT = 300000;  // 5 минут - таймаут для определения offline датчика
-bool homeTempSensorLWTOnline = false;  // LWT статус датчика температуры дома (true = online, false = offline)
-float setpoint = 60.0;
-
-// Структура для отслеживания истории температур (для определения тренда)
-struct TemperatureHistory {
-  float values[20];  // История последних 20 значений (увеличено)
-  int index;         // Текущий индекс
-  int count;         // Количество записанных значений
-  unsigned long lastUpdate;  // Время последнего обновления
-  bool isValid;      // Валидность данных (защита от помех)
-};
 
-TemperatureHistory supplyHistory = {{0}, 0, 0, 0, false};
+// История температур для определения тренда (supplyHistory - в BoilerControl,
+// homeHistory - в BoilerCommands)
 TemperatureHistory returnHistory = {{0}, 0, 0, 0, false};
 TemperatureHistory boilerHistory = {{0}, 0, 0, 0, false};
 TemperatureHistory outdoorHistory = {{0}, 0, 0, 0, false};
-TemperatureHistory homeHistory = {{0}, 0, 0, 0, false};
 
-const float TEMP_CHANGE_THRESHOLD = 0.01;  // Минимальное изменение для определения тренда (°C)
-const float TEMP_NOISE_THRESHOLD = 5.0;  // Максимальное изменение за один шаг (защита от помех)
 const unsigned long TEMP_UPDATE_INTERVAL = 3000;  // Интервал обновления истории (3 сек для сбора 10 значений за 30 секунд)
-const int TEMP_HISTORY_SIZE = 20;  // Размер истории (увеличено с 10 до 20 для более точного анализа)
-const int TEMP_TREND_SAMPLES = 10;  // Количество значений для анализа тренда (увеличено с 5 до 10)
-
-// Константы для защиты от застоя насоса
-const unsigned long PUMP_ANTI_STAGNATION_INTERVAL = 30 * 60 * 1000;  // 30 минут в миллисекундах
-const unsigned long PUMP_ANTI_STAGNATION_DURATION = 2 * 60 * 1000;   // 2 минуты в миллисекундах
-
-// Константы для обнаружения прогорания угля
-const unsigned long COAL_BURNED_CHECK_TIME = 10 * 60 * 1000;  // 10 минут в миллисекундах
-bool fanState = false;
-bool pumpState = false;
-bool systemEnabled = true;  // Флаг включения/выключения системы
-String systemState = "IDLE";
-int workMode = 0;  // 0 = Авто, 1 = Комфорт
-
-// Защита от частых переключений вентилятора
-unsigned long lastFanToggleTime = 0;  // Время последнего переключения вентилятора
-const unsigned long FAN_TOGGLE_MIN_INTERVAL_MS = 10000;  // Минимальный интервал между переключениями (10 секунд)
-float lastFanToggleTemp = 0;  // Температура при последнем переключении
-const float FAN_TOGGLE_MIN_TEMP_DELTA = 0.3;  // Минимальное изменение температуры для переключения (0.3°C)
-
-// Инженерное управление реле
-bool manualFanControl = false;  // Ручное управление вентилятором
-bool manualPumpControl = false;  // Ручное управление насосом
-bool sensorsRelayState = true;  // Состояние реле датчиков (true = включено, false = выключено)
-bool sensorsResetPending = false;  // Флаг ожидания автоматического включения реле датчиков
-unsigned long sensorsResetStartTime = 0;  // Время начала ожидания сброса
+
+// Каналы фильтрации (sensorFilters - в BoilerCommands) и их настройки по умолчанию - в SensorFilter.h
+uint32_t sensorReadFailures[SENSOR_CHANNEL_COUNT] = {0};  // Датчик не ответил на шине (-127°C)
+
+// Журнал трассы: сырые показания, входящие команды, реле и смены состояний
+TraceRecorder traceRecorder;
+int tracedWorkMode = -1;  // Режим, последний записанный в трассу (-1 - запись не начата)
+
+// Хранимая часть настроек фильтра (диапазоны задаются в прошивке). Без
+// выравнивания: 5 каналов по 18 байт помещаются до EEPROM_ADDR_ML
+struct __attribute__((packed)) SensorFilterStored {
+  uint8_t medianWindow;
+  uint8_t smoother;
+  float maxRate;
+  float emaAlpha;
+  float kalmanQ;
+  float kalmanR;
+};
+// Прежняя запись без параметров Калмана - читается, пока ее не перезапишут
+struct SensorFilterStoredV1 {
+  uint8_t medianWindow;
+  uint8_t smoother;
+  float maxRate;
+  float emaAlpha;
+};
+const uint8_t SENSOR_FILTERS_MAGIC = 0xF2;
+const uint8_t SENSOR_FILTERS_MAGIC_V1 = 0xF1;
+EEPROM_REGION_FITS(EEPROM_ADDR_FILTERS, 1 + SENSOR_CHANNEL_COUNT * sizeof(SensorFilterStored), EEPROM_ADDR_ML);
+
+#ifdef BOILER_SIMULATION
+// Режим симуляции: температуры берутся из модели, которая видит вентилятор и насос.
+// Сборка: build_flags = -DBOILER_SIMULATION
+// Модель идет по тем же millis(), что и таймеры управления (таймаут разогрева,
+// прогорание, розжиг, выдержки Комфорта): ускорение одной модели сдвигало бы
+// их друг относительно друга. Ускоренные прогоны - на хосте, tools/hostsim/week_run.cpp
+#if defined(BOILER_SIM_TIME_SCALE) && BOILER_SIM_TIME_SCALE != 1
+#error "BOILER_SIM_TIME_SCALE больше не поддерживается: ускоренный прогон - tools/hostsim/week_run.cpp"
+#endif
+#define BOILER_SIM_TRACE_INTERVAL 10000  // Вывод строки трассы в Serial каждые 10 секунд
+BoilerSim boilerSim;
+#endif
+
+// Состояние управления (fanState, pumpState, systemState, workMode, таймеры) - в BoilerControl
+
+// Инженерное управление реле (флаги ручного управления - в BoilerControl,
+// реле датчиков и время ручного управления - в BoilerCommands)
 const unsigned long SENSORS_RESET_DELAY = 3000;  // Задержка перед автоматическим включением (3 секунды)
 
 // Переменные для асинхронного сканирования WiFi
 bool wifiScanInProgress = false;
 unsigned long wifiScanStartTime = 0;
 int wifiScanResult = 0;
-unsigned long lastManualControlTime = 0;  // Время последнего ручного управления
-const unsigned long MANUAL_CONTROL_TIMEOUT = 2 * 60 * 1000;  // 2 минуты в миллисекундах
+
+// Поколение настроек: растет при каждой загрузке, сохранении или изменении
+// настроек. GET настроек отдают готовый ответ из кеша, пока поколение не
+// сменилось, и 304 по If-None-Match
+uint32_t settingsGeneration = 1;
+enum SettingsCacheSlot : uint8_t {
+  SETTINGS_CACHE_AUTO,
+  SETTINGS_CACHE_COMFORT,
+  SETTINGS_CACHE_MQTT,
+  SETTINGS_CACHE_RELAY,
+  SETTINGS_CACHE_NTP,
+  SETTINGS_CACHE_ML,
+  SETTINGS_CACHE_UPDATE,
+  SETTINGS_CACHE_SENSOR_MAPPING,
+  SETTINGS_CACHE_ALL,
+  SETTINGS_CACHE_COUNT
+};
+struct SettingsCacheEntry {
+  uint32_t generation = 0;  // 0 - пусто
+  uint32_t variant = 0;     // Живое состояние, попавшее в ответ (реле)
+  String body;
+};
+SettingsCacheEntry settingsCache[SETTINGS_CACHE_COUNT];
+uint32_t settingsCacheHits = 0;
+uint32_t settingsCacheMisses = 0;
+uint32_t settingsCacheNotModified = 0;
+
+inline void markSettingsChanged() {
+  settingsGeneration++;
+}
 
 // Автоматический сброс питания датчиков при отсутствии обнаружения
 unsigned long lastSensorsDetectedTime = 0;  // Время последнего успешного обнаружения датчиков
@@ -183,36 +248,8 @@ bool tempRequestPending = false;  // Флаг ожидания конверта
 unsigned long tempRequestTime = 0;  // Время запроса температуры
 const unsigned long TEMP_CONVERSION_DELAY = 800;  // Задержка для конвертации DS18B20 (мс)
 
-// Переменные для подброса угля
-bool coalFeedingActive = false;  // Флаг активного подброса угля
-unsigned long coalFeedingStartTime = 0;  // Время начала подброса угля
+// Подброс угля (время начала и автозавершение - в BoilerCommands)
 const unsigned long COAL_FEEDING_DURATION = 10 * 60 * 1000;  // 10 минут в миллисекундах
-bool fanStateBeforeCoalFeeding = false;  // Состояние вентилятора до подброса угля
-
-// Переменная для отслеживания времени начала разогрева
-unsigned long heatingStartTime = 0;  // Время начала разогрева (для проверки таймаута)
-
-// Переменные для защиты от застоя насоса
-unsigned long lastPumpRunTime = 0;  // Время последнего запуска насоса
-
-// Переменные для защиты от разгона без наддува
-// Переменные для обнаружения прогорания угля
-unsigned long coalBurnedCheckStart = 0;  // Время начала отслеживания падения температуры
-
-// Переменные для обнаружения погасания котла
-unsigned long fanStartTime = 0;  // Время начала работы вентилятора
-float maxTempDuringFan = 0.0;   // Максимальная температура за время работы вентилятора
-bool boilerExtinguished = false; // Флаг погасания котла
-const unsigned long BOILER_EXTINGUISHED_CHECK_TIME = 60 * 60 * 1000;  // 60 минут в миллисекундах
-const float BOILER_EXTINGUISHED_TEMP_DROP = 5.0;  // Падение температуры на 5°C для определения погасания
-
-// Переменные для контроля розжига
-bool ignitionInProgress = false;  // Флаг активного розжига
-unsigned long ignitionStartTime = 0;  // Время начала розжига
-float ignitionStartTemp = 0.0;  // Температура при начале розжига
-const unsigned long IGNITION_TIMEOUT_MIN = 10 * 60 * 1000;  // 10 минут в миллисекундах (минимальный таймаут)
-const unsigned long IGNITION_TIMEOUT_MAX = 20 * 60 * 1000;  // 20 минут в миллисекундах (максимальный таймаут)
-const float IGNITION_TEMP_INCREASE = 2.0;  // Минимальное повышение температуры для успешного розжига (°C)
 
 // Структура для логирования событий
 struct EventLogEntry {
@@ -226,6 +263,8 @@ const int EVENT_LOG_MAX_ENTRIES = 30;  // Максимум 30 записей с
 EventLogEntry eventLog[EVENT_LOG_MAX_ENTRIES];
 uint8_t eventLogWriteIndex = 0;  // Индекс для записи следующей записи
 const int EVENT_LOG_ENTRY_SIZE = 80;  // Размер одной записи (timestamp + eventType + details + valid)
+static_assert(sizeof(EventLogEntry) <= EVENT_LOG_ENTRY_SIZE, "запись журнала событий больше ячейки");
+EEPROM_REGION_FITS(EEPROM_ADDR_EVENT_LOG, EVENT_LOG_MAX_ENTRIES * EVENT_LOG_ENTRY_SIZE, EEPROM_ADDR_FAN_STATS);
 
 // Статистика работы
 struct FanStatistics {
@@ -235,6 +274,7 @@ struct FanStatistics {
   int cycleCount = 0;               // Количество циклов включения/выключения
   int dailyCycleCount = 0;          // Количество циклов за сегодня
 } fanStats;
+EEPROM_REGION_FITS(EEPROM_ADDR_FAN_STATS, sizeof(FanStatistics), EEPROM_SIZE);
 
 // Флаг для отложенного сохранения в EEPROM
 bool autoSettingsDirty = false;
@@ -253,11 +293,56 @@ struct BootLogEntry {
   uint32_t timestamp;  // Unix timestamp
   char reason[20];      // Причина перезагрузки
   bool valid;           // Флаг валидности записи
+  uint8_t fastBoot;     // 1 - быстрый старт после WDT/просадки питания
+  uint16_t setupMs;     // Длительность setup(), мс (в записи 32 байта без изменения размера)
 };
 
+static_assert(sizeof(BootLogEntry) == BOOT_LOG_ENTRY_SIZE, "запись журнала перезагрузок не 32 байта");
 BootLogEntry bootLog[BOOT_LOG_MAX_ENTRIES];
 uint8_t bootLogWriteIndex = 0;  // Индекс для записи следующей записи
 
+// Профиль загрузки: начало и конец каждого этапа в мкс от старта чипа.
+// Хранится в RTC-памяти, которая переживает программный сброс, WDT и просадку
+// питания - после перезагрузки доступен профиль предыдущего запуска
+enum BootPhase : uint8_t {
+  BOOT_PHASE_SERIAL,          // Serial и watchdog
+  BOOT_PHASE_GPIO,            // Реле, энкодер, светодиод
+  BOOT_PHASE_DISPLAY,         // I2C, OLED, задача дисплея
+  BOOT_PHASE_SENSOR_BUS,      // Шины DS18B20
+  BOOT_PHASE_EEPROM,          // Счетчик перезагрузок и все настройки
+  BOOT_PHASE_SPIFFS,          // Монтирование SPIFFS и трасса
+  BOOT_PHASE_WIFI_START,      // Запуск подключения к WiFi (без ожидания)
+  BOOT_PHASE_ROUTES,          // Регистрация маршрутов и запуск веб-сервера
+  BOOT_PHASE_SETUP,           // setup() целиком
+  BOOT_PHASE_WIFI_CONNECTED,  // От запуска подключения до получения IP (в loop)
+  BOOT_PHASE_MDNS,
+  BOOT_PHASE_NTP,
+  BOOT_PHASE_OTA,
+  BOOT_PHASE_COUNT
+};
+const char* const BOOT_PHASE_NAMES[BOOT_PHASE_COUNT] = {
+  "serial", "gpio", "display", "sensorBus", "eeprom", "spiffs", "wifiStart", "routes",
+  "setup", "wifiConnected", "mdns", "ntp", "ota"
+};
+#define BOOT_PROFILE_MAGIC 0xB007F11E
+struct BootProfile {
+  uint32_t magic;
+  uint32_t bootCount;
+  uint8_t resetReason;  // esp_reset_reason_t
+  bool fastBoot;
+  uint32_t startUs[BOOT_PHASE_COUNT];
+  uint32_t endUs[BOOT_PHASE_COUNT];  // 0 - этап не завершен (или пропущен)
+};
+RTC_NOINIT_ATTR BootProfile rtcBootProfile;  // Текущий запуск, пишется по ходу загрузки
+BootProfile previousBootProfile;  // Копия профиля прошлого запуска
+bool previousBootProfileValid = false;
+
+// Быстрый старт после WDT или просадки питания: главное - вернуть управление.
+// Заставка и пауза Serial пропускаются, SPIFFS, WiFi и веб-сервер откладываются
+const unsigned long FAST_BOOT_DEFER_MS = 15000;
+bool fastBoot = false;
+bool deferredBootPending = false;
+
 // Переменные для вычисления загрузки CPU
 unsigned long loopStartTime = 0;
 unsigned long totalLoopTime = 0;  // Суммарное время выполнения loop() за период обновления
@@ -266,6 +351,52 @@ float cpuLoad = 0.0;  // Загрузка CPU в процентах
 unsigned long lastCpuUpdate = 0;
 const unsigned long CPU_UPDATE_INTERVAL = 1000;  // Обновление загрузки CPU раз в секунду
 
+// Профиль loop(): гистограмма длительности каждого этапа за каждую итерацию
+enum LoopStage {
+  LOOP_STAGE_OTA,
+  LOOP_STAGE_WEB,
+  LOOP_STAGE_UPDATE,
+  LOOP_STAGE_MQTT,
+  LOOP_STAGE_CONTROL,
+  LOOP_STAGE_DISPLAY,
+  LOOP_STAGE_NTP,
+  LOOP_STAGE_SENSORS,
+  LOOP_STAGE_TOTAL,
+  LOOP_STAGE_COUNT
+};
+const char* const LOOP_STAGE_NAMES[LOOP_STAGE_COUNT] = {"ota", "web", "update", "mqtt", "control", "display", "ntp", "sensors", "total"};
+LatencyHistogram loopStageHistograms[LOOP_STAGE_COUNT];
+uint32_t loopStageLast[LOOP_STAGE_COUNT] = {0};  // Длительности этапов текущей итерации
+uint32_t slowLoopStages[LOOP_STAGE_COUNT] = {0};  // Разбивка последней медленной итерации
+unsigned long slowLoopTime = 0;  // millis() последней медленной итерации
+const uint32_t SLOW_LOOP_THRESHOLD_US = 100000;  // Итерация дольше 100 мс считается медленной
+const unsigned long PROFILE_MQTT_INTERVAL = 60000;  // Публикация профиля в MQTT раз в минуту
+
+// Фрагментация кучи: 100 - наибольший свободный блок / всего свободно, раз в минуту за последний час
+#define HEAP_HISTORY_SIZE 60
+const unsigned long HEAP_SAMPLE_INTERVAL = 60000;
+uint8_t heapFragHistory[HEAP_HISTORY_SIZE] = {0};
+uint16_t heapFreeKBHistory[HEAP_HISTORY_SIZE] = {0};
+uint8_t heapHistoryIndex = 0;
+uint8_t heapHistoryCount = 0;
+
+// Heartbeat: итерации loop() за последнюю полную минуту
+unsigned long loopIterations = 0;
+unsigned long heartbeatPerMinute = 0;
+
+// Событийный пересчет управления (причины, срок таймера, счетчики) - в BoilerCommands
+
+// Последнее решение управления (смена реле или состояния) и его причина
+struct ControlDecision {
+  unsigned long time;
+  uint8_t trigger;
+  bool fan;
+  bool pump;
+  uint8_t systemState;
+  uint8_t comfortState;
+};
+ControlDecision lastControlDecision = {0, 0, false, false, 0, 0};
+
 // Настройки MQTT (по умолчанию включен)
 struct MqttSettings {
   bool enabled = true;  // По умолчанию включен
@@ -277,41 +408,91 @@ struct MqttSettings {
   String prefix = "kotel/device1";
   int tempInterval = 10;
   int stateInterval = 30;
+  int stateFormat = PAYLOAD_JSON;  // Кодирование <prefix>/state: 0 - JSON, 1 - MessagePack
 } mqttSettings;
 
-// Настройки Авто (заглушки)
-struct AutoSettings {
-  float setpoint = 60.0;
-  float minTemp = 45.0;
-  float maxTemp = 75.0;
-  float hysteresis = 2.0;
-  float inertiaTemp = 55.0;
-  int inertiaTime = 10;
-  float overheatTemp = 77.0;
-  int heatingTimeout = 30;
-} autoSettings;
-
-// Настройки режима "Комфорт"
-struct ComfortSettings {
-  float targetHomeTemp = 24.0;  // Целевая температура в доме (°C)
-  float minBoilerTemp = 45.0;  // Минимальная температура котла (°C)
-  float maxBoilerTemp = 75.0;  // Максимальная температура котла (°C)
-  float waitTemp = 65.0;  // Температура ожидания (°C)
-  float catchUpTemp = 23.5;  // Догон до (°C) - начало снижения наддува
-  int waitCoolingTime = 10;  // Время ожидания на промежуточной температуре (минуты)
-  int waitAfterHeating1Time = 20;  // Время ожидания после первого разогрева (минуты)
-  int waitAfterReductionTime = 25;  // Время ожидания после снижения наддува (минуты)
-  int inertiaCheckInterval = 5;  // Интервал проверки инерции (минуты)
-  float hysteresisOn = 0.5;  // Гистерезис включения (°C)
-  float hysteresisOff = 0.3;  // Гистерезис выключения (°C)
-  float hysteresisBoiler = 2.0;  // Гистерезис температуры котла (°C)
-  float warningTemp = 85.0;  // Температура предупреждения (°C)
-} comfortSettings;
-
-// Переменные для режима "Комфорт"
-String comfortState = "WAIT";  // Состояния: WAIT, HEATING_1, WAIT_COOLING, WAIT_HEATING, HEATING_2, COMFORT, MAINTAIN
-unsigned long comfortStateStartTime = 0;  // Время входа в текущее состояние
-float homeTempAtStateStart = 0.0;  // Температура дома при входе в состояние
+// Счетчики публикаций MQTT (для /metrics)
+uint32_t mqttPublishCount = 0;
+uint32_t mqttPublishFailures = 0;  // Клиент не принял: нет соединения или не влезло в буфер
+
+// Публикация с учетом в счетчиках. Пишет в сокет синхронно - напрямую
+// только при подключении и перед перезагрузкой, остальное через mqttEnqueue()
+bool mqttPublish(const char* topic, const uint8_t* payload, size_t length, bool retain = false) {
+  if (mqttClient.publish(topic, payload, length, retain)) {
+    mqttPublishCount++;
+    return true;
+  }
+  mqttPublishFailures++;
+  return false;
+}
+
+bool mqttPublish(const char* topic, const char* payload, bool retain = false) {
+  return mqttPublish(topic, (const uint8_t*)payload, strlen(payload), retain);
+}
+
+// Очередь исходящих: loop() досылает ее, пока сокет готов принять данные
+const uint16_t MQTT_BUFFER_SIZE = 1536;  // Буфер PubSubClient - предел заголовок + топик + данные (схема ml/data ~1.1 КБ)
+const int MQTT_OUTBOX_DRAIN_PER_LOOP = 4;  // Сообщений за проход loop()
+MqttOutbox mqttOutbox;
+const char* const MQTT_PRIORITY_NAMES[MQTT_PRIORITY_COUNT] = {"event", "state", "telemetry"};
+LatencyHistogram mqttDrainLatency;  // От постановки в очередь до записи в сокет, мкс
+uint32_t mqttOutboxStalls = 0;  // Проходы, прерванные заполненным окном TCP
+
+// Постановка в очередь; false - не влезло в буфер PubSubClient или класса
+bool mqttEnqueue(MqttPriority priority, const char* topic, const uint8_t* payload, size_t length, bool retain = false) {
+  // 5 байт заголовка MQTT + 2 байта длины топика (как проверяет PubSubClient::publish)
+  if (7 + strlen(topic) + length > MQTT_BUFFER_SIZE) {
+    mqttPublishFailures++;
+    Serial.printf("[MQTT] Message too large for %s\n", topic);
+    return false;
+  }
+  return mqttOutbox.push(priority, topic, payload, length, retain, micros());
+}
+
+bool mqttEnqueue(MqttPriority priority, const char* topic, const char* payload, bool retain = false) {
+  return mqttEnqueue(priority, topic, (const uint8_t*)payload, strlen(payload), retain);
+}
+
+// Есть ли место в окне отправки сокета MQTT (select с нулевым таймаутом).
+// Готовность на запись в lwip - свободно не меньше половины буфера отправки,
+// сообщение до MQTT_BUFFER_SIZE уходит без ожидания
+bool mqttSocketWritable() {
+  int fd = mqttSettings.useTLS ? mqttSecureClient.fd() : wifiClient.fd();
+  if (fd < 0) {
+    return false;
+  }
+  fd_set writeSet;
+  FD_ZERO(&writeSet);
+  FD_SET(fd, &writeSet);
+  struct timeval tv = {0, 0};
+  return lwip_select(fd + 1, NULL, &writeSet, NULL, &tv) > 0;
+}
+
+bool sendPendingMqttSchemas();
+
+// Досылка очереди: по приоритету, не больше MQTT_OUTBOX_DRAIN_PER_LOOP сообщений
+// и только пока сокет готов - при заполненном окне продолжим на следующем проходе
+void drainMqttOutbox() {
+  if (!mqttSettings.enabled || !mqttClient.connected()) {
+    return;  // Очередь ждет переподключения (старая телеметрия вытесняется новой)
+  }
+  if (!sendPendingMqttSchemas()) {
+    mqttOutboxStalls++;
+    return;  // Данные - только после словаря для их разбора
+  }
+  MqttOutboxMessage msg;
+  for (int i = 0; i < MQTT_OUTBOX_DRAIN_PER_LOOP && mqttOutbox.peek(msg); i++) {
+    if (!mqttSocketWritable()) {
+      mqttOutboxStalls++;
+      return;
+    }
+    mqttPublish(msg.topic, (const uint8_t*)msg.payload, msg.payloadLen, msg.retain);
+    mqttDrainLatency.record(micros() - msg.enqueuedUs);
+    mqttOutbox.pop();
+  }
+}
+
+// Настройки Авто и Комфорт, состояния автомата "Комфорт" - в BoilerControl
 
 // Настройки WiFi
 struct WiFiSettings {
@@ -323,6 +504,24 @@ struct WiFiSettings {
   bool antennaTuning = false;  // Режим настройки антенны
 } wifiSettings;
 
+// Подключение к WiFi в фоне: основная сеть -> резервная -> сохраненная порталом ->
+// портал настройки. Управление котлом работает с первой секунды и сети не ждет
+enum WiFiStage : uint8_t {
+  WIFI_STAGE_PRIMARY,
+  WIFI_STAGE_BACKUP,
+  WIFI_STAGE_SAVED,     // Сеть, сохраненная порталом WiFiManager
+  WIFI_STAGE_PORTAL,    // Портал KotelAP (неблокирующий)
+  WIFI_STAGE_CONNECTED
+};
+const char* const WIFI_STAGE_NAMES[] = {"primary", "backup", "saved", "portal", "connected"};
+const unsigned long WIFI_PRIMARY_TIMEOUT = 30000;
+const unsigned long WIFI_BACKUP_TIMEOUT = 20000;
+const unsigned long WIFI_SAVED_TIMEOUT = 20000;
+const unsigned long WIFI_PORTAL_TIMEOUT_SEC = 180;  // Потом снова пробуем сети по кругу
+WiFiStage wifiStage = WIFI_STAGE_PRIMARY;
+unsigned long wifiStageStartTime = 0;
+bool networkServicesStarted = false;  // mDNS, NTP и OTA запускаются при первом подключении
+
 // Настройки NTP
 struct NTPSettings {
   bool enabled = true;
@@ -335,6 +534,7 @@ struct NTPSettings {
 struct MLSettings {
   bool enabled = true;  // По умолчанию включено
   int publishInterval = 10;  // Интервал публикации в секундах (по умолчанию 10 сек)
+  int format = PAYLOAD_JSON;  // Кодирование <prefix>/ml/data: 0 - JSON, 1 - MessagePack
 } mlSettings;
 
 // Настройки реле (инженерные)
@@ -363,6 +563,12 @@ struct UpdateProgress {
   float speedKBps = 0.0;  // Скорость загрузки в KB/s
 } updateProgress;
 
+// Рукопожатия TLS с GitHub и переиспользованные соединения (для диагностики)
+uint32_t httpsHandshakes = 0;
+uint32_t httpsReused = 0;
+uint32_t httpsLastHandshakeMs = 0;
+uint32_t httpsMaxHandshakeMs = 0;
+
 // Структура для привязки датчиков
 struct SensorMapping {
   String supply = "";
@@ -372,26 +578,32 @@ struct SensorMapping {
 } sensorMapping;
 
 // Forward declarations
-void startCoalFeeding();
-void stopCoalFeeding();
-void checkCoalFeeding();
 int getCoalFeedingRemainingSeconds();
 void updateDisplay();
 void setupOTA();
 void updateTemperatures();
 float getTemperatureByAddress(String address);
-void saveWiFiSettingsToEEPROM();
+bool saveWiFiSettingsToEEPROM();
 void loadWiFiSettingsFromEEPROM();
-void saveUpdateSettingsToEEPROM();
+bool saveUpdateSettingsToEEPROM();
 void loadUpdateSettingsFromEEPROM();
-bool connectToWiFi();
-void saveMLSettingsToEEPROM();
+void startWiFiConnection();
+void handleWiFiConnection(unsigned long now);
+void bootPhaseBegin(BootPhase phase);
+void bootPhaseEnd(BootPhase phase);
+void startStorage();
+void saveBootLogEntry();
+bool saveMLSettingsToEEPROM();
 void loadMLSettingsFromEEPROM();
 void publishMqttML();
+void publishMqttSchemas();
 void syncRelays();  // Синхронизация состояния реле с переменными
-void saveRelaySettingsToEEPROM();
+void writeRelayPin(uint8_t pin, uint8_t level);
+bool writeEEPROMBlob(int addr, const String& json, int maxLen);
+bool readEEPROMBlob(int addr, int maxLen, String& json);
+bool saveRelaySettingsToEEPROM();
 void loadRelaySettingsFromEEPROM();
-void saveComfortSettingsToEEPROM();
+bool saveComfortSettingsToEEPROM();
 void loadComfortSettingsFromEEPROM();
 void saveWorkModeToEEPROM();
 void loadWorkModeFromEEPROM();
@@ -400,9 +612,9 @@ void saveEventLogToEEPROM();
 void loadEventLogFromEEPROM();
 void saveFanStatsToEEPROM();
 void loadFanStatsFromEEPROM();
-void startIgnition();
-void checkBoilerExtinguished(unsigned long now);
-void checkIgnitionProgress(unsigned long now);
+void formatControlTrigger(uint8_t trigger, char* buf, size_t size);
+void renderDisplayModel(const DisplayModel& model);
+void showDisplayMessage(const char* title, int percent);
 
 // Функция обработки прерывания энкодера с улучшенной фильтрацией дребезга
 void IRAM_ATTR encoderISR() {
@@ -467,114 +679,200 @@ void IRAM_ATTR encoderISR() {
 }
 
 // Обновление дисплея OLED
-void updateDisplay() {
-  u8g2.clearBuffer();
+// Тайловые ряды, которые задевает строка (по высоте всех глифов шрифта)
+void computeDisplayLineRows() {
+  u8g2.setFontRefHeightAll();
+  for (int i = 0; i < DISPLAY_LINE_COUNT; i++) {
+    u8g2.setFont(DISPLAY_LINES[i].font);
+    displayLineRows[i] = displayLineRowsMask(DISPLAY_LINES[i].baseline, u8g2.getAscent(), u8g2.getDescent());
+  }
+}
+
+// Снимок основного экрана из текущего состояния (только форматирование строк)
+void buildDisplayModel(DisplayModel& model) {
+  model.screen = DISPLAY_SCREEN_MAIN;
+  model.percent = -1;
   
   // Температура подачи (крупным шрифтом)
-  u8g2.setFont(u8g2_font_ncenB18_tr);
-  char tempStr[16];
   if (supplyTemp > 0) {
-    snprintf(tempStr, sizeof(tempStr), "%.1f°C", supplyTemp);
+    snprintf(model.lines[0], DISPLAY_LINE_LENGTH, "%.1f°C", supplyTemp);
   } else {
-    strcpy(tempStr, "--°C");
+    strcpy(model.lines[0], "--°C");
   }
-  u8g2.drawStr(0, 25, tempStr);
   
   // Уставка (меньшим шрифтом)
-  u8g2.setFont(u8g2_font_ncenB10_tr);
-  char setpointStr[16];
-  snprintf(setpointStr, sizeof(setpointStr), "Уст: %.1f°C", setpoint);
-  u8g2.drawStr(0, 40, setpointStr);
+  snprintf(model.lines[1], DISPLAY_LINE_LENGTH, "Уст: %.1f°C", setpoint);
   
   // Статус подброса угля (если активен) или текущее время или состояние погасания/розжига
-  if (boilerExtinguished || systemState == "КОТЕЛ_ПОГАС") {
-    u8g2.setFont(u8g2_font_ncenB10_tr);
-    u8g2.drawStr(0, 55, "КОТЕЛ ПОГАС");
-  } else if (ignitionInProgress || systemState == "РОЗЖИГ") {
-    u8g2.setFont(u8g2_font_ncenB10_tr);
-    unsigned long elapsed = (millis() >= ignitionStartTime) ? (millis() - ignitionStartTime) : (ULONG_MAX - ignitionStartTime + millis());
-    char ignitionStr[20];
-    snprintf(ignitionStr, sizeof(ignitionStr), "РОЗЖИГ %luм", elapsed / 60000);
-    u8g2.drawStr(0, 55, ignitionStr);
-  } else if (systemState == "ОШИБКА_РОЗЖИГА") {
-    u8g2.setFont(u8g2_font_ncenB10_tr);
-    u8g2.drawStr(0, 55, "ОШИБКА РОЗЖИГА");
+  model.lines[2][0] = '\0';
+  if (boilerExtinguished || systemState == STATE_EXTINGUISHED) {
+    strcpy(model.lines[2], "КОТЕЛ ПОГАС");
+  } else if (ignitionInProgress || systemState == STATE_IGNITION) {
+    unsigned long elapsed = millis() - ignitionStartTime;
+    snprintf(model.lines[2], DISPLAY_LINE_LENGTH, "РОЗЖИГ %luм", elapsed / 60000);
+  } else if (systemState == STATE_IGNITION_FAILED) {
+    strcpy(model.lines[2], "ОШИБКА РОЗЖИГА");
   } else if (coalFeedingActive) {
     int remaining = getCoalFeedingRemainingSeconds(); // Оставшееся время
     int minutes = remaining / 60;
     int seconds = remaining % 60;
-    char coalStr[20];
-    snprintf(coalStr, sizeof(coalStr), "Уголь: %02d:%02d", minutes, seconds);
-    u8g2.drawStr(0, 55, coalStr);
+    snprintf(model.lines[2], DISPLAY_LINE_LENGTH, "Уголь: %02d:%02d", minutes, seconds);
   } else {
     // Показываем текущее время с секундами, если нет подброса угля
-    if (ntpSettings.enabled && timeClient.isTimeSet()) {
-      timeClient.update();
-      unsigned long epochTime = timeClient.getEpochTime();
-      time_t rawTime = epochTime;
-      struct tm *timeinfo = localtime(&rawTime);
-      if (timeinfo != NULL) {
-        char timeStr[20];
-        snprintf(timeStr, sizeof(timeStr), "%02d:%02d:%02d", 
-                 timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
-        u8g2.drawStr(0, 55, timeStr);
-      }
+    if (ntpSettings.enabled && timeService.isSynced()) {
+      strcpy(model.lines[2], timeService.timeString());
     }
   }
   // Загрузка CPU убрана с дисплея
   
   // Нижняя строка: состояние системы и активный таймер
-  u8g2.setFont(u8g2_font_6x10_tr);
-  String bottomLine = "";
+  char* bottomLine = model.lines[3];
   unsigned long now = millis();
   
   // Определяем активный таймер для отображения
   if (ignitionInProgress && ignitionStartTime > 0) {
-    unsigned long elapsed = (now >= ignitionStartTime) ? (now - ignitionStartTime) : (ULONG_MAX - ignitionStartTime + now);
+    unsigned long elapsed = now - ignitionStartTime;
     unsigned long minutes = elapsed / 60000;
     unsigned long seconds = (elapsed % 60000) / 1000;
-    char timerStr[16];
-    snprintf(timerStr, sizeof(timerStr), "Розж:%lu:%02lu", minutes, seconds);
-    bottomLine = String(timerStr);
+    snprintf(bottomLine, DISPLAY_LINE_LENGTH, "Розж:%lu:%02lu", minutes, seconds);
   } else if (coalFeedingActive && coalFeedingStartTime > 0) {
-    unsigned long elapsed = (now >= coalFeedingStartTime) ? (now - coalFeedingStartTime) : (ULONG_MAX - coalFeedingStartTime + now);
+    unsigned long elapsed = now - coalFeedingStartTime;
     unsigned long remaining = (COAL_FEEDING_DURATION > elapsed) ? (COAL_FEEDING_DURATION - elapsed) : 0;
     unsigned long minutes = remaining / 60000;
     unsigned long seconds = (remaining % 60000) / 1000;
-    char timerStr[16];
-    snprintf(timerStr, sizeof(timerStr), "Уголь:%lu:%02lu", minutes, seconds);
-    bottomLine = String(timerStr);
+    snprintf(bottomLine, DISPLAY_LINE_LENGTH, "Уголь:%lu:%02lu", minutes, seconds);
   } else if (fanStartTime > 0 && fanState) {
-    unsigned long elapsed = (now >= fanStartTime) ? (now - fanStartTime) : (ULONG_MAX - fanStartTime + now);
+    unsigned long elapsed = now - fanStartTime;
     unsigned long minutes = elapsed / 60000;
     unsigned long seconds = (elapsed % 60000) / 1000;
-    char timerStr[16];
-    snprintf(timerStr, sizeof(timerStr), "Вент:%lu:%02lu", minutes, seconds);
-    bottomLine = String(timerStr);
+    snprintf(bottomLine, DISPLAY_LINE_LENGTH, "Вент:%lu:%02lu", minutes, seconds);
   } else {
-    // Показываем состояние системы
-    if (systemState.length() > 0) {
-      // Сокращаем длинные состояния
-      String stateDisplay = systemState;
-      if (stateDisplay == "КОТЕЛ_ПОГАС") stateDisplay = "ПОГАС";
-      else if (stateDisplay == "ОШИБКА_РОЗЖИГА") stateDisplay = "ОШИБКА";
-      else if (stateDisplay == "HEATING_TIMEOUT") stateDisplay = "ТАЙМАУТ";
-      else if (stateDisplay == "COAL_BURNED") stateDisplay = "ПРОГОРЕЛ";
-      else if (stateDisplay == "HIGH_TEMP") stateDisplay = "ВЫСОКАЯ";
-      bottomLine = stateDisplay;
-    } else {
-      bottomLine = systemEnabled ? "РАБОТА" : "СТОП";
-    }
+    // Показываем состояние системы (короткое имя из таблицы)
+    snprintf(bottomLine, DISPLAY_LINE_LENGTH, "%s", SYSTEM_STATES[systemState].shortName);
   }
   
   // Обрезаем строку если слишком длинная (максимум 16 символов для дисплея)
-  if (bottomLine.length() > 16) {
-    bottomLine = bottomLine.substring(0, 16);
+  bottomLine[16] = '\0';
+}
+
+// Публикация модели задаче дисплея. Не блокирует: непрочитанный кадр заменяется новым
+void publishDisplayModel(const DisplayModel& model) {
+  if (displayQueue != NULL) {
+    xQueueOverwrite(displayQueue, &model);
+  } else {
+    renderDisplayModel(model);  // Задача не запущена - рисуем сами
+  }
+}
+
+// Задача дисплея: ждет модель и рисует ее, управление и сеть на шину не ждут
+void displayTask(void* parameter) {
+  DisplayModel model;
+  for (;;) {
+    if (xQueueReceive(displayQueue, &model, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    uint32_t start = micros();
+    renderDisplayModel(model);
+    uint32_t elapsed = micros() - start;
+    displayRenderUs = elapsed;
+    if (elapsed > displayRenderMaxUs) {
+      displayRenderMaxUs = elapsed;
+    }
+  }
+}
+
+bool startDisplayTask() {
+  displayQueue = xQueueCreate(1, sizeof(DisplayModel));
+  if (displayQueue == NULL) {
+    return false;
+  }
+  // Низкий приоритет, ядро 0: loop() работает на ядре 1
+  if (xTaskCreatePinnedToCore(displayTask, "display", 4096, NULL, 1, &displayTaskHandle, 0) != pdPASS) {
+    vQueueDelete(displayQueue);
+    displayQueue = NULL;
+    return false;
+  }
+  return true;
+}
+
+void updateDisplay() {
+  DisplayModel model;
+  buildDisplayModel(model);
+  publishDisplayModel(model);
+}
+
+// Экран-сообщение (OTA, загрузка обновления), percent < 0 - без прогресса
+void showDisplayMessage(const char* title, int percent) {
+  DisplayModel model;
+  model.screen = DISPLAY_SCREEN_MESSAGE;
+  model.percent = percent > 100 ? 100 : percent;
+  snprintf(model.lines[0], DISPLAY_LINE_LENGTH, "%s", title);
+  for (int i = 1; i < DISPLAY_LINE_COUNT; i++) {
+    model.lines[i][0] = '\0';
+  }
+  publishDisplayModel(model);
+}
+
+// Отрисовка сообщения: всегда целиком
+void renderDisplayMessage(const DisplayModel& model) {
+  u8g2.clearBuffer();
+  if (model.percent < 0) {
+    u8g2.setFont(u8g2_font_ncenB14_tr);
+    u8g2.drawStr(0, 30, model.lines[0]);
+  } else {
+    u8g2.setFont(u8g2_font_ncenB10_tr);
+    u8g2.drawStr(0, 20, model.lines[0]);
+    char progressStr[8];
+    snprintf(progressStr, sizeof(progressStr), "%d%%", model.percent);
+    u8g2.drawStr(0, 40, progressStr);
+    u8g2.drawBox(0, 50, model.percent, 8);  // Прогресс-бар
+  }
+  u8g2.sendBuffer();
+  displayFrames++;
+  displayBytesSent += DISPLAY_FRAME_BYTES;
+  displayFullRedraw = true;  // Основной экран после этого - целиком
+}
+
+// Отрисовка модели в буфер u8g2 (задний буфер) и отправка готового кадра.
+// Вызывается только из задачи дисплея
+void renderDisplayModel(const DisplayModel& model) {
+  if (model.screen == DISPLAY_SCREEN_MESSAGE) {
+    renderDisplayMessage(model);
+    return;
   }
+  const char (*lines)[DISPLAY_LINE_LENGTH] = model.lines;
   
-  u8g2.drawStr(0, 64, bottomLine.c_str());
+  // Какие тайловые ряды изменились
+  if (displayLineRows[0] == 0) {
+    computeDisplayLineRows();
+  }
+  uint8_t dirtyRows = displayDirtyRows(model, displayLastLines, displayLineRows, displayFullRedraw);
+  if (dirtyRows == 0) {
+    displaySkippedFrames++;
+    return;
+  }
   
-  u8g2.sendBuffer();
+  // Буфер в RAM рисуется целиком: соседние строки могут делить тайловый ряд
+  u8g2.clearBuffer();
+  for (int i = 0; i < DISPLAY_LINE_COUNT; i++) {
+    if (lines[i][0] != '\0') {
+      u8g2.setFont(DISPLAY_LINES[i].font);
+      u8g2.drawStr(0, DISPLAY_LINES[i].baseline, lines[i]);
+    }
+  }
+  
+  displayFrames++;
+  if (displayFullRedraw) {
+    u8g2.sendBuffer();
+    displayBytesSent += DISPLAY_FRAME_BYTES;
+    displayFullRedraw = false;
+    return;
+  }
+  
+  // По шине - только непрерывные участки измененных рядов (ряд = 16 тайлов по 8 байт)
+  displayBytesSent += displaySendDirtyRows(dirtyRows, [](uint8_t tileRow, uint8_t rowCount) {
+    u8g2.updateDisplayArea(0, tileRow, DISPLAY_ROW_BYTES / 8, rowCount);
+  });
 }
 
 // Функция получения температуры по адресу датчика (проверяет обе шины)
@@ -609,82 +907,66 @@ float getTemperatureByAddress(String address) {
   return DEVICE_DISCONNECTED_C;
 }
 
-// Функция добавления значения в историю с защитой от помех
-void addToHistory(TemperatureHistory* history, float newValue) {
+#ifdef BOILER_SIMULATION
+// Шаг модели и подача ее температур через те же фильтры, что и у реальных датчиков
+void updateSimulatedTemperatures() {
+  static unsigned long lastStepTime = 0;
+  static unsigned long lastTraceTime = 0;
   unsigned long now = millis();
   
-  // Проверка на валидность значения
-  if (newValue < -50.0 || newValue > 150.0) {
-    // Недопустимое значение - помеха
-    history->isValid = false;
-    return;
-  }
-  
-  // Защита от резких скачков (помехи)
-  if (history->count > 0) {
-    float lastValue = history->values[(history->index - 1 + TEMP_HISTORY_SIZE) % TEMP_HISTORY_SIZE];
-    float diff = abs(newValue - lastValue);
-    
-    if (diff > TEMP_NOISE_THRESHOLD) {
-      // Слишком большой скачок - вероятно помеха
-      // Для датчика обратки делаем более мягкую проверку (он часто отваливается)
-      if (history != &returnHistory || diff > TEMP_NOISE_THRESHOLD * 2) {
-        history->isValid = false;
-        return;
-      }
-    }
+  if (lastStepTime != 0) {
+    float dt = (now - lastStepTime) / 1000.0;
+    boilerSim.step(dt, fanState, pumpState);
   }
+  lastStepTime = now;
   
-  // Добавляем значение в историю
-  history->values[history->index] = newValue;
-  history->index = (history->index + 1) % TEMP_HISTORY_SIZE;
-  if (history->count < TEMP_HISTORY_SIZE) {
-    history->count++;
-  }
-  history->lastUpdate = now;
-  history->isValid = true;
-}
-
-// Функция определения тренда температуры
-// Возвращает: 1 = рост, 0 = стабильно, -1 = падение
-int getTemperatureTrend(TemperatureHistory* history) {
-  if (history->count < TEMP_TREND_SAMPLES || !history->isValid) {
-    return 0; // Недостаточно данных или невалидные данные
+  const BoilerSimState& sim = boilerSim.state();
+  if (sensorFilters[SENSOR_SUPPLY].process(sim.supplyTemp, now) == FILTER_ACCEPTED) {
+    lastValidSupplyTempTime = now;
+    supplyTemp = sensorFilters[SENSOR_SUPPLY].value();
+    addToHistory(&supplyHistory, supplyTemp, now);
   }
-  
-  // Берем последние TEMP_TREND_SAMPLES значений для анализа
-  int samples = min(TEMP_TREND_SAMPLES, history->count);
-  float firstHalf = 0, secondHalf = 0;
-  
-  // Первая половина (старые значения) - первые samples/2 значений
-  int firstCount = samples / 2;
-  for (int i = 0; i < firstCount; i++) {
-    int idx = (history->index - samples + i + TEMP_HISTORY_SIZE) % TEMP_HISTORY_SIZE;
-    firstHalf += history->values[idx];
+  if (sensorFilters[SENSOR_RETURN].process(sim.returnTemp, now) == FILTER_ACCEPTED) {
+    lastValidReturnTempTime = now;
+    returnTemp = sensorFilters[SENSOR_RETURN].value();
+    addToHistory(&returnHistory, returnTemp, now);
   }
-  firstHalf /= firstCount;
-  
-  // Вторая половина (новые значения) - последние samples/2 значений
-  int secondCount = samples - firstCount;
-  for (int i = firstCount; i < samples; i++) {
-    int idx = (history->index - samples + i + TEMP_HISTORY_SIZE) % TEMP_HISTORY_SIZE;
-    secondHalf += history->values[idx];
+  if (sensorFilters[SENSOR_BOILER].process(sim.boilerTemp, now) == FILTER_ACCEPTED) {
+    lastValidBoilerTempTime = now;
+    boilerTemp = sensorFilters[SENSOR_BOILER].value();
+    addToHistory(&boilerHistory, boilerTemp, now);
   }
-  secondHalf /= secondCount;
-  
-  float diff = secondHalf - firstHalf;
-  
-  if (diff > TEMP_CHANGE_THRESHOLD) {
-    return 1; // Рост
-  } else if (diff < -TEMP_CHANGE_THRESHOLD) {
-    return -1; // Падение
+  if (sensorFilters[SENSOR_OUTDOOR].process(sim.outdoorTemp, now) == FILTER_ACCEPTED) {
+    lastValidOutdoorTempTime = now;
+    outdoorTemp = sensorFilters[SENSOR_OUTDOOR].value();
+    addToHistory(&outdoorHistory, outdoorTemp, now);
+  }
+  // Температура дома в реальности приходит от ESP01 по MQTT
+  if (sensorFilters[SENSOR_HOME].process(sim.houseTemp, now) == FILTER_ACCEPTED) {
+    homeTemp = sensorFilters[SENSOR_HOME].value();
+    lastHomeTempUpdate = now;
+    homeTempSensorLWTOnline = true;
+    addToHistory(&homeHistory, homeTemp, now);
+    requestControlEvaluation(CONTROL_TRIGGER_HOME);
+  }
+  requestControlEvaluation(CONTROL_TRIGGER_SENSORS);
+  
+  if (now - lastTraceTime >= BOILER_SIM_TRACE_INTERVAL) {
+    lastTraceTime = now;
+    char line[128];
+    boilerSim.formatTrace(line, sizeof(line), fanState, pumpState);
+    Serial.print("SIM,");
+    Serial.println(line);
   }
-  
-  return 0; // Стабильно
 }
+#endif
 
 // Обновление температур с датчиков (работает с двумя шинами) - АСИНХРОННОЕ
 void updateTemperatures() {
+#ifdef BOILER_SIMULATION
+  updateSimulatedTemperatures();
+  return;
+#endif
   unsigned long now = millis();
   
   // Если запрос еще не отправлен, отправляем его
@@ -705,86 +987,81 @@ void updateTemperatures() {
   // Если запрос отправлен, проверяем, прошло ли достаточно времени для конвертации
   if (tempRequestPending) {
     // Защита от переполнения millis()
-    unsigned long elapsed = (now >= tempRequestTime) ? (now - tempRequestTime) : (ULONG_MAX - tempRequestTime + now);
+    unsigned long elapsed = now - tempRequestTime;
     
     if (elapsed >= TEMP_CONVERSION_DELAY) {
-      // Время конвертации прошло, читаем температуры
+      // Время конвертации прошло, читаем температуры.
+      // Фильтр канала отбрасывает зависания (0/85°C) и выход за диапазон,
+      // а медиана и ограничение скорости гасят помехи без "залипания" на старом значении
+      int16_t traceRaw[4] = {TRACE_SENSOR_NO_VALUE, TRACE_SENSOR_NO_VALUE, TRACE_SENSOR_NO_VALUE, TRACE_SENSOR_NO_VALUE};  // Сырые значения для трассы
       if (sensorMapping.supply.length() == 16) {
         float temp = getTemperatureByAddress(sensorMapping.supply);
+        traceRaw[SENSOR_SUPPLY] = (int16_t)(temp * 100);
         if (temp != DEVICE_DISCONNECTED_C && temp != -127.0) {
-          // Проверка на зависание (0 или 85 градусов), но разрешаем отрицательные температуры
-          if ((temp < -0.1 || temp > 0.1) && temp < 84.9) {
-            // Валидное показание (включая отрицательные) - обновляем время
+          if (sensorFilters[SENSOR_SUPPLY].process(temp, now) == FILTER_ACCEPTED) {
             lastValidSupplyTempTime = now;
-            supplyTemp = temp;
-            addToHistory(&supplyHistory, temp);
-          } else {
-            // Зависшее показание (0 или 85) - не обновляем температуру, но проверяем таймер
-            if (lastValidSupplyTempTime == 0) {
-              lastValidSupplyTempTime = now;  // Первое показание - устанавливаем время
-            }
+            supplyTemp = sensorFilters[SENSOR_SUPPLY].value();
+            addToHistory(&supplyHistory, supplyTemp, now);
+          } else if (lastValidSupplyTempTime == 0) {
+            lastValidSupplyTempTime = now;  // Первое показание - устанавливаем время
           }
+        } else {
+          sensorReadFailures[SENSOR_SUPPLY]++;
         }
       }
       
       if (sensorMapping.return_sensor.length() == 16) {
         float temp = getTemperatureByAddress(sensorMapping.return_sensor);
+        traceRaw[SENSOR_RETURN] = (int16_t)(temp * 100);
         if (temp != DEVICE_DISCONNECTED_C && temp != -127.0) {
-          // Проверка на зависание (0 или 85 градусов), но разрешаем отрицательные температуры
-          if ((temp < -0.1 || temp > 0.1) && temp < 84.9) {
-            // Валидное показание (включая отрицательные) - обновляем время
+          if (sensorFilters[SENSOR_RETURN].process(temp, now) == FILTER_ACCEPTED) {
+            lastValidReturnTempTime = now;
+            returnTemp = sensorFilters[SENSOR_RETURN].value();
+            addToHistory(&returnHistory, returnTemp, now);
+          } else if (lastValidReturnTempTime == 0) {
             lastValidReturnTempTime = now;
-            // Для датчика обратки - базовая защита от помех (только очень большие скачки)
-            // Принимаем значение если оно первое или изменение не слишком большое
-            if (returnTemp == 0.0 || abs(temp - returnTemp) < TEMP_NOISE_THRESHOLD * 2 || abs(temp - returnTemp) < 10.0) {
-              returnTemp = temp;
-              addToHistory(&returnHistory, temp);
-            }
-          } else {
-            // Зависшее показание (0 или 85) - не обновляем температуру, но проверяем таймер
-            if (lastValidReturnTempTime == 0) {
-              lastValidReturnTempTime = now;  // Первое показание - устанавливаем время
-            }
           }
+        } else {
+          sensorReadFailures[SENSOR_RETURN]++;
         }
       }
       
       if (sensorMapping.boiler.length() == 16) {
         float temp = getTemperatureByAddress(sensorMapping.boiler);
+        traceRaw[SENSOR_BOILER] = (int16_t)(temp * 100);
         if (temp != DEVICE_DISCONNECTED_C && temp != -127.0) {
-          // Проверка на зависание (0 или 85 градусов), но разрешаем отрицательные температуры
-          if ((temp < -0.1 || temp > 0.1) && temp < 84.9) {
-            // Валидное показание (включая отрицательные) - обновляем время
+          if (sensorFilters[SENSOR_BOILER].process(temp, now) == FILTER_ACCEPTED) {
+            lastValidBoilerTempTime = now;
+            boilerTemp = sensorFilters[SENSOR_BOILER].value();
+            addToHistory(&boilerHistory, boilerTemp, now);
+          } else if (lastValidBoilerTempTime == 0) {
             lastValidBoilerTempTime = now;
-            boilerTemp = temp;
-            addToHistory(&boilerHistory, temp);
-          } else {
-            // Зависшее показание (0 или 85) - не обновляем температуру, но проверяем таймер
-            if (lastValidBoilerTempTime == 0) {
-              lastValidBoilerTempTime = now;  // Первое показание - устанавливаем время
-            }
           }
+        } else {
+          sensorReadFailures[SENSOR_BOILER]++;
         }
       }
       
       if (sensorMapping.outside.length() == 16) {
         float temp = getTemperatureByAddress(sensorMapping.outside);
+        traceRaw[SENSOR_OUTDOOR] = (int16_t)(temp * 100);
         if (temp != DEVICE_DISCONNECTED_C && temp != -127.0) {
-          // Для датчика улицы: 0°C - валидное значение (зима), блокируем только 85°C
-          if (temp < 84.9) {
-            // Валидное показание (включая 0°C) - обновляем время
+          // Для датчика улицы 0°C - валидное значение (зима), фильтр блокирует только 85°C
+          if (sensorFilters[SENSOR_OUTDOOR].process(temp, now) == FILTER_ACCEPTED) {
+            lastValidOutdoorTempTime = now;
+            outdoorTemp = sensorFilters[SENSOR_OUTDOOR].value();
+            addToHistory(&outdoorHistory, outdoorTemp, now);
+          } else if (lastValidOutdoorTempTime == 0) {
             lastValidOutdoorTempTime = now;
-            outdoorTemp = temp;
-            addToHistory(&outdoorHistory, temp);
-          } else {
-            // Зависшее показание (85°C) - не обновляем температуру, но проверяем таймер
-            if (lastValidOutdoorTempTime == 0) {
-              lastValidOutdoorTempTime = now;  // Первое показание - устанавливаем время
-            }
           }
+        } else {
+          sensorReadFailures[SENSOR_OUTDOOR]++;
         }
       }
       
+      traceRecorder.record(TRACE_SENSORS, (const uint8_t*)traceRaw, sizeof(traceRaw));
+      requestControlEvaluation(CONTROL_TRIGGER_SENSORS);
+      
       // Сбрасываем флаг для следующего запроса
       tempRequestPending = false;
     }
@@ -806,7 +1083,7 @@ void checkSensorsFreeze() {
   
   // Проверка датчика подачи
   if (sensorMapping.supply.length() == 16 && lastValidSupplyTempTime > 0) {
-    unsigned long timeSinceValid = (now >= lastValidSupplyTempTime) ? (now - lastValidSupplyTempTime) : (ULONG_MAX - lastValidSupplyTempTime + now);
+    unsigned long timeSinceValid = now - lastValidSupplyTempTime;
     if (timeSinceValid >= SENSORS_FREEZE_TIMEOUT) {
       needReset = true;
       frozenSensor = "supply";
@@ -816,7 +1093,7 @@ void checkSensorsFreeze() {
   
   // Проверка датчика обратки
   if (sensorMapping.return_sensor.length() == 16 && lastValidReturnTempTime > 0) {
-    unsigned long timeSinceValid = (now >= lastValidReturnTempTime) ? (now - lastValidReturnTempTime) : (ULONG_MAX - lastValidReturnTempTime + now);
+    unsigned long timeSinceValid = now - lastValidReturnTempTime;
     if (timeSinceValid >= SENSORS_FREEZE_TIMEOUT) {
       needReset = true;
       frozenSensor = "return";
@@ -826,7 +1103,7 @@ void checkSensorsFreeze() {
   
   // Проверка датчика котельной
   if (sensorMapping.boiler.length() == 16 && lastValidBoilerTempTime > 0) {
-    unsigned long timeSinceValid = (now >= lastValidBoilerTempTime) ? (now - lastValidBoilerTempTime) : (ULONG_MAX - lastValidBoilerTempTime + now);
+    unsigned long timeSinceValid = now - lastValidBoilerTempTime;
     if (timeSinceValid >= SENSORS_FREEZE_TIMEOUT) {
       needReset = true;
       frozenSensor = "boiler";
@@ -838,7 +1115,7 @@ void checkSensorsFreeze() {
   if (sensorMapping.outside.length() == 16 && lastValidOutdoorTempTime > 0) {
     // Проверяем, что текущее показание действительно 85°C (зависание)
     if (outdoorTemp >= 84.9) {
-      unsigned long timeSinceValid = (now >= lastValidOutdoorTempTime) ? (now - lastValidOutdoorTempTime) : (ULONG_MAX - lastValidOutdoorTempTime + now);
+      unsigned long timeSinceValid = now - lastValidOutdoorTempTime;
       if (timeSinceValid >= SENSORS_FREEZE_TIMEOUT) {
         needReset = true;
         frozenSensor = "outside";
@@ -852,7 +1129,7 @@ void checkSensorsFreeze() {
     Serial.println(frozenSensor);
     sensorsRelayState = false;
     int sensorsLevel = relaySettings.sensorsOffIsLow ? LOW : HIGH;
-    digitalWrite(PIN_RELAY_SENSORS, sensorsLevel);
+    writeRelayPin(PIN_RELAY_SENSORS, sensorsLevel);
     sensorsAutoResetInProgress = true;
     sensorsAutoResetStartTime = now;
     // Сбрасываем таймеры валидных показаний
@@ -869,12 +1146,12 @@ void checkSensorsDetection() {
   
   // Если идет автоматический сброс, обрабатываем его
   if (sensorsAutoResetInProgress) {
-    unsigned long elapsed = (now >= sensorsAutoResetStartTime) ? (now - sensorsAutoResetStartTime) : (ULONG_MAX - sensorsAutoResetStartTime + now);
+    unsigned long elapsed = now - sensorsAutoResetStartTime;
     
     if (elapsed >= SENSORS_RESET_DELAY) {
       // Время сброса прошло, включаем реле обратно
       sensorsRelayState = true;
-      digitalWrite(PIN_RELAY_SENSORS, HIGH);
+      writeRelayPin(PIN_RELAY_SENSORS, HIGH);
       sensorsAutoResetInProgress = false;
       lastSensorsDetectedTime = now;  // Сбрасываем таймер после сброса
       Serial.println("[Авто-сброс датчиков] Реле включено после автоматического сброса");
@@ -903,14 +1180,14 @@ void checkSensorsDetection() {
     } else {
       // Датчики не обнаружены - проверяем таймаут
       if (lastSensorsDetectedTime > 0) {
-        unsigned long timeSinceDetection = (now >= lastSensorsDetectedTime) ? (now - lastSensorsDetectedTime) : (ULONG_MAX - lastSensorsDetectedTime + now);
+        unsigned long timeSinceDetection = now - lastSensorsDetectedTime;
         
         if (timeSinceDetection >= SENSORS_AUTO_RESET_TIMEOUT) {
           // Прошло 60 секунд без обнаружения - выполняем автоматический сброс
           Serial.println("[Авто-сброс датчиков] Датчики не обнаружены 60 секунд, выполняю сброс питания...");
           sensorsRelayState = false;
           int sensorsLevel = relaySettings.sensorsOffIsLow ? LOW : HIGH;
-          digitalWrite(PIN_RELAY_SENSORS, sensorsLevel);
+          writeRelayPin(PIN_RELAY_SENSORS, sensorsLevel);
           sensorsAutoResetInProgress = true;
           sensorsAutoResetStartTime = now;
         }
@@ -922,83 +1199,178 @@ void checkSensorsDetection() {
   }
 }
 
+// Запись JSON-блока настроек: длина (int) по адресу addr, затем сами байты.
+// Вызывается между EEPROM.begin() и EEPROM.commit().
+bool writeEEPROMBlob(int addr, const String& json, int maxLen) {
+  int len = json.length();
+  if (len > maxLen) {
+    // Обрезанный JSON все равно не распарсится - оставляем прежние настройки
+    Serial.printf("[EEPROM] Блок по адресу %d слишком длинный (%d > %d), не сохранен\n", addr, len, maxLen);
+    return false;
+  }
+  EEPROM.put(addr, len);
+  for (int i = 0; i < len; i++) {
+    EEPROM.write(addr + 4 + i, json[i]);
+  }
+  return true;
+}
+
+// Чтение JSON-блока настроек, false если длина невалидна (пустая ячейка или мусор)
+bool readEEPROMBlob(int addr, int maxLen, String& json) {
+  int len = 0;
+  EEPROM.get(addr, len);
+  if (len <= 0 || len > maxLen) {
+    return false;
+  }
+  json = "";
+  json.reserve(len);
+  for (int i = 0; i < len; i++) {
+    json += (char)EEPROM.read(addr + 4 + i);
+  }
+  return true;
+}
+
+// Управление выходом реле - единственное место, где логика касается GPIO реле
+void writeRelayPin(uint8_t pin, uint8_t level) {
+  // В трассу попадают только переключения, а не повторы syncRelays()
+  static uint64_t knownPins = 0;
+  static uint64_t highPins = 0;
+  uint64_t bit = 1ULL << pin;
+  bool high = (level == HIGH);
+  if (!(knownPins & bit) || ((highPins & bit) != 0) != high) {
+    uint8_t payload[2] = {pin, level};
+    traceRecorder.record(TRACE_RELAY, payload, sizeof(payload));
+    knownPins |= bit;
+    if (high) highPins |= bit; else highPins &= ~bit;
+  }
+  digitalWrite(pin, level);
+}
+
+// Значение в пределах: для строк - длина, для чисел - диапазон
+bool settingValueValid(const SettingsFieldLimit& limit, JsonVariantConst value) {
+  if (limit.isString) {
+    if (!value.is<const char*>()) {
+      return false;
+    }
+    size_t len = strlen(value.as<const char*>());
+    return len >= limit.minValue && len <= limit.maxValue;
+  }
+  return value.is<float>() && settingNumberValid(limit, value.as<float>());
+}
+
+// Проверка полей по таблице пределов, возвращает имя неверного поля или nullptr
+const char* validateSettingsFields(const SettingsFieldLimit* limits, uint8_t count, JsonObjectConst obj) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (obj.containsKey(limits[i].key) && !settingValueValid(limits[i], obj[limits[i].key])) {
+      return limits[i].key;
+    }
+  }
+  return nullptr;
+}
+
+// Ответ 400 на поле вне пределов таблицы; group - nullptr для POST одной группы
+void sendInvalidSetting(const char* group, const char* field) {
+  DynamicJsonDocument errorDoc(192);
+  errorDoc["error"] = "Invalid value";
+  if (group != nullptr) {
+    errorDoc["group"] = group;
+  }
+  errorDoc["field"] = field;
+  String response;
+  serializeJson(errorDoc, response);
+  server.send(400, "application/json", response);
+}
+
+// Ответ на неудачное сохранение: прежние значения уже возвращены вызывающим
+void sendSettingsSaveFailed() {
+  server.send(500, "application/json", "{\"error\":\"EEPROM write failed\"}");
+}
+
+// Поле из блока EEPROM, если оно есть и проходит пределы таблицы; иначе
+// остается прежнее значение (по умолчанию)
+template <typename T>
+void loadSettingField(JsonObjectConst doc, const SettingsFieldLimit* limits, uint8_t count, const char* key, T& field) {
+  if (!doc.containsKey(key)) {
+    return;
+  }
+  const SettingsFieldLimit* limit = findSettingsLimit(limits, count, key);
+  if (limit == nullptr || settingValueValid(*limit, doc[key])) {
+    field = doc[key].as<T>();
+  }
+}
+
+// Поля Авто/Комфорта по таблицам переменных lib/BoilerCommands: целые поля
+// (минуты) в JSON остаются целыми
+void settingsValuesToJson(JsonObject doc, const SettingsFieldValue* values, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (values[i].floatValue != nullptr) {
+      doc[values[i].key] = *values[i].floatValue;
+    } else {
+      doc[values[i].key] = *values[i].intValue;
+    }
+  }
+}
+
+// Применение из JSON (только значения, без проверки и сохранения)
+void applySettingsValues(JsonObjectConst doc, const SettingsFieldValue* values, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (doc.containsKey(values[i].key)) {
+      setSettingsFieldValue(values[i], doc[values[i].key].as<float>());
+    }
+  }
+}
+
+// Загрузка блока EEPROM: поле вне пределов таблицы оставляет прежнее значение
+void loadSettingsValues(JsonObjectConst doc, const SettingsFieldLimit* limits, uint8_t limitCount,
+                        const SettingsFieldValue* values, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (values[i].floatValue != nullptr) {
+      loadSettingField(doc, limits, limitCount, values[i].key, *values[i].floatValue);
+    } else {
+      loadSettingField(doc, limits, limitCount, values[i].key, *values[i].intValue);
+    }
+  }
+}
+
 // Функции работы с EEPROM
-void saveAutoSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+// Запись блока в открытую сессию EEPROM (без commit)
+bool writeAutoSettingsToEEPROM() {
   EEPROM.put(EEPROM_ADDR_MAGIC, (uint8_t)EEPROM_MAGIC);
   
   // Сохранение через JSON для надежности
   String json;
   DynamicJsonDocument doc(512);
-  doc["setpoint"] = autoSettings.setpoint;
-  doc["minTemp"] = autoSettings.minTemp;
-  doc["maxTemp"] = autoSettings.maxTemp;
-  doc["hysteresis"] = autoSettings.hysteresis;
-  doc["inertiaTemp"] = autoSettings.inertiaTemp;
-  doc["inertiaTime"] = autoSettings.inertiaTime;
-  doc["overheatTemp"] = autoSettings.overheatTemp;
-  doc["heatingTimeout"] = autoSettings.heatingTimeout;
+  settingsValuesToJson(doc.to<JsonObject>(), SETTINGS_VALUES(AUTO_SETTINGS_VALUES));
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_AUTO, len);
-  for (int i = 0; i < len && i < 200; i++) {
-    EEPROM.write(EEPROM_ADDR_AUTO + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_AUTO, json, EEPROM_AUTO_MAX_LEN);
+}
+
+// false - блок не влез в свое место или commit не удался
+bool saveAutoSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeAutoSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
+  return saved;
 }
 
 void loadAutoSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_AUTO, len);
-    if (len > 0 && len < 250) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_AUTO + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_AUTO, EEPROM_AUTO_MAX_LEN, json)) {
       DynamicJsonDocument doc(512);
       DeserializationError error = deserializeJson(doc, json);
       
       if (error == DeserializationError::Ok) {
         // Загрузка значений с проверкой валидности
-        if (doc.containsKey("setpoint")) {
-          float val = doc["setpoint"];
-          if (val >= 40 && val <= 80) autoSettings.setpoint = val;
-        }
-        if (doc.containsKey("minTemp")) {
-          float val = doc["minTemp"];
-          if (val >= 30 && val <= 60) autoSettings.minTemp = val;
-        }
-        if (doc.containsKey("maxTemp")) {
-          float val = doc["maxTemp"];
-          if (val >= 60 && val <= 90) autoSettings.maxTemp = val;
-        }
-        if (doc.containsKey("hysteresis")) {
-          float val = doc["hysteresis"];
-          if (val >= 0.5 && val <= 10) autoSettings.hysteresis = val;
-        }
-        if (doc.containsKey("inertiaTemp")) {
-          float val = doc["inertiaTemp"];
-          if (val >= 40 && val <= 70) autoSettings.inertiaTemp = val;
-        }
-        if (doc.containsKey("inertiaTime")) {
-          int val = doc["inertiaTime"];
-          if (val >= 1 && val <= 60) autoSettings.inertiaTime = val;
-        }
-        if (doc.containsKey("overheatTemp")) {
-          float val = doc["overheatTemp"];
-          if (val >= 70 && val <= 90) autoSettings.overheatTemp = val;
-        }
-        if (doc.containsKey("heatingTimeout")) {
-          int val = doc["heatingTimeout"];
-          if (val >= 10 && val <= 120) autoSettings.heatingTimeout = val;
-        }
+        loadSettingsValues(doc.as<JsonObjectConst>(), SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS),
+                           SETTINGS_VALUES(AUTO_SETTINGS_VALUES));
         
         setpoint = autoSettings.setpoint;
       } else {
@@ -1014,8 +1386,8 @@ void loadAutoSettingsFromEEPROM() {
   EEPROM.end();
 }
 
-void saveMqttSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+// JSON блока настроек MQTT в EEPROM
+String mqttSettingsBlobJson() {
   String json;
   DynamicJsonDocument doc(512);
   doc["enabled"] = mqttSettings.enabled;
@@ -1027,48 +1399,51 @@ void saveMqttSettingsToEEPROM() {
   doc["prefix"] = mqttSettings.prefix;
   doc["tempInterval"] = mqttSettings.tempInterval;
   doc["stateInterval"] = mqttSettings.stateInterval;
+  doc["stateFormat"] = mqttSettings.stateFormat;
   serializeJson(doc, json);
-  
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_MQTT, len);
-  for (int i = 0; i < len && i < 180; i++) {
-    EEPROM.write(EEPROM_ADDR_MQTT + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return json;
+}
+
+bool writeMqttSettingsToEEPROM() {
+  return writeEEPROMBlob(EEPROM_ADDR_MQTT, mqttSettingsBlobJson(), EEPROM_MQTT_MAX_LEN);
+}
+
+bool saveMqttSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeMqttSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
+  return saved;
 }
 
 void loadMqttSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_MQTT, len);
-    if (len > 0 && len < 200) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_MQTT + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_MQTT, EEPROM_MQTT_MAX_LEN, json)) {
       DynamicJsonDocument doc(512);
       deserializeJson(doc, json);
-      if (doc.containsKey("enabled")) mqttSettings.enabled = doc["enabled"];
-      if (doc.containsKey("server")) mqttSettings.server = doc["server"].as<String>();
-      if (doc.containsKey("port")) mqttSettings.port = doc["port"];
-      if (doc.containsKey("useTLS")) mqttSettings.useTLS = doc["useTLS"];
-      if (doc.containsKey("user")) mqttSettings.user = doc["user"].as<String>();
-      if (doc.containsKey("password")) mqttSettings.password = doc["password"].as<String>();
-      if (doc.containsKey("prefix")) mqttSettings.prefix = doc["prefix"].as<String>();
-      if (doc.containsKey("tempInterval")) mqttSettings.tempInterval = doc["tempInterval"];
-      if (doc.containsKey("stateInterval")) mqttSettings.stateInterval = doc["stateInterval"];
+      JsonObjectConst obj = doc.as<JsonObjectConst>();
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "enabled", mqttSettings.enabled);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "server", mqttSettings.server);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "port", mqttSettings.port);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "useTLS", mqttSettings.useTLS);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "user", mqttSettings.user);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "password", mqttSettings.password);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "prefix", mqttSettings.prefix);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "tempInterval", mqttSettings.tempInterval);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "stateInterval", mqttSettings.stateInterval);
+      loadSettingField(obj, SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), "stateFormat", mqttSettings.stateFormat);
     }
   }
   EEPROM.end();
 }
 
-void saveSensorMappingToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeSensorMappingToEEPROM() {
   String json;
   DynamicJsonDocument doc(256);
   doc["supply"] = sensorMapping.supply;
@@ -1077,47 +1452,122 @@ void saveSensorMappingToEEPROM() {
   doc["outside"] = sensorMapping.outside;
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_SENSORS, len);
-  for (int i = 0; i < len && i < 200; i++) {
-    EEPROM.write(EEPROM_ADDR_SENSORS + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_SENSORS, json, EEPROM_SENSORS_MAX_LEN);
+}
+
+bool saveSensorMappingToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeSensorMappingToEEPROM() && EEPROM.commit();
   EEPROM.end();
-  Serial.println("Sensor mapping saved to EEPROM");
+  if (saved) {
+    Serial.println("Sensor mapping saved to EEPROM");
+  }
+  return saved;
 }
 
 void loadSensorMappingFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_SENSORS, len);
-    if (len > 0 && len < 250) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_SENSORS + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_SENSORS, EEPROM_SENSORS_MAX_LEN, json)) {
       DynamicJsonDocument doc(256);
       deserializeJson(doc, json);
-      if (doc.containsKey("supply")) sensorMapping.supply = doc["supply"].as<String>();
-      if (doc.containsKey("return")) sensorMapping.return_sensor = doc["return"].as<String>();
-      if (doc.containsKey("boiler")) sensorMapping.boiler = doc["boiler"].as<String>();
-      if (doc.containsKey("outside")) sensorMapping.outside = doc["outside"].as<String>();
+      JsonObjectConst obj = doc.as<JsonObjectConst>();
+      loadSettingField(obj, SETTINGS_LIMITS(SENSOR_MAPPING_LIMITS), "supply", sensorMapping.supply);
+      loadSettingField(obj, SETTINGS_LIMITS(SENSOR_MAPPING_LIMITS), "return", sensorMapping.return_sensor);
+      loadSettingField(obj, SETTINGS_LIMITS(SENSOR_MAPPING_LIMITS), "boiler", sensorMapping.boiler);
+      loadSettingField(obj, SETTINGS_LIMITS(SENSOR_MAPPING_LIMITS), "outside", sensorMapping.outside);
       Serial.println("Sensor mapping loaded from EEPROM");
     }
   }
   EEPROM.end();
 }
 
-void saveSystemEnabledToEEPROM() {
+// Сохранение настроек фильтров датчиков в EEPROM
+bool saveSensorFiltersToEEPROM() {
   EEPROM.begin(EEPROM_SIZE);
-  EEPROM.put(EEPROM_ADDR_SYSTEM, systemEnabled);
-  EEPROM.commit();
+  EEPROM.put(EEPROM_ADDR_FILTERS, SENSOR_FILTERS_MAGIC);
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+    const SensorFilterConfig& config = sensorFilters[i].config();
+    SensorFilterStored stored;
+    stored.medianWindow = config.medianWindow;
+    stored.smoother = config.smoother;
+    stored.maxRate = config.maxRate;
+    stored.emaAlpha = config.emaAlpha;
+    stored.kalmanQ = config.kalmanQ;
+    stored.kalmanR = config.kalmanR;
+    EEPROM.put(EEPROM_ADDR_FILTERS + 1 + i * sizeof(SensorFilterStored), stored);
+  }
+  bool saved = EEPROM.commit();
   EEPROM.end();
-  Serial.println("System enabled saved to EEPROM");
+  if (saved) {
+    Serial.println("[Фильтры] Настройки сохранены в EEPROM");
+  } else {
+    Serial.println("[Фильтры] ОШИБКА: Не удалось сохранить в EEPROM!");
+  }
+  return saved;
+}
+
+// Поле фильтра из EEPROM, если проходит пределы SENSOR_FILTER_LIMITS
+template <typename T>
+void loadSensorFilterField(const char* key, float value, T& field) {
+  if (settingNumberAllowed(SETTINGS_LIMITS(SENSOR_FILTER_LIMITS), key, value)) {
+    field = (T)value;
+  }
+}
+
+// Загрузка настроек фильтров датчиков из EEPROM
+void loadSensorFiltersFromEEPROM() {
+  EEPROM.begin(EEPROM_SIZE);
+  uint8_t magic = 0;
+  EEPROM.get(EEPROM_ADDR_FILTERS, magic);
+  
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+    SensorFilterConfig config = defaultSensorFilterConfig(i);
+    SensorFilterStored stored;
+    bool found = true;
+    if (magic == SENSOR_FILTERS_MAGIC) {
+      EEPROM.get(EEPROM_ADDR_FILTERS + 1 + i * sizeof(SensorFilterStored), stored);
+    } else if (magic == SENSOR_FILTERS_MAGIC_V1) {
+      SensorFilterStoredV1 legacy;
+      EEPROM.get(EEPROM_ADDR_FILTERS + 1 + i * sizeof(SensorFilterStoredV1), legacy);
+      stored.medianWindow = legacy.medianWindow;
+      stored.smoother = legacy.smoother;
+      stored.maxRate = legacy.maxRate;
+      stored.emaAlpha = legacy.emaAlpha;
+      stored.kalmanQ = config.kalmanQ;
+      stored.kalmanR = config.kalmanR;
+    } else {
+      found = false;
+    }
+    if (found) {
+      loadSensorFilterField("medianWindow", stored.medianWindow, config.medianWindow);
+      loadSensorFilterField("smoother", stored.smoother, config.smoother);
+      loadSensorFilterField("maxRate", stored.maxRate, config.maxRate);
+      loadSensorFilterField("emaAlpha", stored.emaAlpha, config.emaAlpha);
+      loadSensorFilterField("kalmanQ", stored.kalmanQ, config.kalmanQ);
+      loadSensorFilterField("kalmanR", stored.kalmanR, config.kalmanR);
+    }
+    sensorFilters[i].begin(config);
+  }
+  EEPROM.end();
+  
+  if (magic != SENSOR_FILTERS_MAGIC && magic != SENSOR_FILTERS_MAGIC_V1) {
+    Serial.println("[Фильтры] Настройки не найдены в EEPROM, используются значения по умолчанию");
+  }
+}
+
+void saveSystemEnabledToEEPROM() {
+  EEPROM.begin(EEPROM_SIZE);
+  EEPROM.put(EEPROM_ADDR_SYSTEM, systemEnabled);
+  EEPROM.commit();
+  EEPROM.end();
+  Serial.println("System enabled saved to EEPROM");
 }
 
 void loadSystemEnabledFromEEPROM() {
@@ -1137,8 +1587,7 @@ void loadSystemEnabledFromEEPROM() {
 }
 
 // Функции работы с настройками WiFi
-void saveWiFiSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeWiFiSettingsToEEPROM() {
   String json;
   DynamicJsonDocument doc(512);
   doc["primarySSID"] = wifiSettings.primarySSID;
@@ -1148,116 +1597,174 @@ void saveWiFiSettingsToEEPROM() {
   doc["useBackup"] = wifiSettings.useBackup;
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_WIFI, len);
-  for (int i = 0; i < len && i < 200; i++) {
-    EEPROM.write(EEPROM_ADDR_WIFI + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_WIFI, json, EEPROM_WIFI_MAX_LEN);
+}
+
+bool saveWiFiSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeWiFiSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
+  return saved;
 }
 
 void loadWiFiSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_WIFI, len);
-    if (len > 0 && len < 250) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_WIFI + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_WIFI, EEPROM_WIFI_MAX_LEN, json)) {
       DynamicJsonDocument doc(512);
       deserializeJson(doc, json);
-      if (doc.containsKey("primarySSID")) wifiSettings.primarySSID = doc["primarySSID"].as<String>();
-      if (doc.containsKey("primaryPassword")) wifiSettings.primaryPassword = doc["primaryPassword"].as<String>();
-      if (doc.containsKey("backupSSID")) wifiSettings.backupSSID = doc["backupSSID"].as<String>();
-      if (doc.containsKey("backupPassword")) wifiSettings.backupPassword = doc["backupPassword"].as<String>();
-      if (doc.containsKey("useBackup")) wifiSettings.useBackup = doc["useBackup"];
-      if (doc.containsKey("antennaTuning")) wifiSettings.antennaTuning = doc["antennaTuning"];
+      JsonObjectConst obj = doc.as<JsonObjectConst>();
+      loadSettingField(obj, SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), "primarySSID", wifiSettings.primarySSID);
+      loadSettingField(obj, SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), "primaryPassword", wifiSettings.primaryPassword);
+      loadSettingField(obj, SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), "backupSSID", wifiSettings.backupSSID);
+      loadSettingField(obj, SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), "backupPassword", wifiSettings.backupPassword);
+      loadSettingField(obj, SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), "useBackup", wifiSettings.useBackup);
+      loadSettingField(obj, SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), "antennaTuning", wifiSettings.antennaTuning);
     }
   }
   EEPROM.end();
 }
 
-// Функция подключения к WiFi с приоритетом
-bool connectToWiFi() {
-  // Сначала пытаемся подключиться к основному WiFi (даже при слабом сигнале)
-  if (wifiSettings.primarySSID.length() > 0) {
-    
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(wifiSettings.primarySSID.c_str(), wifiSettings.primaryPassword.c_str());
-    
-    // Увеличенное количество попыток и таймаут для надежности
-    int attempts = 0;
-    int maxAttempts = 30;  // 30 попыток по 1 секунде = 30 секунд
-    unsigned long lastCheckTime = millis();
-    
-    while (WiFi.status() != WL_CONNECTED && attempts < maxAttempts) {
-      unsigned long now = millis();
-      // Неблокирующая задержка 1 секунда с yield()
-      if (now - lastCheckTime >= 1000 || now < lastCheckTime) {
-        lastCheckTime = now;
-        Serial.print(".");
-        attempts++;
-        
-        // Периодически проверяем статус
-        if (attempts % 5 == 0) {
-          Serial.print(" [");
-          Serial.print(attempts);
-          Serial.print("/");
-          Serial.print(maxAttempts);
-          Serial.println("]");
-        }
+// Переход на этап подключения к WiFi (без ожидания - результат проверяет handleWiFiConnection)
+void enterWiFiStage(WiFiStage stage) {
+  wifiStage = stage;
+  wifiStageStartTime = millis();
+  
+  switch (stage) {
+    case WIFI_STAGE_PRIMARY:
+      if (wifiSettings.primarySSID.length() == 0) {
+        enterWiFiStage(WIFI_STAGE_BACKUP);
+        return;
       }
-      yield(); // Позволяем другим задачам выполняться
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-      return true;
-    } else {
-    }
+      Serial.print("[WiFi] Подключение к основной сети: ");
+      Serial.println(wifiSettings.primarySSID);
+      WiFi.begin(wifiSettings.primarySSID.c_str(), wifiSettings.primaryPassword.c_str());
+      break;
+    case WIFI_STAGE_BACKUP:
+      if (wifiSettings.backupSSID.length() == 0) {
+        enterWiFiStage(WIFI_STAGE_SAVED);
+        return;
+      }
+      Serial.print("[WiFi] Подключение к резервной сети: ");
+      Serial.println(wifiSettings.backupSSID);
+      WiFi.disconnect();
+      WiFi.begin(wifiSettings.backupSSID.c_str(), wifiSettings.backupPassword.c_str());
+      break;
+    case WIFI_STAGE_SAVED:
+      if (!wifiManager.getWiFiIsSaved()) {
+        enterWiFiStage(WIFI_STAGE_PORTAL);
+        return;
+      }
+      Serial.println("[WiFi] Подключение к сети, сохраненной порталом");
+      WiFi.disconnect();
+      WiFi.begin();
+      break;
+    case WIFI_STAGE_PORTAL:
+      // Портал поднимает свой веб-сервер на 80 порту - наш на это время останавливаем
+      Serial.println("[WiFi] Сеть недоступна, портал настройки KotelAP");
+      server.stop();
+      wifiManager.setConfigPortalBlocking(false);
+      wifiManager.setConfigPortalTimeout(WIFI_PORTAL_TIMEOUT_SEC);
+      wifiManager.startConfigPortal("KotelAP", "kotel12345");
+      setupOTA();  // OTA работает и в режиме точки доступа
+      break;
+    case WIFI_STAGE_CONNECTED:
+      break;
+  }
+}
+
+// Запуск подключения из setup(): только настройка и первая попытка, без ожидания
+void startWiFiConnection() {
+  bootPhaseBegin(BOOT_PHASE_WIFI_START);
+  bootPhaseBegin(BOOT_PHASE_WIFI_CONNECTED);
+  WiFi.setHostname("kotel");
+  WiFi.mode(WIFI_STA);
+  enterWiFiStage(WIFI_STAGE_PRIMARY);
+  bootPhaseEnd(BOOT_PHASE_WIFI_START);
+}
+
+// Сервисы, которым нужна сеть: mDNS, NTP, OTA
+void startNetworkServices() {
+  if (networkServicesStarted) {
+    return;
   }
+  networkServicesStarted = true;
   
-  // Если основной не подключился, пробуем резервный
-  if (wifiSettings.backupSSID.length() > 0) {
-    
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(wifiSettings.backupSSID.c_str(), wifiSettings.backupPassword.c_str());
-    
-    int attempts = 0;
-    int maxAttempts = 20;  // 20 секунд для резервного
-    unsigned long lastCheckTime = millis();
-    
-    while (WiFi.status() != WL_CONNECTED && attempts < maxAttempts) {
-      unsigned long now = millis();
-      // Неблокирующая задержка 1 секунда с yield()
-      if (now - lastCheckTime >= 1000 || now < lastCheckTime) {
-        lastCheckTime = now;
-        Serial.print(".");
-        attempts++;
+  // Инициализация mDNS для доступа по kotel.local
+  bootPhaseBegin(BOOT_PHASE_MDNS);
+  if (MDNS.begin("kotel")) {
+    Serial.println("[mDNS] mDNS responder started: kotel.local");
+    // Добавляем сервис HTTP
+    MDNS.addService("http", "tcp", 80);
+  } else {
+    Serial.println("[mDNS] Error setting up mDNS responder!");
+  }
+  bootPhaseEnd(BOOT_PHASE_MDNS);
+  
+  if (ntpSettings.enabled) {
+    bootPhaseBegin(BOOT_PHASE_NTP);
+    setupNTP();
+    bootPhaseEnd(BOOT_PHASE_NTP);
+  }
+  setupOTA();
+}
+
+// Ход подключения к WiFi (из loop, не блокирует)
+void handleWiFiConnection(unsigned long now) {
+  if (deferredBootPending) {
+    return;  // Быстрый старт: подключение еще не запускалось
+  }
+  unsigned long elapsed = now - wifiStageStartTime;
+  
+  switch (wifiStage) {
+    case WIFI_STAGE_PRIMARY:
+    case WIFI_STAGE_BACKUP:
+    case WIFI_STAGE_SAVED: {
+      if (WiFi.status() == WL_CONNECTED) {
+        break;
       }
-      yield(); // Позволяем другим задачам выполняться
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-      Serial.println("\nПодключено к резервному WiFi!");
-      Serial.print("IP адрес: ");
-      Serial.println(WiFi.localIP());
-      return true;
-    } else {
+      unsigned long timeout = (wifiStage == WIFI_STAGE_PRIMARY) ? WIFI_PRIMARY_TIMEOUT :
+                              (wifiStage == WIFI_STAGE_BACKUP) ? WIFI_BACKUP_TIMEOUT : WIFI_SAVED_TIMEOUT;
+      if (elapsed >= timeout) {
+        enterWiFiStage((WiFiStage)(wifiStage + 1));
+      }
+      return;
     }
+    case WIFI_STAGE_PORTAL:
+      if (wifiManager.process()) {
+        server.begin();  // Сеть настроена через портал
+        break;
+      }
+      if (!wifiManager.getConfigPortalActive()) {
+        // Таймаут портала - снова пробуем сети по кругу (раньше здесь была перезагрузка)
+        server.begin();
+        enterWiFiStage(WIFI_STAGE_PRIMARY);
+      }
+      return;
+    case WIFI_STAGE_CONNECTED:
+      // Потерю связи обслуживает автопереподключение WiFi
+      return;
   }
   
-  return false;
+  Serial.print("[WiFi] Подключено (");
+  Serial.print(WIFI_STAGE_NAMES[wifiStage]);
+  Serial.print(") через ");
+  Serial.print(now / 1000);
+  Serial.print(" с после старта, IP адрес: ");
+  Serial.println(WiFi.localIP());
+  wifiStage = WIFI_STAGE_CONNECTED;
+  bootPhaseEnd(BOOT_PHASE_WIFI_CONNECTED);
+  startNetworkServices();
 }
 
 // Функции работы с настройками NTP
-void saveNTPSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeNTPSettingsToEEPROM() {
   String json;
   DynamicJsonDocument doc(256);
   doc["enabled"] = ntpSettings.enabled;
@@ -1266,35 +1773,45 @@ void saveNTPSettingsToEEPROM() {
   doc["updateInterval"] = ntpSettings.updateInterval;
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_NTP, len);
-  for (int i = 0; i < len && i < 150; i++) {
-    EEPROM.write(EEPROM_ADDR_NTP + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_NTP, json, EEPROM_NTP_MAX_LEN);
+}
+
+bool saveNTPSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeNTPSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
+  return saved;
 }
 
 void loadNTPSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_NTP, len);
-    if (len > 0 && len < 200) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_NTP + 4 + i);
-      }
+    String json;
+    bool found = readEEPROMBlob(EEPROM_ADDR_NTP, EEPROM_NTP_MAX_LEN, json);
+    bool legacy = false;
+    if (!found) {
+      // Блок со старого адреса, если его не затер блок WiFi: мусор отсеивают
+      // длина и разбор JSON, после чтения настройки пишутся на новое место
+      found = legacy = readEEPROMBlob(EEPROM_ADDR_NTP_LEGACY, EEPROM_NTP_MAX_LEN, json);
+    }
+    if (found) {
       DynamicJsonDocument doc(256);
       DeserializationError error = deserializeJson(doc, json);
-      if (!error) {
-        if (doc.containsKey("enabled")) ntpSettings.enabled = doc["enabled"];
-        if (doc.containsKey("server")) ntpSettings.server = doc["server"].as<String>();
-        if (doc.containsKey("timezone")) ntpSettings.timezone = doc["timezone"];
-        if (doc.containsKey("updateInterval")) ntpSettings.updateInterval = doc["updateInterval"];
+      if (!error && doc.is<JsonObject>()) {
+        JsonObjectConst obj = doc.as<JsonObjectConst>();
+        loadSettingField(obj, SETTINGS_LIMITS(NTP_SETTINGS_LIMITS), "enabled", ntpSettings.enabled);
+        loadSettingField(obj, SETTINGS_LIMITS(NTP_SETTINGS_LIMITS), "server", ntpSettings.server);
+        loadSettingField(obj, SETTINGS_LIMITS(NTP_SETTINGS_LIMITS), "timezone", ntpSettings.timezone);
+        loadSettingField(obj, SETTINGS_LIMITS(NTP_SETTINGS_LIMITS), "updateInterval", ntpSettings.updateInterval);
+        if (legacy) {
+          Serial.println("NTP settings moved to the new EEPROM address");
+          saveNTPSettingsToEEPROM();
+        }
       } else {
         Serial.println("Error parsing NTP settings from EEPROM, using defaults");
         // Сохраняем настройки по умолчанию
@@ -1314,48 +1831,43 @@ void loadNTPSettingsFromEEPROM() {
 }
 
 // Сохранение настроек ML в EEPROM
-void saveMLSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeMLSettingsToEEPROM() {
   DynamicJsonDocument doc(128);
   doc["enabled"] = mlSettings.enabled;
   doc["publishInterval"] = mlSettings.publishInterval;
+  doc["format"] = mlSettings.format;
   
   String json;
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_ML, len);
-  for (int i = 0; i < len; i++) {
-    EEPROM.write(EEPROM_ADDR_ML + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_ML, json, EEPROM_ML_MAX_LEN);
+}
+
+bool saveMLSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeMLSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
+  return saved;
 }
 
 // Загрузка настроек ML из EEPROM
 void loadMLSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_ML, len);
-    if (len > 0 && len < 200) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_ML + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_ML, EEPROM_ML_MAX_LEN, json)) {
       DynamicJsonDocument doc(128);
       DeserializationError error = deserializeJson(doc, json);
       if (!error) {
-        if (doc.containsKey("enabled")) mlSettings.enabled = doc["enabled"];
-        if (doc.containsKey("publishInterval")) {
-          int interval = doc["publishInterval"];
-          if (interval >= 5 && interval <= 300) {  // Валидация: от 5 до 300 секунд
-            mlSettings.publishInterval = interval;
-          }
-        }
+        JsonObjectConst obj = doc.as<JsonObjectConst>();
+        loadSettingField(obj, SETTINGS_LIMITS(ML_SETTINGS_LIMITS), "enabled", mlSettings.enabled);
+        loadSettingField(obj, SETTINGS_LIMITS(ML_SETTINGS_LIMITS), "publishInterval", mlSettings.publishInterval);
+        loadSettingField(obj, SETTINGS_LIMITS(ML_SETTINGS_LIMITS), "format", mlSettings.format);
       } else {
         Serial.println("Error parsing ML settings from EEPROM, using defaults");
         // Сохраняем настройки по умолчанию если ошибка парсинга
@@ -1375,8 +1887,7 @@ void loadMLSettingsFromEEPROM() {
 }
 
 // Сохранение настроек реле в EEPROM
-void saveRelaySettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeRelaySettingsToEEPROM() {
   DynamicJsonDocument doc(128);
   doc["fanOffIsLow"] = relaySettings.fanOffIsLow;
   doc["pumpOffIsLow"] = relaySettings.pumpOffIsLow;
@@ -1387,34 +1898,33 @@ void saveRelaySettingsToEEPROM() {
   Serial.print("[Реле] Сохранение в EEPROM: ");
   Serial.println(json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_RELAY, len);
-  for (int i = 0; i < len && i < 200; i++) {
-    EEPROM.write(EEPROM_ADDR_RELAY + 4 + i, json[i]);
-  }
+  return writeEEPROMBlob(EEPROM_ADDR_RELAY, json, EEPROM_RELAY_MAX_LEN);
+}
+
+bool saveRelaySettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeRelaySettingsToEEPROM() && EEPROM.commit();
   
-  if (EEPROM.commit()) {
+  if (saved) {
     Serial.println("[Реле] Настройки успешно сохранены в EEPROM");
   } else {
     Serial.println("[Реле] ОШИБКА: Не удалось сохранить в EEPROM!");
   }
   EEPROM.end();
+  return saved;
 }
 
 // Загрузка настроек реле из EEPROM
 void loadRelaySettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_RELAY, len);
-    if (len > 0 && len < 200) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_RELAY + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_RELAY, EEPROM_RELAY_MAX_LEN, json)) {
       DynamicJsonDocument doc(128);
       DeserializationError error = deserializeJson(doc, json);
       if (!error) {
@@ -1454,104 +1964,39 @@ void loadRelaySettingsFromEEPROM() {
 }
 
 // Сохранение настроек комфорт в EEPROM
-void saveComfortSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeComfortSettingsToEEPROM() {
   DynamicJsonDocument doc(512);
-  doc["targetHomeTemp"] = comfortSettings.targetHomeTemp;
-  doc["minBoilerTemp"] = comfortSettings.minBoilerTemp;
-  doc["maxBoilerTemp"] = comfortSettings.maxBoilerTemp;
-  doc["waitTemp"] = comfortSettings.waitTemp;
-  doc["catchUpTemp"] = comfortSettings.catchUpTemp;
-  doc["waitCoolingTime"] = comfortSettings.waitCoolingTime;
-  doc["waitAfterHeating1Time"] = comfortSettings.waitAfterHeating1Time;
-  doc["waitAfterReductionTime"] = comfortSettings.waitAfterReductionTime;
-  doc["inertiaCheckInterval"] = comfortSettings.inertiaCheckInterval;
-  doc["hysteresisOn"] = comfortSettings.hysteresisOn;
-  doc["hysteresisOff"] = comfortSettings.hysteresisOff;
-  doc["hysteresisBoiler"] = comfortSettings.hysteresisBoiler;
-  doc["warningTemp"] = comfortSettings.warningTemp;
+  settingsValuesToJson(doc.to<JsonObject>(), SETTINGS_VALUES(COMFORT_SETTINGS_VALUES));
   
   String json;
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_COMFORT, len);
-  for (int i = 0; i < len && i < 250; i++) {
-    EEPROM.write(EEPROM_ADDR_COMFORT + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_COMFORT, json, EEPROM_COMFORT_MAX_LEN);
+}
+
+bool saveComfortSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeComfortSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
+  return saved;
 }
 
 // Загрузка настроек комфорт из EEPROM
 void loadComfortSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_COMFORT, len);
-    if (len > 0 && len < 250) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_COMFORT + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_COMFORT, EEPROM_COMFORT_MAX_LEN, json)) {
       DynamicJsonDocument doc(512);
       DeserializationError error = deserializeJson(doc, json);
       if (!error) {
-        if (doc.containsKey("targetHomeTemp")) {
-          float val = doc["targetHomeTemp"];
-          if (val >= 20 && val <= 28) comfortSettings.targetHomeTemp = val;
-        }
-        if (doc.containsKey("minBoilerTemp")) {
-          float val = doc["minBoilerTemp"];
-          if (val >= 40 && val <= 80) comfortSettings.minBoilerTemp = val;
-        }
-        if (doc.containsKey("maxBoilerTemp")) {
-          float val = doc["maxBoilerTemp"];
-          if (val >= 40 && val <= 80) comfortSettings.maxBoilerTemp = val;
-        }
-        if (doc.containsKey("waitTemp")) {
-          float val = doc["waitTemp"];
-          if (val >= 50 && val <= 80) comfortSettings.waitTemp = val;
-        }
-        if (doc.containsKey("catchUpTemp")) {
-          float val = doc["catchUpTemp"];
-          if (val >= 20 && val <= 28) comfortSettings.catchUpTemp = val;
-        }
-        if (doc.containsKey("waitCoolingTime")) {
-          int val = doc["waitCoolingTime"];
-          if (val >= 5 && val <= 30) comfortSettings.waitCoolingTime = val;
-        }
-        if (doc.containsKey("waitAfterHeating1Time")) {
-          int val = doc["waitAfterHeating1Time"];
-          if (val >= 10 && val <= 60) comfortSettings.waitAfterHeating1Time = val;
-        }
-        if (doc.containsKey("waitAfterReductionTime")) {
-          int val = doc["waitAfterReductionTime"];
-          if (val >= 10 && val <= 60) comfortSettings.waitAfterReductionTime = val;
-        }
-        if (doc.containsKey("inertiaCheckInterval")) {
-          int val = doc["inertiaCheckInterval"];
-          if (val >= 1 && val <= 15) comfortSettings.inertiaCheckInterval = val;
-        }
-        if (doc.containsKey("hysteresisOn")) {
-          float val = doc["hysteresisOn"];
-          if (val >= 0.1 && val <= 2.0) comfortSettings.hysteresisOn = val;
-        }
-        if (doc.containsKey("hysteresisOff")) {
-          float val = doc["hysteresisOff"];
-          if (val >= 0.1 && val <= 2.0) comfortSettings.hysteresisOff = val;
-        }
-        if (doc.containsKey("hysteresisBoiler")) {
-          float val = doc["hysteresisBoiler"];
-          if (val >= 0.5 && val <= 5.0) comfortSettings.hysteresisBoiler = val;
-        }
-        if (doc.containsKey("warningTemp")) {
-          float val = doc["warningTemp"];
-          if (val >= 80 && val <= 90) comfortSettings.warningTemp = val;
-        }
+        loadSettingsValues(doc.as<JsonObjectConst>(), SETTINGS_LIMITS(COMFORT_SETTINGS_LIMITS),
+                           SETTINGS_VALUES(COMFORT_SETTINGS_VALUES));
       }
     }
   }
@@ -1635,9 +2080,76 @@ String getResetReasonString() {
   }
 }
 
+// Время от старта чипа в мкс для профиля загрузки
+uint32_t bootProfileNowUs() {
+  uint64_t us = esp_timer_get_time();
+  return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+void bootPhaseBegin(BootPhase phase) {
+  rtcBootProfile.startUs[phase] = bootProfileNowUs();
+  rtcBootProfile.endUs[phase] = 0;
+}
+
+void bootPhaseEnd(BootPhase phase) {
+  if (rtcBootProfile.endUs[phase] == 0) {
+    rtcBootProfile.endUs[phase] = bootProfileNowUs();
+  }
+}
+
+// Начало нового профиля: сохраняем прошлый из RTC-памяти и очищаем
+void beginBootProfile() {
+  previousBootProfileValid = (rtcBootProfile.magic == BOOT_PROFILE_MAGIC);
+  if (previousBootProfileValid) {
+    previousBootProfile = rtcBootProfile;
+  }
+  memset(&rtcBootProfile, 0, sizeof(rtcBootProfile));
+  rtcBootProfile.magic = BOOT_PROFILE_MAGIC;
+  rtcBootProfile.resetReason = (uint8_t)esp_reset_reason();
+  rtcBootProfile.startUs[BOOT_PHASE_SETUP] = 0;  // setup() считаем от старта чипа
+}
+
+// Быстрый старт нужен, если прошлый запуск оборвался зависанием или питанием
+bool shouldFastBoot() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  return reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+         reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
+
+void buildBootProfileJson(JsonObject obj, const BootProfile& profile) {
+  obj["bootCount"] = profile.bootCount;
+  obj["resetReason"] = profile.resetReason;
+  obj["fastBoot"] = profile.fastBoot;
+  JsonArray phases = obj.createNestedArray("phases");
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    JsonObject phase = phases.createNestedObject();
+    phase["name"] = BOOT_PHASE_NAMES[i];
+    phase["startUs"] = profile.startUs[i];
+    if (profile.endUs[i] != 0) {
+      phase["durationUs"] = profile.endUs[i] - profile.startUs[i];
+    } else {
+      phase["durationUs"] = nullptr;  // Не завершен или пропущен
+    }
+  }
+}
+
+// API: Профиль загрузки - текущий и предыдущий запуск
+void handleBootProfile() {
+  DynamicJsonDocument doc(3072);
+  buildBootProfileJson(doc.createNestedObject("current"), rtcBootProfile);
+  if (previousBootProfileValid) {
+    buildBootProfileJson(doc.createNestedObject("previous"), previousBootProfile);
+  }
+  String response;
+  serializeJson(doc, response);
+  server.send(200, "application/json", response);
+}
+
 // Загрузка журнала перезагрузок из EEPROM
 void loadBootLogFromEEPROM() {
+  EEPROM.begin(EEPROM_SIZE);
   EEPROM.get(EEPROM_ADDR_BOOT_LOG, bootLog);
+  EEPROM.end();
   
   // Находим индекс последней записи
   bootLogWriteIndex = 0;
@@ -1652,14 +2164,19 @@ void loadBootLogFromEEPROM() {
 void saveBootLogEntry() {
   BootLogEntry entry;
   entry.bootCount = bootCount;
-  entry.timestamp = (ntpSettings.enabled && timeClient.isTimeSet()) ? timeClient.getEpochTime() : 0;
+  entry.timestamp = (ntpSettings.enabled && timeService.isSynced()) ? timeService.epoch() : 0;
   lastResetReason.toCharArray(entry.reason, sizeof(entry.reason));
   entry.valid = true;
+  entry.fastBoot = fastBoot ? 1 : 0;
+  uint32_t setupMs = rtcBootProfile.endUs[BOOT_PHASE_SETUP] / 1000;
+  entry.setupMs = setupMs > UINT16_MAX ? UINT16_MAX : setupMs;
   
   // Записываем в текущую позицию
   bootLog[bootLogWriteIndex] = entry;
+  EEPROM.begin(EEPROM_SIZE);
   EEPROM.put(EEPROM_ADDR_BOOT_LOG + bootLogWriteIndex * BOOT_LOG_ENTRY_SIZE, entry);
   EEPROM.commit();
+  EEPROM.end();
   
   // Увеличиваем индекс (циклический буфер)
   bootLogWriteIndex = (bootLogWriteIndex + 1) % BOOT_LOG_MAX_ENTRIES;
@@ -1667,7 +2184,10 @@ void saveBootLogEntry() {
   Serial.print("[Boot] Log entry saved: bootCount=");
   Serial.print(entry.bootCount);
   Serial.print(", reason=");
-  Serial.println(entry.reason);
+  Serial.print(entry.reason);
+  Serial.print(", setup=");
+  Serial.print(entry.setupMs);
+  Serial.println(" ms");
 }
 
 // API: Получение журнала перезагрузок
@@ -1682,13 +2202,16 @@ void handleBootLog() {
       entry["bootCount"] = bootLog[i].bootCount;
       entry["timestamp"] = bootLog[i].timestamp;
       entry["reason"] = bootLog[i].reason;
+      entry["fastBoot"] = bootLog[i].fastBoot == 1;
+      entry["setupMs"] = bootLog[i].setupMs;
       
       // Форматируем дату/время если доступно
       if (bootLog[i].timestamp > 0) {
         time_t t = bootLog[i].timestamp;
-        struct tm *timeInfo = localtime(&t);
+        struct tm timeInfo;
+        localtime_r(&t, &timeInfo);
         char timeStr[20];
-        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeInfo);
+        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timeInfo);
         entry["datetime"] = timeStr;
       } else {
         entry["datetime"] = "N/A";
@@ -1730,7 +2253,7 @@ void handleBootCountReset() {
 // Функция логирования событий
 void logEvent(const char* eventType, const char* details) {
   EventLogEntry entry;
-  entry.timestamp = (ntpSettings.enabled && timeClient.isTimeSet()) ? timeClient.getEpochTime() : 0;
+  entry.timestamp = (ntpSettings.enabled && timeService.isSynced()) ? timeService.epoch() : 0;
   strncpy(entry.eventType, eventType, sizeof(entry.eventType) - 1);
   entry.eventType[sizeof(entry.eventType) - 1] = '\0';
   strncpy(entry.details, details, sizeof(entry.details) - 1);
@@ -1790,325 +2313,257 @@ void loadFanStatsFromEEPROM() {
   }
 }
 
-// Функция запуска розжига
-void startIgnition() {
-  if (boilerExtinguished || systemState == "КОТЕЛ_ПОГАС") {
-    boilerExtinguished = false;
-    ignitionInProgress = true;
-    ignitionStartTime = millis();
-    ignitionStartTemp = supplyTemp;
-    fanStartTime = 0;
-    maxTempDuringFan = 0.0;
-    fanState = true;
-    digitalWrite(PIN_RELAY_FAN, HIGH);
-    systemState = "РОЗЖИГ";
-    
-    char details[50];
-    snprintf(details, sizeof(details), "Температура: %.1f°C", ignitionStartTemp);
-    logEvent("IGNITION_STARTED", details);
-    
-    // Публикация в MQTT
-    if (mqttSettings.enabled && mqttClient.connected()) {
-      String topic = mqttSettings.prefix + "/event/boiler_ignition_started";
-      mqttClient.publish(topic.c_str(), details, false);
-    }
-    
-    Serial.println("[Котел] Розжиг начат по нажатию кнопки");
-  }
-}
-
-// Проверка погасания котла
-void checkBoilerExtinguished(unsigned long now) {
-  if (!fanState || boilerExtinguished) {
-    return;
-  }
-  
-  // Если вентилятор только что включился
-  if (fanStartTime == 0) {
-    fanStartTime = now;
-    maxTempDuringFan = supplyTemp;
-    return;
-  }
-  
-  // Обновляем максимальную температуру
-  if (supplyTemp > maxTempDuringFan) {
-    maxTempDuringFan = supplyTemp;
-  }
-  
-  // Проверяем время работы вентилятора
-  unsigned long fanWorkTime = (now >= fanStartTime) ? (now - fanStartTime) : (ULONG_MAX - fanStartTime + now);
-  
-  if (fanWorkTime >= BOILER_EXTINGUISHED_CHECK_TIME) {
-    // Проверяем тренд температуры
-    int trend = getTemperatureTrend(&supplyHistory);
-    
-    // Если температура падает
-    if (trend == -1) {
-      float tempDrop = maxTempDuringFan - supplyTemp;
-      
-      // Если температура упала на заданное значение
-      if (tempDrop >= BOILER_EXTINGUISHED_TEMP_DROP) {
-        boilerExtinguished = true;
-        fanState = false;
-        digitalWrite(PIN_RELAY_FAN, LOW);
-        systemState = "КОТЕЛ_ПОГАС";
-        
-        char details[50];
-        snprintf(details, sizeof(details), "Падение: %.1f°C за %.1fч", tempDrop, fanWorkTime / 3600000.0);
-        logEvent("BOILER_EXTINGUISHED", details);
-        
-        // Публикация в MQTT
-        if (mqttSettings.enabled && mqttClient.connected()) {
-          String topic = mqttSettings.prefix + "/event/boiler_extinguished";
-          mqttClient.publish(topic.c_str(), details, false);
-        }
-        
-        Serial.print("[Котел] Обнаружено погасание! Вентилятор отключен. Падение температуры: ");
-        Serial.print(tempDrop);
-        Serial.println("°C");
-      }
-    }
-  }
-}
-
-// Проверка прогресса розжига
-void checkIgnitionProgress(unsigned long now) {
-  if (!ignitionInProgress) {
-    return;
-  }
-  
-  unsigned long ignitionElapsed = (now >= ignitionStartTime) ? (now - ignitionStartTime) : (ULONG_MAX - ignitionStartTime + now);
-  float tempIncrease = supplyTemp - ignitionStartTemp;
-  
-  // Проверяем успешность розжига
-  if (tempIncrease >= IGNITION_TEMP_INCREASE) {
-    // Розжиг успешен
-    ignitionInProgress = false;
-    systemState = "HEATING";
-    heatingStartTime = now;
-    fanStartTime = now;
-    maxTempDuringFan = supplyTemp;
-    
-    char details[50];
-    snprintf(details, sizeof(details), "Успех за %lu мин, +%.1f°C", ignitionElapsed / 60000, tempIncrease);
-    logEvent("IGNITION_SUCCESS", details);
-    
-    // Публикация в MQTT
-    if (mqttSettings.enabled && mqttClient.connected()) {
-      String topic = mqttSettings.prefix + "/event/boiler_ignition_success";
-      mqttClient.publish(topic.c_str(), details, false);
-    }
-    
-    Serial.print("[Котел] Розжиг успешен! Температура повысилась на ");
-    Serial.print(tempIncrease);
-    Serial.println("°C");
-    return;
-  }
-  
-  // Проверяем таймаут (10-20 минут в зависимости от начальной температуры)
-  unsigned long timeout = (ignitionStartTemp < 30.0) ? IGNITION_TIMEOUT_MAX : IGNITION_TIMEOUT_MIN;
-  
-  if (ignitionElapsed >= timeout) {
-    // Розжиг неудачен
-    ignitionInProgress = false;
-    fanState = false;
-    digitalWrite(PIN_RELAY_FAN, LOW);
-    systemState = "ОШИБКА_РОЗЖИГА";
-    boilerExtinguished = true;
-    
-    char details[50];
-    snprintf(details, sizeof(details), "Таймаут %lu мин, +%.1f°C", timeout / 60000, tempIncrease);
-    logEvent("IGNITION_FAILED", details);
-    
-    // Публикация в MQTT
-    if (mqttSettings.enabled && mqttClient.connected()) {
-      String topic = mqttSettings.prefix + "/event/boiler_ignition_failed";
-      mqttClient.publish(topic.c_str(), details, false);
-    }
-    
-    Serial.print("[Котел] Розжиг неудачен! Таймаут. Температура повысилась только на ");
-    Serial.print(tempIncrease);
-    Serial.println("°C");
-  }
-}
-
-// Настройка NTP клиента
+// Настройка службы времени (SNTP ESP-IDF, синхронизация в фоне)
 void setupNTP() {
   if (!ntpSettings.enabled) {
+    timeService.stop();
     return;
   }
   
-  timeClient.setTimeOffset(ntpSettings.timezone * 3600);  // Смещение в секундах
-  timeClient.setUpdateInterval(ntpSettings.updateInterval * 1000);  // Интервал обновления в миллисекундах
-  timeClient.begin();
+  timeService.begin(ntpSettings.server.c_str(), ntpSettings.timezone, ntpSettings.updateInterval);
   
   Serial.print("NTP клиент настроен: ");
   Serial.print(ntpSettings.server);
   Serial.print(", часовой пояс: UTC+");
   Serial.println(ntpSettings.timezone);
-  
-  // Первая синхронизация (может занять несколько секунд)
-  Serial.println("Синхронизация времени с NTP сервером...");
-  int attempts = 0;
-  unsigned long lastCheckTime = millis();
-  while (!timeClient.update() && attempts < 10) {
-    unsigned long now = millis();
-    // Неблокирующая задержка 500 мс с yield()
-    if (now - lastCheckTime >= 500 || now < lastCheckTime) {
-      lastCheckTime = now;
-      attempts++;
-      Serial.print(".");
-    }
-    yield(); // Позволяем другим задачам выполняться
-  }
-  
-  if (timeClient.update()) {
-    Serial.println("\nВремя синхронизировано!");
-    Serial.print("Текущее время: ");
-    // Используем прямое форматирование здесь
-    unsigned long epochTime = timeClient.getEpochTime();
-    time_t rawTime = epochTime;
-    struct tm *timeInfo = localtime(&rawTime);
-    char timeStr[9];
-    sprintf(timeStr, "%02d:%02d:%02d", timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
-    Serial.println(timeStr);
-  } else {
-    Serial.println("\nОшибка синхронизации времени");
-  }
 }
 
-// Получение отформатированного времени
+// Получение отформатированного времени (из кэша службы времени)
 String getFormattedTime() {
-  if (!ntpSettings.enabled || !timeClient.isTimeSet()) {
+  if (!ntpSettings.enabled || !timeService.isSynced()) {
     return "--:--:--";
   }
-  
-  timeClient.update();
-  unsigned long epochTime = timeClient.getEpochTime();
-  time_t rawTime = epochTime;
-  struct tm *timeInfo = localtime(&rawTime);
-  
-  char timeStr[9];
-  sprintf(timeStr, "%02d:%02d:%02d", timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
-  return String(timeStr);
+  return String(timeService.timeString());
 }
 
 // Получение отформатированной даты
 String getFormattedDate() {
-  if (!ntpSettings.enabled || !timeClient.isTimeSet()) {
+  if (!ntpSettings.enabled || !timeService.isSynced()) {
     return "--.--.----";
   }
-  
-  timeClient.update();
-  unsigned long epochTime = timeClient.getEpochTime();
-  time_t rawTime = epochTime;
-  struct tm *timeInfo = localtime(&rawTime);
-  
-  char dateStr[11];
-  sprintf(dateStr, "%02d.%02d.%04d", timeInfo->tm_mday, timeInfo->tm_mon + 1, timeInfo->tm_year + 1900);
-  return String(dateStr);
+  return String(timeService.dateString());
 }
 
-// MQTT функции
+// Входящие MQTT: команды котлу и данные ESP01 по таблице MQTT_COMMANDS из
+// lib/MqttMessages (по ней же разбирает поток стенд tools/mqttbench),
+// обработчики - в lib/BoilerCommands (их же выполняют стенды tools/hostsim)
+MqttCommandRegistry mqttCommands(MQTT_COMMANDS, MQTT_COMMAND_COUNT);
+
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
-  String topicStr = String(topic);
-  String message = "";
-  for (unsigned int i = 0; i < length; i++) {
-    message += (char)payload[i];
+  traceRecorder.recordPair(TRACE_MQTT_IN, topic, (const char*)payload, length);
+  dispatchMqttCommand(mqttCommands, topic, payload, length, millis());
+}
+
+// Подключение к брокеру - конечный автомат, по шагу на каждом проходе loop():
+// DNS-запрос в фоне lwip, TCP connect на неблокирующем сокете (готовность
+// проверяется select без ожидания), при useTLS - рукопожатие TLS на том же
+// сокете по шагу mbedTLS за проход loop(), затем CONNECT/CONNACK внутри
+// PubSubClient::connect(). Последний шаг синхронный, но выполняется только
+// после установленного соединения - брокер уже отвечает, ожидание ограничено
+// socketTimeout. Недоступный брокер loop() не задерживает: неудачи
+// разносятся экспоненциальной задержкой со случайным разбросом
+enum MqttConnState : uint8_t {
+  MQTT_CONN_IDLE,        // Ждем срока следующей попытки
+  MQTT_CONN_RESOLVING,   // DNS-запрос в фоне
+  MQTT_CONN_CONNECTING,  // TCP connect, ждем готовности сокета
+  MQTT_CONN_TLS,         // Рукопожатие TLS по шагам
+  MQTT_CONN_CONNECTED
+};
+const char* const MQTT_CONN_STATE_NAMES[] = {"idle", "resolving", "connecting", "tls", "connected"};
+const unsigned long MQTT_BACKOFF_MIN = 2000;    // Первая повторная попытка через 1-2 с
+const unsigned long MQTT_BACKOFF_MAX = 300000;  // Не реже раза в 2.5-5 минут
+const unsigned long MQTT_DNS_TIMEOUT = 10000;
+const unsigned long MQTT_TCP_TIMEOUT = 10000;
+const unsigned long MQTT_TLS_TIMEOUT = 10000;  // Рукопожатие TLS целиком
+const unsigned long MQTT_DNS_CACHE_TTL = 3600000;  // Адрес брокера перепроверяется раз в час
+MqttConnState mqttConnState = MQTT_CONN_IDLE;
+unsigned long mqttConnStateTime = 0;  // Начало текущего шага
+unsigned long mqttNextAttempt = 0;
+uint8_t mqttConsecutiveFailures = 0;
+uint32_t mqttConnectAttempts = 0;
+uint32_t mqttConnectCount = 0;
+char mqttLastError[48] = "";
+int mqttConnectFd = -1;  // Сокет, пока идет TCP connect
+uint32_t mqttTcpConnectMs = 0;  // Длительность шагов последней удачной попытки
+uint32_t mqttHandshakeMs = 0;
+uint32_t mqttTlsHandshakeMs = 0;
+uint32_t mqttTlsHandshakes = 0;  // Всего; полные и возобновленные - счетчики mqttSecureClient
+uint32_t mqttTlsLongestStepMs = 0;  // Самый долгий шаг рукопожатия (задержка loop())
+// Кэш адреса брокера
+IPAddress mqttBrokerIP;
+unsigned long mqttBrokerResolvedAt = 0;
+bool mqttBrokerIPValid = false;
+// Ответ DNS приходит в задаче tcpip: только флаг и адрес
+volatile bool mqttDnsDone = false;
+volatile uint32_t mqttDnsAddress = 0;
+volatile uint32_t mqttDnsGeneration = 0;  // Ответ на брошенный запрос игнорируется
+
+// Однократная настройка клиента (и после смены настроек MQTT)
+void mqttSetupClient() {
+  // TCP соединение устанавливает автомат, PubSubClient получает готовый сокет -
+  // сервер нужен ему только для полноты состояния
+  mqttClient.setServer(mqttSettings.server.c_str(), mqttSettings.port);
+  if (mqttSettings.useTLS) {
+    mqttClient.setClient(mqttSecureClient);  // Сертификат брокера не проверяется, как и у обновлений
+  } else {
+    mqttClient.setClient(wifiClient);
   }
-  
-  
-  // Обработка установки уставки
-  String setpointTopic = mqttSettings.prefix + "/setpoint/set";
-  if (topicStr == setpointTopic) {
-    float newSetpoint = message.toFloat();
-    if (newSetpoint >= 40 && newSetpoint <= 80) {
-      setpoint = newSetpoint;
-      autoSettings.setpoint = newSetpoint;
-      saveAutoSettingsToEEPROM();
-    }
+  mqttClient.setCallback(mqttCallback);
+  if (!mqttCommands.setPrefix(mqttSettings.prefix.c_str())) {
+    Serial.println("[MQTT] Prefix too long, commands disabled");
   }
-  
-  // Обработка температуры в доме от ESP01
-  if (topicStr == "home/esp01/temperature") {
-    float newHomeTemp = message.toFloat();
-    if (newHomeTemp >= -50 && newHomeTemp <= 50) {  // Валидация диапазона
-      homeTemp = newHomeTemp;
-      lastHomeTempUpdate = millis();  // Обновляем время последнего получения данных
-      addToHistory(&homeHistory, newHomeTemp);
-    }
-  }
-  
-  // Обработка LWT статуса датчика температуры дома
-  if (topicStr == "home/esp01/status") {
-    message.toLowerCase();
-    message.trim();
-    if (message == "online") {
-      homeTempSensorLWTOnline = true;
-      Serial.println("[MQTT] Home temperature sensor LWT: online");
-    } else if (message == "offline") {
-      homeTempSensorLWTOnline = false;
-      Serial.println("[MQTT] Home temperature sensor LWT: offline");
-      // Если режим Комфорт и датчик стал offline, переключаемся на Авто и сохраняем
-      if (workMode == 1) {
-        Serial.println("[MQTT] Switching from Comfort to Auto mode due to sensor offline");
-        workMode = 0;
-        comfortState = "WAIT";
-        comfortStateStartTime = 0;
-        saveWorkModeToEEPROM();
-      }
-    }
+  // Увеличиваем размер буфера для больших сообщений (схема ML ~1.1 КБ)
+  mqttClient.setBufferSize(MQTT_BUFFER_SIZE);  // Увеличено с 256 до 1536 байт
+  mqttClient.setSocketTimeout(1);  // Ожидание CONNACK и дочитывания пакета
+}
+
+// IPv4-адрес в сетевом порядке байт, 0 - нет адреса или он IPv6 (брокер
+// подключается по IPv4)
+uint32_t mqttIPv4Address(const ip_addr_t* ipaddr) {
+  return (ipaddr != nullptr && IP_IS_V4(ipaddr)) ? ip_2_ip4(ipaddr)->addr : 0;
+}
+
+void mqttDnsFound(const char* name, const ip_addr_t* ipaddr, void* arg) {
+  if ((uint32_t)(uintptr_t)arg != mqttDnsGeneration) {
+    return;
   }
-  
-  // Обработка управления реле датчиков
-  String sensorsRelayTopic = mqttSettings.prefix + "/sensors/reset";
-  if (topicStr == sensorsRelayTopic) {
-    if (message == "1" || message == "on" || message == "reset") {
-      // Выключаем реле для сброса
-      sensorsRelayState = false;
-      int sensorsLevel = relaySettings.sensorsOffIsLow ? LOW : HIGH;
-      digitalWrite(PIN_RELAY_SENSORS, sensorsLevel);
-      sensorsResetPending = true;
-      sensorsResetStartTime = millis();
-      Serial.println("[MQTT] Sensors reset command received");
-    } else if (message == "0" || message == "off") {
-      // Выключаем реле
-      sensorsRelayState = false;
-      int sensorsLevel = relaySettings.sensorsOffIsLow ? LOW : HIGH;
-      digitalWrite(PIN_RELAY_SENSORS, sensorsLevel);
-      sensorsResetPending = false;
-      Serial.println("[MQTT] Sensors relay off command received");
-    }
+  mqttDnsAddress = mqttIPv4Address(ipaddr);
+  mqttDnsDone = true;
+}
+
+// dns_gethostbyname не потокобезопасна - таблица DNS принадлежит задаче
+// tcpip, поэтому запрос выполняется в ней через tcpip_api_call (loop() ждет
+// только постановки запроса, не ответа сервера)
+struct MqttDnsRequest {
+  struct tcpip_api_call_data call;  // Первым полем - требование tcpip_api_call
+  const char* host;
+  ip_addr_t addr;
+  uint32_t generation;
+};
+
+err_t mqttDnsRequestInTcpip(struct tcpip_api_call_data* call) {
+  MqttDnsRequest* request = (MqttDnsRequest*)call;
+  return dns_gethostbyname(request->host, &request->addr, mqttDnsFound, (void*)(uintptr_t)request->generation);
+}
+
+void mqttCloseConnectSocket() {
+  if (mqttConnectFd >= 0) {
+    lwip_close(mqttConnectFd);
+    mqttConnectFd = -1;
   }
-  
-  // Обработка запуска розжига
-  String ignitionStartTopic = mqttSettings.prefix + "/ignition/start";
-  if (topicStr == ignitionStartTopic) {
-    message.toLowerCase();
-    message.trim();
-    if (message == "1" || message == "on" || message == "start") {
-      startIgnition();
-      Serial.println("[MQTT] Ignition start command received");
-    }
+  if (mqttConnState == MQTT_CONN_TLS) {
+    mqttSecureClient.stop();  // Сокет перешел к TLS-клиенту
   }
 }
 
-bool mqttConnect() {
-  if (!mqttSettings.enabled) {
-    return false;
-  }
-  
-  if (mqttClient.connected()) {
-    return true;
+void mqttSetConnState(MqttConnState state, unsigned long now) {
+  mqttConnState = state;
+  mqttConnStateTime = now;
+}
+
+// Неудачная попытка: задержка растет вдвое до MQTT_BACKOFF_MAX, срок
+// выбирается случайно в [задержка/2, задержка] - несколько устройств не
+// ломятся к поднявшемуся брокеру одновременно
+void mqttAttemptFailed(unsigned long now) {
+  mqttCloseConnectSocket();
+  if (mqttConsecutiveFailures < 16) {
+    mqttConsecutiveFailures++;
+  }
+  unsigned long backoff = MQTT_BACKOFF_MIN << min((int)mqttConsecutiveFailures - 1, 8);
+  if (backoff > MQTT_BACKOFF_MAX) {
+    backoff = MQTT_BACKOFF_MAX;
+  }
+  backoff = backoff / 2 + esp_random() % (backoff / 2 + 1);
+  mqttNextAttempt = now + backoff;
+  mqttSetConnState(MQTT_CONN_IDLE, now);
+  Serial.printf("[MQTT] Connect failed (%s), retry in %lu s\n", mqttLastError, backoff / 1000);
+}
+
+// Сброс попыток: смена настроек, потеря WiFi - следующая попытка сразу
+void mqttResetConnection() {
+  mqttCloseConnectSocket();
+  mqttDnsGeneration++;
+  mqttBrokerIPValid = false;
+  mqttConsecutiveFailures = 0;
+  mqttNextAttempt = millis();
+  mqttSetConnState(MQTT_CONN_IDLE, millis());
+}
+
+// Неблокирующий TCP connect к закэшированному адресу
+void mqttStartTcpConnect(unsigned long now) {
+  int fd = lwip_socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    snprintf(mqttLastError, sizeof(mqttLastError), "socket: errno %d", errno);
+    mqttAttemptFailed(now);
+    return;
   }
-  
-  
-  mqttClient.setServer(mqttSettings.server.c_str(), mqttSettings.port);
-  mqttClient.setCallback(mqttCallback);
-  // Увеличиваем размер буфера для больших JSON сообщений (ML данные ~540 байт)
-  mqttClient.setBufferSize(1024);  // Увеличено с 256 до 1024 байт
-  mqttClient.setSocketTimeout(2);  // Таймаут 2 секунды вместо дефолтных 15
-  
+  lwip_fcntl(fd, F_SETFL, lwip_fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = (uint32_t)mqttBrokerIP;
+  addr.sin_port = htons(mqttSettings.port);
+  mqttConnectFd = fd;
+  if (lwip_connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    snprintf(mqttLastError, sizeof(mqttLastError), "connect: errno %d", errno);
+    mqttAttemptFailed(now);
+    return;
+  }
+  mqttSetConnState(MQTT_CONN_CONNECTING, now);
+}
+
+void mqttFinishConnect();
+
+void mqttTlsFailed(unsigned long now) {
+  char tlsError[32];
+  int code = mqttSecureClient.lastError(tlsError, sizeof(tlsError));
+  snprintf(mqttLastError, sizeof(mqttLastError), "tls: %d %s", code, tlsError);
+  mqttAttemptFailed(now);
+}
+
+// TCP установлен. Без TLS сокет передается WiFiClient (как после accept у
+// WiFiServer); с TLS - TLS-клиенту, рукопожатие дальше идет шагами автомата
+void mqttTcpConnected(unsigned long now) {
+  mqttTcpConnectMs = now - mqttConnStateTime;
+  int fd = mqttConnectFd;
+  mqttConnectFd = -1;
+  if (!mqttSettings.useTLS) {
+    lwip_fcntl(fd, F_SETFL, lwip_fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);  // Как после WiFiClient::connect()
+    wifiClient = WiFiClient(fd);
+    mqttFinishConnect();
+    return;
+  }
+  mqttTlsLongestStepMs = 0;
+  mqttSetConnState(MQTT_CONN_TLS, now);
+  if (!mqttSecureClient.begin(fd, mqttSettings.server.c_str())) {
+    mqttTlsFailed(now);
+  }
+}
+
+// Один шаг рукопожатия TLS; общий срок - MQTT_TLS_TIMEOUT
+void mqttTlsStep(unsigned long now) {
+  unsigned long stepStart = micros();
+  TlsHandshakeResult result = mqttSecureClient.handshakeStep();
+  uint32_t stepMs = (micros() - stepStart) / 1000;
+  if (stepMs > mqttTlsLongestStepMs) {
+    mqttTlsLongestStepMs = stepMs;
+  }
+  if (result == TLS_HANDSHAKE_FAILED) {
+    mqttTlsFailed(millis());
+  } else if (result == TLS_HANDSHAKE_DONE) {
+    mqttTlsHandshakeMs = millis() - mqttConnStateTime;
+    mqttTlsHandshakes++;
+    mqttFinishConnect();
+  } else if (now - mqttConnStateTime >= MQTT_TLS_TIMEOUT) {
+    mqttSecureClient.clearSession();  // Как при ошибке: следующая попытка - полное рукопожатие
+    snprintf(mqttLastError, sizeof(mqttLastError), "tls: timeout");
+    mqttAttemptFailed(now);
+  }
+}
+
+// Соединение (и TLS) готово: PubSubClient видит открытый клиент и сразу
+// отправляет CONNECT
+void mqttFinishConnect() {
   // Генерация уникального clientId
   uint32_t chipId = 0;
   for(int i=0; i<17; i=i+8) {
@@ -2122,81 +2577,271 @@ bool mqttConnect() {
   bool willRetain = true;
   int willQoS = 1;
   
-  // Неблокирующее подключение с LWT и коротким таймаутом
-  if (mqttClient.connect(clientId.c_str(), mqttSettings.user.c_str(), mqttSettings.password.c_str(),
-                         willTopic.c_str(), willQoS, willRetain, willMessage.c_str())) {
-    // Публикация статуса online с retain
-    mqttClient.publish(willTopic.c_str(), "online", true);  // true = retain
-    
-    // Публикация IP адреса при подключении (с retain)
-    if (WiFi.status() == WL_CONNECTED) {
-      String ipTopic = mqttSettings.prefix + "/simple/ip";
-      mqttClient.publish(ipTopic.c_str(), WiFi.localIP().toString().c_str(), true);  // true = retain
+  unsigned long handshakeStart = millis();
+  if (!mqttClient.connect(clientId.c_str(), mqttSettings.user.c_str(), mqttSettings.password.c_str(),
+                          willTopic.c_str(), willQoS, willRetain, willMessage.c_str())) {
+    snprintf(mqttLastError, sizeof(mqttLastError), "CONNECT: state %d", mqttClient.state());
+    if (mqttSettings.useTLS) {
+      mqttSecureClient.stop();
+    } else {
+      wifiClient.stop();
     }
+    mqttAttemptFailed(millis());
+    return;
+  }
+  mqttHandshakeMs = millis() - handshakeStart;
+  mqttConnectCount++;
+  mqttConsecutiveFailures = 0;
+  mqttLastError[0] = '\0';
+  mqttSetConnState(MQTT_CONN_CONNECTED, millis());
+  Serial.printf("[MQTT] Connected to %s (tcp %lu ms, tls %lu ms%s, handshake %lu ms)\n",
+                mqttBrokerIP.toString().c_str(), (unsigned long)mqttTcpConnectMs,
+                mqttSettings.useTLS ? (unsigned long)mqttTlsHandshakeMs : 0UL,
+                mqttSettings.useTLS && mqttSecureClient.resumed() ? " resumed" : "", (unsigned long)mqttHandshakeMs);
+  
+  // Публикация статуса online с retain
+  mqttPublish(willTopic.c_str(), "online", true);  // true = retain
+  
+  // Публикация IP адреса при подключении (с retain)
+  String ipTopic = mqttSettings.prefix + "/simple/ip";
+  mqttPublish(ipTopic.c_str(), WiFi.localIP().toString().c_str(), true);  // true = retain
+  
+  // Словари MessagePack (IP и SSID в них могли смениться)
+  publishMqttSchemas();
+  
+  // Подписка на команды и данные ESP01 из таблицы MQTT_COMMANDS
+  char commandTopic[MQTT_COMMAND_PREFIX_MAX + 32];
+  for (size_t i = 0; i < mqttCommands.size(); i++) {
+    if (mqttCommands.topic(i, commandTopic, sizeof(commandTopic))) {
+      mqttClient.subscribe(commandTopic);
+    }
+  }
+  
+  // Проверка режима работы после подключения к MQTT
+  // Если режим Комфорт, но датчик температуры дома недоступен, переключаемся на Авто
+  if (workMode == 1 && !homeTempSensorLWTOnline) {
+    Serial.println("[MQTT] Work mode is Comfort, but home temp sensor is offline. Switching to Auto mode.");
+    workMode = 0;
+    comfortState = COMFORT_WAIT;
+    comfortStateStartTime = 0;
+    saveWorkModeToEEPROM();
+  }
+}
+
+// Шаг автомата подключения (из loop(), ничего не ждет)
+void mqttConnectStep(unsigned long now) {
+  if (!mqttSettings.enabled || WiFi.status() != WL_CONNECTED) {
+    // Без сети попытка бессмысленна - начнем заново, когда WiFi вернется
+    if (mqttConnState == MQTT_CONN_RESOLVING || mqttConnState == MQTT_CONN_CONNECTING ||
+        mqttConnState == MQTT_CONN_TLS) {
+      mqttResetConnection();
+    }
+    return;
+  }
+  
+  switch (mqttConnState) {
+    case MQTT_CONN_CONNECTED:
+      if (!mqttClient.connected()) {
+        snprintf(mqttLastError, sizeof(mqttLastError), "lost: state %d", mqttClient.state());
+        mqttAttemptFailed(now);
+      }
+      break;
     
-    // Подписка на уставку
-    String setpointTopic = mqttSettings.prefix + "/setpoint/set";
-    mqttClient.subscribe(setpointTopic.c_str());
-    
-    // Подписка на управление реле датчиков
-    String sensorsRelayTopic = mqttSettings.prefix + "/sensors/reset";
-    mqttClient.subscribe(sensorsRelayTopic.c_str());
-    
-    // Подписка на запуск розжига
-    String ignitionStartTopic = mqttSettings.prefix + "/ignition/start";
-    mqttClient.subscribe(ignitionStartTopic.c_str());
-    
-    // Подписка на температуру в доме от ESP01
-    mqttClient.subscribe("home/esp01/temperature");
+    case MQTT_CONN_IDLE: {
+      if ((long)(now - mqttNextAttempt) < 0) {
+        break;
+      }
+      mqttConnectAttempts++;
+      if (mqttBrokerIPValid && now - mqttBrokerResolvedAt < MQTT_DNS_CACHE_TTL) {
+        mqttStartTcpConnect(now);
+        break;
+      }
+      IPAddress literal;
+      if (literal.fromString(mqttSettings.server)) {
+        mqttBrokerIP = literal;
+        mqttBrokerIPValid = true;
+        mqttBrokerResolvedAt = now;
+        mqttStartTcpConnect(now);
+        break;
+      }
+      MqttDnsRequest request = {};
+      request.host = mqttSettings.server.c_str();
+      mqttDnsDone = false;
+      request.generation = ++mqttDnsGeneration;
+      err_t err = tcpip_api_call(mqttDnsRequestInTcpip, &request.call);
+      if (err == ERR_OK) {  // Адрес уже в кэше lwip
+        uint32_t address = mqttIPv4Address(&request.addr);
+        if (address == 0) {
+          snprintf(mqttLastError, sizeof(mqttLastError), "dns: %s has no IPv4", mqttSettings.server.c_str());
+          mqttAttemptFailed(now);
+          break;
+        }
+        mqttBrokerIP = IPAddress(address);
+        mqttBrokerIPValid = true;
+        mqttBrokerResolvedAt = now;
+        mqttStartTcpConnect(now);
+      } else if (err == ERR_INPROGRESS) {
+        mqttSetConnState(MQTT_CONN_RESOLVING, now);
+      } else {
+        snprintf(mqttLastError, sizeof(mqttLastError), "dns: err %d", err);
+        mqttAttemptFailed(now);
+      }
+      break;
+    }
     
-    // Подписка на LWT статус датчика температуры дома
-    mqttClient.subscribe("home/esp01/status");
+    case MQTT_CONN_RESOLVING:
+      if (mqttDnsDone) {
+        if (mqttDnsAddress == 0) {
+          snprintf(mqttLastError, sizeof(mqttLastError), "dns: %s not found", mqttSettings.server.c_str());
+          mqttAttemptFailed(now);
+          break;
+        }
+        mqttBrokerIP = IPAddress(mqttDnsAddress);
+        mqttBrokerIPValid = true;
+        mqttBrokerResolvedAt = now;
+        mqttStartTcpConnect(now);
+      } else if (now - mqttConnStateTime >= MQTT_DNS_TIMEOUT) {
+        mqttDnsGeneration++;
+        snprintf(mqttLastError, sizeof(mqttLastError), "dns: timeout");
+        mqttAttemptFailed(now);
+      }
+      break;
     
-    // Проверка режима работы после подключения к MQTT
-    // Если режим Комфорт, но датчик температуры дома недоступен, переключаемся на Авто
-    if (workMode == 1 && !homeTempSensorLWTOnline) {
-      Serial.println("[MQTT] Work mode is Comfort, but home temp sensor is offline. Switching to Auto mode.");
-      workMode = 0;
-      comfortState = "WAIT";
-      comfortStateStartTime = 0;
-      saveWorkModeToEEPROM();
+    case MQTT_CONN_CONNECTING: {
+      fd_set writeSet;
+      FD_ZERO(&writeSet);
+      FD_SET(mqttConnectFd, &writeSet);
+      struct timeval tv = {0, 0};
+      if (lwip_select(mqttConnectFd + 1, NULL, &writeSet, NULL, &tv) <= 0) {
+        if (now - mqttConnStateTime >= MQTT_TCP_TIMEOUT) {
+          snprintf(mqttLastError, sizeof(mqttLastError), "tcp: timeout");
+          mqttBrokerIPValid = false;  // Брокер мог переехать - следующая попытка с DNS
+          mqttAttemptFailed(now);
+        }
+        break;
+      }
+      int soError = 0;
+      socklen_t len = sizeof(soError);
+      lwip_getsockopt(mqttConnectFd, SOL_SOCKET, SO_ERROR, &soError, &len);
+      if (soError != 0) {
+        snprintf(mqttLastError, sizeof(mqttLastError), "tcp: errno %d", soError);
+        mqttBrokerIPValid = false;
+        mqttAttemptFailed(now);
+        break;
+      }
+      mqttTcpConnected(now);
+      break;
     }
     
-    return true;
-  } else {
-    return false;
+    case MQTT_CONN_TLS:
+      mqttTlsStep(now);
+      break;
+  }
+}
+
+// Состояние подключения для диагностики и теста из веб-интерфейса
+void buildMqttConnectionJson(JsonObject obj) {
+  unsigned long now = millis();
+  obj["state"] = MQTT_CONN_STATE_NAMES[mqttConnState];
+  obj["connected"] = mqttClient.connected();
+  obj["attempts"] = mqttConnectAttempts;
+  obj["connects"] = mqttConnectCount;
+  obj["failures"] = mqttConsecutiveFailures;
+  obj["lastError"] = mqttLastError;
+  obj["nextAttemptIn"] = mqttConnState == MQTT_CONN_IDLE && (long)(mqttNextAttempt - now) > 0 ? (mqttNextAttempt - now) / 1000 : 0;
+  obj["brokerIP"] = mqttBrokerIPValid ? mqttBrokerIP.toString() : String("");
+  obj["tcpConnectMs"] = mqttTcpConnectMs;
+  obj["handshakeMs"] = mqttHandshakeMs;
+  obj["tls"] = mqttSettings.useTLS;
+  if (mqttSettings.useTLS) {
+    obj["tlsHandshakeMs"] = mqttTlsHandshakeMs;
+    obj["tlsHandshakes"] = mqttTlsHandshakes;
+    obj["tlsFullHandshakes"] = mqttSecureClient.fullHandshakes;
+    obj["tlsResumedHandshakes"] = mqttSecureClient.resumedHandshakes;
+    obj["tlsLastResumed"] = mqttSecureClient.resumed();
+    obj["tlsLongestStepMs"] = mqttTlsLongestStepMs;
+  }
+  obj["commands"] = mqttCommands.dispatched();  // Входящие, разобранные по таблице
+  obj["unknownTopics"] = mqttCommands.unknown();
+}
+
+// Буфер сборки state и ml/data (loop() однопоточный, сообщение сразу копируется в очередь)
+uint8_t mqttPayloadBuffer[MQTT_BUFFER_SIZE];
+
+const MqttEnumNames MQTT_ENUM_NAMES = {
+  &SYSTEM_STATES[0].apiName, sizeof(SystemStateInfo), SYSTEM_STATE_COUNT,
+  COMFORT_STATE_NAMES, COMFORT_STATE_COUNT
+};
+
+// Снимок переменных прошивки для полей state и ml/data (lib/MqttMessages)
+void captureMqttSnapshot(MqttSnapshot& s) {
+  s.names = &MQTT_ENUM_NAMES;
+  s.supplyTemp = supplyTemp;
+  s.returnTemp = returnTemp;
+  s.boilerTemp = boilerTemp;
+  s.outdoorTemp = outdoorTemp;
+  s.homeTemp = homeTemp;
+  s.setpoint = setpoint;
+  s.fan = fanState;
+  s.pump = pumpState;
+  s.systemEnabled = systemEnabled;
+  s.systemState = systemState;
+  
+  s.workMode = workMode;
+  s.homeTempSensorLWTOnline = homeTempSensorLWTOnline;
+  s.comfortState = comfortState;
+  s.targetHomeTemp = comfortSettings.targetHomeTemp;
+  
+  s.autoSetpoint = autoSettings.setpoint;
+  s.minTemp = autoSettings.minTemp;
+  s.maxTemp = autoSettings.maxTemp;
+  s.hysteresis = autoSettings.hysteresis;
+  s.inertiaTemp = autoSettings.inertiaTemp;
+  s.inertiaTime = autoSettings.inertiaTime;
+  s.overheatTemp = autoSettings.overheatTemp;
+  s.heatingTimeout = autoSettings.heatingTimeout;
+  
+  s.coalFeedingActive = coalFeedingActive;
+  s.coalFeedingElapsedSec = coalFeedingActive ? (millis() - coalFeedingStartTime) / 1000 : 0;
+  
+  // Время от NTP, если синхронизировано
+  s.timestamp = (ntpSettings.enabled && timeService.isSynced()) ? timeService.epoch() : 0;
+  s.uptimeSec = (uint32_t)(uptimeMillis() / 1000);
+  bool hasTime = ntpSettings.enabled && WiFi.isConnected();
+  strlcpy(s.time, hasTime ? getFormattedTime().c_str() : "", sizeof(s.time));
+  strlcpy(s.date, hasTime ? getFormattedDate().c_str() : "", sizeof(s.date));
+  
+  s.wifiRSSI = WiFi.RSSI();
+  strlcpy(s.wifiSSID, WiFi.SSID().c_str(), sizeof(s.wifiSSID));
+  strlcpy(s.wifiIP, WiFi.localIP().toString().c_str(), sizeof(s.wifiIP));
+  strlcpy(s.wifiMAC, WiFi.macAddress().c_str(), sizeof(s.wifiMAC));
+  s.freeMem = ESP.getFreeHeap();
+  s.heapSize = ESP.getHeapSize();
+  s.mlPublishInterval = mlSettings.publishInterval;
+  s.sensorCountBus1 = sensors1.getDeviceCount();
+  s.sensorCountBus2 = sensors2.getDeviceCount();
+  s.mqttConnected = mqttClient.connected();
+}
+
+// Постановка записи в очередь телеметрии под топиком <prefix><suffix>
+void enqueueMqttPayload(const char* suffix, int format, MqttPayloadFill fill) {
+  String topic = mqttSettings.prefix + suffix;
+  MqttSnapshot snapshot;
+  captureMqttSnapshot(snapshot);
+  size_t len = buildMqttPayload((PayloadFormat)format, mqttPayloadBuffer, sizeof(mqttPayloadBuffer), fill, snapshot);
+  if (len == 0) {
+    mqttPublishFailures++;
+    Serial.printf("[MQTT] Payload too large for %s\n", topic.c_str());
+    return;
   }
+  mqttEnqueue(MQTT_PRIORITY_TELEMETRY, topic.c_str(), mqttPayloadBuffer, len);
 }
 
 void publishMqttState() {
   if (!mqttSettings.enabled || !mqttClient.connected()) {
     return;
   }
-  
-  // Полный JSON со всеми данными
-  DynamicJsonDocument doc(2048);
-  doc["supplyTemp"] = supplyTemp;
-  doc["returnTemp"] = returnTemp;
-  doc["boilerTemp"] = boilerTemp;
-  doc["outdoorTemp"] = outdoorTemp;
-  doc["homeTemp"] = homeTemp;  // Температура в доме (от ESP01)
-  doc["setpoint"] = setpoint;
-  doc["fan"] = fanState;
-  doc["pump"] = pumpState;
-  doc["systemEnabled"] = systemEnabled;
-  doc["state"] = systemState;
-  doc["wifiRSSI"] = WiFi.RSSI();
-  doc["wifiSSID"] = WiFi.SSID();
-  doc["wifiIP"] = WiFi.localIP().toString();
-  doc["wifiMAC"] = WiFi.macAddress();
-  doc["uptime"] = millis() / 1000;
-  doc["freeMem"] = ESP.getFreeHeap();
-  
-  String json;
-  serializeJson(doc, json);
-  
-  String topic = mqttSettings.prefix + "/state";
-  mqttClient.publish(topic.c_str(), json.c_str(), false);  // false = не ждать подтверждения
+  enqueueMqttPayload("/state", mqttSettings.stateFormat, writeStatePayload);
 }
 
 void publishMqttSimple() {
@@ -2204,7 +2849,7 @@ void publishMqttSimple() {
     return;
   }
   
-  // Простые публикации (неблокирующие, без подтверждения)
+  // Простые публикации (в очередь, досылаются в loop())
   String tempTopic = mqttSettings.prefix + "/simple/temp";
   String returnTempTopic = mqttSettings.prefix + "/simple/returnTemp";
   String boilerTempTopic = mqttSettings.prefix + "/simple/boilerTemp";
@@ -2218,140 +2863,89 @@ void publishMqttSimple() {
   
   // Публикация температур датчиков
   if (supplyTemp > 0) {
-    mqttClient.publish(tempTopic.c_str(), String(supplyTemp, 1).c_str(), false);
+    mqttEnqueue(MQTT_PRIORITY_TELEMETRY, tempTopic.c_str(), String(supplyTemp, 1).c_str());
   }
   if (returnTemp > 0) {
-    mqttClient.publish(returnTempTopic.c_str(), String(returnTemp, 1).c_str(), false);
+    mqttEnqueue(MQTT_PRIORITY_TELEMETRY, returnTempTopic.c_str(), String(returnTemp, 1).c_str());
   }
   if (boilerTemp > 0) {
-    mqttClient.publish(boilerTempTopic.c_str(), String(boilerTemp, 1).c_str(), false);
+    mqttEnqueue(MQTT_PRIORITY_TELEMETRY, boilerTempTopic.c_str(), String(boilerTemp, 1).c_str());
   }
   if (outdoorTemp > -50.0 && outdoorTemp < 150.0) {  // Валидный диапазон для уличной температуры
-    mqttClient.publish(outdoorTempTopic.c_str(), String(outdoorTemp, 1).c_str(), false);
+    mqttEnqueue(MQTT_PRIORITY_TELEMETRY, outdoorTempTopic.c_str(), String(outdoorTemp, 1).c_str());
   }
   if (homeTemp > 0 && homeTemp < 50.0) {  // Валидный диапазон для домашней температуры
-    mqttClient.publish(homeTempTopic.c_str(), String(homeTemp, 1).c_str(), false);
+    mqttEnqueue(MQTT_PRIORITY_TELEMETRY, homeTempTopic.c_str(), String(homeTemp, 1).c_str());
   }
   
   // Публикация состояния системы
-  mqttClient.publish(enabledTopic.c_str(), systemEnabled ? "1" : "0", false);
-  mqttClient.publish(setpointTopic.c_str(), String(setpoint, 1).c_str(), false);
+  mqttEnqueue(MQTT_PRIORITY_TELEMETRY, enabledTopic.c_str(), systemEnabled ? "1" : "0");
+  mqttEnqueue(MQTT_PRIORITY_TELEMETRY, setpointTopic.c_str(), String(setpoint, 1).c_str());
   
   // Публикация режима работы (0 = Авто, 1 = Комфорт)
-  mqttClient.publish(workModeTopic.c_str(), String(workMode).c_str(), false);
+  mqttEnqueue(MQTT_PRIORITY_TELEMETRY, workModeTopic.c_str(), String(workMode).c_str());
   
   // Публикация уставки температуры дома
-  mqttClient.publish(targetHomeTempTopic.c_str(), String(comfortSettings.targetHomeTemp, 1).c_str(), false);
+  mqttEnqueue(MQTT_PRIORITY_TELEMETRY, targetHomeTempTopic.c_str(), String(comfortSettings.targetHomeTemp, 1).c_str());
   
   // Публикация IP адреса (с retain для сохранения последнего значения)
   if (WiFi.status() == WL_CONNECTED) {
-    mqttClient.publish(ipTopic.c_str(), WiFi.localIP().toString().c_str(), true);  // true = retain
+    mqttEnqueue(MQTT_PRIORITY_TELEMETRY, ipTopic.c_str(), WiFi.localIP().toString().c_str(), true);  // true = retain
   }
 }
 
-// Публикация детального JSON для обучения ML модели
+// Публикация детальной записи для обучения ML модели
 void publishMqttML() {
   if (!mlSettings.enabled || !mqttSettings.enabled || !mqttClient.connected()) {
     return;
   }
-  
-  // Минимальные вычисления - только разница температур (простое вычитание)
-  float tempDiff = supplyTemp - returnTemp;
-  
-  // Получение времени от NTP если доступно
-  unsigned long currentTime = 0;
-  if (ntpSettings.enabled && WiFi.isConnected()) {
-    currentTime = timeClient.getEpochTime();
-  }
-  
-  // Детальный JSON для обучения модели
-  DynamicJsonDocument doc(3072);  // Увеличенный размер для всех данных
-  
-  // 1. Температуры
-  doc["supplyTemp"] = supplyTemp;
-  doc["returnTemp"] = returnTemp;
-  doc["boilerTemp"] = boilerTemp;
-  doc["outdoorTemp"] = outdoorTemp;
-  doc["homeTemp"] = homeTemp;  // Температура в доме (от ESP01)
-  doc["tempDiff"] = tempDiff;  // Единственное вычисление - разница температур
-  
-  // 2. Состояния устройств
-  doc["fan"] = fanState;
-  doc["pump"] = pumpState;
-  doc["systemEnabled"] = systemEnabled;
-  doc["state"] = systemState;
-  
-  // 2.1. Режим работы
-  doc["workMode"] = workMode;  // 0 = Авто, 1 = Комфорт
-  doc["workModeName"] = (workMode == 0) ? "Авто" : "Комфорт";
-  
-  // 2.2. Статус датчика температуры дома
-  // Проверяем валидность датчика: LWT online и температура в допустимом диапазоне
-  bool homeTempValid = homeTempSensorLWTOnline && homeTemp > 0 && homeTemp < 50.0;
-  doc["homeTempSensorValid"] = homeTempValid;
-  doc["homeTempSensorLWTOnline"] = homeTempSensorLWTOnline;
-  
-  // 2.3. Настройки Comfort режима (если активен)
-  if (workMode == 1) {
-    doc["comfortState"] = comfortState;
-    doc["targetHomeTemp"] = comfortSettings.targetHomeTemp;
-  } else {
-    doc["comfortState"] = "";
-    doc["targetHomeTemp"] = 0.0;
-  }
-  
-  // 3. Настройки Auto режима (для контекста)
-  doc["setpoint"] = autoSettings.setpoint;
-  doc["minTemp"] = autoSettings.minTemp;
-  doc["maxTemp"] = autoSettings.maxTemp;
-  doc["hysteresis"] = autoSettings.hysteresis;
-  doc["inertiaTemp"] = autoSettings.inertiaTemp;
-  doc["inertiaTime"] = autoSettings.inertiaTime;
-  doc["overheatTemp"] = autoSettings.overheatTemp;
-  doc["heatingTimeout"] = autoSettings.heatingTimeout;
-  
-  // 4. Подброс угля
-  doc["coalFeedingActive"] = coalFeedingActive;
-  if (coalFeedingActive) {
-    doc["coalFeedingElapsed"] = (millis() - coalFeedingStartTime) / 1000;  // секунды
-  } else {
-    doc["coalFeedingElapsed"] = 0;
+  enqueueMqttPayload("/ml/data", mlSettings.format, writeMLPayload);
+}
+
+// Словари для MessagePack: порядок полей, значения перечислений, неизменные
+// строки. С retain при каждом подключении. Идут мимо очереди - поток
+// телеметрии вытесняет из нее старые сообщения, а словарь должен дойти:
+// неотправленная схема повторяется на следующем проходе, раньше досылки очереди
+struct MqttSchemaTopic {
+  const char* suffix;
+  MqttPayloadFill fill;
+};
+const MqttSchemaTopic MQTT_SCHEMAS[] = {
+  {"/schema/state", writeStatePayload},
+  {"/schema/ml", writeMLPayload}
+};
+const uint8_t MQTT_SCHEMA_COUNT = sizeof(MQTT_SCHEMAS) / sizeof(MQTT_SCHEMAS[0]);
+uint8_t mqttSchemasPending = 0;  // Биты MQTT_SCHEMAS, ждущие отправки
+
+void publishMqttSchemas() {
+  mqttSchemasPending = (1 << MQTT_SCHEMA_COUNT) - 1;
+}
+
+// Отправка отложенных схем, пока сокет готов; false - отправлены не все
+bool sendPendingMqttSchemas() {
+  if (mqttSchemasPending == 0) {
+    return true;
   }
-  
-  // 5. Временные метки
-  doc["timestamp"] = currentTime;
-  doc["uptime"] = millis() / 1000;
-  if (ntpSettings.enabled && WiFi.isConnected()) {
-    doc["time"] = getFormattedTime();
-    doc["date"] = getFormattedDate();
-  } else {
-    doc["time"] = "";
-    doc["date"] = "";
+  MqttSnapshot snapshot;
+  captureMqttSnapshot(snapshot);
+  for (uint8_t i = 0; i < MQTT_SCHEMA_COUNT; i++) {
+    if (!(mqttSchemasPending & (1 << i))) {
+      continue;
+    }
+    if (!mqttSocketWritable()) {
+      return false;
+    }
+    String topic = mqttSettings.prefix + MQTT_SCHEMAS[i].suffix;
+    size_t len = buildMqttPayload(PAYLOAD_SCHEMA, mqttPayloadBuffer, sizeof(mqttPayloadBuffer), MQTT_SCHEMAS[i].fill, snapshot);
+    if (len == 0) {
+      mqttPublishFailures++;
+      Serial.printf("[MQTT] Payload too large for %s\n", topic.c_str());
+    } else if (!mqttPublish(topic.c_str(), mqttPayloadBuffer, len, true)) {
+      return false;
+    }
+    mqttSchemasPending &= ~(1 << i);
   }
-  
-  // 6. WiFi и сеть
-  doc["wifiRSSI"] = WiFi.RSSI();
-  doc["wifiSSID"] = WiFi.SSID();
-  doc["wifiIP"] = WiFi.localIP().toString();
-  
-  // 7. Системные параметры
-  doc["freeMem"] = ESP.getFreeHeap();
-  doc["heapSize"] = ESP.getHeapSize();
-  
-  // 8. ML настройки (интервал публикации)
-  doc["mlPublishInterval"] = mlSettings.publishInterval;
-  
-  // 9. Дополнительная информация
-  doc["sensorCount"] = sensors1.getDeviceCount() + sensors2.getDeviceCount();  // Количество найденных датчиков на обеих шинах
-  doc["sensorCountBus1"] = sensors1.getDeviceCount();  // Количество на шине 1
-  doc["sensorCountBus2"] = sensors2.getDeviceCount();  // Количество на шине 2
-  doc["mqttConnected"] = mqttClient.connected();
-  
-  String json;
-  serializeJson(doc, json);
-  
-  String topic = mqttSettings.prefix + "/ml/data";
-  mqttClient.publish(topic.c_str(), json.c_str(), false);  // false = не ждать подтверждения
+  return true;
 }
 
 // Обработка поворота энкодера для изменения уставки
@@ -2385,15 +2979,17 @@ void handleEncoderRotation() {
     
     setpoint = newSetpoint;
     autoSettings.setpoint = newSetpoint;
+    requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
     
     // Отложенное сохранение в EEPROM (не блокируем сразу)
     autoSettingsDirty = true;
     lastAutoSettingsChange = millis();
+    markSettingsChanged();
     
     // Публикация уставки в MQTT (неблокирующая)
     if (mqttSettings.enabled && mqttClient.connected()) {
       String topic = mqttSettings.prefix + "/setpoint";
-      mqttClient.publish(topic.c_str(), String(setpoint, 1).c_str(), false);
+      mqttEnqueue(MQTT_PRIORITY_STATE, topic.c_str(), String(setpoint, 1).c_str());
     }
     
     lastEncoderRotation = millis(); // Запоминаем время поворота
@@ -2433,7 +3029,7 @@ void handleEncoderButton() {
       if (pressDuration >= BUTTON_LONG_PRESS_MS && !longPressHandled) {
         // Длительное нажатие (3 секунды) - запуск розжига
         longPressHandled = true;
-        startIgnition();
+        startIgnition(millis());
         Serial.println("[ENCODER] Long press detected - starting ignition");
       }
     }
@@ -2457,12 +3053,12 @@ void handleEncoderButton() {
         lastButtonPress = currentTime;
         
         // Если котел погас - запускаем розжиг
-        if (boilerExtinguished || systemState == "КОТЕЛ_ПОГАС") {
-          startIgnition();
+        if (boilerExtinguished || systemState == STATE_EXTINGUISHED) {
+          startIgnition(millis());
         }
         // Иначе переключение подброса угля
         else if (!coalFeedingActive) {
-          startCoalFeeding();
+          startCoalFeeding(millis());
         } else {
           stopCoalFeeding();
         }
@@ -2512,7 +3108,7 @@ void handleSerialCommands() {
       Serial.println(coalFeedingActive ? "АКТИВЕН" : "ВЫКЛ");
       Serial.println("[ТЕСТ] Переключение подброса угля...");
       if (!coalFeedingActive) {
-        startCoalFeeding();
+        startCoalFeeding(millis());
         Serial.println("[ТЕСТ] ✓ Подброс угля АКТИВИРОВАН");
       } else {
         stopCoalFeeding();
@@ -2579,22 +3175,8 @@ void handleSerialCommands() {
 
 // Функция синхронизации состояния реле с переменными
 void syncRelays() {
-  // Проверка таймаута ручного управления (2 минуты)
-  if (lastManualControlTime > 0) {
-    unsigned long elapsed = millis() - lastManualControlTime;
-    if (elapsed > MANUAL_CONTROL_TIMEOUT) {
-      // Возврат к автоматическому управлению
-      if (manualFanControl) {
-        manualFanControl = false;
-        Serial.println("[Реле] Ручное управление вентилятором отключено (таймаут 2 мин)");
-      }
-      if (manualPumpControl) {
-        manualPumpControl = false;
-        Serial.println("[Реле] Ручное управление насосом отключено (таймаут 2 мин)");
-      }
-      lastManualControlTime = 0;
-    }
-  }
+  // Таймаут ручного управления (2 минуты) - возврат к автоматике
+  checkManualControlTimeout(millis());
   
   // Если система выключена, принудительно выключаем реле
   if (!systemEnabled) {
@@ -2602,8 +3184,8 @@ void syncRelays() {
       fanState = false;
       pumpState = false;
       // Используем настройки логики для выключенного состояния
-      digitalWrite(PIN_RELAY_FAN, relaySettings.fanOffIsLow ? LOW : HIGH);
-      digitalWrite(PIN_RELAY_PUMP, relaySettings.pumpOffIsLow ? LOW : HIGH);
+      writeRelayPin(PIN_RELAY_FAN, relaySettings.fanOffIsLow ? LOW : HIGH);
+      writeRelayPin(PIN_RELAY_PUMP, relaySettings.pumpOffIsLow ? LOW : HIGH);
     }
     return;  // Не синхронизируем, если система выключена
   }
@@ -2615,7 +3197,7 @@ void syncRelays() {
     if (fanState != lastFanState) {
       // Включено = HIGH, выключено = зависит от настройки
       int fanLevel = fanState ? HIGH : (relaySettings.fanOffIsLow ? LOW : HIGH);
-      digitalWrite(PIN_RELAY_FAN, fanLevel);
+      writeRelayPin(PIN_RELAY_FAN, fanLevel);
       lastFanState = fanState;
     }
   }
@@ -2627,76 +3209,20 @@ void syncRelays() {
     if (pumpState != lastPumpState) {
       // Включено = HIGH, выключено = зависит от настройки
       int pumpLevel = pumpState ? HIGH : (relaySettings.pumpOffIsLow ? LOW : HIGH);
-      digitalWrite(PIN_RELAY_PUMP, pumpLevel);
+      writeRelayPin(PIN_RELAY_PUMP, pumpLevel);
       lastPumpState = pumpState;
     }
   }
 }
 
-// Функция запуска подброса угля
-void startCoalFeeding() {
-  if (coalFeedingActive) {
-    return;  // Уже активен
-  }
-  
-  coalFeedingActive = true;
-  coalFeedingStartTime = millis();
-  fanStateBeforeCoalFeeding = fanState;
-  
-  // Выключаем вентилятор
-  fanState = false;
-  digitalWrite(PIN_RELAY_FAN, LOW);
-  
-  
-  // Публикация в MQTT
-  if (mqttSettings.enabled && mqttClient.connected()) {
-    String topic = mqttSettings.prefix + "/coalFeeding";
-    mqttClient.publish(topic.c_str(), "1");
-  }
-  
-  updateDisplay();
-}
-
-// Функция остановки подброса угля
-void stopCoalFeeding() {
-  if (!coalFeedingActive) {
-    return;  // Не активен
-  }
-  
-  coalFeedingActive = false;
-  
-  // Восстанавливаем состояние вентилятора (или оставляем выключенным, если система выключена)
-  if (systemEnabled) {
-    // Восстанавливаем предыдущее состояние или оставляем управление автоматике
-    // fanState = fanStateBeforeCoalFeeding;  // Можно раскомментировать для восстановления
-  } else {
-    fanState = false;
-  }
-  
-  digitalWrite(PIN_RELAY_FAN, fanState ? HIGH : LOW);
-  
-  
-  // Публикация в MQTT
-  if (mqttSettings.enabled && mqttClient.connected()) {
-    String topic = mqttSettings.prefix + "/coalFeeding";
-    mqttClient.publish(topic.c_str(), "0");
-  }
-  
-  updateDisplay();
-}
-
-// Функция проверки и автоматического завершения подброса угля (резерв на случай забытого включения)
-void checkCoalFeeding() {
-  if (!coalFeedingActive) {
-    return;
-  }
-  
-  unsigned long elapsed = millis() - coalFeedingStartTime;
-  
-  // Автоматическое завершение через 30 минут (резерв, если забыли выключить)
-  if (elapsed >= (30 * 60 * 1000)) {
-    stopCoalFeeding();
+// Подброс угля начат/закончен (startCoalFeeding/stopCoalFeeding в BoilerCommands)
+void onCoalFeedingChanged(bool active) {
+#ifdef BOILER_SIMULATION
+  if (active) {
+    boilerSim.addCoal();  // В модели подброс сразу добавляет закладку
   }
+#endif
+  displayRefreshRequested = true;
 }
 
 // Получение времени работы подброса угля в секундах (с момента начала)
@@ -2716,201 +3242,119 @@ int getCoalFeedingRemainingSeconds() {
   return (int)(remaining / 1000);  // Возвращаем оставшиеся секунды
 }
 
-// Проверка валидности датчика температуры дома
-bool isHomeTempSensorValid(unsigned long now) {
-  // Сначала проверяем LWT статус - если offline, датчик невалиден
-  if (!homeTempSensorLWTOnline) {
-    return false;
+// Запись HTTP-команды в трассу: uri и тело (JSON или параметры формы)
+void traceHttpCommand() {
+  String body;
+  if (server.hasArg("plain")) {
+    body = server.arg("plain");
+  } else {
+    for (int i = 0; i < server.args(); i++) {
+      if (i > 0) body += "&";
+      body += server.argName(i) + "=" + server.arg(i);
+    }
   }
-  
-  // Если LWT online, разрешаем режим комфорт, даже если температура еще не получена
-  // Это позволяет включить режим комфорт сразу после появления датчика в сети
-  // Проверку температуры и таймаута используем только как дополнительную информацию
-  
-  return true;
+  traceRecorder.recordPair(TRACE_HTTP, server.uri().c_str(), body.c_str(), body.length());
+  requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
 }
 
-// Функция управления режимом "Комфорт"
-void handleComfortMode(unsigned long now) {
-  // Проверка наличия температуры в доме - если датчик offline, переключаемся на режим Авто
-  if (!isHomeTempSensorValid(now)) {
-    Serial.println("[Comfort] Home temperature sensor offline, switching to Auto mode");
-    workMode = 0;
-    saveWorkModeToEEPROM();
-    comfortState = "WAIT";
-    comfortStateStartTime = 0;
-    homeTempAtStateStart = 0.0;
-    return;
-  }
-  
-  // Вычисляем промежуточную температуру
-  float intermediateTemp = (comfortSettings.minBoilerTemp + comfortSettings.maxBoilerTemp) / 2.0;
-  
-  // Адаптивная температура поддержания
-  float maintainTemp = comfortSettings.minBoilerTemp + 5.0;
-  if (homeTemp < comfortSettings.targetHomeTemp) {
-    maintainTemp = comfortSettings.minBoilerTemp + 3.0;
-  } else {
-    maintainTemp = comfortSettings.minBoilerTemp + 7.0;
+// Запись смен systemState/comfortState/workMode в трассу (вызывается из loop)
+void traceStateChanges() {
+  static uint8_t lastSystemState = 0xFF;
+  static uint8_t lastComfortState = 0xFF;
+  if (systemState != lastSystemState) {
+    lastSystemState = systemState;
+    const char* name = SYSTEM_STATES[systemState].apiName;
+    traceRecorder.recordPair(TRACE_STATE, "system", name, strlen(name));
+  }
+  if (comfortState != lastComfortState) {
+    lastComfortState = comfortState;
+    const char* name = COMFORT_STATE_NAMES[comfortState];
+    traceRecorder.recordPair(TRACE_STATE, "comfort", name, strlen(name));
+  }
+  if (tracedWorkMode >= 0 && workMode != tracedWorkMode) {
+    tracedWorkMode = workMode;
+    const char* name = WORK_MODE_NAMES[workMode == 1 ? 1 : 0];
+    traceRecorder.recordPair(TRACE_STATE, "mode", name, strlen(name));
   }
-  
-  // Защита от перегрева
-  if (supplyTemp >= comfortSettings.warningTemp) {
-    fanState = false;
-    systemState = "OVERHEAT";
-    comfortState = "OVERHEAT";
-    return;
-  }
-  
-  // Восстановление после перегрева
-  if (comfortState == "OVERHEAT" && supplyTemp < comfortSettings.warningTemp) {
-    comfortState = "WAIT";
-    comfortStateStartTime = now;
-    systemState = "Ожидание";
-    Serial.println("[Comfort] Восстановление после перегрева");
-  }
-  
-  unsigned long stateElapsed = (comfortStateStartTime == 0) ? 0 : 
-    ((now >= comfortStateStartTime) ? (now - comfortStateStartTime) : (ULONG_MAX - comfortStateStartTime + now)) / 60000;
-  
-  if (comfortState == "WAIT") {
-    systemState = "Ожидание";
-    fanState = false;
-    if (homeTemp < (comfortSettings.targetHomeTemp - comfortSettings.hysteresisOn)) {
-      comfortState = "HEATING_1";
-      comfortStateStartTime = now;
-      homeTempAtStateStart = homeTemp;
-    }
-  } else if (comfortState == "HEATING_1") {
-    systemState = "Разогрев 1";
-    if (supplyTemp < intermediateTemp) {
-      if (!boilerExtinguished) {
-        fanState = true;
-        if (fanStartTime == 0) {
-          fanStartTime = now;
-          maxTempDuringFan = supplyTemp;
+}
+
+// API: Трасса - скачивание (оба файла кольца по порядку, бинарный формат)
+void handleTraceDownload() {
+  traceRecorder.flush();
+  const char* files[2] = {traceRecorder.olderFile(), traceRecorder.newerFile()};
+  size_t total = 0;
+  for (int i = 0; i < 2; i++) {
+    if (SPIFFS.exists(files[i])) {
+      File f = SPIFFS.open(files[i], "r");
+      total += f.size();
+      f.close();
+    }
+  }
+  
+  // Файлы отдаются кусками по мере освобождения сокета, loop() не ждет клиента
+  int index = 0;
+  File f;
+  server.sendHeader("Content-Disposition", "attachment; filename=trace.bin");
+  server.sendChunks(200, "application/octet-stream", total, [files, index, f](uint8_t* buf, size_t maxLen) mutable -> size_t {
+    while (index < 2) {
+      if (!f) {
+        if (SPIFFS.exists(files[index])) {
+          f = SPIFFS.open(files[index], "r");
         }
-      }
-    } else {
-      fanState = false;
-      fanStartTime = 0;
-      maxTempDuringFan = 0.0;
-      comfortState = "WAIT_COOLING";
-      comfortStateStartTime = now;
-      homeTempAtStateStart = homeTemp;
-    }
-  } else if (comfortState == "WAIT_COOLING") {
-    systemState = "Ожидание охлаждения";
-    if (supplyTemp < 63.0) {
-      fanState = true;
-    } else if (supplyTemp >= comfortSettings.waitTemp) {
-      fanState = false;
-    }
-    if (stateElapsed >= comfortSettings.waitCoolingTime) {
-      if (supplyTemp <= comfortSettings.waitTemp && supplyTemp >= 60.0) {
-        comfortState = "WAIT_HEATING";
-        comfortStateStartTime = now;
-        homeTempAtStateStart = homeTemp;
-      } else if (supplyTemp < 55.0) {
-        comfortState = "HEATING_1";
-        comfortStateStartTime = now;
-      }
-    }
-  } else if (comfortState == "WAIT_HEATING") {
-    systemState = "Ожидание прогрева";
-    if (supplyTemp < 63.0) {
-      fanState = true;
-    } else if (supplyTemp >= comfortSettings.waitTemp) {
-      fanState = false;
-    }
-    if (stateElapsed >= comfortSettings.waitAfterHeating1Time) {
-      float homeTempChange = homeTemp - homeTempAtStateStart;
-      if (homeTempChange >= 0.5 || homeTemp >= comfortSettings.catchUpTemp) {
-        comfortState = "COMFORT";
-        comfortStateStartTime = now;
-        homeTempAtStateStart = homeTemp;
-      } else {
-        comfortState = "HEATING_2";
-        comfortStateStartTime = now;
-        homeTempAtStateStart = homeTemp;
-      }
-    }
-  } else if (comfortState == "HEATING_2") {
-    systemState = "Разогрев 2";
-    if (supplyTemp < comfortSettings.maxBoilerTemp) {
-      fanState = true;
-    } else {
-      fanState = false;
-      comfortState = "WAIT_HEATING";
-      comfortStateStartTime = now;
-      homeTempAtStateStart = homeTemp;
-    }
-  } else if (comfortState == "COMFORT") {
-    systemState = "Комфорт";
-    // Проверяем, достигли ли целевой температуры - если да, выключаем вентилятор и переходим в MAINTAIN
-    if (homeTemp >= comfortSettings.targetHomeTemp) {
-      fanState = false;
-      comfortState = "MAINTAIN";
-      comfortStateStartTime = now;
-      homeTempAtStateStart = homeTemp;
-    } else {
-      float comfortLow = intermediateTemp - comfortSettings.hysteresisBoiler;
-      float comfortHigh = intermediateTemp + comfortSettings.hysteresisBoiler;
-      if (supplyTemp < comfortLow) {
-        fanState = true;
-      } else if (supplyTemp >= comfortHigh) {
-        fanState = false;
-      }
-      if (stateElapsed > 0 && stateElapsed % comfortSettings.inertiaCheckInterval == 0) {
-        float homeTempChange = homeTemp - homeTempAtStateStart;
-        if (homeTemp < 23.0) {
-          comfortState = "HEATING_1";
-          comfortStateStartTime = now;
-          homeTempAtStateStart = homeTemp;
-        } else if (stateElapsed >= comfortSettings.waitAfterReductionTime && homeTempChange < 0.3) {
-          comfortState = "HEATING_2";
-          comfortStateStartTime = now;
-          homeTempAtStateStart = homeTemp;
+        if (!f) {
+          index++;
+          continue;
         }
       }
-    }
-  } else if (comfortState == "MAINTAIN") {
-    systemState = "Поддержание";
-    // Если температура дома уже выше целевой с гистерезисом выключения, выключаем вентилятор
-    if (homeTemp >= (comfortSettings.targetHomeTemp + comfortSettings.hysteresisOff)) {
-      fanState = false;
-    } else if (homeTemp < (comfortSettings.targetHomeTemp - comfortSettings.hysteresisOn)) {
-      // Если температура упала ниже целевой, начинаем нагрев
-      comfortState = "HEATING_1";
-      comfortStateStartTime = now;
-      homeTempAtStateStart = homeTemp;
-      fanState = true;
-    } else {
-      // Поддержание температуры котла в диапазоне
-      float maintainLow = maintainTemp - comfortSettings.hysteresisBoiler;
-      float maintainHigh = maintainTemp + comfortSettings.hysteresisBoiler;
-      if (supplyTemp < maintainLow) {
-        fanState = true;
-      } else if (supplyTemp >= maintainHigh) {
-        fanState = false;
+      size_t n = f.read(buf, maxLen);
+      if (n > 0) {
+        return n;
       }
+      f.close();
+      f = File();
+      index++;
     }
-  }
+    return 0;
+  });
+}
+
+// API: Трасса - состояние
+void handleTraceInfo() {
+  DynamicJsonDocument doc(256);
+  doc["enabled"] = traceRecorder.isEnabled();
+  doc["records"] = traceRecorder.recordCount;
+  doc["dropped"] = traceRecorder.droppedCount;
+  doc["size"] = traceRecorder.storedSize();
+  doc["capacity"] = 2 * TRACE_FILE_SIZE;
   
-  // Проверка погасания котла в режиме Комфорт (только если не в режиме розжига)
-  if (!ignitionInProgress && !boilerExtinguished && fanState) {
-    checkBoilerExtinguished(now);
-    // Если котел погас, переключаемся в режим Авто
-    if (boilerExtinguished) {
-      workMode = 0;
-      saveWorkModeToEEPROM();
-      comfortState = "WAIT";
-      comfortStateStartTime = 0;
-      homeTempAtStateStart = 0.0;
+  String response;
+  serializeJson(doc, response);
+  server.send(200, "application/json", response);
+}
+
+// API: Трасса - включение/выключение записи
+void handleTraceSettingsPost() {
+  if (server.hasArg("plain")) {
+    DynamicJsonDocument doc(128);
+    DeserializationError error = deserializeJson(doc, server.arg("plain"));
+    if (error || !doc.containsKey("enabled")) {
+      server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
+      return;
     }
+    traceRecorder.flush();
+    traceRecorder.setEnabled(doc["enabled"].as<bool>());
+    server.send(200, "application/json", "{\"success\":true}");
+  } else {
+    server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
   }
 }
 
+// API: Трасса - очистка
+void handleTraceClear() {
+  traceRecorder.clear();
+  server.send(200, "application/json", "{\"success\":true}");
+}
+
 // Функция для отправки HTML интерфейса (потоковая передача)
 // Оптимизировано: убраны лишние проверки и отладочные сообщения
 void handleWebInterface() {
@@ -2922,11 +3366,9 @@ void handleWebInterface() {
     server.sendHeader("Connection", "keep-alive");  // Keep-alive для быстрых последующих запросов
     server.sendHeader("Content-Encoding", "identity");  // Явно указываем отсутствие сжатия
     
-    // Увеличиваем размер буфера для более быстрой передачи
     // Потоковая передача файла (не загружает весь файл в память)
-    // streamFile автоматически обрабатывает большие файлы по частям
+    // streamFile отдает файл по частям из handleClient и сам закрывает его в конце
     server.streamFile(file, "text/html; charset=utf-8");
-    file.close();
     return;
   }
   
@@ -2938,7 +3380,8 @@ void handleWebInterface() {
 }
 
 // API: Получение статуса
-void handleStatus() {
+// Сборка JSON статуса (отдельно от отправки - используется и в бенчмарке)
+String buildStatusJson() {
   DynamicJsonDocument doc(1024);
   doc["supplyTemp"] = supplyTemp;
   doc["returnTemp"] = returnTemp;
@@ -2950,13 +3393,14 @@ void handleStatus() {
   doc["fan"] = fanState;
   doc["pump"] = pumpState;
   doc["systemEnabled"] = systemEnabled;
-  doc["state"] = systemState;
+  doc["state"] = SYSTEM_STATES[systemState].apiName;
+  doc["stateLabel"] = SYSTEM_STATES[systemState].label;
   doc["workMode"] = workMode;
   doc["workModeName"] = (workMode == 0) ? "Авто" : "Комфорт";
   doc["homeTempSensorValid"] = isHomeTempSensorValid(millis());  // Статус датчика температуры дома
   doc["homeTempSensorLWTOnline"] = homeTempSensorLWTOnline;  // LWT статус датчика (online/offline)
   if (workMode == 1) {
-    doc["comfortState"] = comfortState;
+    doc["comfortState"] = COMFORT_STATE_NAMES[comfortState];
     doc["targetHomeTemp"] = comfortSettings.targetHomeTemp;  // Уставка для дома в режиме Комфорт
   }
   doc["firmwareVersion"] = FIRMWARE_VERSION;
@@ -2971,14 +3415,14 @@ void handleStatus() {
   doc["lowReturnTemp"] = lowReturnTemp;
   
   // Предупреждение о прогорании угля
-  bool coalBurned = (systemState == "COAL_BURNED");
+  bool coalBurned = (systemState == STATE_COAL_BURNED);
   doc["coalBurned"] = coalBurned;
   
   // Информация о погасании котла и розжиге
   doc["boilerExtinguished"] = boilerExtinguished;
   doc["ignitionInProgress"] = ignitionInProgress;
   if (ignitionInProgress) {
-    unsigned long ignitionElapsed = (millis() >= ignitionStartTime) ? (millis() - ignitionStartTime) : (ULONG_MAX - ignitionStartTime + millis());
+    unsigned long ignitionElapsed = millis() - ignitionStartTime;
     doc["ignitionElapsed"] = ignitionElapsed / 1000;  // секунды
     doc["ignitionStartTemp"] = ignitionStartTemp;
     doc["ignitionTempIncrease"] = supplyTemp - ignitionStartTemp;
@@ -2991,7 +3435,7 @@ void handleStatus() {
   doc["fanStats"]["cycleCount"] = fanStats.cycleCount;
   doc["fanStats"]["dailyCycleCount"] = fanStats.dailyCycleCount;
   if (fanStartTime > 0 && fanState) {
-    unsigned long currentWorkTime = (millis() >= fanStartTime) ? (millis() - fanStartTime) : (ULONG_MAX - fanStartTime + millis());
+    unsigned long currentWorkTime = millis() - fanStartTime;
     doc["fanStats"]["currentWorkTime"] = currentWorkTime / 1000;  // секунды
   } else {
     doc["fanStats"]["currentWorkTime"] = 0;
@@ -3001,7 +3445,7 @@ void handleStatus() {
   doc["freeHeap"] = ESP.getFreeHeap();
   doc["minFreeHeap"] = ESP.getMinFreeHeap();
   doc["cpuLoad"] = cpuLoad;
-  doc["uptime"] = millis() / 1000;  // Время работы в секундах
+  doc["uptime"] = (unsigned long)(uptimeMillis() / 1000);  // Время работы в секундах
   
   // Информация о тренде температуры (1 = рост, 0 = стабильно, -1 = падение)
   // Показываем только если есть рост (1) или падение (-1)
@@ -3027,14 +3471,290 @@ void handleStatus() {
   if (homeTrend == 1) doc["homeTrend"] = 1;
   else if (homeTrend == -1) doc["homeTrend"] = -1;
   
+  String response;
+  serializeJson(doc, response);
+  return response;
+}
+
+void handleStatus() {
+  server.send(200, "application/json", buildStatusJson());
+}
+
+// Фиксация длительности этапа loop(), возвращает время начала следующего этапа
+uint32_t recordLoopStage(LoopStage stage, uint32_t stageStart) {
+  uint32_t now = micros();
+  uint32_t elapsed = now - stageStart;
+  loopStageLast[stage] = elapsed;
+  loopStageHistograms[stage].record(elapsed);
+  return now;
+}
+
+// Профиль этапов loop() в JSON (p50/p99/max в мкс)
+String buildLoopProfileJson() {
+  DynamicJsonDocument doc(2048);
+  JsonObject stages = doc.createNestedObject("stages");
+  for (int i = 0; i < LOOP_STAGE_COUNT; i++) {
+    const LatencyHistogram& h = loopStageHistograms[i];
+    JsonObject stage = stages.createNestedObject(LOOP_STAGE_NAMES[i]);
+    stage["count"] = h.count();
+    stage["p50"] = h.percentile(50);
+    stage["p99"] = h.percentile(99);
+    stage["max"] = h.max();
+    stage["avg"] = h.count() > 0 ? (uint32_t)(h.total() / h.count()) : 0;
+  }
+  
+  // Последняя медленная итерация - какой этап ее затянул
+  if (slowLoopTime > 0) {
+    JsonObject slow = doc.createNestedObject("lastSlowLoop");
+    slow["ago"] = (millis() - slowLoopTime) / 1000;  // секунды назад
+    for (int i = 0; i < LOOP_STAGE_COUNT; i++) {
+      slow[LOOP_STAGE_NAMES[i]] = slowLoopStages[i];
+    }
+  }
+  doc["heartbeatPerMinute"] = heartbeatPerMinute;
+  
+  String json;
+  serializeJson(doc, json);
+  return json;
+}
+
+// API: Профиль этапов loop(), ?reset=1 - обнулить после выдачи
+void handleLoopProfile() {
+  server.send(200, "application/json", buildLoopProfileJson());
+  if (server.hasArg("reset") && server.arg("reset").toInt() == 1) {
+    for (int i = 0; i < LOOP_STAGE_COUNT; i++) {
+      loopStageHistograms[i].reset();
+    }
+    slowLoopTime = 0;
+  }
+}
+
+// Публикация профиля loop() в MQTT
+void publishMqttProfile() {
+  if (!mqttSettings.enabled || !mqttClient.connected()) {
+    return;
+  }
+  String json = buildLoopProfileJson();
+  String topic = mqttSettings.prefix + "/diagnostics/profile";
+  mqttEnqueue(MQTT_PRIORITY_TELEMETRY, topic.c_str(), json.c_str());
+}
+
+// Фрагментация кучи в процентах: 0 - вся свободная память одним блоком
+float getHeapFragmentation() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  if (info.total_free_bytes == 0) {
+    return 100.0;
+  }
+  return 100.0 - (info.largest_free_block * 100.0 / info.total_free_bytes);
+}
+
+void sampleHeapFragmentation() {
+  heapFragHistory[heapHistoryIndex] = (uint8_t)getHeapFragmentation();
+  heapFreeKBHistory[heapHistoryIndex] = ESP.getFreeHeap() / 1024;
+  heapHistoryIndex = (heapHistoryIndex + 1) % HEAP_HISTORY_SIZE;
+  if (heapHistoryCount < HEAP_HISTORY_SIZE) heapHistoryCount++;
+}
+
+// API: Куча - фрагментация за последний час и учет по подсистемам (если собрано с HEAP_PROFILER)
+void handleHeapProfile() {
+  DynamicJsonDocument doc(4096);
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  doc["freeBytes"] = info.total_free_bytes;
+  doc["allocatedBytes"] = info.total_allocated_bytes;
+  doc["largestFreeBlock"] = info.largest_free_block;
+  doc["freeBlocks"] = info.free_blocks;
+  doc["allocatedBlocks"] = info.allocated_blocks;
+  doc["fragmentation"] = getHeapFragmentation();
+  
+  // История от старых к новым
+  JsonArray frag = doc.createNestedArray("fragmentationHistory");
+  JsonArray freeKB = doc.createNestedArray("freeKBHistory");
+  int start = (heapHistoryIndex + HEAP_HISTORY_SIZE - heapHistoryCount) % HEAP_HISTORY_SIZE;
+  for (int i = 0; i < heapHistoryCount; i++) {
+    int idx = (start + i) % HEAP_HISTORY_SIZE;
+    frag.add(heapFragHistory[idx]);
+    freeKB.add(heapFreeKBHistory[idx]);
+  }
+  
+#ifdef HEAP_PROFILER
+  doc["profiler"] = true;
+  HeapTagStats stats[HEAP_TAG_COUNT];
+  heapProfilerSnapshot(stats);
+  JsonObject tags = doc.createNestedObject("tags");
+  for (int i = 0; i < HEAP_TAG_COUNT; i++) {
+    JsonObject tag = tags.createNestedObject(HEAP_TAG_NAMES[i]);
+    tag["allocs"] = stats[i].allocCount;
+    tag["frees"] = stats[i].freeCount;
+    tag["allocBytes"] = stats[i].allocBytes;
+    tag["freeBytes"] = stats[i].freeBytes;
+    tag["liveBytes"] = stats[i].liveBytes;
+    tag["peakLiveBytes"] = stats[i].peakLiveBytes;
+  }
+  HeapUntrackedStats untracked = heapProfilerUntracked();
+  JsonObject untrackedObj = doc.createNestedObject("untracked");
+  untrackedObj["allocs"] = untracked.allocCount;
+  untrackedObj["frees"] = untracked.freeCount;
+  untrackedObj["liveBlocks"] = untracked.liveBlocks;
+  if (server.hasArg("reset") && server.arg("reset").toInt() == 1) {
+    heapProfilerReset();
+  }
+#else
+  doc["profiler"] = false;
+#endif
+  
   String response;
   serializeJson(doc, response);
   server.send(200, "application/json", response);
 }
 
+// ============ Микробенчмарки горячих функций ============
+// Только в отдельной сборке с флагом DEVICE_BENCH: прогон занимает loop() на
+// доли секунды, поэтому в рабочей прошивке маршрутов нет. Замеры не трогают
+// брокер и флеш - только сборка данных в памяти. Время и выделения памяти
+// библиотек без Arduino меряет хостовый стенд tools/hostbench.
+// Запуск на устройстве: POST /api/bench/run. Базовая линия хранится в SPIFFS,
+// регрессия - среднее время выше базового на BENCH_TOLERANCE_PERCENT (и хотя бы на BENCH_TOLERANCE_US)
+#ifdef DEVICE_BENCH
+#define BENCH_BASELINE_FILE "/bench_baseline.json"
+#define BENCH_TOLERANCE_PERCENT 25
+#define BENCH_TOLERANCE_US 5
+
+struct BenchResult {
+  const char* name;
+  uint32_t iterations;
+  float avgUs;
+  uint32_t maxUs;
+  int32_t heapDelta;  // Изменение свободной памяти после всех итераций (признак утечки)
+};
+
+template <typename Fn>
+BenchResult runBench(const char* name, uint32_t iterations, Fn fn) {
+  BenchResult result = {name, iterations, 0.0, 0, 0};
+  fn();  // Прогрев: первые выделения памяти и кеши не должны попадать в замер
+  
+  uint32_t heapBefore = ESP.getFreeHeap();
+  uint64_t totalUs = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint32_t start = micros();
+    fn();
+    uint32_t elapsed = micros() - start;
+    totalUs += elapsed;
+    if (elapsed > result.maxUs) result.maxUs = elapsed;
+    if ((i & 15) == 15) {
+      esp_task_wdt_reset();
+      yield();
+    }
+  }
+  result.avgUs = (float)totalUs / iterations;
+  result.heapDelta = (int32_t)ESP.getFreeHeap() - (int32_t)heapBefore;
+  return result;
+}
+
+// Прогон всех бенчмарков (не больше 12), возвращает количество результатов
+int runAllBenchmarks(BenchResult* results) {
+  int count = 0;
+  static TemperatureHistory benchHistory = {{0}, 0, 0, 0, false};
+  static float benchValue = 50.0;
+  
+  results[count++] = runBench("statusJson", 100, []() { buildStatusJson(); });
+  static MqttSnapshot benchSnapshot;
+  results[count++] = runBench("mqttMLJson", 100, []() {
+    captureMqttSnapshot(benchSnapshot);
+    buildMqttPayload(PAYLOAD_JSON, mqttPayloadBuffer, sizeof(mqttPayloadBuffer), writeMLPayload, benchSnapshot);
+  });
+  results[count++] = runBench("mqttMLMsgpack", 100, []() {
+    captureMqttSnapshot(benchSnapshot);
+    buildMqttPayload(PAYLOAD_MSGPACK, mqttPayloadBuffer, sizeof(mqttPayloadBuffer), writeMLPayload, benchSnapshot);
+  });
+  results[count++] = runBench("addToHistory", 1000, []() {
+    benchValue = (benchValue > 80.0) ? 50.0 : benchValue + 0.1;
+    addToHistory(&benchHistory, benchValue, millis());
+  });
+  results[count++] = runBench("temperatureTrend", 1000, []() { getTemperatureTrend(&benchHistory); });
+  results[count++] = runBench("updateDisplay", 100, []() { updateDisplay(); });  // Сборка модели; отрисовка - в задаче дисплея
+  // Настройки MQTT: JSON блока EEPROM туда и обратно с проверкой пределов - без флеша
+  results[count++] = runBench("mqttSettingsJson", 100, []() {
+    String json = mqttSettingsBlobJson();
+    DynamicJsonDocument doc(512);
+    deserializeJson(doc, json);
+    validateSettingsFields(SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+  });
+  
+  return count;
+}
+
+// Прогон и вывод результатов в JSON, сравнение с базовой линией
+void handleBenchRun() {
+  BenchResult results[12];
+  int count = runAllBenchmarks(results);
+  
+  DynamicJsonDocument baseline(1024);
+  bool hasBaseline = false;
+  File file = SPIFFS.open(BENCH_BASELINE_FILE, "r");
+  if (file) {
+    hasBaseline = (deserializeJson(baseline, file) == DeserializationError::Ok);
+    file.close();
+  }
+  
+  DynamicJsonDocument doc(3072);
+  JsonArray arr = doc.createNestedArray("results");
+  JsonArray regressions = doc.createNestedArray("regressions");
+  for (int i = 0; i < count; i++) {
+    JsonObject item = arr.createNestedObject();
+    item["name"] = results[i].name;
+    item["iterations"] = results[i].iterations;
+    item["avgUs"] = results[i].avgUs;
+    item["maxUs"] = results[i].maxUs;
+    item["heapDelta"] = results[i].heapDelta;
+    if (hasBaseline && baseline.containsKey(results[i].name)) {
+      float base = baseline[results[i].name];
+      item["baselineUs"] = base;
+      float limit = base * (100 + BENCH_TOLERANCE_PERCENT) / 100.0;
+      if (limit < base + BENCH_TOLERANCE_US) limit = base + BENCH_TOLERANCE_US;
+      if (results[i].avgUs > limit) {
+        regressions.add(results[i].name);
+      }
+    }
+  }
+  doc["hasBaseline"] = hasBaseline;
+  bool passed = regressions.size() == 0;
+  doc["passed"] = passed;
+  
+  String response;
+  serializeJson(doc, response);
+  // 409 при регрессии, чтобы скрипт с curl --fail падал
+  server.send(passed ? 200 : 409, "application/json", response);
+}
+
+// Прогон и сохранение результата как новой базовой линии
+void handleBenchBaseline() {
+  BenchResult results[12];
+  int count = runAllBenchmarks(results);
+  
+  DynamicJsonDocument baseline(1024);
+  for (int i = 0; i < count; i++) {
+    baseline[results[i].name] = results[i].avgUs;
+  }
+  
+  File file = SPIFFS.open(BENCH_BASELINE_FILE, "w");
+  if (!file) {
+    server.send(500, "application/json", "{\"error\":\"SPIFFS write failed\"}");
+    return;
+  }
+  serializeJson(baseline, file);
+  file.close();
+  
+  String response;
+  serializeJson(baseline, response);
+  server.send(200, "application/json", response);
+}
+#endif
+
 // API: Диагностика системы (для обнаружения зависаний)
 void handleDiagnostics() {
-  DynamicJsonDocument doc(2048);
+  DynamicJsonDocument doc(3648);
   unsigned long now = millis();
   
   // Информация о памяти
@@ -3042,9 +3762,10 @@ void handleDiagnostics() {
   doc["minFreeHeap"] = ESP.getMinFreeHeap();
   doc["maxAllocHeap"] = ESP.getMaxAllocHeap();
   doc["heapSize"] = ESP.getHeapSize();
+  doc["heapFragmentation"] = getHeapFragmentation();
   
   // Информация о времени работы
-  unsigned long uptime = now / 1000;
+  unsigned long uptime = (unsigned long)(uptimeMillis() / 1000);  // 64-битный счетчик: не сбрасывается через 49 суток
   doc["uptime"] = uptime;
   unsigned long hours = uptime / 3600;
   unsigned long minutes = (uptime % 3600) / 60;
@@ -3059,6 +3780,9 @@ void handleDiagnostics() {
   // Информация о WiFi
   doc["wifiStatus"] = WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected";
   doc["wifiRSSI"] = WiFi.RSSI();
+  doc["wifiStage"] = WIFI_STAGE_NAMES[wifiStage];
+  doc["fastBoot"] = fastBoot;
+  doc["deferredBootPending"] = deferredBootPending;
   if (WiFi.status() == WL_CONNECTED) {
     doc["wifiIP"] = WiFi.localIP().toString();
   } else {
@@ -3068,20 +3792,87 @@ void handleDiagnostics() {
   // Информация о MQTT
   doc["mqttConnected"] = mqttClient.connected();
   doc["mqttEnabled"] = mqttSettings.enabled;
-  
-  // Heartbeat - счетчик итераций loop()
-  static unsigned long heartbeatCounter = 0;
-  static unsigned long lastHeartbeatReset = 0;
-  if (now - lastHeartbeatReset > 60000 || now < lastHeartbeatReset) {
-    heartbeatCounter = 0;
-    lastHeartbeatReset = now;
-  }
-  heartbeatCounter++;
-  doc["heartbeatPerMinute"] = heartbeatCounter;
+  buildMqttConnectionJson(doc.createNestedObject("mqttConnection"));
+  
+  // HTTPS к GitHub (обновления): рукопожатия TLS и переиспользованные соединения
+  JsonObject https = doc.createNestedObject("https");
+  https["handshakes"] = httpsHandshakes;
+  https["reused"] = httpsReused;
+  https["lastHandshakeMs"] = httpsLastHandshakeMs;
+  https["maxHandshakeMs"] = httpsMaxHandshakeMs;
+  
+  // Очередь исходящих MQTT: по классам приоритета и задержка досылки (мкс)
+  JsonObject outbox = doc.createNestedObject("mqttOutbox");
+  for (int i = 0; i < MQTT_PRIORITY_COUNT; i++) {
+    const MqttOutboxClassStats& st = mqttOutbox.stats((MqttPriority)i);
+    JsonObject cls = outbox.createNestedObject(MQTT_PRIORITY_NAMES[i]);
+    cls["depth"] = st.depth;
+    cls["maxDepth"] = st.maxDepth;
+    cls["bytes"] = st.bytes;
+    cls["queued"] = st.queued;
+    cls["dropped"] = st.dropped;
+  }
+  outbox["published"] = mqttPublishCount;
+  outbox["failures"] = mqttPublishFailures;
+  outbox["stalls"] = mqttOutboxStalls;
+  outbox["drainP50"] = mqttDrainLatency.percentile(50);
+  outbox["drainP99"] = mqttDrainLatency.percentile(99);
+  outbox["drainMax"] = mqttDrainLatency.max();
+  
+  // Heartbeat - итерации loop() за последнюю полную минуту
+  doc["heartbeatPerMinute"] = heartbeatPerMinute;
+  
+  // Дисплей: отправленные кадры и объем по I2C
+  JsonObject display = doc.createNestedObject("display");
+  display["i2cClock"] = DISPLAY_I2C_CLOCK;
+  display["frames"] = displayFrames;
+  display["skippedFrames"] = displaySkippedFrames;
+  display["bytesSent"] = displayBytesSent;
+  display["renderUs"] = displayRenderUs;
+  display["renderMaxUs"] = displayRenderMaxUs;
+  display["task"] = displayTaskHandle != NULL;
+  
+  // Веб-сервер: соединения и отказы
+  const NbHttpStats& httpStats = server.stats();
+  JsonObject http = doc.createNestedObject("http");
+  http["active"] = httpStats.active;
+  http["maxActive"] = httpStats.maxActive;
+  http["accepted"] = httpStats.accepted;
+  http["requests"] = httpStats.requests;
+  http["timeouts"] = httpStats.timeouts;
+  http["rejected"] = httpStats.rejected;
+  http["evicted"] = httpStats.evicted;
+  http["errors"] = httpStats.errors;
+  
+  // Кеш ответов настроек
+  JsonObject settingsCacheInfo = doc.createNestedObject("settingsCache");
+  settingsCacheInfo["generation"] = settingsGeneration;
+  settingsCacheInfo["hits"] = settingsCacheHits;
+  settingsCacheInfo["misses"] = settingsCacheMisses;
+  settingsCacheInfo["notModified"] = settingsCacheNotModified;
+  
+  // Событийное управление: сколько пересчетов и решений, что вызвало последнее
+  JsonObject control = doc.createNestedObject("control");
+  char triggerName[40];
+  control["evaluations"] = controlEvaluations;
+  control["decisions"] = controlDecisions;
+  formatControlTrigger(lastControlTrigger, triggerName, sizeof(triggerName));
+  control["lastTrigger"] = triggerName;
+  if (controlDecisions > 0) {
+    JsonObject decision = control.createNestedObject("lastDecision");
+    formatControlTrigger(lastControlDecision.trigger, triggerName, sizeof(triggerName));
+    decision["trigger"] = triggerName;
+    decision["ago"] = (now - lastControlDecision.time) / 1000;
+    decision["fan"] = lastControlDecision.fan;
+    decision["pump"] = lastControlDecision.pump;
+    decision["state"] = SYSTEM_STATES[lastControlDecision.systemState].apiName;
+    decision["comfortState"] = COMFORT_STATE_NAMES[lastControlDecision.comfortState];
+  }
+  control["nextTimerIn"] = controlDeadline != 0 ? (long)(controlDeadline - now) : -1;
   
   // Информация о системе
   doc["systemEnabled"] = systemEnabled;
-  doc["systemState"] = systemState;
+  doc["systemState"] = SYSTEM_STATES[systemState].apiName;
   
   // Предупреждения
   JsonArray warnings = doc.createNestedArray("warnings");
@@ -3097,8 +3888,199 @@ void handleDiagnostics() {
   server.send(200, "application/json", response);
 }
 
+// Метрики Prometheus (/metrics). Текст пишется прямо в буфер отправки
+// соединения веб-сервера кусками chunked - без String, JSON и выделений кучи.
+// Курсор - семейство и номер строки в нем: строка, не влезшая в кусок,
+// уходит первой в следующем. Значения читаются в момент формирования куска.
+enum MetricsFamily : uint8_t {
+  METRICS_TEMPERATURE,
+  METRICS_SETPOINT,
+  METRICS_RELAY,
+  METRICS_FAN_WORK,
+  METRICS_FAN_CYCLES,
+  METRICS_SENSOR_READINGS,
+  METRICS_SENSOR_READ_FAILURES,
+  METRICS_HEAP_FREE,
+  METRICS_HEAP_MIN_FREE,
+  METRICS_HEAP_MAX_ALLOC,
+  METRICS_LOOP_STAGE,
+  METRICS_LOOP_STAGE_MAX,
+  METRICS_MQTT_CONNECTED,
+  METRICS_MQTT_CONNECT_ATTEMPTS,
+  METRICS_MQTT_PUBLISH,
+  METRICS_MQTT_PUBLISH_FAILURES,
+  METRICS_MQTT_OUTBOX_DEPTH,
+  METRICS_MQTT_OUTBOX_DROPPED,
+  METRICS_MQTT_DRAIN,
+  METRICS_WIFI_RSSI,
+  METRICS_BOOT_COUNT,
+  METRICS_UPTIME,
+  METRICS_FAMILY_COUNT
+};
+
+struct MetricsCursor {
+  uint8_t family;
+  uint8_t item;  // 0 - строки HELP/TYPE, дальше - значения
+};
+
+int formatMetricsHeader(char* out, size_t size, const char* name, const char* type, const char* help) {
+  return snprintf(out, size, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Строка item семейства family в out; -1 - семейство закончилось.
+// Результат >= size - строка не влезла (как у snprintf)
+int formatMetricsItem(uint8_t family, uint8_t item, char* out, size_t size) {
+  static const char* const RELAY_NAMES[2] = {"fan", "pump"};
+  static const char* const READING_RESULTS[3] = {"accepted", "rejected", "rate_limited"};
+  switch (family) {
+    case METRICS_TEMPERATURE: {
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_temperature_celsius", "gauge", "Filtered sensor temperature");
+      if (item > SENSOR_CHANNEL_COUNT) return -1;
+      const float temps[SENSOR_CHANNEL_COUNT] = {supplyTemp, returnTemp, boilerTemp, outdoorTemp, homeTemp};
+      return snprintf(out, size, "boiler_temperature_celsius{sensor=\"%s\"} %.2f\n", SENSOR_CHANNEL_NAMES[item - 1], temps[item - 1]);
+    }
+    case METRICS_SETPOINT:
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_setpoint_celsius", "gauge", "Supply temperature setpoint");
+      if (item > 1) return -1;
+      return snprintf(out, size, "boiler_setpoint_celsius %.1f\n", setpoint);
+    case METRICS_RELAY:
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_relay_on", "gauge", "Relay state (1 - on)");
+      if (item > 2) return -1;
+      return snprintf(out, size, "boiler_relay_on{relay=\"%s\"} %d\n", RELAY_NAMES[item - 1], (item == 1 ? fanState : pumpState) ? 1 : 0);
+    case METRICS_FAN_WORK:
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_fan_work_seconds_total", "counter", "Fan run time (minute resolution)");
+      if (item > 1) return -1;
+      return snprintf(out, size, "boiler_fan_work_seconds_total %lu\n", fanStats.totalWorkTime / 1000);
+    case METRICS_FAN_CYCLES:
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_fan_cycles_total", "counter", "Fan on/off cycles");
+      if (item > 1) return -1;
+      return snprintf(out, size, "boiler_fan_cycles_total %d\n", fanStats.cycleCount);
+    case METRICS_SENSOR_READINGS: {
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_sensor_readings_total", "counter", "Sensor readings by filter result");
+      if (item > SENSOR_CHANNEL_COUNT * 3) return -1;
+      const SensorFilter& f = sensorFilters[(item - 1) / 3];
+      int result = (item - 1) % 3;
+      uint32_t value = result == 0 ? f.acceptedCount : (result == 1 ? f.rejectedCount : f.rateLimitedCount);
+      return snprintf(out, size, "boiler_sensor_readings_total{sensor=\"%s\",result=\"%s\"} %u\n",
+                      SENSOR_CHANNEL_NAMES[(item - 1) / 3], READING_RESULTS[result], (unsigned)value);
+    }
+    case METRICS_SENSOR_READ_FAILURES:
+      if (item == 0) return formatMetricsHeader(out, size, "boiler_sensor_read_failures_total", "counter", "Sensor did not answer on the bus");
+      if (item > SENSOR_CHANNEL_COUNT) return -1;
+      return snprintf(out, size, "boiler_sensor_read_failures_total{sensor=\"%s\"} %u\n", SENSOR_CHANNEL_NAMES[item - 1], (unsigned)sensorReadFailures[item - 1]);
+    case METRICS_HEAP_FREE:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_heap_free_bytes", "gauge", "Free heap");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_heap_free_bytes %u\n", (unsigned)ESP.getFreeHeap());
+    case METRICS_HEAP_MIN_FREE:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_heap_min_free_bytes %u\n", (unsigned)ESP.getMinFreeHeap());
+    case METRICS_HEAP_MAX_ALLOC:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_heap_max_alloc_bytes", "gauge", "Largest free heap block");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_heap_max_alloc_bytes %u\n", (unsigned)ESP.getMaxAllocHeap());
+    case METRICS_LOOP_STAGE: {
+      // Квантили - оценка по логарифмическим корзинам гистограммы (верхняя граница корзины)
+      if (item == 0) return formatMetricsHeader(out, size, "esp_loop_stage_seconds", "summary", "loop() stage duration");
+      if (item > LOOP_STAGE_COUNT) return -1;
+      const LatencyHistogram& h = loopStageHistograms[item - 1];
+      const char* stage = LOOP_STAGE_NAMES[item - 1];
+      return snprintf(out, size,
+                      "esp_loop_stage_seconds{stage=\"%s\",quantile=\"0.5\"} %.6f\n"
+                      "esp_loop_stage_seconds{stage=\"%s\",quantile=\"0.99\"} %.6f\n"
+                      "esp_loop_stage_seconds_sum{stage=\"%s\"} %.6f\n"
+                      "esp_loop_stage_seconds_count{stage=\"%s\"} %u\n",
+                      stage, h.percentile(50) / 1e6, stage, h.percentile(99) / 1e6,
+                      stage, h.total() / 1e6, stage, (unsigned)h.count());
+    }
+    case METRICS_LOOP_STAGE_MAX:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_loop_stage_max_seconds", "gauge", "Longest loop() stage duration");
+      if (item > LOOP_STAGE_COUNT) return -1;
+      return snprintf(out, size, "esp_loop_stage_max_seconds{stage=\"%s\"} %.6f\n", LOOP_STAGE_NAMES[item - 1], loopStageHistograms[item - 1].max() / 1e6);
+    case METRICS_MQTT_CONNECTED:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_connected", "gauge", "MQTT broker connection (1 - connected)");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_mqtt_connected %d\n", mqttClient.connected() ? 1 : 0);
+    case METRICS_MQTT_CONNECT_ATTEMPTS:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_connect_attempts_total", "counter", "MQTT broker connection attempts");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_mqtt_connect_attempts_total %u\n", (unsigned)mqttConnectAttempts);
+    case METRICS_MQTT_PUBLISH:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_publish_total", "counter", "MQTT messages accepted by the client");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_mqtt_publish_total %u\n", (unsigned)mqttPublishCount);
+    case METRICS_MQTT_PUBLISH_FAILURES:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_publish_failures_total", "counter", "MQTT messages rejected by the client");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_mqtt_publish_failures_total %u\n", (unsigned)mqttPublishFailures);
+    case METRICS_MQTT_OUTBOX_DEPTH:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_outbox_depth", "gauge", "Messages waiting in the MQTT outbox");
+      if (item > MQTT_PRIORITY_COUNT) return -1;
+      return snprintf(out, size, "esp_mqtt_outbox_depth{priority=\"%s\"} %u\n", MQTT_PRIORITY_NAMES[item - 1], (unsigned)mqttOutbox.stats((MqttPriority)(item - 1)).depth);
+    case METRICS_MQTT_OUTBOX_DROPPED:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_outbox_dropped_total", "counter", "Messages dropped from a full MQTT outbox");
+      if (item > MQTT_PRIORITY_COUNT) return -1;
+      return snprintf(out, size, "esp_mqtt_outbox_dropped_total{priority=\"%s\"} %u\n", MQTT_PRIORITY_NAMES[item - 1], (unsigned)mqttOutbox.stats((MqttPriority)(item - 1)).dropped);
+    case METRICS_MQTT_DRAIN:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_mqtt_outbox_drain_seconds", "summary", "Time from enqueue to socket write");
+      if (item > 1) return -1;
+      return snprintf(out, size,
+                      "esp_mqtt_outbox_drain_seconds{quantile=\"0.5\"} %.6f\n"
+                      "esp_mqtt_outbox_drain_seconds{quantile=\"0.99\"} %.6f\n"
+                      "esp_mqtt_outbox_drain_seconds_sum %.6f\n"
+                      "esp_mqtt_outbox_drain_seconds_count %u\n",
+                      mqttDrainLatency.percentile(50) / 1e6, mqttDrainLatency.percentile(99) / 1e6,
+                      mqttDrainLatency.total() / 1e6, (unsigned)mqttDrainLatency.count());
+    case METRICS_WIFI_RSSI:
+      // Без соединения RSSI не определен - семейство без значений
+      if (item == 0) return formatMetricsHeader(out, size, "esp_wifi_rssi_dbm", "gauge", "WiFi signal strength");
+      if (item > 1 || WiFi.status() != WL_CONNECTED) return -1;
+      return snprintf(out, size, "esp_wifi_rssi_dbm %d\n", (int)WiFi.RSSI());
+    case METRICS_BOOT_COUNT:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_boot_count", "gauge", "Boot counter stored in EEPROM");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_boot_count %u\n", (unsigned)bootCount);
+    case METRICS_UPTIME:
+      if (item == 0) return formatMetricsHeader(out, size, "esp_uptime_seconds", "gauge", "Time since boot");
+      if (item > 1) return -1;
+      return snprintf(out, size, "esp_uptime_seconds %lu\n", (unsigned long)(uptimeMillis() / 1000));
+  }
+  return -1;
+}
+
+// Заполняет кусок целыми строками; 0 - метрики закончились
+size_t writeMetricsChunk(MetricsCursor& cursor, char* buf, size_t maxLen) {
+  size_t used = 0;
+  while (cursor.family < METRICS_FAMILY_COUNT) {
+    int n = formatMetricsItem(cursor.family, cursor.item, buf + used, maxLen - used);
+    if (n < 0) {
+      cursor.family++;
+      cursor.item = 0;
+      continue;
+    }
+    if ((size_t)n >= maxLen - used) {
+      break;  // snprintf оставляет место под '\0' - строка уйдет в следующем куске
+    }
+    used += n;
+    cursor.item++;
+  }
+  return used;
+}
+
+// API: Метрики в текстовом формате Prometheus
+void handleMetrics() {
+  MetricsCursor cursor = {0, 0};
+  server.sendChunks(200, "text/plain; version=0.0.4; charset=utf-8", NBHTTP_CONTENT_LENGTH_UNKNOWN,
+                    [cursor](uint8_t* buf, size_t maxLen) mutable -> size_t {
+                      return writeMetricsChunk(cursor, (char*)buf, maxLen);
+                    });
+}
+
 // API: Установка уставки
 void handleSetpoint() {
+  traceHttpCommand();
+  
   if (server.hasArg("value")) {
     float value = server.arg("value").toFloat();
     // В режиме Комфорт уставка не меняется через этот API (используется targetHomeTemp)
@@ -3106,18 +4088,19 @@ void handleSetpoint() {
       server.send(400, "application/json", "{\"error\":\"Use comfort settings API in Comfort mode\"}");
       return;
     }
-    if (value >= 40 && value <= 80) {
+    if (settingNumberAllowed(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), "setpoint", value)) {
       setpoint = value;
       autoSettings.setpoint = value;
       
       // Отложенное сохранение в EEPROM
       autoSettingsDirty = true;
       lastAutoSettingsChange = millis();
+      markSettingsChanged();
       
       // Публикация уставки в MQTT (неблокирующая)
       if (mqttSettings.enabled && mqttClient.connected()) {
         String topic = mqttSettings.prefix + "/setpoint";
-        mqttClient.publish(topic.c_str(), String(setpoint, 1).c_str(), false);
+        mqttEnqueue(MQTT_PRIORITY_STATE, topic.c_str(), String(setpoint, 1).c_str());
       }
       
       DynamicJsonDocument doc(200);
@@ -3136,62 +4119,21 @@ void handleSetpoint() {
 
 // API: Управление устройствами
 void handleControl() {
+  traceHttpCommand();
+  
   if (server.hasArg("device") && server.hasArg("state")) {
     String device = server.arg("device");
     bool state = server.arg("state").toInt() == 1;
     
     bool manual = server.hasArg("manual") && server.arg("manual").toInt() == 1;  // Инженерное управление
     
+    // Реле датчиков при выключении включается снова через SENSORS_RESET_DELAY (сброс ошибки)
     if (device == "fan") {
-      fanState = state;
-      // Управление реле вентилятора с учетом логики
-      int fanLevel = state ? HIGH : (relaySettings.fanOffIsLow ? LOW : HIGH);
-      digitalWrite(PIN_RELAY_FAN, fanLevel);
-      
-      if (manual) {
-        manualFanControl = true;
-        lastManualControlTime = millis();
-        Serial.print("[Инженерное] Вентилятор: ");
-      } else {
-        manualFanControl = false;
-        Serial.print("Вентилятор: ");
-      }
-      Serial.print(state ? "ВКЛ (HIGH)" : "ВЫКЛ (");
-      Serial.print(relaySettings.fanOffIsLow ? "LOW" : "HIGH");
-      Serial.println(")");
+      applyFanControl(state, manual, millis());
     } else if (device == "pump") {
-      pumpState = state;
-      // Управление реле насоса с учетом логики
-      int pumpLevel = state ? HIGH : (relaySettings.pumpOffIsLow ? LOW : HIGH);
-      digitalWrite(PIN_RELAY_PUMP, pumpLevel);
-      
-      if (manual) {
-        manualPumpControl = true;
-        lastManualControlTime = millis();
-        Serial.print("[Инженерное] Насос: ");
-      } else {
-        manualPumpControl = false;
-        Serial.print("Насос: ");
-      }
-      Serial.print(state ? "ВКЛ (HIGH)" : "ВЫКЛ (");
-      Serial.print(relaySettings.pumpOffIsLow ? "LOW" : "HIGH");
-      Serial.println(")");
+      applyPumpControl(state, manual, millis());
     } else if (device == "sensors") {
-      sensorsRelayState = state;
-      // Управление реле датчиков с учетом логики (обратная логика вентилятора)
-      int sensorsLevel = state ? HIGH : (relaySettings.sensorsOffIsLow ? LOW : HIGH);
-      digitalWrite(PIN_RELAY_SENSORS, sensorsLevel);
-      Serial.print("[Реле датчиков] ");
-      Serial.print(state ? "ВКЛ (HIGH)" : "ВЫКЛ (");
-      Serial.print(relaySettings.sensorsOffIsLow ? "LOW" : "HIGH");
-      Serial.println(")");
-      
-      // Если выключили реле датчиков, планируем автоматическое включение через 500мс для сброса ошибки
-      if (!state) {
-        sensorsResetPending = true;
-        sensorsResetStartTime = millis();
-        Serial.println("[Реле датчиков] Запланирован сброс через 500мс");
-      }
+      applySensorsRelay(state, true, millis());
     }
     
     DynamicJsonDocument doc(200);
@@ -3207,9 +4149,49 @@ void handleControl() {
   }
 }
 
-// API: Настройки реле - GET
-void handleRelaySettingsGet() {
-  DynamicJsonDocument doc(256);
+// ETag ответа настроек: поколение и живое состояние
+void formatSettingsETag(char* buf, size_t size, uint32_t generation, uint32_t variant) {
+  snprintf(buf, size, "\"%lu-%lu\"", (unsigned long)generation, (unsigned long)variant);
+}
+
+// Ответ из кеша, если он не устарел: 304 при совпадении ETag клиента или
+// сохраненное тело без ArduinoJson. false - ответ нужно собрать заново
+bool sendCachedSettings(SettingsCacheSlot slot, uint32_t variant = 0) {
+  char etag[24];
+  formatSettingsETag(etag, sizeof(etag), settingsGeneration, variant);
+  if (server.header("If-None-Match") == etag) {
+    settingsCacheNotModified++;
+    server.sendHeader("ETag", etag);
+    server.send(304);
+    return true;
+  }
+  SettingsCacheEntry& entry = settingsCache[slot];
+  if (entry.generation != settingsGeneration || entry.variant != variant) {
+    settingsCacheMisses++;
+    return false;
+  }
+  settingsCacheHits++;
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");  // Браузер всегда перепроверяет
+  server.send(200, "application/json", entry.body);
+  return true;
+}
+
+// Отправка собранного ответа с запоминанием для следующих запросов
+void sendAndCacheSettings(SettingsCacheSlot slot, const String& response, uint32_t variant = 0) {
+  SettingsCacheEntry& entry = settingsCache[slot];
+  entry.generation = settingsGeneration;
+  entry.variant = variant;
+  entry.body = response;
+  char etag[24];
+  formatSettingsETag(etag, sizeof(etag), settingsGeneration, variant);
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", "no-cache");
+  server.send(200, "application/json", response);
+}
+
+// Настройки реле и текущее ручное управление (GET отдельной группы и /api/settings/all)
+void buildRelaySettingsJson(JsonObject doc) {
   doc["fanOffIsLow"] = relaySettings.fanOffIsLow;
   doc["pumpOffIsLow"] = relaySettings.pumpOffIsLow;
   doc["sensorsOffIsLow"] = relaySettings.sensorsOffIsLow;
@@ -3222,14 +4204,68 @@ void handleRelaySettingsGet() {
   } else {
     doc["manualControlRemaining"] = 0;
   }
+}
+
+// Живое состояние реле в ответе настроек - часть ETag
+uint32_t relaySettingsVariant() {
+  return (sensorsRelayState ? 1 : 0) | (manualFanControl ? 2 : 0) | (manualPumpControl ? 4 : 0);
+}
+
+// API: Настройки реле - GET
+void handleRelaySettingsGet() {
+  // Пока идет ручное управление, в ответе тикает оставшееся время - без кеша
+  bool manualActive = lastManualControlTime > 0;
+  uint32_t variant = relaySettingsVariant();
+  if (!manualActive && sendCachedSettings(SETTINGS_CACHE_RELAY, variant)) {
+    return;
+  }
+  DynamicJsonDocument doc(256);
+  buildRelaySettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  if (manualActive) {
+    server.send(200, "application/json", response);
+  } else {
+    sendAndCacheSettings(SETTINGS_CACHE_RELAY, response, variant);
+  }
+}
+
+// Применение настроек реле из JSON (только значения, без сохранения)
+void applyRelaySettings(JsonObjectConst doc) {
+  if (doc.containsKey("fanOffIsLow")) {
+    bool newValue = doc["fanOffIsLow"].as<bool>();
+    Serial.print("[Реле] Новое значение fanOffIsLow: ");
+    Serial.println(newValue ? "true" : "false");
+    if (relaySettings.fanOffIsLow != newValue) {
+      relaySettings.fanOffIsLow = newValue;
+      Serial.println("[Реле] ✓ fanOffIsLow изменено");
+    }
+  }
+  if (doc.containsKey("pumpOffIsLow")) {
+    bool newValue = doc["pumpOffIsLow"].as<bool>();
+    Serial.print("[Реле] Новое значение pumpOffIsLow: ");
+    Serial.println(newValue ? "true" : "false");
+    if (relaySettings.pumpOffIsLow != newValue) {
+      relaySettings.pumpOffIsLow = newValue;
+      Serial.println("[Реле] ✓ pumpOffIsLow изменено");
+    }
+  }
+  if (doc.containsKey("sensorsOffIsLow")) {
+    bool newValue = doc["sensorsOffIsLow"].as<bool>();
+    Serial.print("[Реле] Новое значение sensorsOffIsLow: ");
+    Serial.println(newValue ? "true" : "false");
+    if (relaySettings.sensorsOffIsLow != newValue) {
+      relaySettings.sensorsOffIsLow = newValue;
+      Serial.println("[Реле] ✓ sensorsOffIsLow изменено");
+    }
+  }
 }
 
 // API: Настройки реле - POST
 void handleRelaySettingsPost() {
+  traceHttpCommand();
+  
   if (server.hasArg("plain")) {
     String plainData = server.arg("plain");
     Serial.print("[Реле] Получены данные: ");
@@ -3250,41 +4286,15 @@ void handleRelaySettingsPost() {
     Serial.print(", pumpOffIsLow=");
     Serial.println(relaySettings.pumpOffIsLow ? "true" : "false");
     
-    bool changed = false;
-    if (doc.containsKey("fanOffIsLow")) {
-      bool newValue = doc["fanOffIsLow"].as<bool>();
-      Serial.print("[Реле] Новое значение fanOffIsLow: ");
-      Serial.println(newValue ? "true" : "false");
-      if (relaySettings.fanOffIsLow != newValue) {
-        relaySettings.fanOffIsLow = newValue;
-        changed = true;
-        Serial.println("[Реле] ✓ fanOffIsLow изменено");
-      }
-    }
-    if (doc.containsKey("pumpOffIsLow")) {
-      bool newValue = doc["pumpOffIsLow"].as<bool>();
-      Serial.print("[Реле] Новое значение pumpOffIsLow: ");
-      Serial.println(newValue ? "true" : "false");
-      if (relaySettings.pumpOffIsLow != newValue) {
-        relaySettings.pumpOffIsLow = newValue;
-        changed = true;
-        Serial.println("[Реле] ✓ pumpOffIsLow изменено");
-      }
-    }
-    if (doc.containsKey("sensorsOffIsLow")) {
-      bool newValue = doc["sensorsOffIsLow"].as<bool>();
-      Serial.print("[Реле] Новое значение sensorsOffIsLow: ");
-      Serial.println(newValue ? "true" : "false");
-      if (relaySettings.sensorsOffIsLow != newValue) {
-        relaySettings.sensorsOffIsLow = newValue;
-        changed = true;
-        Serial.println("[Реле] ✓ sensorsOffIsLow изменено");
-      }
-    }
+    RelaySettings old = relaySettings;
+    applyRelaySettings(doc.as<JsonObjectConst>());
     
     // Сохраняем всегда, даже если значения не изменились (для надежности)
-    saveRelaySettingsToEEPROM();
-    Serial.println("[Реле] Настройки сохранены в EEPROM");
+    if (!saveRelaySettingsToEEPROM()) {
+      relaySettings = old;
+      sendSettingsSaveFailed();
+      return;
+    }
     // Применяем новые настройки к текущему состоянию реле
     syncRelays();
     
@@ -3304,51 +4314,53 @@ void handleRelaySettingsPost() {
   }
 }
 
+// Настройки режима Авто
+void buildAutoSettingsJson(JsonObject doc) {
+  settingsValuesToJson(doc, SETTINGS_VALUES(AUTO_SETTINGS_VALUES));
+}
+
 // API: Настройки Авто - GET
 void handleAutoSettingsGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_AUTO)) {
+    return;
+  }
   DynamicJsonDocument doc(512);
-  doc["setpoint"] = autoSettings.setpoint;
-  doc["minTemp"] = autoSettings.minTemp;
-  doc["maxTemp"] = autoSettings.maxTemp;
-  doc["hysteresis"] = autoSettings.hysteresis;
-  doc["inertiaTemp"] = autoSettings.inertiaTemp;
-  doc["inertiaTime"] = autoSettings.inertiaTime;
-  doc["overheatTemp"] = autoSettings.overheatTemp;
-  doc["heatingTimeout"] = autoSettings.heatingTimeout;
+  buildAutoSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_AUTO, response);
+}
+
+// Применение настроек Авто из JSON (только значения, без сохранения);
+// onAutoSettingsChanged() - в BoilerCommands
+void applyAutoSettings(JsonObjectConst doc) {
+  applySettingsValues(doc, SETTINGS_VALUES(AUTO_SETTINGS_VALUES));
 }
 
 // API: Настройки Авто - POST
 void handleAutoSettingsPost() {
+  traceHttpCommand();
+  
   if (server.hasArg("plain")) {
     DynamicJsonDocument doc(1024);
     deserializeJson(doc, server.arg("plain"));
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
+    }
     
-    if (doc.containsKey("setpoint")) {
-      float newSetpoint = doc["setpoint"].as<float>();
-      if (newSetpoint != autoSettings.setpoint) {
-        // Уставка изменилась - сбрасываем таймеры переключения вентилятора
-        lastFanToggleTime = 0;
-        lastFanToggleTemp = supplyTemp;
-        Serial.println("[Auto] Setpoint changed - resetting fan toggle timers");
-      }
-      autoSettings.setpoint = newSetpoint;
-    }
-    if (doc.containsKey("minTemp")) autoSettings.minTemp = doc["minTemp"];
-    if (doc.containsKey("maxTemp")) autoSettings.maxTemp = doc["maxTemp"];
-    if (doc.containsKey("hysteresis")) autoSettings.hysteresis = doc["hysteresis"];
-    if (doc.containsKey("inertiaTemp")) autoSettings.inertiaTemp = doc["inertiaTemp"];
-    if (doc.containsKey("inertiaTime")) autoSettings.inertiaTime = doc["inertiaTime"];
-    if (doc.containsKey("overheatTemp")) autoSettings.overheatTemp = doc["overheatTemp"];
-    if (doc.containsKey("heatingTimeout")) autoSettings.heatingTimeout = doc["heatingTimeout"];
-    
-    setpoint = autoSettings.setpoint;
+    AutoSettings old = autoSettings;
+    applyAutoSettings(doc.as<JsonObjectConst>());
     
     // Сохраняем сразу при изменении через веб-интерфейс (это редкая операция)
-    saveAutoSettingsToEEPROM();
+    if (!saveAutoSettingsToEEPROM()) {
+      autoSettings = old;
+      sendSettingsSaveFailed();
+      return;
+    }
+    onAutoSettingsChanged(old);
     
     server.send(200, "application/json", "{\"success\":true}");
   } else {
@@ -3361,7 +4373,7 @@ void handleWorkModeGet() {
   DynamicJsonDocument doc(256);
   doc["mode"] = workMode;
   doc["modeName"] = (workMode == 0) ? "Авто" : "Комфорт";
-  doc["comfortState"] = comfortState;
+  doc["comfortState"] = COMFORT_STATE_NAMES[comfortState];
   
   String response;
   serializeJson(doc, response);
@@ -3370,6 +4382,8 @@ void handleWorkModeGet() {
 
 // API: Установка режима работы
 void handleWorkModePost() {
+  traceHttpCommand();
+  
   if (server.hasArg("plain")) {
     DynamicJsonDocument doc(256);
     deserializeJson(doc, server.arg("plain"));
@@ -3377,21 +4391,11 @@ void handleWorkModePost() {
     if (doc.containsKey("mode")) {
       int newMode = doc["mode"];
       if (newMode == 0 || newMode == 1) {
-        // Проверка: нельзя переключиться в режим Комфорт, если датчик температуры дома offline
-        if (newMode == 1 && !isHomeTempSensorValid(millis())) {
+        if (!applyWorkMode(newMode, millis())) {
           server.send(400, "application/json", "{\"error\":\"Home temperature sensor offline. Cannot switch to Comfort mode.\"}");
           return;
         }
         
-        workMode = newMode;
-        // Сброс состояний при переключении
-        comfortState = "WAIT";
-        comfortStateStartTime = 0;
-        homeTempAtStateStart = 0.0;
-        heatingStartTime = 0;
-        
-        saveWorkModeToEEPROM();
-        
         server.send(200, "application/json", "{\"success\":true,\"mode\":" + String(workMode) + "}");
       } else {
         server.send(400, "application/json", "{\"error\":\"Invalid mode\"}");
@@ -3404,68 +4408,50 @@ void handleWorkModePost() {
   }
 }
 
+// Настройки режима Комфорт
+void buildComfortSettingsJson(JsonObject doc) {
+  settingsValuesToJson(doc, SETTINGS_VALUES(COMFORT_SETTINGS_VALUES));
+}
+
 // API: Получение настроек комфорт
 void handleComfortSettingsGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_COMFORT)) {
+    return;
+  }
   DynamicJsonDocument doc(1024);
-  doc["targetHomeTemp"] = comfortSettings.targetHomeTemp;
-  doc["minBoilerTemp"] = comfortSettings.minBoilerTemp;
-  doc["maxBoilerTemp"] = comfortSettings.maxBoilerTemp;
-  doc["waitTemp"] = comfortSettings.waitTemp;
-  doc["catchUpTemp"] = comfortSettings.catchUpTemp;
-  doc["waitCoolingTime"] = comfortSettings.waitCoolingTime;
-  doc["waitAfterHeating1Time"] = comfortSettings.waitAfterHeating1Time;
-  doc["waitAfterReductionTime"] = comfortSettings.waitAfterReductionTime;
-  doc["inertiaCheckInterval"] = comfortSettings.inertiaCheckInterval;
-  doc["hysteresisOn"] = comfortSettings.hysteresisOn;
-  doc["hysteresisOff"] = comfortSettings.hysteresisOff;
-  doc["hysteresisBoiler"] = comfortSettings.hysteresisBoiler;
-  doc["warningTemp"] = comfortSettings.warningTemp;
+  buildComfortSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_COMFORT, response);
+}
+
+// Применение настроек комфорт из JSON (только значения, без сохранения)
+void applyComfortSettings(JsonObjectConst doc) {
+  applySettingsValues(doc, SETTINGS_VALUES(COMFORT_SETTINGS_VALUES));
 }
 
 // API: Сохранение настроек комфорт
 void handleComfortSettingsPost() {
+  traceHttpCommand();
+  
   if (server.hasArg("plain")) {
     DynamicJsonDocument doc(1024);
     deserializeJson(doc, server.arg("plain"));
-    
-    bool targetHomeTempChanged = false;
-    if (doc.containsKey("targetHomeTemp")) {
-      float oldTarget = comfortSettings.targetHomeTemp;
-      comfortSettings.targetHomeTemp = doc["targetHomeTemp"];
-      if (abs(oldTarget - comfortSettings.targetHomeTemp) > 0.1) {
-        targetHomeTempChanged = true;
-      }
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(COMFORT_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
     }
-    if (doc.containsKey("minBoilerTemp")) comfortSettings.minBoilerTemp = doc["minBoilerTemp"];
-    if (doc.containsKey("maxBoilerTemp")) comfortSettings.maxBoilerTemp = doc["maxBoilerTemp"];
-    if (doc.containsKey("waitTemp")) comfortSettings.waitTemp = doc["waitTemp"];
-    if (doc.containsKey("catchUpTemp")) comfortSettings.catchUpTemp = doc["catchUpTemp"];
-    if (doc.containsKey("waitCoolingTime")) comfortSettings.waitCoolingTime = doc["waitCoolingTime"];
-    if (doc.containsKey("waitAfterHeating1Time")) comfortSettings.waitAfterHeating1Time = doc["waitAfterHeating1Time"];
-    if (doc.containsKey("waitAfterReductionTime")) comfortSettings.waitAfterReductionTime = doc["waitAfterReductionTime"];
-    if (doc.containsKey("inertiaCheckInterval")) comfortSettings.inertiaCheckInterval = doc["inertiaCheckInterval"];
-    if (doc.containsKey("hysteresisOn")) comfortSettings.hysteresisOn = doc["hysteresisOn"];
-    if (doc.containsKey("hysteresisOff")) comfortSettings.hysteresisOff = doc["hysteresisOff"];
-    if (doc.containsKey("hysteresisBoiler")) comfortSettings.hysteresisBoiler = doc["hysteresisBoiler"];
-    if (doc.containsKey("warningTemp")) comfortSettings.warningTemp = doc["warningTemp"];
     
-    // При изменении целевой температуры сбрасываем счетчики ожиданий
-    if (targetHomeTempChanged && workMode == 1) {
-      comfortStateStartTime = 0;
-      homeTempAtStateStart = homeTemp;
-      // Если температура уже достигла целевой, переходим в MAINTAIN
-      if (homeTemp >= comfortSettings.targetHomeTemp) {
-        comfortState = "MAINTAIN";
-      } else {
-        comfortState = "WAIT";
-      }
+    ComfortSettings old = comfortSettings;
+    applyComfortSettings(doc.as<JsonObjectConst>());
+    if (!saveComfortSettingsToEEPROM()) {
+      comfortSettings = old;
+      sendSettingsSaveFailed();
+      return;
     }
-    
-    saveComfortSettingsToEEPROM();
+    onComfortSettingsChanged(old);
     
     server.send(200, "application/json", "{\"success\":true}");
   } else {
@@ -3473,9 +4459,8 @@ void handleComfortSettingsPost() {
   }
 }
 
-// API: Настройки MQTT - GET
-void handleMqttSettingsGet() {
-  DynamicJsonDocument doc(512);
+// Настройки MQTT
+void buildMqttSettingsJson(JsonObject doc) {
   doc["enabled"] = mqttSettings.enabled;
   doc["server"] = mqttSettings.server;
   doc["port"] = mqttSettings.port;
@@ -3485,10 +4470,54 @@ void handleMqttSettingsGet() {
   doc["prefix"] = mqttSettings.prefix;
   doc["tempInterval"] = mqttSettings.tempInterval;
   doc["stateInterval"] = mqttSettings.stateInterval;
+  doc["stateFormat"] = mqttSettings.stateFormat;
+}
+
+// API: Настройки MQTT - GET
+void handleMqttSettingsGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_MQTT)) {
+    return;
+  }
+  DynamicJsonDocument doc(512);
+  buildMqttSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_MQTT, response);
+}
+
+// Применение настроек MQTT из JSON (только значения, без сохранения)
+void applyMqttSettings(JsonObjectConst doc) {
+  if (doc.containsKey("enabled")) mqttSettings.enabled = doc["enabled"];
+  if (doc.containsKey("server")) mqttSettings.server = doc["server"].as<String>();
+  if (doc.containsKey("port")) mqttSettings.port = doc["port"];
+  if (doc.containsKey("useTLS")) mqttSettings.useTLS = doc["useTLS"];
+  if (doc.containsKey("user")) mqttSettings.user = doc["user"].as<String>();
+  if (doc.containsKey("password")) mqttSettings.password = doc["password"].as<String>();
+  if (doc.containsKey("prefix")) mqttSettings.prefix = doc["prefix"].as<String>();
+  if (doc.containsKey("tempInterval")) mqttSettings.tempInterval = doc["tempInterval"];
+  if (doc.containsKey("stateInterval")) mqttSettings.stateInterval = doc["stateInterval"];
+  if (doc.containsKey("stateFormat")) mqttSettings.stateFormat = doc["stateFormat"];
+}
+
+// Переподключение MQTT клиента с новыми настройками
+void restartMqttClient() {
+  // Публикуем offline перед отключением
+  if (mqttClient.connected()) {
+    String statusTopic = mqttSettings.prefix + "/status";
+    mqttPublish(statusTopic.c_str(), "offline", true);  // true = retain
+    // Неблокирующая задержка для публикации MQTT
+    unsigned long startTime = millis();
+    for (int i = 0; i < 10; i++) {
+      yield();
+      mqttClient.loop();
+      if (millis() - startTime >= 100 || millis() < startTime) break;
+    }
+  }
+  mqttClient.disconnect();
+  // Новый адрес брокера - заново через DNS, попытка на ближайшем проходе loop()
+  mqttSetupClient();
+  mqttResetConnection();
 }
 
 // API: Настройки MQTT - POST
@@ -3496,50 +4525,20 @@ void handleMqttSettingsPost() {
   if (server.hasArg("plain")) {
     DynamicJsonDocument doc(1024);
     deserializeJson(doc, server.arg("plain"));
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
+    }
     
-    if (doc.containsKey("enabled")) mqttSettings.enabled = doc["enabled"];
-    if (doc.containsKey("server")) mqttSettings.server = doc["server"].as<String>();
-    if (doc.containsKey("port")) mqttSettings.port = doc["port"];
-    if (doc.containsKey("useTLS")) mqttSettings.useTLS = doc["useTLS"];
-    if (doc.containsKey("user")) mqttSettings.user = doc["user"].as<String>();
-    if (doc.containsKey("password")) mqttSettings.password = doc["password"].as<String>();
-    if (doc.containsKey("prefix")) mqttSettings.prefix = doc["prefix"].as<String>();
-    if (doc.containsKey("tempInterval")) mqttSettings.tempInterval = doc["tempInterval"];
-    if (doc.containsKey("stateInterval")) mqttSettings.stateInterval = doc["stateInterval"];
-    
-    saveMqttSettingsToEEPROM();
-    
-    // Переподключение MQTT клиента
-    if (mqttSettings.enabled) {
-      // Публикуем offline перед отключением
-      if (mqttClient.connected()) {
-        String statusTopic = mqttSettings.prefix + "/status";
-        mqttClient.publish(statusTopic.c_str(), "offline", true);  // true = retain
-        // Неблокирующая задержка для публикации MQTT
-        unsigned long startTime = millis();
-        for (int i = 0; i < 10; i++) {
-          yield();
-          mqttClient.loop();
-          if (millis() - startTime >= 100 || millis() < startTime) break;
-        }
-      }
-      mqttClient.disconnect();
-      mqttConnect();
-    } else {
-      // Публикуем offline перед отключением
-      if (mqttClient.connected()) {
-        String statusTopic = mqttSettings.prefix + "/status";
-        mqttClient.publish(statusTopic.c_str(), "offline", true);  // true = retain
-        // Неблокирующая задержка для публикации MQTT
-        unsigned long startTime = millis();
-        for (int i = 0; i < 10; i++) {
-          yield();
-          mqttClient.loop();
-          if (millis() - startTime >= 100 || millis() < startTime) break;
-        }
-      }
-      mqttClient.disconnect();
+    MqttSettings old = mqttSettings;
+    applyMqttSettings(doc.as<JsonObjectConst>());
+    if (!saveMqttSettingsToEEPROM()) {
+      mqttSettings = old;
+      sendSettingsSaveFailed();
+      return;
     }
+    restartMqttClient();
     
     server.send(200, "application/json", "{\"success\":true}");
   } else {
@@ -3547,25 +4546,48 @@ void handleMqttSettingsPost() {
   }
 }
 
-// API: Тест MQTT подключения
+// API: Тест MQTT подключения - запускает попытку без ожидания задержки.
+// Результат веб-интерфейс получает опросом /api/mqtt/status: попытка с
+// номером attempt завершилась, когда attempts >= attempt и state = idle
 void handleMqttTest() {
-  bool connected = mqttConnect();
-  DynamicJsonDocument doc(200);
+  DynamicJsonDocument doc(384);
+  bool connected = mqttClient.connected();
   doc["success"] = connected;
   if (connected) {
     doc["message"] = "Подключение успешно";
+  } else if (!mqttSettings.enabled) {
+    doc["message"] = "MQTT выключен";
+  } else if (WiFi.status() != WL_CONNECTED) {
+    doc["message"] = "Нет подключения к WiFi";
   } else {
-    doc["message"] = "Ошибка подключения: " + String(mqttClient.state());
+    if (mqttConnState == MQTT_CONN_IDLE) {
+      mqttNextAttempt = millis();
+      doc["attempt"] = mqttConnectAttempts + 1;
+    } else {
+      doc["attempt"] = mqttConnectAttempts;  // Попытка уже идет
+    }
+    doc["pending"] = true;
+    doc["message"] = "Подключение...";
   }
   String response;
   serializeJson(doc, response);
   server.send(200, "application/json", response);
 }
 
+// API: Состояние подключения MQTT
+void handleMqttStatus() {
+  DynamicJsonDocument doc(512);
+  buildMqttConnectionJson(doc.to<JsonObject>());
+  String response;
+  serializeJson(doc, response);
+  server.send(200, "application/json", response);
+}
+
 // API: Запуск розжига
 void handleIgnition() {
-  if (boilerExtinguished || systemState == "КОТЕЛ_ПОГАС" || systemState == "ОШИБКА_РОЗЖИГА") {
-    startIgnition();
+  traceHttpCommand();
+  
+  if (requestIgnition(millis())) {
     DynamicJsonDocument doc(200);
     doc["success"] = true;
     doc["message"] = "Розжиг запущен";
@@ -3582,34 +4604,25 @@ void handleIgnition() {
   }
 }
 
-// Функция сброса всех таймеров при выключении системы
-void resetAllTimers() {
-  fanStartTime = 0;
-  heatingStartTime = 0;
-  coalFeedingStartTime = 0;
-  ignitionStartTime = 0;
-  sensorsResetStartTime = 0;
-  lastManualControlTime = 0;
+// Таймеры прошивки вне управления (датчики, WiFi, перезагрузка); таймеры
+// управления сбрасывает resetControlTimers() из BoilerCommands
+void resetDeviceTimers() {
   lastAutoSettingsChange = 0;
-  lastHomeTempUpdate = 0;
   lastSensorsDetectedTime = 0;
   lastValidSupplyTempTime = 0;
   lastValidReturnTempTime = 0;
   lastValidBoilerTempTime = 0;
   lastValidOutdoorTempTime = 0;
   tempRequestTime = 0;
-  lastPumpRunTime = 0;
-  coalBurnedCheckStart = 0;
   wifiScanStartTime = 0;
-  lastFanToggleTime = 0;
   pendingRebootTime = 0;
-  maxTempDuringFan = 0.0;
-  boilerExtinguished = false;
-  ignitionInProgress = false;
-  coalFeedingActive = false;
-  sensorsResetPending = false;
   sensorsAutoResetInProgress = false;
-  systemState = "IDLE";
+}
+
+// Функция сброса всех таймеров при выключении системы
+void resetAllTimers() {
+  resetControlTimers();
+  resetDeviceTimers();
   Serial.println("[TIMERS] Все таймеры сброшены");
 }
 
@@ -3622,7 +4635,7 @@ void determineSystemStateOnStartup() {
     resetAllTimers();
     fanState = false;
     pumpState = false;
-    systemState = "IDLE";
+    systemState = STATE_IDLE;
     Serial.println("[STARTUP] Система выключена - все таймеры сброшены");
     return;
   }
@@ -3677,23 +4690,23 @@ void determineSystemStateOnStartup() {
   }
   
   // Если система была в состоянии "КОТЕЛ ПОГАС" или "ОШИБКА_РОЗЖИГА" - сбрасываем
-  if (systemState == "КОТЕЛ_ПОГАС" || systemState == "ОШИБКА_РОЗЖИГА") {
+  if (systemState == STATE_EXTINGUISHED || systemState == STATE_IGNITION_FAILED) {
     boilerExtinguished = false;
-    systemState = "IDLE";
+    systemState = STATE_IDLE;
     Serial.println("[STARTUP] Сбрасываем состояние погасания/ошибки розжига");
   }
   
   // Устанавливаем начальное состояние, если оно не определено
-  if (systemState == "" || systemState == "IDLE") {
+  if (systemState == STATE_IDLE) {
     if (fanState) {
-      systemState = "HEATING";
+      systemState = STATE_HEATING;
     } else {
-      systemState = "IDLE";
+      systemState = STATE_IDLE;
     }
   }
   
   Serial.print("[STARTUP] Текущее состояние: ");
-  Serial.println(systemState);
+  Serial.println(SYSTEM_STATES[systemState].label);
   Serial.print("[STARTUP] Система включена: ");
   Serial.println(systemEnabled ? "Да" : "Нет");
   Serial.print("[STARTUP] Вентилятор: ");
@@ -3704,19 +4717,13 @@ void determineSystemStateOnStartup() {
 
 // API: Управление системой (включение/выключение)
 void handleSystemControl() {
+  traceHttpCommand();
+  
   if (server.hasArg("enabled")) {
-    systemEnabled = server.arg("enabled").toInt() == 1;
-    saveSystemEnabledToEEPROM();
-    
-    // Если система выключена, выключаем реле и сбрасываем таймеры
+    // При выключении реле отключаются, таймеры сбрасываются
+    applySystemEnabled(server.arg("enabled").toInt() == 1);
     if (!systemEnabled) {
-      fanState = false;
-      pumpState = false;
-      // Управление реле: выключено = LOW
-      digitalWrite(PIN_RELAY_FAN, LOW);
-      digitalWrite(PIN_RELAY_PUMP, LOW);
-      resetAllTimers();  // Сбрасываем все таймеры
-      Serial.println("Система выключена - реле отключены, таймеры сброшены");
+      resetDeviceTimers();
     }
     
     DynamicJsonDocument doc(200);
@@ -3732,14 +4739,16 @@ void handleSystemControl() {
 
 // API: Сброс состояния системы (погас, ошибка розжига и т.д.)
 void handleSystemReset() {
+  traceHttpCommand();
+  
   // Сбрасываем состояние погасания и ошибок
   boilerExtinguished = false;
   ignitionInProgress = false;
   ignitionStartTime = 0;
   
   // Сбрасываем состояние системы, если оно было в ошибке
-  if (systemState == "КОТЕЛ_ПОГАС" || systemState == "ОШИБКА_РОЗЖИГА") {
-    systemState = "IDLE";
+  if (systemState == STATE_EXTINGUISHED || systemState == STATE_IGNITION_FAILED) {
+    systemState = STATE_IDLE;
   }
   
   // Сбрасываем таймеры, связанные с погасанием
@@ -3753,7 +4762,7 @@ void handleSystemReset() {
   doc["message"] = "Состояние сброшено";
   doc["boilerExtinguished"] = false;
   doc["ignitionInProgress"] = false;
-  doc["systemState"] = systemState;
+  doc["systemState"] = SYSTEM_STATES[systemState].apiName;
   String response;
   serializeJson(doc, response);
   server.send(200, "application/json", response);
@@ -3810,7 +4819,7 @@ void processWiFiScanResults() {
   if (n == WIFI_SCAN_RUNNING) {
     // Проверка таймаута (максимум 10 секунд) с защитой от переполнения millis()
     unsigned long now = millis();
-    unsigned long elapsed = (now >= wifiScanStartTime) ? (now - wifiScanStartTime) : (ULONG_MAX - wifiScanStartTime + now);
+    unsigned long elapsed = now - wifiScanStartTime;
     if (elapsed > 10000) {
       WiFi.scanDelete();
       wifiScanInProgress = false;
@@ -3882,35 +4891,54 @@ void handleWiFiScanResults() {
   server.send(200, "application/json", response);
 }
 
-// API: Получение настроек WiFi
-void handleWiFiSettingsGet() {
-  DynamicJsonDocument doc(512);
+// Настройки WiFi
+void buildWiFiSettingsJson(JsonObject doc) {
   doc["primarySSID"] = wifiSettings.primarySSID;
   doc["primaryPassword"] = wifiSettings.primaryPassword;
   doc["backupSSID"] = wifiSettings.backupSSID;
   doc["backupPassword"] = wifiSettings.backupPassword;
   doc["useBackup"] = wifiSettings.useBackup;
   doc["antennaTuning"] = wifiSettings.antennaTuning;
+}
+
+// API: Получение настроек WiFi
+void handleWiFiSettingsGet() {
+  DynamicJsonDocument doc(512);
+  buildWiFiSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
   server.send(200, "application/json", response);
 }
 
+// Применение настроек WiFi из JSON (вступают в силу после перезагрузки)
+void applyWiFiSettings(JsonObjectConst doc) {
+  if (doc.containsKey("primarySSID")) wifiSettings.primarySSID = doc["primarySSID"].as<String>();
+  if (doc.containsKey("primaryPassword")) wifiSettings.primaryPassword = doc["primaryPassword"].as<String>();
+  if (doc.containsKey("backupSSID")) wifiSettings.backupSSID = doc["backupSSID"].as<String>();
+  if (doc.containsKey("backupPassword")) wifiSettings.backupPassword = doc["backupPassword"].as<String>();
+  if (doc.containsKey("useBackup")) wifiSettings.useBackup = doc["useBackup"];
+  if (doc.containsKey("antennaTuning")) wifiSettings.antennaTuning = doc["antennaTuning"];
+}
+
 // API: Сохранение настроек WiFi
 void handleWiFiSettingsPost() {
   if (server.hasArg("plain")) {
     DynamicJsonDocument doc(512);
     deserializeJson(doc, server.arg("plain"));
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
+    }
     
-    if (doc.containsKey("primarySSID")) wifiSettings.primarySSID = doc["primarySSID"].as<String>();
-    if (doc.containsKey("primaryPassword")) wifiSettings.primaryPassword = doc["primaryPassword"].as<String>();
-    if (doc.containsKey("backupSSID")) wifiSettings.backupSSID = doc["backupSSID"].as<String>();
-    if (doc.containsKey("backupPassword")) wifiSettings.backupPassword = doc["backupPassword"].as<String>();
-    if (doc.containsKey("useBackup")) wifiSettings.useBackup = doc["useBackup"];
-    if (doc.containsKey("antennaTuning")) wifiSettings.antennaTuning = doc["antennaTuning"];
-    
-    saveWiFiSettingsToEEPROM();
+    WiFiSettings old = wifiSettings;
+    applyWiFiSettings(doc.as<JsonObjectConst>());
+    if (!saveWiFiSettingsToEEPROM()) {
+      wifiSettings = old;
+      sendSettingsSaveFailed();
+      return;
+    }
     
     server.send(200, "application/json", "{\"success\":true}");
     
@@ -4075,17 +5103,61 @@ void handleSensorsScan() {
   server.send(200, "application/json", response);
 }
 
-// API: Привязка датчиков - GET
-void handleSensorsMappingGet() {
-  DynamicJsonDocument doc(256);
+// Привязка датчиков
+void buildSensorMappingJson(JsonObject doc) {
   doc["supply"] = sensorMapping.supply;
   doc["return"] = sensorMapping.return_sensor;
   doc["boiler"] = sensorMapping.boiler;
   doc["outside"] = sensorMapping.outside;
+}
+
+// API: Привязка датчиков - GET
+void handleSensorsMappingGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_SENSOR_MAPPING)) {
+    return;
+  }
+  DynamicJsonDocument doc(256);
+  buildSensorMappingJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_SENSOR_MAPPING, response);
+}
+
+// Применение привязки датчиков из JSON (только значения, без сохранения)
+void applySensorMapping(JsonObjectConst doc) {
+  if (doc.containsKey("supply")) sensorMapping.supply = doc["supply"].as<String>();
+  if (doc.containsKey("return")) sensorMapping.return_sensor = doc["return"].as<String>();
+  if (doc.containsKey("boiler")) sensorMapping.boiler = doc["boiler"].as<String>();
+  if (doc.containsKey("outside")) sensorMapping.outside = doc["outside"].as<String>();
+}
+
+// Сбрасываем таймеры и значения для измененных датчиков
+void onSensorMappingChanged(const SensorMapping& old) {
+  if (sensorMapping.supply != old.supply) {
+    lastValidSupplyTempTime = 0;
+    supplyTemp = 0.0;
+    sensorFilters[SENSOR_SUPPLY].reset();
+    Serial.println("[Привязка датчиков] Сброшен датчик подачи");
+  }
+  if (sensorMapping.return_sensor != old.return_sensor) {
+    lastValidReturnTempTime = 0;
+    returnTemp = 0.0;
+    sensorFilters[SENSOR_RETURN].reset();
+    Serial.println("[Привязка датчиков] Сброшен датчик обратки");
+  }
+  if (sensorMapping.boiler != old.boiler) {
+    lastValidBoilerTempTime = 0;
+    boilerTemp = 0.0;
+    sensorFilters[SENSOR_BOILER].reset();
+    Serial.println("[Привязка датчиков] Сброшен датчик котельной");
+  }
+  if (sensorMapping.outside != old.outside) {
+    lastValidOutdoorTempTime = 0;
+    outdoorTemp = 0.0;
+    sensorFilters[SENSOR_OUTDOOR].reset();
+    Serial.println("[Привязка датчиков] Сброшен датчик улицы");
+  }
 }
 
 // API: Привязка датчиков - POST
@@ -4094,41 +5166,107 @@ void handleSensorsMappingPost() {
     DynamicJsonDocument doc(256);
     deserializeJson(doc, server.arg("plain"));
     
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(SENSOR_MAPPING_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
+    }
+    
     // Сохраняем старые значения для проверки изменений
-    String oldSupply = sensorMapping.supply;
-    String oldReturn = sensorMapping.return_sensor;
-    String oldBoiler = sensorMapping.boiler;
-    String oldOutside = sensorMapping.outside;
+    SensorMapping old = sensorMapping;
+    applySensorMapping(doc.as<JsonObjectConst>());
+    if (!saveSensorMappingToEEPROM()) {
+      sensorMapping = old;
+      sendSettingsSaveFailed();
+      return;
+    }
+    onSensorMappingChanged(old);
+    
+    server.send(200, "application/json", "{\"success\":true}");
+  } else {
+    server.send(400, "application/json", "{\"error\":\"Invalid request\"}");
+  }
+}
+
+// API: Фильтры датчиков - GET (настройки и счетчики по каждому каналу)
+void handleSensorFiltersGet() {
+  DynamicJsonDocument doc(1536);
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+    const SensorFilter& filter = sensorFilters[i];
+    const SensorFilterConfig& config = filter.config();
+    JsonObject channel = doc.createNestedObject(SENSOR_CHANNEL_NAMES[i]);
+    channel["medianWindow"] = config.medianWindow;
+    channel["maxRate"] = config.maxRate;
+    channel["smoother"] = config.smoother;  // 0 = нет, 1 = EMA, 2 = Калман
+    channel["emaAlpha"] = config.emaAlpha;
+    channel["kalmanQ"] = config.kalmanQ;
+    channel["kalmanR"] = config.kalmanR;
+    channel["accepted"] = filter.acceptedCount;
+    channel["rejected"] = filter.rejectedCount;
+    channel["rateLimited"] = filter.rateLimitedCount;
+    if (filter.hasValue()) {
+      channel["value"] = filter.value();
+    }
+  }
+  
+  String response;
+  serializeJson(doc, response);
+  server.send(200, "application/json", response);
+}
+
+// API: Фильтры датчиков - POST
+void handleSensorFiltersPost() {
+  if (server.hasArg("plain")) {
+    DynamicJsonDocument doc(1024);
+    DeserializationError error = deserializeJson(doc, server.arg("plain"));
+    
+    if (error) {
+      server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
     
-    if (doc.containsKey("supply")) sensorMapping.supply = doc["supply"].as<String>();
-    if (doc.containsKey("return")) sensorMapping.return_sensor = doc["return"].as<String>();
-    if (doc.containsKey("boiler")) sensorMapping.boiler = doc["boiler"].as<String>();
-    if (doc.containsKey("outside")) sensorMapping.outside = doc["outside"].as<String>();
+    // Сначала проверка всех каналов: при ошибке не меняется ничего
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+      if (!doc.containsKey(SENSOR_CHANNEL_NAMES[i])) {
+        continue;
+      }
+      const char* badField = validateSettingsFields(SETTINGS_LIMITS(SENSOR_FILTER_LIMITS),
+                                                    doc[SENSOR_CHANNEL_NAMES[i]].as<JsonObjectConst>());
+      if (badField != nullptr) {
+        sendInvalidSetting(SENSOR_CHANNEL_NAMES[i], badField);
+        return;
+      }
+    }
     
-    // Сбрасываем таймеры и значения для измененных датчиков
-    unsigned long now = millis();
-    if (sensorMapping.supply != oldSupply) {
-      lastValidSupplyTempTime = 0;
-      supplyTemp = 0.0;
-      Serial.println("[Привязка датчиков] Сброшен датчик подачи");
-    }
-    if (sensorMapping.return_sensor != oldReturn) {
-      lastValidReturnTempTime = 0;
-      returnTemp = 0.0;
-      Serial.println("[Привязка датчиков] Сброшен датчик обратки");
-    }
-    if (sensorMapping.boiler != oldBoiler) {
-      lastValidBoilerTempTime = 0;
-      boilerTemp = 0.0;
-      Serial.println("[Привязка датчиков] Сброшен датчик котельной");
-    }
-    if (sensorMapping.outside != oldOutside) {
-      lastValidOutdoorTempTime = 0;
-      outdoorTemp = 0.0;
-      Serial.println("[Привязка датчиков] Сброшен датчик улицы");
+    SensorFilterConfig oldConfigs[SENSOR_CHANNEL_COUNT];
+    bool changed[SENSOR_CHANNEL_COUNT] = {false};
+    for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+      oldConfigs[i] = sensorFilters[i].config();
+      if (!doc.containsKey(SENSOR_CHANNEL_NAMES[i])) {
+        continue;
+      }
+      JsonObjectConst channel = doc[SENSOR_CHANNEL_NAMES[i]];
+      SensorFilterConfig config = oldConfigs[i];
+      if (channel.containsKey("medianWindow")) config.medianWindow = channel["medianWindow"].as<uint8_t>();
+      if (channel.containsKey("maxRate")) config.maxRate = channel["maxRate"];
+      if (channel.containsKey("smoother")) config.smoother = channel["smoother"].as<uint8_t>();
+      if (channel.containsKey("emaAlpha")) config.emaAlpha = channel["emaAlpha"];
+      if (channel.containsKey("kalmanQ")) config.kalmanQ = channel["kalmanQ"];
+      if (channel.containsKey("kalmanR")) config.kalmanR = channel["kalmanR"];
+      // Перезапуск фильтра: окно медианы и состояние сглаживания начинаются заново
+      sensorFilters[i].begin(config);
+      changed[i] = true;
     }
     
-    saveSensorMappingToEEPROM();
+    if (!saveSensorFiltersToEEPROM()) {
+      for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+        if (changed[i]) {
+          sensorFilters[i].begin(oldConfigs[i]);
+        }
+      }
+      sendSettingsSaveFailed();
+      return;
+    }
     
     server.send(200, "application/json", "{\"success\":true}");
   } else {
@@ -4137,48 +5275,96 @@ void handleSensorsMappingPost() {
 }
 
 // Функции для работы с обновлениями через GitHub
-void saveUpdateSettingsToEEPROM() {
-  EEPROM.begin(EEPROM_SIZE);
+bool writeUpdateSettingsToEEPROM() {
   String json;
   DynamicJsonDocument doc(256);
   doc["autoCheckEnabled"] = updateSettings.autoCheckEnabled;
   doc["checkInterval"] = updateSettings.checkInterval;
   serializeJson(doc, json);
   
-  int len = json.length();
-  EEPROM.put(EEPROM_ADDR_UPDATE, len);
-  for (int i = 0; i < len; i++) {
-    EEPROM.write(EEPROM_ADDR_UPDATE + 4 + i, json[i]);
-  }
-  EEPROM.commit();
+  return writeEEPROMBlob(EEPROM_ADDR_UPDATE, json, EEPROM_UPDATE_MAX_LEN);
+}
+
+bool saveUpdateSettingsToEEPROM() {
+  markSettingsChanged();
+  EEPROM.begin(EEPROM_SIZE);
+  bool saved = writeUpdateSettingsToEEPROM() && EEPROM.commit();
   EEPROM.end();
-  Serial.println("Update settings saved to EEPROM");
+  if (saved) {
+    Serial.println("Update settings saved to EEPROM");
+  }
+  return saved;
 }
 
 void loadUpdateSettingsFromEEPROM() {
+  markSettingsChanged();
   EEPROM.begin(EEPROM_SIZE);
   uint8_t magic = 0;
   EEPROM.get(EEPROM_ADDR_MAGIC, magic);
   
   if (magic == EEPROM_MAGIC) {
-    int len = 0;
-    EEPROM.get(EEPROM_ADDR_UPDATE, len);
-    if (len > 0 && len < 250) {
-      String json = "";
-      for (int i = 0; i < len; i++) {
-        json += (char)EEPROM.read(EEPROM_ADDR_UPDATE + 4 + i);
-      }
+    String json;
+    if (readEEPROMBlob(EEPROM_ADDR_UPDATE, EEPROM_UPDATE_MAX_LEN, json)) {
       DynamicJsonDocument doc(256);
       deserializeJson(doc, json);
       if (doc.containsKey("autoCheckEnabled")) updateSettings.autoCheckEnabled = doc["autoCheckEnabled"];
-      if (doc.containsKey("checkInterval")) updateSettings.checkInterval = doc["checkInterval"];
+      if (doc.containsKey("checkInterval")) {
+        // В блоке - миллисекунды, в таблице пределов - часы, как в POST
+        unsigned long interval = doc["checkInterval"];
+        const SettingsFieldLimit* limit = findSettingsLimit(SETTINGS_LIMITS(UPDATE_SETTINGS_LIMITS), "checkInterval");
+        if (settingNumberValid(*limit, interval / 3600000.0f)) {
+          updateSettings.checkInterval = interval;
+        }
+      }
     }
   }
   EEPROM.end();
 }
 
-// Проверка обновлений через GitHub
+// HTTPS к GitHub на одну операцию обновления: проверка версии, прошивка и
+// SPIFFS идут по одному keep-alive соединению - TLS-рукопожатие одно вместо
+// трех. Возобновления TLS-сессий нет: WiFiClientSecure ядра выполняет
+// настройку и рукопожатие mbedTLS одним вызовом, сохраненную сессию
+// подставить некуда. Соединение живет до конца операции - контекст mbedTLS
+// занимает ~40 КБ кучи
+struct GitHubConnection {
+  WiFiClientSecure client;
+  HTTPClient http;
+};
+
+// Начать запрос по соединению conn: открытое переиспользуется, иначе
+// TCP + TLS заранее, чтобы замерить рукопожатие отдельно от запроса
+bool beginGitHubRequest(GitHubConnection& conn, const char* url) {
+  if (conn.client.connected()) {
+    httpsReused++;
+    Serial.println("[Update] Reusing HTTPS connection");
+  } else {
+    unsigned long start = millis();
+    if (!conn.client.connect(GITHUB_RAW_HOST, 443)) {
+      Serial.println("[Update] ERROR: TLS connection to " GITHUB_RAW_HOST " failed");
+      return false;
+    }
+    httpsLastHandshakeMs = millis() - start;
+    if (httpsLastHandshakeMs > httpsMaxHandshakeMs) {
+      httpsMaxHandshakeMs = httpsLastHandshakeMs;
+    }
+    httpsHandshakes++;
+    Serial.printf("[Update] TLS handshake: %lu ms\n", (unsigned long)httpsLastHandshakeMs);
+  }
+  conn.http.setReuse(true);  // end() оставляет соединение открытым для следующего запроса
+  return conn.http.begin(conn.client, url);
+}
+
+String checkForUpdates(GitHubConnection& conn);
+
+// Проверка обновлений отдельной операцией (соединение закрывается сразу)
 String checkForUpdates() {
+  GitHubConnection conn;
+  return checkForUpdates(conn);
+}
+
+// Проверка обновлений через GitHub
+String checkForUpdates(GitHubConnection& conn) {
   // Проверяем WiFi соединение
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("[Update] ERROR: WiFi not connected!");
@@ -4192,8 +5378,8 @@ String checkForUpdates() {
   Serial.print("[Update] Checking for updates from: ");
   Serial.println(GITHUB_VERSION_URL);
   
-  WiFiClientSecure client;
-  HTTPClient http;
+  WiFiClientSecure& client = conn.client;
+  HTTPClient& http = conn.http;
   
   // Настройка клиента для HTTPS
   client.setInsecure();  // Отключаем проверку сертификата
@@ -4201,7 +5387,7 @@ String checkForUpdates() {
   
   // Пробуем подключиться
   Serial.println("[Update] Initializing HTTP client...");
-  bool beginResult = http.begin(client, GITHUB_VERSION_URL);
+  bool beginResult = beginGitHubRequest(conn, GITHUB_VERSION_URL);
   
   if (!beginResult) {
     Serial.println("[Update] ERROR: http.begin() returned false");
@@ -4308,14 +5494,14 @@ String checkForUpdates() {
   }
   
   http.end();
-  Serial.println("[Update] HTTP connection closed");
+  Serial.println("[Update] HTTP request finished");
   return "";  // Нет обновлений или ошибка
 }
 
-// Загрузка и установка обновления (прошивка и SPIFFS)
-bool downloadAndInstallUpdate(String version) {
-  WiFiClientSecure client;
-  HTTPClient http;
+// Загрузка и установка обновления (прошивка и SPIFFS) по соединению conn
+bool downloadAndInstallUpdate(String version, GitHubConnection& conn) {
+  WiFiClientSecure& client = conn.client;
+  HTTPClient& http = conn.http;
   
   Serial.println("[Update] Starting update download...");
   
@@ -4338,7 +5524,7 @@ bool downloadAndInstallUpdate(String version) {
   
   // 1. Загружаем прошивку
   Serial.println("[Update] Step 1: Downloading firmware...");
-  if (!http.begin(client, GITHUB_FIRMWARE_URL)) {
+  if (!beginGitHubRequest(conn, GITHUB_FIRMWARE_URL)) {
     Serial.println("[Update] Failed to connect to GitHub for firmware");
     esp_task_wdt_add(NULL);
     return false;
@@ -4418,13 +5604,7 @@ bool downloadAndInstallUpdate(String version) {
               updateProgress.message = "Загрузка прошивки...";
               
               if (percent % 5 == 0 || lastProgressUpdate == 0) {
-                u8g2.clearBuffer();
-                u8g2.setFont(u8g2_font_ncenB10_tr);
-                u8g2.drawStr(0, 20, "FW Download...");
-                char progressStr[20];
-                snprintf(progressStr, sizeof(progressStr), "%d%%", percent);
-                u8g2.drawStr(0, 40, progressStr);
-                u8g2.sendBuffer();
+                showDisplayMessage("FW Download...", percent);
                 lastProgressUpdate = now;
                 Serial.print("[Update] Firmware progress: ");
                 Serial.print(percent);
@@ -4441,7 +5621,7 @@ bool downloadAndInstallUpdate(String version) {
         } else {
           // Проверка таймаута: если долго нет данных, прерываем
           unsigned long now = millis();
-          unsigned long timeSinceData = (now >= lastDataTime) ? (now - lastDataTime) : (ULONG_MAX - lastDataTime + now);
+          unsigned long timeSinceData = now - lastDataTime;
           
           if (timeSinceData > DATA_TIMEOUT) {
             Serial.println("[Update] ERROR: Timeout waiting for data! Connection may be lost.");
@@ -4497,9 +5677,9 @@ bool downloadAndInstallUpdate(String version) {
   // 2. Загружаем SPIFFS (если доступен)
   if (success) {
     Serial.println("[Update] Step 2: Downloading SPIFFS...");
-    delay(1000);  // Небольшая пауза между загрузками
     
-    if (!http.begin(client, GITHUB_SPIFFS_URL)) {
+    // То же соединение, без нового рукопожатия (если сервер оставил его открытым)
+    if (!beginGitHubRequest(conn, GITHUB_SPIFFS_URL)) {
       Serial.println("[Update] Warning: Failed to connect to GitHub for SPIFFS, continuing...");
       // SPIFFS не критичен, продолжаем
     } else {
@@ -4576,13 +5756,7 @@ bool downloadAndInstallUpdate(String version) {
                     updateProgress.message = "Загрузка файловой системы...";
                     
                     if (percent % 5 == 0 || lastProgressUpdate == 0) {
-                      u8g2.clearBuffer();
-                      u8g2.setFont(u8g2_font_ncenB10_tr);
-                      u8g2.drawStr(0, 20, "FS Download...");
-                      char progressStr[20];
-                      snprintf(progressStr, sizeof(progressStr), "%d%%", percent);
-                      u8g2.drawStr(0, 40, progressStr);
-                      u8g2.sendBuffer();
+                      showDisplayMessage("FS Download...", percent);
                       lastProgressUpdate = now;
                       Serial.print("[Update] SPIFFS progress: ");
                       Serial.print(percent);
@@ -4599,7 +5773,7 @@ bool downloadAndInstallUpdate(String version) {
               } else {
                 // Проверка таймаута
                 unsigned long now = millis();
-                unsigned long timeSinceData = (now >= lastDataTime) ? (now - lastDataTime) : (ULONG_MAX - lastDataTime + now);
+                unsigned long timeSinceData = now - lastDataTime;
                 
                 if (timeSinceData > DATA_TIMEOUT) {
                   Serial.println("[Update] WARNING: SPIFFS download timeout! Aborting SPIFFS update.");
@@ -4656,10 +5830,7 @@ bool downloadAndInstallUpdate(String version) {
     Serial.println("[Update] All updates complete! Rebooting...");
     updateProgress.percent = 100;
     updateProgress.message = "Обновление завершено! Перезагрузка...";
-    u8g2.clearBuffer();
-    u8g2.setFont(u8g2_font_ncenB10_tr);
-    u8g2.drawStr(0, 30, "Update Done!");
-    u8g2.sendBuffer();
+    showDisplayMessage("Update Done!", -1);
     delay(1000);
     // Watchdog не возвращаем, т.к. устройство перезагрузится
     return true;
@@ -4710,7 +5881,9 @@ void handleUpdateCheck() {
 
 // API: Установка обновления
 void handleUpdateInstall() {
-  String latestVersion = checkForUpdates();
+  // Проверка и загрузка - по одному HTTPS-соединению
+  GitHubConnection conn;
+  String latestVersion = checkForUpdates(conn);
   
   if (latestVersion.length() == 0) {
     server.send(400, "application/json", "{\"error\":\"No update available\"}");
@@ -4726,10 +5899,10 @@ void handleUpdateInstall() {
   
   server.send(200, "application/json", "{\"success\":true,\"message\":\"Update started\"}");
   
-  // Небольшая задержка перед началом загрузки
-  delay(1000);
+  // Загрузка блокирует loop() - ответ отправляем сразу, а не после нее
+  server.flush(1000);
   
-  if (downloadAndInstallUpdate(latestVersion)) {
+  if (downloadAndInstallUpdate(latestVersion, conn)) {
     Serial.println("[Update] Update successful, rebooting...");
     delay(2000);
     ESP.restart();
@@ -4761,16 +5934,33 @@ void handleUpdateProgress() {
   server.send(200, "application/json", response);
 }
 
-// API: Настройки обновлений - GET
-void handleUpdateSettingsGet() {
-  DynamicJsonDocument doc(256);
+// Настройки автообновления
+void buildUpdateSettingsJson(JsonObject doc) {
   doc["autoCheckEnabled"] = updateSettings.autoCheckEnabled;
   doc["checkInterval"] = updateSettings.checkInterval / 3600000;  // Конвертируем в часы
   doc["lastCheckTime"] = updateSettings.lastCheckTime;
+}
+
+// API: Настройки обновлений - GET
+void handleUpdateSettingsGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_UPDATE)) {
+    return;
+  }
+  DynamicJsonDocument doc(256);
+  buildUpdateSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_UPDATE, response);
+}
+
+// Применение настроек автообновления из JSON (интервал приходит в часах)
+void applyUpdateSettings(JsonObjectConst doc) {
+  if (doc.containsKey("autoCheckEnabled")) updateSettings.autoCheckEnabled = doc["autoCheckEnabled"];
+  if (doc.containsKey("checkInterval")) {
+    int hours = doc["checkInterval"];
+    updateSettings.checkInterval = hours * 3600000;  // Конвертируем в миллисекунды
+  }
 }
 
 // API: Настройки обновлений - POST
@@ -4778,14 +5968,19 @@ void handleUpdateSettingsPost() {
   if (server.hasArg("plain")) {
     DynamicJsonDocument doc(256);
     deserializeJson(doc, server.arg("plain"));
-    
-    if (doc.containsKey("autoCheckEnabled")) updateSettings.autoCheckEnabled = doc["autoCheckEnabled"];
-    if (doc.containsKey("checkInterval")) {
-      int hours = doc["checkInterval"];
-      updateSettings.checkInterval = hours * 3600000;  // Конвертируем в миллисекунды
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(UPDATE_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
     }
     
-    saveUpdateSettingsToEEPROM();
+    UpdateSettings old = updateSettings;
+    applyUpdateSettings(doc.as<JsonObjectConst>());
+    if (!saveUpdateSettingsToEEPROM()) {
+      updateSettings = old;
+      sendSettingsSaveFailed();
+      return;
+    }
     
     server.send(200, "application/json", "{\"success\":true}");
   } else {
@@ -4800,7 +5995,7 @@ void handleSystemInfo() {
   doc["ip"] = WiFi.localIP().toString();
   doc["mac"] = WiFi.macAddress();
   
-  unsigned long uptime = millis() / 1000;
+  unsigned long uptime = (unsigned long)(uptimeMillis() / 1000);
   unsigned long hours = uptime / 3600;
   unsigned long minutes = (uptime % 3600) / 60;
   unsigned long seconds = uptime % 60;
@@ -4813,7 +6008,7 @@ void handleSystemInfo() {
   doc["resetReason"] = lastResetReason;
   
   // Добавляем время NTP
-  if (ntpSettings.enabled && timeClient.isTimeSet()) {
+  if (ntpSettings.enabled && timeService.isSynced()) {
     doc["time"] = getFormattedTime();
     doc["date"] = getFormattedDate();
     doc["ntpSynced"] = true;
@@ -4854,8 +6049,7 @@ void handleTimers() {
   // Функция для вычисления прошедшего времени
   auto getElapsed = [now](unsigned long startTime) -> unsigned long {
     if (startTime == 0) return 0;
-    if (now >= startTime) return now - startTime;
-    return ULONG_MAX - startTime + now;
+    return now - startTime;  // Беззнаковая разность корректна и через переполнение millis()
   };
   
   // Таймеры работы вентилятора
@@ -4998,17 +6192,37 @@ void handleTimers() {
   server.send(200, "application/json", response);
 }
 
-// API: Получение настроек NTP
-void handleNTPSettingsGet() {
-  DynamicJsonDocument doc(256);
+// Настройки NTP
+void buildNTPSettingsJson(JsonObject doc) {
   doc["enabled"] = ntpSettings.enabled;
   doc["server"] = ntpSettings.server;
   doc["timezone"] = ntpSettings.timezone;
   doc["updateInterval"] = ntpSettings.updateInterval;
+}
+
+// API: Получение настроек NTP
+void handleNTPSettingsGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_NTP)) {
+    return;
+  }
+  DynamicJsonDocument doc(256);
+  buildNTPSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_NTP, response);
+}
+
+// Применение настроек NTP из JSON (только значения, без сохранения)
+void applyNTPSettings(JsonObjectConst doc) {
+  if (doc.containsKey("enabled")) ntpSettings.enabled = doc["enabled"];
+  if (doc.containsKey("server")) {
+    String newServer = doc["server"].as<String>();
+    // Если сервер пустой, используем значение по умолчанию
+    ntpSettings.server = newServer.length() > 0 ? newServer : String("ru.pool.ntp.org");
+  }
+  if (doc.containsKey("timezone")) ntpSettings.timezone = doc["timezone"];
+  if (doc.containsKey("updateInterval")) ntpSettings.updateInterval = doc["updateInterval"];
 }
 
 // API: Сохранение настроек NTP
@@ -5022,52 +6236,25 @@ void handleNTPSettingsPost() {
       return;
     }
     
-    bool settingsChanged = false;
-    
-    if (doc.containsKey("enabled")) {
-      bool newEnabled = doc["enabled"];
-      if (ntpSettings.enabled != newEnabled) {
-        ntpSettings.enabled = newEnabled;
-        settingsChanged = true;
-      }
-    }
-    if (doc.containsKey("server")) {
-      String newServer = doc["server"].as<String>();
-      // Проверяем, что сервер не пустой
-      if (newServer.length() > 0 && ntpSettings.server != newServer) {
-        ntpSettings.server = newServer;
-        settingsChanged = true;
-      } else if (newServer.length() == 0) {
-        // Если сервер пустой, используем значение по умолчанию
-        ntpSettings.server = "ru.pool.ntp.org";
-        settingsChanged = true;
-      }
-    }
-    if (doc.containsKey("timezone")) {
-      int newTimezone = doc["timezone"];
-      if (ntpSettings.timezone != newTimezone) {
-        ntpSettings.timezone = newTimezone;
-        settingsChanged = true;
-      }
-    }
-    if (doc.containsKey("updateInterval")) {
-      int newInterval = doc["updateInterval"];
-      if (ntpSettings.updateInterval != newInterval) {
-        ntpSettings.updateInterval = newInterval;
-        settingsChanged = true;
-      }
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(NTP_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
     }
     
+    NTPSettings old = ntpSettings;
+    applyNTPSettings(doc.as<JsonObjectConst>());
+    
     // Сохраняем в EEPROM всегда (даже если не было изменений, чтобы убедиться что настройки сохранены)
-    saveNTPSettingsToEEPROM();
+    if (!saveNTPSettingsToEEPROM()) {
+      ntpSettings = old;
+      sendSettingsSaveFailed();
+      return;
+    }
     
     // Переинициализация NTP с новыми настройками
     if (WiFi.status() == WL_CONNECTED) {
-      if (ntpSettings.enabled) {
-        setupNTP();
-      } else {
-        timeClient.end();
-      }
+      setupNTP();  // При выключенном NTP останавливает SNTP
     }
     
     DynamicJsonDocument responseDoc(128);
@@ -5086,22 +6273,40 @@ void handleNTPTime() {
   doc["time"] = getFormattedTime();
   doc["date"] = getFormattedDate();
   doc["enabled"] = ntpSettings.enabled;
-  doc["synced"] = (ntpSettings.enabled && timeClient.isTimeSet());
+  doc["synced"] = (ntpSettings.enabled && timeService.isSynced());
+  doc["syncCount"] = timeService.syncCount();
+  doc["lastSync"] = (unsigned long)timeService.lastSyncEpoch();
   
   String response;
   serializeJson(doc, response);
   server.send(200, "application/json", response);
 }
 
-// API: Получение настроек ML
-void handleMLSettingsGet() {
-  DynamicJsonDocument doc(256);
+// Настройки публикации ML
+void buildMLSettingsJson(JsonObject doc) {
   doc["enabled"] = mlSettings.enabled;
   doc["publishInterval"] = mlSettings.publishInterval;
+  doc["format"] = mlSettings.format;
+}
+
+// API: Получение настроек ML
+void handleMLSettingsGet() {
+  if (sendCachedSettings(SETTINGS_CACHE_ML)) {
+    return;
+  }
+  DynamicJsonDocument doc(256);
+  buildMLSettingsJson(doc.to<JsonObject>());
   
   String response;
   serializeJson(doc, response);
-  server.send(200, "application/json", response);
+  sendAndCacheSettings(SETTINGS_CACHE_ML, response);
+}
+
+// Применение настроек ML из JSON (только значения, без сохранения)
+void applyMLSettings(JsonObjectConst doc) {
+  if (doc.containsKey("enabled")) mlSettings.enabled = doc["enabled"];
+  if (doc.containsKey("publishInterval")) mlSettings.publishInterval = doc["publishInterval"];
+  if (doc.containsKey("format")) mlSettings.format = doc["format"];
 }
 
 // API: Сохранение настроек ML
@@ -5115,38 +6320,30 @@ void handleMLSettingsPost() {
       return;
     }
     
-    bool settingsChanged = false;
-    
-    if (doc.containsKey("enabled")) {
-      bool newEnabled = doc["enabled"];
-      if (mlSettings.enabled != newEnabled) {
-        mlSettings.enabled = newEnabled;
-        settingsChanged = true;
-      }
-    }
-    if (doc.containsKey("publishInterval")) {
-      int newInterval = doc["publishInterval"];
-      if (newInterval >= 5 && newInterval <= 300) {  // Валидация: от 5 до 300 секунд
-        if (mlSettings.publishInterval != newInterval) {
-          mlSettings.publishInterval = newInterval;
-          settingsChanged = true;
-        }
-      } else {
-        server.send(400, "application/json", "{\"error\":\"Invalid interval (5-300 seconds)\"}");
-        return;
-      }
+    const char* badField = validateSettingsFields(SETTINGS_LIMITS(ML_SETTINGS_LIMITS), doc.as<JsonObjectConst>());
+    if (badField != nullptr) {
+      sendInvalidSetting(nullptr, badField);
+      return;
     }
     
+    MLSettings old = mlSettings;
+    applyMLSettings(doc.as<JsonObjectConst>());
+    
     // Сохраняем в EEPROM только если были изменения
-    if (settingsChanged) {
-      saveMLSettingsToEEPROM();
-      Serial.print(mlSettings.enabled);
+    if (mlSettings.enabled != old.enabled || mlSettings.publishInterval != old.publishInterval ||
+        mlSettings.format != old.format) {
+      if (!saveMLSettingsToEEPROM()) {
+        mlSettings = old;
+        sendSettingsSaveFailed();
+        return;
+      }
     }
     
     DynamicJsonDocument responseDoc(128);
     responseDoc["success"] = true;
     responseDoc["enabled"] = mlSettings.enabled;
     responseDoc["publishInterval"] = mlSettings.publishInterval;
+    responseDoc["format"] = mlSettings.format;
     String response;
     serializeJson(responseDoc, response);
     server.send(200, "application/json", response);
@@ -5155,8 +6352,221 @@ void handleMLSettingsPost() {
   }
 }
 
+// Пакетный API настроек: все группы одним запросом.
+// POST сначала проверяет все переданные группы (по таблицам пределов у
+// загрузки из EEPROM) и ничего не меняет при ошибке, затем применяет их и
+// пишет в EEPROM одним commit
+// Копия всех групп: "до" для последствий изменений и отката при ошибке записи
+struct SettingsSnapshot {
+  AutoSettings autoSettings;
+  ComfortSettings comfortSettings;
+  MqttSettings mqttSettings;
+  RelaySettings relaySettings;
+  NTPSettings ntpSettings;
+  MLSettings mlSettings;
+  UpdateSettings updateSettings;
+  WiFiSettings wifiSettings;
+  SensorMapping sensorMapping;
+};
+
+void captureSettings(SettingsSnapshot& snapshot) {
+  snapshot.autoSettings = autoSettings;
+  snapshot.comfortSettings = comfortSettings;
+  snapshot.mqttSettings = mqttSettings;
+  snapshot.relaySettings = relaySettings;
+  snapshot.ntpSettings = ntpSettings;
+  snapshot.mlSettings = mlSettings;
+  snapshot.updateSettings = updateSettings;
+  snapshot.wifiSettings = wifiSettings;
+  snapshot.sensorMapping = sensorMapping;
+}
+
+void restoreSettings(const SettingsSnapshot& snapshot) {
+  autoSettings = snapshot.autoSettings;
+  comfortSettings = snapshot.comfortSettings;
+  mqttSettings = snapshot.mqttSettings;
+  relaySettings = snapshot.relaySettings;
+  ntpSettings = snapshot.ntpSettings;
+  mlSettings = snapshot.mlSettings;
+  updateSettings = snapshot.updateSettings;
+  wifiSettings = snapshot.wifiSettings;
+  sensorMapping = snapshot.sensorMapping;
+}
+
+struct SettingsGroup {
+  const char* name;
+  const SettingsFieldLimit* limits;
+  uint8_t limitCount;
+  void (*build)(JsonObject obj);
+  void (*apply)(JsonObjectConst obj);
+  bool (*write)();
+  void (*afterCommit)(const SettingsSnapshot& old);  // nullptr - без последствий
+  bool requiresReboot;
+};
+
+const SettingsGroup SETTINGS_GROUPS[] = {
+  {"auto", SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), buildAutoSettingsJson, applyAutoSettings, writeAutoSettingsToEEPROM,
+   [](const SettingsSnapshot& old) { onAutoSettingsChanged(old.autoSettings); }, false},
+  {"comfort", SETTINGS_LIMITS(COMFORT_SETTINGS_LIMITS), buildComfortSettingsJson, applyComfortSettings, writeComfortSettingsToEEPROM,
+   [](const SettingsSnapshot& old) { onComfortSettingsChanged(old.comfortSettings); }, false},
+  {"mqtt", SETTINGS_LIMITS(MQTT_SETTINGS_LIMITS), buildMqttSettingsJson, applyMqttSettings, writeMqttSettingsToEEPROM,
+   [](const SettingsSnapshot&) { restartMqttClient(); }, false},
+  {"relay", nullptr, 0, buildRelaySettingsJson, applyRelaySettings, writeRelaySettingsToEEPROM,
+   [](const SettingsSnapshot&) { syncRelays(); }, false},
+  {"ntp", SETTINGS_LIMITS(NTP_SETTINGS_LIMITS), buildNTPSettingsJson, applyNTPSettings, writeNTPSettingsToEEPROM,
+   [](const SettingsSnapshot&) { if (WiFi.status() == WL_CONNECTED) setupNTP(); }, false},
+  {"ml", SETTINGS_LIMITS(ML_SETTINGS_LIMITS), buildMLSettingsJson, applyMLSettings, writeMLSettingsToEEPROM, nullptr, false},
+  {"update", SETTINGS_LIMITS(UPDATE_SETTINGS_LIMITS), buildUpdateSettingsJson, applyUpdateSettings, writeUpdateSettingsToEEPROM, nullptr, false},
+  {"wifi", SETTINGS_LIMITS(WIFI_SETTINGS_LIMITS), buildWiFiSettingsJson, applyWiFiSettings, writeWiFiSettingsToEEPROM,
+   [](const SettingsSnapshot&) { pendingRebootTime = millis() + 1000; }, true},
+  {"sensors", SETTINGS_LIMITS(SENSOR_MAPPING_LIMITS), buildSensorMappingJson, applySensorMapping, writeSensorMappingToEEPROM,
+   [](const SettingsSnapshot& old) { onSensorMappingChanged(old.sensorMapping); }, false}
+};
+const int SETTINGS_GROUP_COUNT = sizeof(SETTINGS_GROUPS) / sizeof(SETTINGS_GROUPS[0]);
+
+// Проверка полей группы по таблице пределов, возвращает имя неверного поля или nullptr
+const char* validateSettingsGroup(const SettingsGroup& group, JsonObjectConst obj) {
+  return validateSettingsFields(group.limits, group.limitCount, obj);
+}
+
+// API: Все настройки одним ответом - GET
+void handleSettingsAllGet() {
+  // Группа relay содержит живое состояние ручного управления - как в handleRelaySettingsGet
+  bool manualActive = lastManualControlTime > 0;
+  uint32_t variant = relaySettingsVariant();
+  if (!manualActive && sendCachedSettings(SETTINGS_CACHE_ALL, variant)) {
+    return;
+  }
+  DynamicJsonDocument doc(3072);
+  for (int i = 0; i < SETTINGS_GROUP_COUNT; i++) {
+    SETTINGS_GROUPS[i].build(doc.createNestedObject(SETTINGS_GROUPS[i].name));
+  }
+  
+  String response;
+  serializeJson(doc, response);
+  if (manualActive) {
+    server.send(200, "application/json", response);
+  } else {
+    sendAndCacheSettings(SETTINGS_CACHE_ALL, response, variant);
+  }
+}
+
+// API: Все настройки одним запросом - POST (передаются только меняемые группы)
+void handleSettingsAllPost() {
+  traceHttpCommand();
+  
+  if (!server.hasArg("plain")) {
+    server.send(400, "application/json", "{\"error\":\"No data\"}");
+    return;
+  }
+  DynamicJsonDocument doc(3072);
+  if (deserializeJson(doc, server.arg("plain")) || !doc.is<JsonObject>()) {
+    server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+    return;
+  }
+  JsonObjectConst root = doc.as<JsonObjectConst>();
+  
+  // 1. Проверка всего запроса до изменения чего-либо
+  bool present[SETTINGS_GROUP_COUNT];
+  size_t groupCount = 0;
+  bool reboot = false;
+  for (int i = 0; i < SETTINGS_GROUP_COUNT; i++) {
+    const SettingsGroup& group = SETTINGS_GROUPS[i];
+    present[i] = root.containsKey(group.name);
+    if (!present[i]) {
+      continue;
+    }
+    groupCount++;
+    reboot = reboot || group.requiresReboot;
+    const char* badField = nullptr;
+    if (!root[group.name].is<JsonObjectConst>()) {
+      badField = "";
+    } else {
+      badField = validateSettingsGroup(group, root[group.name].as<JsonObjectConst>());
+    }
+    if (badField != nullptr) {
+      sendInvalidSetting(group.name, badField);
+      return;
+    }
+  }
+  if (groupCount != root.size()) {
+    server.send(400, "application/json", "{\"error\":\"Unknown settings group\"}");
+    return;
+  }
+  
+  // 2. Применение и запись всех групп за одну сессию EEPROM
+  uint32_t startUs = micros();
+  SettingsSnapshot old;
+  captureSettings(old);
+  for (int i = 0; i < SETTINGS_GROUP_COUNT; i++) {
+    if (present[i]) {
+      SETTINGS_GROUPS[i].apply(root[SETTINGS_GROUPS[i].name].as<JsonObjectConst>());
+    }
+  }
+  
+  EEPROM.begin(EEPROM_SIZE);
+  EEPROM.put(EEPROM_ADDR_MAGIC, (uint8_t)EEPROM_MAGIC);
+  const char* failedGroup = nullptr;
+  for (int i = 0; i < SETTINGS_GROUP_COUNT && failedGroup == nullptr; i++) {
+    if (present[i] && !SETTINGS_GROUPS[i].write()) {
+      failedGroup = SETTINGS_GROUPS[i].name;
+    }
+  }
+  if (failedGroup != nullptr) {
+    // Блок не влез в EEPROM - возвращаем прежние значения всех групп, чтобы
+    // ни в памяти, ни во флеше не осталось половины изменений
+    restoreSettings(old);
+    for (int i = 0; i < SETTINGS_GROUP_COUNT; i++) {
+      if (present[i]) {
+        SETTINGS_GROUPS[i].write();
+      }
+    }
+  }
+  bool committed = EEPROM.commit();
+  EEPROM.end();
+  markSettingsChanged();
+  uint32_t saveUs = micros() - startUs;
+  
+  if (failedGroup != nullptr || !committed) {
+    DynamicJsonDocument errorDoc(192);
+    errorDoc["error"] = failedGroup != nullptr ? "Settings too long for EEPROM" : "EEPROM commit failed";
+    if (failedGroup != nullptr) {
+      errorDoc["group"] = failedGroup;
+    }
+    String response;
+    serializeJson(errorDoc, response);
+    server.send(500, "application/json", response);
+    return;
+  }
+  
+  Serial.printf("[Настройки] Сохранено групп: %u за %lu мкс\n", (unsigned)groupCount, (unsigned long)saveUs);
+  DynamicJsonDocument responseDoc(128);
+  responseDoc["success"] = true;
+  responseDoc["groups"] = groupCount;
+  responseDoc["saveUs"] = saveUs;
+  responseDoc["reboot"] = reboot;  // Настройки WiFi применяются после перезагрузки
+  String response;
+  serializeJson(responseDoc, response);
+  server.send(200, "application/json", response);
+  
+  // 3. Последствия (переподключение MQTT, NTP, реле) - после ответа, чтобы клиент не ждал
+  for (int i = 0; i < SETTINGS_GROUP_COUNT; i++) {
+    if (present[i] && SETTINGS_GROUPS[i].afterCommit != nullptr) {
+      SETTINGS_GROUPS[i].afterCommit(old);
+    }
+  }
+}
+
 // Инициализация OTA (Over The Air обновление)
 void setupOTA() {
+  // Вызывается при первом подключении или при запуске портала - настраиваем один раз
+  static bool otaStarted = false;
+  if (otaStarted) {
+    return;
+  }
+  otaStarted = true;
+  bootPhaseBegin(BOOT_PHASE_OTA);
+  
   // Генерация уникального hostname на основе MAC адреса
   String hostname = "KotelESP32_" + WiFi.macAddress();
   hostname.replace(":", "");
@@ -5174,50 +6584,32 @@ void setupOTA() {
     }
     
     // Обновление дисплея
-    u8g2.clearBuffer();
-    u8g2.setFont(u8g2_font_ncenB14_tr);
-    u8g2.drawStr(0, 30, "OTA Update...");
-    u8g2.sendBuffer();
+    showDisplayMessage("OTA Update...", -1);
   });
   
   // Обработчик завершения обновления
   ArduinoOTA.onEnd([]() {
-    u8g2.clearBuffer();
-    u8g2.setFont(u8g2_font_ncenB14_tr);
-    u8g2.drawStr(0, 30, "OTA Done!");
-    u8g2.sendBuffer();
+    showDisplayMessage("OTA Done!", -1);
   });
   
   // Обработчик прогресса обновления
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
     int percent = (progress / (total / 100));
     
-    // Обновление дисплея с прогрессом
-    u8g2.clearBuffer();
-    u8g2.setFont(u8g2_font_ncenB10_tr);
-    u8g2.drawStr(0, 20, "OTA Update");
-    char progressStr[20];
-    snprintf(progressStr, sizeof(progressStr), "%d%%", percent);
-    u8g2.drawStr(0, 40, progressStr);
-    
-    // Прогресс-бар
-    int barWidth = (percent * 100) / 100;
-    u8g2.drawBox(0, 50, barWidth, 8);
-    u8g2.sendBuffer();
+    // Обновление дисплея с прогрессом (с прогресс-баром)
+    showDisplayMessage("OTA Update", percent);
   });
   
   // Обработчик ошибок
   ArduinoOTA.onError([](ota_error_t error) {
     // Ошибка OTA (отображается на дисплее)
     
-    u8g2.clearBuffer();
-    u8g2.setFont(u8g2_font_ncenB10_tr);
-    u8g2.drawStr(0, 30, "OTA Error!");
-    u8g2.sendBuffer();
+    showDisplayMessage("OTA Error!", -1);
   });
   
   // Запуск OTA
   ArduinoOTA.begin();
+  bootPhaseEnd(BOOT_PHASE_OTA);
   
   // OTA готов к обновлению
 }
@@ -5232,11 +6624,12 @@ void handleReboot() {
 // API: Управление подбросом угля
 void handleCoalFeeding() {
   if (server.method() == HTTP_POST) {
+    traceHttpCommand();
     // Переключение подброса угля
     if (coalFeedingActive) {
       stopCoalFeeding();
     } else {
-      startCoalFeeding();
+      startCoalFeeding(millis());
     }
     
     DynamicJsonDocument doc(200);
@@ -5260,31 +6653,46 @@ void handleCoalFeeding() {
 }
 
 void setup() {
+  beginBootProfile();
+  fastBoot = shouldFastBoot();
+  rtcBootProfile.fastBoot = fastBoot;
+  
+  bootPhaseBegin(BOOT_PHASE_SERIAL);
   Serial.begin(115200);
-  delay(500);  // Уменьшена задержка для быстрого старта
+  if (!fastBoot) {
+    delay(500);  // Уменьшена задержка для быстрого старта
+  }
   
   // Инициализация Watchdog Timer для обнаружения зависаний
   // Таймаут: 30 секунд (если loop() не выполнится за это время, ESP32 перезагрузится)
   esp_task_wdt_init(30, true);  // 30 секунд, enable panic handler
   esp_task_wdt_add(NULL);  // Добавляем текущую задачу (loop) в watchdog
   
+  // Учет выделений памяти по подсистемам (пусто без HEAP_PROFILER)
+  heapProfilerBegin();
+  
   Serial.println("[DIAG] Watchdog timer initialized (30s timeout)");
   Serial.print("[DIAG] Free heap at startup: ");
   Serial.print(ESP.getFreeHeap());
   Serial.println(" bytes");
+  if (fastBoot) {
+    Serial.println("[Boot] Быстрый старт: SPIFFS, WiFi и веб-сервер отложены");
+  }
+  bootPhaseEnd(BOOT_PHASE_SERIAL);
   
   // Минимальный вывод при старте - только энкодер для отладки
   
   // Инициализация пинов реле
+  bootPhaseBegin(BOOT_PHASE_GPIO);
   pinMode(PIN_RELAY_FAN, OUTPUT);
   pinMode(PIN_RELAY_PUMP, OUTPUT);
   pinMode(PIN_RELAY_SENSORS, OUTPUT);
   // Выключено = LOW, включено = HIGH
-  digitalWrite(PIN_RELAY_FAN, LOW);
-  digitalWrite(PIN_RELAY_PUMP, LOW);
+  writeRelayPin(PIN_RELAY_FAN, LOW);
+  writeRelayPin(PIN_RELAY_PUMP, LOW);
   // Реле датчиков по умолчанию включено (питание датчиков)
   sensorsRelayState = true;
-  digitalWrite(PIN_RELAY_SENSORS, HIGH);
+  writeRelayPin(PIN_RELAY_SENSORS, HIGH);
   lastSensorsDetectedTime = millis();  // Инициализируем время обнаружения при старте
   // Инициализируем время валидных показаний при старте
   unsigned long startupTime = millis();
@@ -5312,20 +6720,32 @@ void setup() {
   // Инициализация встроенного светодиода
   pinMode(PIN_LED_BUILTIN, OUTPUT);
   digitalWrite(PIN_LED_BUILTIN, LOW);  // Выключаем по умолчанию
+  bootPhaseEnd(BOOT_PHASE_GPIO);
   
   // Инициализация I2C для OLED (если нужно явно указать пины)
+  bootPhaseBegin(BOOT_PHASE_DISPLAY);
   Wire.begin(PIN_OLED_SDA, PIN_OLED_SCL);
   
   // Инициализация OLED дисплея (SSD1306, адрес 0x3C)
+  u8g2.setBusClock(DISPLAY_I2C_CLOCK);
   u8g2.begin();
-  u8g2.clearBuffer();
-  u8g2.setFont(u8g2_font_ncenB14_tr);
-  u8g2.drawStr(0, 30, "Loading...");
-  u8g2.setFont(u8g2_font_6x10_tr);
-  u8g2.drawStr(0, 50, "by Pavel");
-  u8g2.sendBuffer();
+  if (!fastBoot) {
+    u8g2.clearBuffer();
+    u8g2.setFont(u8g2_font_ncenB14_tr);
+    u8g2.drawStr(0, 30, "Loading...");
+    u8g2.setFont(u8g2_font_6x10_tr);
+    u8g2.drawStr(0, 50, "by Pavel");
+    u8g2.sendBuffer();
+  }
+  
+  // Дальше экраном владеет задача дисплея
+  if (!startDisplayTask()) {
+    Serial.println("[Display] Не удалось запустить задачу дисплея, отрисовка в loop()");
+  }
+  bootPhaseEnd(BOOT_PHASE_DISPLAY);
   
   // Инициализация датчиков температуры DS18B20 (две шины)
+  bootPhaseBegin(BOOT_PHASE_SENSOR_BUS);
   sensors1.begin();
   sensors1.setResolution(12);  // 12 бит = 0.0625°C точность
   sensors1.setWaitForConversion(false);  // Неблокирующий режим
@@ -5333,14 +6753,17 @@ void setup() {
   sensors2.begin();
   sensors2.setResolution(12);  // 12 бит = 0.0625°C точность
   sensors2.setWaitForConversion(false);  // Неблокирующий режим
+  bootPhaseEnd(BOOT_PHASE_SENSOR_BUS);
   
   // Инициализация EEPROM
+  bootPhaseBegin(BOOT_PHASE_EEPROM);
   EEPROM.begin(EEPROM_SIZE);
   
   // Загрузка счетчика перезагрузок и получение причины перезагрузки
   loadBootCountFromEEPROM();
   bootCount++;
   saveBootCountToEEPROM();
+  rtcBootProfile.bootCount = bootCount;
   
   // Получение причины перезагрузки
   lastResetReason = getResetReasonString();
@@ -5353,6 +6776,13 @@ void setup() {
   loadAutoSettingsFromEEPROM();
   loadMqttSettingsFromEEPROM();
   loadSensorMappingFromEEPROM();
+  loadSensorFiltersFromEEPROM();
+#ifdef BOILER_SIMULATION
+  boilerSim.begin(BoilerSimParams());
+  boilerSim.addCoal();
+  Serial.println("[Симуляция] Режим симуляции котла, датчики не используются");
+  Serial.println("SIM," BOILER_SIM_TRACE_HEADER);
+#endif
   loadSystemEnabledFromEEPROM();
   loadWiFiSettingsFromEEPROM();
   loadNTPSettingsFromEEPROM();
@@ -5362,75 +6792,37 @@ void setup() {
   loadEventLogFromEEPROM();
   loadFanStatsFromEEPROM();
   
-  // Определение состояния системы при запуске
-  determineSystemStateOnStartup();
-  
-  // Инициализация SPIFFS (оптимизировано: убраны лишние проверки)
-  if (!SPIFFS.begin(true)) {
-    Serial.println("[ОШИБКА] SPIFFS не смонтирован!");
-  }
-  
-  // Попытка подключения к WiFi с приоритетом
-  bool wifiConnected = false;
-  
-  // Если есть сохраненные настройки WiFi, используем их
-  if (wifiSettings.primarySSID.length() > 0 || wifiSettings.backupSSID.length() > 0) {
-    wifiConnected = connectToWiFi();
-  }
-  
-  // Если не подключились, используем WiFiManager
-  if (!wifiConnected) {
-    wifiManager.setConfigPortalTimeout(180);
-    
-    if (!wifiManager.autoConnect("KotelAP", "kotel12345")) {
-      delay(1000);  // Уменьшена задержка перед перезагрузкой
-      ESP.restart();
-    }
-  }
-  
-  // Определение режима WiFi (STA или AP)
-  bool isAPMode = (WiFi.getMode() == WIFI_AP || WiFi.getMode() == WIFI_AP_STA);
-  
-  // WiFi подключен (информация доступна через веб-интерфейс)
-  
-  // Инициализация mDNS для доступа по kotel.local (только в режиме STA)
-  if (!isAPMode) {
-    // Установка hostname для WiFi
-    WiFi.setHostname("kotel");
-    
-    // Инициализация mDNS
-    if (MDNS.begin("kotel")) {
-      Serial.println("[mDNS] mDNS responder started: kotel.local");
-      // Добавляем сервис HTTP
-      MDNS.addService("http", "tcp", 80);
-    } else {
-      Serial.println("[mDNS] Error setting up mDNS responder!");
-    }
-  }
-  
-  // Инициализация NTP (после подключения к WiFi)
-  if (!isAPMode && ntpSettings.enabled) {
-    setupNTP();
-  }
-  
   // Загрузка настроек ML
   loadMLSettingsFromEEPROM();
   loadRelaySettingsFromEEPROM();
   loadUpdateSettingsFromEEPROM();
   
-  // Инициализация OTA (Over The Air обновление) - работает в обоих режимах
-  setupOTA();
+  // Определение состояния системы при запуске
+  determineSystemStateOnStartup();
+  bootPhaseEnd(BOOT_PHASE_EEPROM);
   
-  // OTA инициализирован
+  // После WDT или просадки питания SPIFFS (может форматироваться) и сеть
+  // поднимаются позже из loop(), чтобы реле и регулирование заработали сразу
+  if (fastBoot) {
+    deferredBootPending = true;
+  } else {
+    startStorage();
+    
+    // WiFi, портал, mDNS, NTP и OTA поднимаются в фоне из loop(): после пропадания
+    // питания реле и регулирование работают сразу, не дожидаясь сети
+    startWiFiConnection();
+  }
   
   // Настройка веб-сервера
+  bootPhaseBegin(BOOT_PHASE_ROUTES);
   server.on("/", handleWebInterface);
   
   // OTA обновление через веб-интерфейс
   server.on("/update", HTTP_POST, []() {
     server.sendHeader("Connection", "close");
     server.send(200, "text/plain", (Update.hasError()) ? "FAIL" : "OK");
-    ESP.restart();
+    // Ответ уходит из loop() - перезагрузка чуть позже, как после сброса WiFi
+    pendingRebootTime = millis() + 500;
   }, []() {
     HTTPUpload& upload = server.upload();
     if (upload.status == UPLOAD_FILE_START) {
@@ -5452,6 +6844,13 @@ void setup() {
   // API endpoints
   server.on("/api/status", HTTP_GET, handleStatus);
   server.on("/api/diagnostics", HTTP_GET, handleDiagnostics);
+  server.on("/api/diagnostics/profile", HTTP_GET, handleLoopProfile);
+  server.on("/api/diagnostics/heap", HTTP_GET, handleHeapProfile);
+  server.on("/metrics", HTTP_GET, handleMetrics);
+#ifdef DEVICE_BENCH
+  server.on("/api/bench/run", HTTP_POST, handleBenchRun);
+  server.on("/api/bench/baseline", HTTP_POST, handleBenchBaseline);
+#endif
   server.on("/api/setpoint", HTTP_POST, handleSetpoint);
   server.on("/api/control", HTTP_POST, handleControl);
   server.on("/api/system/enable", HTTP_POST, handleSystemControl);
@@ -5466,8 +6865,11 @@ void setup() {
   server.on("/api/settings/comfort", HTTP_GET, handleComfortSettingsGet);
   server.on("/api/settings/comfort", HTTP_POST, handleComfortSettingsPost);
   server.on("/api/settings/mqtt", HTTP_GET, handleMqttSettingsGet);
+  server.on("/api/settings/all", HTTP_GET, handleSettingsAllGet);
+  server.on("/api/settings/all", HTTP_POST, handleSettingsAllPost);
   server.on("/api/settings/mqtt", HTTP_POST, handleMqttSettingsPost);
   server.on("/api/mqtt/test", HTTP_POST, handleMqttTest);
+  server.on("/api/mqtt/status", HTTP_GET, handleMqttStatus);
   server.on("/api/wifi/info", HTTP_GET, handleWiFiInfo);
   server.on("/api/wifi/settings", HTTP_GET, handleWiFiSettingsGet);
   server.on("/api/wifi/settings", HTTP_POST, handleWiFiSettingsPost);
@@ -5483,10 +6885,17 @@ void setup() {
   server.on("/api/sensors/scan", HTTP_POST, handleSensorsScan);
   server.on("/api/sensors/mapping", HTTP_GET, handleSensorsMappingGet);
   server.on("/api/sensors/mapping", HTTP_POST, handleSensorsMappingPost);
+  server.on("/api/sensors/filters", HTTP_GET, handleSensorFiltersGet);
+  server.on("/api/sensors/filters", HTTP_POST, handleSensorFiltersPost);
   server.on("/api/system/info", HTTP_GET, handleSystemInfo);
+  server.on("/api/trace", HTTP_GET, handleTraceDownload);
+  server.on("/api/trace/info", HTTP_GET, handleTraceInfo);
+  server.on("/api/trace/settings", HTTP_POST, handleTraceSettingsPost);
+  server.on("/api/trace/clear", HTTP_POST, handleTraceClear);
   server.on("/api/system/reboot", HTTP_POST, handleReboot);
   server.on("/api/system/bootcount/reset", HTTP_POST, handleBootCountReset);
   server.on("/api/system/log", HTTP_GET, handleBootLog);
+  server.on("/api/system/boot-profile", HTTP_GET, handleBootProfile);
   server.on("/api/system/timers", HTTP_GET, handleTimers);
   server.on("/api/coalFeeding", HTTP_GET, handleCoalFeeding);
   server.on("/api/coalFeeding", HTTP_POST, handleCoalFeeding);
@@ -5501,13 +6910,155 @@ void setup() {
     server.send(404, "text/plain", "Not Found");
   });
   
-  server.begin();
+  // Если сразу включился портал, он занимает 80 порт - сервер запустится после него
+  if (!deferredBootPending && wifiStage != WIFI_STAGE_PORTAL) {
+    server.begin();
+  }
+  bootPhaseEnd(BOOT_PHASE_ROUTES);
   
   // Подключение к MQTT (неблокирующее - будет выполнено в loop)
-  // Не вызываем mqttConnect() здесь, чтобы не блокировать запуск
+  // Здесь только настройка клиента, чтобы не блокировать запуск
+  mqttSetupClient();
   
   // Первоначальное обновление дисплея
   updateDisplay();
+  
+  bootPhaseEnd(BOOT_PHASE_SETUP);
+  Serial.print("[Boot] setup() за ");
+  Serial.print(rtcBootProfile.endUs[BOOT_PHASE_SETUP] / 1000);
+  Serial.println(" мс от старта чипа");
+  saveBootLogEntry();
+}
+
+// Монтирование SPIFFS и запуск трассы
+void startStorage() {
+  bootPhaseBegin(BOOT_PHASE_SPIFFS);
+  // Инициализация SPIFFS (оптимизировано: убраны лишние проверки)
+  if (!SPIFFS.begin(true)) {
+    Serial.println("[ОШИБКА] SPIFFS не смонтирован!");
+  } else {
+    traceRecorder.begin(SPIFFS);
+    // Режим - на момент начала записи: по нему trace_replay начинает воспроизведение
+    tracedWorkMode = workMode == 1 ? 1 : 0;
+    const char* mode = WORK_MODE_NAMES[tracedWorkMode];
+    traceRecorder.recordPair(TRACE_BOOT, FIRMWARE_VERSION, mode, strlen(mode));
+  }
+  bootPhaseEnd(BOOT_PHASE_SPIFFS);
+}
+
+// Отложенная часть быстрого старта: SPIFFS, WiFi и веб-сервер
+void runDeferredBoot(unsigned long now) {
+  if (!deferredBootPending || now < FAST_BOOT_DEFER_MS) {
+    return;
+  }
+  deferredBootPending = false;
+  Serial.println("[Boot] Запуск отложенных SPIFFS, WiFi и веб-сервера");
+  startStorage();
+  startWiFiConnection();
+  if (wifiStage != WIFI_STAGE_PORTAL) {
+    server.begin();
+  }
+}
+
+// ============ Связь BoilerControl с прошивкой ============
+void onControlFanRelay(bool on) {
+  writeRelayPin(PIN_RELAY_FAN, on ? HIGH : LOW);
+}
+
+void onControlEvent(const char* name, const char* mqttEvent, const char* details) {
+  logEvent(name, details);
+  // Публикация в MQTT (событие ждет в очереди и при обрыве связи)
+  if (mqttSettings.enabled) {
+    String topic = mqttSettings.prefix + "/event/" + mqttEvent;
+    mqttEnqueue(MQTT_PRIORITY_EVENT, topic.c_str(), details);
+  }
+}
+
+void onControlFanCycle() {
+  fanStats.cycleCount++;
+  fanStats.dailyCycleCount++;
+  saveFanStatsToEEPROM();
+}
+
+void onControlLog(const char* line) {
+  Serial.println(line);
+}
+
+// ============ Связь BoilerCommands с прошивкой ============
+void onCommandRelay(CommandRelay relay, bool on) {
+  switch (relay) {
+    case COMMAND_RELAY_FAN:
+      writeRelayPin(PIN_RELAY_FAN, on ? HIGH : (relaySettings.fanOffIsLow ? LOW : HIGH));
+      break;
+    case COMMAND_RELAY_PUMP:
+      writeRelayPin(PIN_RELAY_PUMP, on ? HIGH : (relaySettings.pumpOffIsLow ? LOW : HIGH));
+      break;
+    case COMMAND_RELAY_SENSORS:
+      writeRelayPin(PIN_RELAY_SENSORS, on ? HIGH : (relaySettings.sensorsOffIsLow ? LOW : HIGH));
+      break;
+  }
+}
+
+void onCommandPublish(const char* suffix, const char* payload) {
+  if (mqttSettings.enabled) {
+    String topic = mqttSettings.prefix + "/" + suffix;
+    mqttEnqueue(MQTT_PRIORITY_STATE, topic.c_str(), payload);
+  }
+}
+
+bool onCommandSave(CommandSave what) {
+  switch (what) {
+    case COMMAND_SAVE_WORK_MODE:
+      saveWorkModeToEEPROM();
+      return true;
+    case COMMAND_SAVE_SYSTEM:
+      saveSystemEnabledToEEPROM();
+      return true;
+    case COMMAND_SAVE_AUTO:
+      return saveAutoSettingsToEEPROM();
+    case COMMAND_SAVE_COMFORT:
+      return saveComfortSettingsToEEPROM();
+  }
+  return false;
+}
+
+// Причина пересчета в виде "sensors+timer"
+void formatControlTrigger(uint8_t trigger, char* buf, size_t size) {
+  buf[0] = '\0';
+  size_t len = 0;
+  for (int i = 0; i < 4; i++) {
+    if (trigger & (1 << i)) {
+      len += snprintf(buf + len, size - len, "%s%s", len > 0 ? "+" : "", CONTROL_TRIGGER_NAMES[i]);
+      if (len >= size) {
+        break;
+      }
+    }
+  }
+}
+
+// Запись решения (evaluateControl() в BoilerCommands): что изменилось и
+// какое событие к этому привело
+void onControlDecision(unsigned long now, uint8_t trigger) {
+  lastControlDecision.time = now;
+  lastControlDecision.trigger = trigger;
+  lastControlDecision.fan = fanState;
+  lastControlDecision.pump = pumpState;
+  lastControlDecision.systemState = systemState;
+  lastControlDecision.comfortState = comfortState;
+  
+  uint8_t payload[5] = {trigger, (uint8_t)fanState, (uint8_t)pumpState, (uint8_t)systemState, (uint8_t)comfortState};
+  traceRecorder.record(TRACE_CONTROL, payload, sizeof(payload));
+  
+  char triggerName[40];
+  formatControlTrigger(trigger, triggerName, sizeof(triggerName));
+  Serial.print("[Control] ");
+  Serial.print(triggerName);
+  Serial.print(": fan=");
+  Serial.print(fanState ? 1 : 0);
+  Serial.print(" pump=");
+  Serial.print(pumpState ? 1 : 0);
+  Serial.print(" state=");
+  Serial.println(SYSTEM_STATES[systemState].apiName);
 }
 
 void loop() {
@@ -5523,11 +7074,18 @@ void loop() {
   // Heartbeat - счетчик итераций loop() для диагностики
   static unsigned long heartbeatCounter = 0;
   static unsigned long lastHeartbeatLog = 0;
+  static unsigned long lastHeartbeatMinute = 0;
   heartbeatCounter++;
+  loopIterations++;
+  if (now - lastHeartbeatMinute >= 60000) {
+    heartbeatPerMinute = loopIterations;
+    loopIterations = 0;
+    lastHeartbeatMinute = now;
+  }
   
   // Логирование heartbeat каждые 10000 итераций (примерно раз в минуту при нормальной работе)
   if (heartbeatCounter % 10000 == 0) {
-    unsigned long heartbeatElapsed = (now >= lastHeartbeatLog) ? (now - lastHeartbeatLog) : (ULONG_MAX - lastHeartbeatLog + now);
+    unsigned long heartbeatElapsed = now - lastHeartbeatLog;
     if (heartbeatElapsed > 0) {
       Serial.print("[DIAG] Heartbeat #");
       Serial.print(heartbeatCounter);
@@ -5536,30 +7094,39 @@ void loop() {
       Serial.print(" bytes | Min free: ");
       Serial.print(ESP.getMinFreeHeap());
       Serial.print(" bytes | Uptime: ");
-      Serial.print(now / 1000);
+      Serial.print((unsigned long)(uptimeMillis() / 1000));
       Serial.println(" sec");
     }
     lastHeartbeatLog = now;
   }
   
   // Обработка OTA обновлений (должен быть первым)
+  uint32_t stageStart = micros();
+  HEAP_SCOPE(HEAP_TAG_OTA);
   ArduinoOTA.handle();
+  stageStart = recordLoopStage(LOOP_STAGE_OTA, stageStart);
+  HEAP_SCOPE(HEAP_TAG_WEB);
   
   // mDNS обновляется автоматически, не требует явного вызова update()
   
+  runDeferredBoot(now);
+  handleWiFiConnection(now);
   server.handleClient();
+  stageStart = recordLoopStage(LOOP_STAGE_WEB, stageStart);
+  HEAP_SCOPE(HEAP_TAG_UPDATE);
   
   // Автоматическая проверка обновлений
   if (updateSettings.autoCheckEnabled && WiFi.status() == WL_CONNECTED) {
     unsigned long timeSinceLastCheck = (updateSettings.lastCheckTime == 0) ? ULONG_MAX :
-      ((now >= updateSettings.lastCheckTime) ? (now - updateSettings.lastCheckTime) : 
-       (ULONG_MAX - updateSettings.lastCheckTime + now));
+      now - updateSettings.lastCheckTime;
     
     if (timeSinceLastCheck >= updateSettings.checkInterval) {
       Serial.println("[Update] Auto-checking for updates...");
       String latestVersion = checkForUpdates();
+      // lastCheckTime (millis) во флеш не пишется - блок обновлений хранит
+      // только настройки; сброс кэша GET /api/update/settings и /api/settings/all
       updateSettings.lastCheckTime = now;
-      saveUpdateSettingsToEEPROM();
+      markSettingsChanged();
       
       if (latestVersion.length() > 0) {
         Serial.print("[Update] New version available: ");
@@ -5568,20 +7135,13 @@ void loop() {
       }
     }
   }
+  stageStart = recordLoopStage(LOOP_STAGE_UPDATE, stageStart);
+  HEAP_SCOPE(HEAP_TAG_MQTT);
   
-  // Обработка MQTT (неблокирующая)
-  if (mqttSettings.enabled) {
-    if (!mqttClient.connected()) {
-      static unsigned long lastReconnect = 0;
-      // Защита от переполнения millis()
-      if (now - lastReconnect > 10000 || now < lastReconnect) {  // Пробуем реже - каждые 10 секунд
-        lastReconnect = now;
-        mqttConnect();
-      }
-    } else {
-      // loop() не должен блокировать, но ограничим время
-      mqttClient.loop();
-    }
+  // Обработка MQTT (неблокирующая): подключение - по шагу за проход
+  mqttConnectStep(now);
+  if (mqttSettings.enabled && mqttClient.connected()) {
+    mqttClient.loop();
   }
   
   // Периодический вывод IP адреса убран - только энкодер для отладки
@@ -5596,10 +7156,10 @@ void loop() {
   
   // Обработка автоматического включения реле датчиков после ручного сброса (через MQTT/веб)
   if (sensorsResetPending && !sensorsAutoResetInProgress) {
-    unsigned long elapsed = (now >= sensorsResetStartTime) ? (now - sensorsResetStartTime) : (ULONG_MAX - sensorsResetStartTime + now);
+    unsigned long elapsed = now - sensorsResetStartTime;
     if (elapsed >= SENSORS_RESET_DELAY) {
       sensorsRelayState = true;
-      digitalWrite(PIN_RELAY_SENSORS, HIGH);
+      writeRelayPin(PIN_RELAY_SENSORS, HIGH);
       sensorsResetPending = false;
       lastSensorsDetectedTime = now;  // Обновляем время обнаружения после ручного сброса
     }
@@ -5616,13 +7176,25 @@ void loop() {
   // Публикация детального JSON для ML (с настраиваемым интервалом)
   static unsigned long lastMLMqtt = 0;
   if (mlSettings.enabled && mqttSettings.enabled && mqttClient.connected()) {
-    unsigned long elapsed = (lastMLMqtt == 0) ? 999999 : ((now >= lastMLMqtt) ? (now - lastMLMqtt) : (ULONG_MAX - lastMLMqtt + now));
+    unsigned long elapsed = (lastMLMqtt == 0) ? 999999 : (now - lastMLMqtt);
     if (elapsed >= (unsigned long)(mlSettings.publishInterval * 1000)) {
       lastMLMqtt = now;
       publishMqttML();
     }
   }
   
+  // Публикация профиля loop()
+  static unsigned long lastProfileMqtt = 0;
+  if (mqttSettings.enabled && mqttClient.connected() && now - lastProfileMqtt >= PROFILE_MQTT_INTERVAL) {
+    lastProfileMqtt = now;
+    publishMqttProfile();
+  }
+  
+  // Досылка очереди MQTT (без ожидания брокера)
+  drainMqttOutbox();
+  stageStart = recordLoopStage(LOOP_STAGE_MQTT, stageStart);
+  HEAP_SCOPE(HEAP_TAG_CONTROL);
+  
   // Обработка результатов сканирования WiFi (асинхронное)
   processWiFiScanResults();
   
@@ -5633,137 +7205,7 @@ void loop() {
   handleEncoder();
   
   // Проверка и обработка подброса угля
-  checkCoalFeeding();
-  
-  // Управление вентилятором с учетом подброса угля
-  if (coalFeedingActive) {
-    // Во время подброса угля вентилятор должен быть выключен
-    if (fanState) {
-      fanState = false;
-      digitalWrite(PIN_RELAY_FAN, LOW);
-    }
-  } else if (systemEnabled && !manualFanControl) {
-    // Автоматическое управление вентилятором
-    static int lastWorkMode = -1;
-    if (lastWorkMode != workMode) {
-      // Переключение режима - сброс состояний
-      comfortState = "WAIT";
-      comfortStateStartTime = 0;
-      homeTempAtStateStart = 0.0;
-      heatingStartTime = 0;
-      lastWorkMode = workMode;
-    }
-    
-    if (workMode == 1) {
-      // Режим "Комфорт" - управление по температуре в доме
-      handleComfortMode(now);
-    } else {
-      // Режим "Авто" - стандартная логика
-      // Включаем вентилятор, если температура подачи ниже (уставка - гистерезис)
-      // Выключаем, если температура достигла (уставка + гистерезис)
-      if (supplyTemp > 0) {  // Только если есть показания датчика
-      
-      // Управление вентилятором
-      // Защита от частых переключений
-      unsigned long timeSinceLastToggle = (lastFanToggleTime == 0) ? 999999 : 
-        ((now >= lastFanToggleTime) ? (now - lastFanToggleTime) : (ULONG_MAX - lastFanToggleTime + now));
-      float tempDelta = abs(supplyTemp - lastFanToggleTemp);
-      
-      // Проверяем условия для включения/выключения с защитой от дребезга
-      bool shouldTurnOn = !fanState && 
-                          supplyTemp < (autoSettings.setpoint - autoSettings.hysteresis) &&
-                          (timeSinceLastToggle >= FAN_TOGGLE_MIN_INTERVAL_MS || lastFanToggleTime == 0) &&
-                          (tempDelta >= FAN_TOGGLE_MIN_TEMP_DELTA || lastFanToggleTime == 0);
-      
-      bool shouldTurnOff = fanState && 
-                           supplyTemp >= (autoSettings.setpoint + autoSettings.hysteresis) &&
-                           (timeSinceLastToggle >= FAN_TOGGLE_MIN_INTERVAL_MS || lastFanToggleTime == 0) &&
-                           (tempDelta >= FAN_TOGGLE_MIN_TEMP_DELTA || lastFanToggleTime == 0);
-      
-      if (shouldTurnOn && !boilerExtinguished) {
-        fanState = true;
-        systemState = "HEATING";
-        heatingStartTime = now;  // Запоминаем время начала разогрева
-        fanStartTime = now;  // Запоминаем время начала работы вентилятора
-        maxTempDuringFan = supplyTemp;  // Инициализируем максимальную температуру
-        lastFanToggleTime = now;
-        lastFanToggleTemp = supplyTemp;
-        fanStats.cycleCount++;
-        fanStats.dailyCycleCount++;
-        saveFanStatsToEEPROM();
-      } else if (shouldTurnOff) {
-        heatingStartTime = 0;  // Сбрасываем таймер разогрева
-        fanState = false;
-        systemState = "IDLE";
-        fanStartTime = 0;  // Сбрасываем таймер работы вентилятора
-        maxTempDuringFan = 0.0;  // Сбрасываем максимальную температуру
-        lastFanToggleTime = now;
-        lastFanToggleTemp = supplyTemp;
-      }
-      
-      // 3. Проверка таймаута разогрева
-      if (heatingStartTime > 0 && fanState) {
-        unsigned long heatingElapsed = ((now >= heatingStartTime) ? (now - heatingStartTime) : (ULONG_MAX - heatingStartTime + now)) / 60000;  // минуты
-        if (heatingElapsed >= autoSettings.heatingTimeout) {
-          if (supplyTemp < autoSettings.setpoint - 5) {
-            systemState = "HEATING_TIMEOUT";
-          }
-        }
-      }
-      
-      // 4. Обнаружение прогорания угля (проверяем реже, чтобы не нагружать систему)
-      static unsigned long lastCoalBurnedCheck = 0;
-      if (fanState && supplyTemp > 0 && (now - lastCoalBurnedCheck > 60000 || now < lastCoalBurnedCheck)) {  // Раз в минуту
-        lastCoalBurnedCheck = now;
-        int trend = getTemperatureTrend(&supplyHistory);
-        if (trend == -1) {  // Падение температуры
-          if (coalBurnedCheckStart == 0) {
-            coalBurnedCheckStart = now;
-          }
-          unsigned long coalElapsed = (now >= coalBurnedCheckStart) ? (now - coalBurnedCheckStart) : (ULONG_MAX - coalBurnedCheckStart + now);
-          if (coalElapsed > COAL_BURNED_CHECK_TIME) {
-            systemState = "COAL_BURNED";
-          }
-        } else {
-          coalBurnedCheckStart = 0;  // Сбрасываем если температура не падает
-        }
-      } else if (!fanState) {
-        coalBurnedCheckStart = 0;
-      }
-      
-      // 5. Защита от перегрева
-      if (supplyTemp >= autoSettings.overheatTemp) {
-        fanState = false;
-        systemState = "OVERHEAT";
-        Serial.print("[Безопасность] Перегрев! Температура ");
-        Serial.print(supplyTemp);
-        Serial.print(" >= ");
-        Serial.println(autoSettings.overheatTemp);
-      } else if (systemState == "OVERHEAT" && supplyTemp < autoSettings.overheatTemp) {
-        // Восстановление из состояния перегрева
-        systemState = "IDLE";
-        Serial.println("[Безопасность] Восстановление после перегрева");
-      }
-      
-      // 6. Предупреждение о высокой температуре (maxTemp)
-      if (supplyTemp >= autoSettings.maxTemp && supplyTemp < autoSettings.overheatTemp) {
-        if (systemState != "HEATING_TIMEOUT" && systemState != "COAL_BURNED" && systemState != "OVERHEAT") {
-          systemState = "HIGH_TEMP";
-        }
-      }
-      
-      // 7. Проверка погасания котла (только если не в режиме розжига)
-      if (!ignitionInProgress && !boilerExtinguished) {
-        checkBoilerExtinguished(now);
-      }
-    }
-    }
-  }
-  
-  // Проверка прогресса розжига (для всех режимов)
-  if (ignitionInProgress) {
-    checkIgnitionProgress(now);
-  }
+  checkCoalFeeding(now);
   
   // Обновление статистики вентилятора
   static unsigned long lastStatsUpdate = 0;
@@ -5782,68 +7224,20 @@ void loop() {
     }
   }
   
-  // Автоматическое управление насосом
-  if (systemEnabled && !manualPumpControl) {
-    bool shouldPumpRun = false;
-    
-    // Проверяем уличную температуру для определения режима работы насоса
-    bool outdoorTempValid = (outdoorTemp > -50.0 && outdoorTemp < 150.0);
-    bool outdoorTempBelowZero = outdoorTempValid && outdoorTemp < 0.0;
-    
-    if (supplyTemp > 0) {  // Только если есть показания датчика подачи
-      // Логика работы насоса:
-      // 1. Если уличная температура < 0°C - насос на постоянке
-      // 2. Если датчик уличной температуры в ошибке - насос на постоянке
-      // 3. Если уличная температура >= 0°C - насос от 45°C
-      
-      if (!outdoorTempValid || outdoorTempBelowZero) {
-        // Насос на постоянке (уличная < 0°C или датчик в ошибке)
-        shouldPumpRun = true;
-      } else {
-        // Насос от 45°C (уличная >= 0°C)
-        if (fanState) {
-          // Если вентилятор работает, насос должен работать
-          shouldPumpRun = true;
-        } else if (supplyTemp >= autoSettings.minTemp) {
-          // Если температура выше минимальной, насос работает для циркуляции
-          shouldPumpRun = true;
-        }
-      }
-    } else {
-      // Если датчик подачи в ошибке - насос на постоянке
-      shouldPumpRun = true;
-    }
-    
-    // Защита от застоя насоса - периодическое включение (только когда насос простаивает)
-    if (!shouldPumpRun && !pumpState) {
-      unsigned long timeSinceLastRun = (now >= lastPumpRunTime) ? (now - lastPumpRunTime) : (ULONG_MAX - lastPumpRunTime + now);
-      if (timeSinceLastRun > PUMP_ANTI_STAGNATION_INTERVAL) {
-        // Включаем насос на 2 минуты для предотвращения застоя
-        shouldPumpRun = true;
-        lastPumpRunTime = now;
-      }
-    }
-    
-    if (shouldPumpRun && !pumpState) {
-      pumpState = true;
-      lastPumpRunTime = now;
-    } else if (!shouldPumpRun && pumpState) {
-      // Проверяем, не идет ли защита от застоя
-      unsigned long pumpRunTime = (now >= lastPumpRunTime) ? (now - lastPumpRunTime) : (ULONG_MAX - lastPumpRunTime + now);
-      if (pumpRunTime < PUMP_ANTI_STAGNATION_DURATION) {
-        // Еще идет защита от застоя - не выключаем
-        shouldPumpRun = true;
-      } else {
-        pumpState = false;
-      }
-    }
-  }
+  // Вентилятор, насос, розжиг - только когда что-то изменилось (смена
+  // флагов режима, истекший таймер или события из обработчиков)
+  serviceControl(now);
   
   // Синхронизация состояния реле с переменными (важно для надежности)
   syncRelays();
   
+  // Трасса: смены состояний и периодический сброс буфера во флеш
+  traceStateChanges();
+  traceRecorder.loop();
+  
   // Проверка необходимости перезагрузки (для handleWiFiReset)
   if (pendingRebootTime > 0 && now >= pendingRebootTime) {
+    traceRecorder.flush();
     ESP.restart();
   }
   
@@ -5852,18 +7246,23 @@ void loop() {
     saveAutoSettingsToEEPROM();
     autoSettingsDirty = false;
   }
+  stageStart = recordLoopStage(LOOP_STAGE_CONTROL, stageStart);
+  HEAP_SCOPE(HEAP_TAG_DISPLAY);
   
-  // Обновление дисплея (каждые 1 секунду, чтобы не блокировать веб-сервер)
+  // Обновление дисплея (каждые 1 секунду или сразу по запросу, например при подбросе угля)
   static unsigned long lastDisplayUpdate = 0;
-  if (now - lastDisplayUpdate > 1000 || now < lastDisplayUpdate) {
+  if (displayRefreshRequested || now - lastDisplayUpdate > 1000 || now < lastDisplayUpdate) {
     lastDisplayUpdate = now;
+    displayRefreshRequested = false;
     updateDisplay();
   }
+  stageStart = recordLoopStage(LOOP_STAGE_DISPLAY, stageStart);
+  HEAP_SCOPE(HEAP_TAG_NTP);
   
-  // Обновление NTP времени (если включено)
-  if (ntpSettings.enabled && WiFi.status() == WL_CONNECTED) {
-    timeClient.update();
-  }
+  // Кэш локального времени (SNTP синхронизируется сам в фоне)
+  timeService.loop();
+  stageStart = recordLoopStage(LOOP_STAGE_NTP, stageStart);
+  HEAP_SCOPE(HEAP_TAG_SENSORS);
   
   // Обновление температур с датчиков (каждые 3 секунды для сбора данных за 30 секунд)
   static unsigned long lastTempUpdate = 0;
@@ -5872,29 +7271,41 @@ void loop() {
     updateTemperatures();
   }
   
+#ifndef BOILER_SIMULATION
   // Проверка обнаружения датчиков и автоматический сброс при отсутствии
   checkSensorsDetection();
   
   // Проверка зависания датчиков (0 или 85 градусов) и автоматический сброс питания
   checkSensorsFreeze();
+#endif
+  recordLoopStage(LOOP_STAGE_SENSORS, stageStart);
+  HEAP_SCOPE(HEAP_TAG_NONE);
+  
+  // Снимок фрагментации кучи раз в минуту
+  static unsigned long lastHeapSample = 0;
+  if (now - lastHeapSample >= HEAP_SAMPLE_INTERVAL || lastHeapSample == 0) {
+    lastHeapSample = now;
+    sampleHeapFragmentation();
+  }
   
   // Вычисление загрузки CPU (обновление раз в секунду)
   // Измеряем время выполнения текущего loop()
   unsigned long loopEndTime = micros();
-  unsigned long currentLoopTime;
-  
-  // Защита от переполнения micros() (происходит каждые ~70 минут)
-  if (loopEndTime >= loopStartTime) {
-    currentLoopTime = loopEndTime - loopStartTime;
-  } else {
-    // Переполнение произошло
-    currentLoopTime = (ULONG_MAX - loopStartTime) + loopEndTime;
-  }
+  // Беззнаковая разность корректна и при переполнении micros() (каждые ~70 минут)
+  unsigned long currentLoopTime = loopEndTime - loopStartTime;
   
   // Накапливаем время выполнения и счетчик циклов
   totalLoopTime += currentLoopTime;
   loopCount++;
   
+  // Профиль: полная итерация и разбивка медленной итерации по этапам
+  loopStageLast[LOOP_STAGE_TOTAL] = currentLoopTime;
+  loopStageHistograms[LOOP_STAGE_TOTAL].record(currentLoopTime);
+  if (currentLoopTime >= SLOW_LOOP_THRESHOLD_US) {
+    memcpy(slowLoopStages, loopStageLast, sizeof(slowLoopStages));
+    slowLoopTime = now;
+  }
+  
   // Обновляем загрузку CPU раз в секунду
   if (now - lastCpuUpdate >= CPU_UPDATE_INTERVAL || now < lastCpuUpdate) {
     if (loopCount > 0) {
@@ -0,0 +1,231 @@
+// Проверка частичной отправки кадров OLED на хосте. Последовательность моделей
+// экрана (часы каждую секунду, температура, уставка, подброс угля, таймер
+// вентилятора, экран OTA) отрисовывается двумя способами:
+//   - как раньше: весь кадр заново и целиком по шине (1024 байта);
+//   - как в прошивке: lib/DisplayFrame выбирает измененные тайловые ряды, и
+//     на "панель" копируются только они.
+// После каждого кадра содержимое панели сравнивается с полной отрисовкой,
+// печатаются расхождения и байты по шине на кадр.
+//
+// u8g2 на хосте нет, поэтому текст рисуется своим условным шрифтом с теми же
+// базовыми линиями и близкими к шрифтам прошивки высотами (setFontRefHeightAll).
+// Глифы занимают всю высоту шрифта, так что ряды, которые соседние строки
+// делят между собой, проверяются с запасом.
+//
+// Сборка (из корня репозитория, одной командой):
+//   g++ -std=c++17 -O2 -Wall -Wextra -Ilib/DisplayFrame -o display_check
+//       tools/displaycheck/display_check.cpp lib/DisplayFrame/DisplayFrame.cpp
+// Запуск:
+//   ./display_check [--seconds 7200] [--text-height] [--verbose]
+// --text-height - ряды строк по высоте цифр (без setFontRefHeightAll), чтобы
+// увидеть, что проверка ловит обрезанные глифы.
+// Код выхода: 0 - панель всегда совпадала с полной отрисовкой, 1 - нет.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DisplayFrame.h"
+
+// Условные шрифты строк: базовая линия как DISPLAY_LINES в main.cpp, высота
+// над и под базовой линией - по всем глифам шрифта
+struct HostFont {
+  uint8_t baseline;
+  int8_t ascent;
+  int8_t descent;      // Отрицательный
+  int8_t digitAscent;  // Высота цифр (без setFontRefHeightAll)
+  uint8_t advance;
+};
+static const HostFont LINE_FONTS[DISPLAY_LINE_COUNT] = {
+  {25, 19, -5, 18, 14},  // ncenB18: температура подачи
+  {40, 11, -3, 10, 8},   // ncenB10: уставка
+  {55, 11, -3, 10, 8},   // ncenB10: погасание/розжиг/уголь/время
+  {64, 7, -2, 7, 6}      // 6x10: состояние и таймер
+};
+static const HostFont MESSAGE_FONT = {30, 14, -4, 13, 11};  // ncenB14
+
+static uint8_t ramFrame[DISPLAY_FRAME_BYTES];   // Буфер u8g2 в RAM
+static uint8_t panel[DISPLAY_FRAME_BYTES];      // Что показывает SSD1306
+static uint8_t reference[DISPLAY_FRAME_BYTES];  // Полная отрисовка той же модели
+
+static void setPixel(uint8_t* frame, int x, int y) {
+  if (x < 0 || x >= DISPLAY_WIDTH || y < 0 || y >= DISPLAY_TILE_ROWS * 8) {
+    return;
+  }
+  frame[(y / 8) * DISPLAY_ROW_BYTES + x] |= (uint8_t)(1 << (y % 8));
+}
+
+// Глиф - столбцы пикселей от верха до низа шрифта по узору из кода символа;
+// первый столбец всегда во всю высоту, чтобы крайние ряды были задеты
+static void drawText(uint8_t* frame, const HostFont& font, int baseline, const char* text) {
+  int x = 0;
+  for (const char* p = text; *p != '\0'; p++) {
+    uint8_t c = (uint8_t)*p;
+    for (int col = 0; col < font.advance - 1; col++) {
+      for (int y = baseline - font.ascent; y <= baseline - font.descent; y++) {
+        uint32_t h = (c * 2654435761u) ^ (col * 40503u) ^ (y * 9973u);
+        if (col == 0 || ((h >> 13) & 3) == 0) {
+          setPixel(frame, x + col, y);
+        }
+      }
+    }
+    x += font.advance;
+  }
+}
+
+static void renderModel(const DisplayModel& model, uint8_t* frame) {
+  memset(frame, 0, DISPLAY_FRAME_BYTES);
+  if (model.screen == DISPLAY_SCREEN_MESSAGE) {
+    drawText(frame, MESSAGE_FONT, MESSAGE_FONT.baseline, model.lines[0]);
+    for (int x = 0; x < model.percent; x++) {
+      for (int y = 50; y < 58; y++) {
+        setPixel(frame, x, y);
+      }
+    }
+    return;
+  }
+  for (int i = 0; i < DISPLAY_LINE_COUNT; i++) {
+    drawText(frame, LINE_FONTS[i], LINE_FONTS[i].baseline, model.lines[i]);
+  }
+}
+
+static void sendRowsToPanel(uint8_t tileRow, uint8_t rowCount) {
+  memcpy(panel + tileRow * DISPLAY_ROW_BYTES, ramFrame + tileRow * DISPLAY_ROW_BYTES, rowCount * DISPLAY_ROW_BYTES);
+}
+
+// ============ Сценарий ============
+// Модель экрана на секунде t: форматирование как в buildDisplayModel()
+static void buildModel(int t, DisplayModel& model) {
+  model.screen = DISPLAY_SCREEN_MAIN;
+  model.percent = -1;
+  // OTA с 1:30 на 20 секунд
+  if (t >= 5400 && t < 5420) {
+    model.screen = DISPLAY_SCREEN_MESSAGE;
+    model.percent = (t - 5400) * 5;
+    snprintf(model.lines[0], DISPLAY_LINE_LENGTH, "OTA Update");
+    for (int i = 1; i < DISPLAY_LINE_COUNT; i++) {
+      model.lines[i][0] = '\0';
+    }
+    return;
+  }
+  // Температура подачи меняется с чтением датчиков (раз в 6 с)
+  int reading = t / 6;
+  float supply = 60.0f + ((reading * 37) % 23 - 11) * 0.0625f + (t % 900 < 180 ? (t % 900) * 0.02f : 0.0f);
+  snprintf(model.lines[0], DISPLAY_LINE_LENGTH, "%.1f°C", supply);
+  snprintf(model.lines[1], DISPLAY_LINE_LENGTH, "Уст: %.1f°C", t < 1800 ? 60.0f : 65.0f);
+  // Подброс угля с 1:00 на 5 минут, иначе часы
+  int coalLeft = 3600 + 300 - t;
+  if (t >= 3600 && coalLeft > 0) {
+    snprintf(model.lines[2], DISPLAY_LINE_LENGTH, "Уголь: %02d:%02d", coalLeft / 60, coalLeft % 60);
+    snprintf(model.lines[3], DISPLAY_LINE_LENGTH, "Уголь:%d:%02d", coalLeft / 60, coalLeft % 60);
+    return;
+  }
+  int clock = 8 * 3600 + t;
+  snprintf(model.lines[2], DISPLAY_LINE_LENGTH, "%02d:%02d:%02d", clock / 3600 % 24, clock / 60 % 60, clock % 60);
+  // Вентилятор: 3 минуты из каждых 15
+  if (t % 900 < 180) {
+    snprintf(model.lines[3], DISPLAY_LINE_LENGTH, "Вент:%d:%02d", t % 900 / 60, t % 60);
+  } else {
+    snprintf(model.lines[3], DISPLAY_LINE_LENGTH, "%s", "РАБОТА");
+  }
+}
+
+int main(int argc, char** argv) {
+  int seconds = 7200;
+  bool textHeight = false;
+  bool verbose = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--text-height") == 0) {
+      textHeight = true;
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+    } else {
+      fprintf(stderr, "usage: %s [--seconds 7200] [--text-height] [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  uint8_t lineRows[DISPLAY_LINE_COUNT];
+  for (int i = 0; i < DISPLAY_LINE_COUNT; i++) {
+    const HostFont& font = LINE_FONTS[i];
+    lineRows[i] = textHeight ? displayLineRowsMask(font.baseline, font.digitAscent, 0)
+                             : displayLineRowsMask(font.baseline, font.ascent, font.descent);
+  }
+  char lastLines[DISPLAY_LINE_COUNT][DISPLAY_LINE_LENGTH];
+  bool fullRedraw = true;
+
+  unsigned long frames = 0;
+  unsigned long skipped = 0;
+  unsigned long mismatches = 0;
+  unsigned long oldBytes = 0;
+  unsigned long newBytes = 0;
+  unsigned long histogram[DISPLAY_TILE_ROWS + 1] = {0};  // Кадры по числу отправленных рядов
+  for (int t = 0; t < seconds; t++) {
+    DisplayModel model;
+    buildModel(t, model);
+    renderModel(model, reference);
+    oldBytes += DISPLAY_FRAME_BYTES;
+
+    // То же, что renderDisplayModel() / renderDisplayMessage() в прошивке
+    size_t sent = 0;
+    if (model.screen == DISPLAY_SCREEN_MESSAGE) {
+      renderModel(model, ramFrame);
+      memcpy(panel, ramFrame, DISPLAY_FRAME_BYTES);
+      sent = DISPLAY_FRAME_BYTES;
+      fullRedraw = true;
+    } else {
+      uint8_t dirtyRows = displayDirtyRows(model, lastLines, lineRows, fullRedraw);
+      if (dirtyRows == 0) {
+        skipped++;
+      } else {
+        renderModel(model, ramFrame);
+        if (fullRedraw) {
+          memcpy(panel, ramFrame, DISPLAY_FRAME_BYTES);
+          sent = DISPLAY_FRAME_BYTES;
+          fullRedraw = false;
+        } else {
+          sent = displaySendDirtyRows(dirtyRows, sendRowsToPanel);
+        }
+      }
+    }
+    frames++;
+    newBytes += sent;
+    histogram[sent / DISPLAY_ROW_BYTES]++;
+
+    if (memcmp(panel, reference, DISPLAY_FRAME_BYTES) != 0) {
+      if (mismatches < 10) {
+        printf("Кадр %d: панель отличается от полной отрисовки в рядах:", t);
+        for (int row = 0; row < DISPLAY_TILE_ROWS; row++) {
+          if (memcmp(panel + row * DISPLAY_ROW_BYTES, reference + row * DISPLAY_ROW_BYTES, DISPLAY_ROW_BYTES) != 0) {
+            printf(" %d", row);
+          }
+        }
+        printf(" (строки: %s | %s | %s | %s)\n", model.lines[0], model.lines[1], model.lines[2], model.lines[3]);
+      }
+      mismatches++;
+    }
+    if (verbose) {
+      printf("%5d %4u байт  %s | %s | %s | %s\n", t, (unsigned)sent, model.lines[0], model.lines[1], model.lines[2],
+             model.lines[3]);
+    }
+  }
+
+  printf("Кадров: %lu (раз в секунду), без отправки: %lu, расхождений с полной отрисовкой: %lu\n", frames, skipped,
+         mismatches);
+  printf("Байт по шине: было %lu (%.0f на кадр), стало %lu (%.0f на кадр), %.1f%%\n", oldBytes,
+         (double)oldBytes / frames, newBytes, (double)newBytes / frames, 100.0 * newBytes / oldBytes);
+  // Данные кадра по 9 бит на байт (с ACK), без команд адресации
+  printf("Шина на кадр: 100 кГц - %.1f -> %.1f мс, 400 кГц - %.1f -> %.1f мс\n",
+         DISPLAY_FRAME_BYTES * 9 / 100.0, newBytes * 9 / 100.0 / frames, DISPLAY_FRAME_BYTES * 9 / 400.0,
+         newBytes * 9 / 400.0 / frames);
+  printf("Кадров по числу рядов:");
+  for (int rows = 0; rows <= DISPLAY_TILE_ROWS; rows++) {
+    if (histogram[rows] > 0) {
+      printf(" %d - %lu;", rows, histogram[rows]);
+    }
+  }
+  printf("\n");
+  return mismatches == 0 ? 0 : 1;
+}
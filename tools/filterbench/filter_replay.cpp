@@ -0,0 +1,430 @@
+// Проверка фильтров датчиков (lib/SensorFilter) на хосте.
+//
+// 1. Сценарии с ожидаемыми решениями: каждое показание подается в фильтр
+//    канала с настройками по умолчанию (defaultSensorFilterConfig), и
+//    результат process() (принято / вне диапазона / зависание) и выход
+//    фильтра сверяются с ожидаемыми.
+// 2. Трасса (TRACE_SENSORS из GET /api/trace или week_run --trace): показания
+//    подаются в фильтры так же, как в updateTemperatures(), а решения шлюза
+//    сверяются с правилами настроек канала - зависание 0/85 °C и выход за
+//    диапазон должны отбрасываться, остальное приниматься.
+// 3. Сравнение настроек: задержка реакции на ступень и остаточный шум для
+//    нескольких вариантов цепочки (на синтетическом сигнале с шумом, выбросами
+//    и зависаниями, а с трассой - и на ней).
+//
+// Сборка (из корня репозитория, одной командой):
+//   g++ -std=c++17 -O2 -Wall -Wextra -Ilib/SensorFilter -Ilib/TraceRecorder -o filter_replay
+//       tools/filterbench/filter_replay.cpp lib/SensorFilter/SensorFilter.cpp lib/TraceRecorder/TraceFormat.cpp
+// Запуск:
+//   ./filter_replay [trace.bin] [--verbose]
+// Код выхода: 0 - все решения совпали, 1 - есть расхождения, 2 - ошибка.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "SensorFilter.h"
+#include "TraceFormat.h"
+
+#define REPLAY_READ_INTERVAL_MS 6000    // Период чтения DS18B20 в loop() прошивки
+#define REPLAY_DISCONNECTED_RAW -12700  // -127 °C в сотых (датчик не ответил)
+#define REPLAY_OUTPUT_TOLERANCE 0.01f   // Допуск сравнения выхода фильтра, °C
+
+static bool verbose = false;
+static int failures = 0;
+
+static const char* resultName(SensorFilterResult result) {
+  switch (result) {
+    case FILTER_ACCEPTED:
+      return "accepted";
+    case FILTER_REJECTED_RANGE:
+      return "range";
+    case FILTER_REJECTED_STUCK:
+      return "stuck";
+  }
+  return "?";
+}
+
+// ============ 1. Сценарии ============
+#define ANY_OUTPUT NAN  // Выход не проверяется
+
+struct ScenarioStep {
+  float raw;
+  SensorFilterResult expected;
+  float output;  // Ожидаемый выход после показания (ANY_OUTPUT - не проверять)
+};
+
+struct Scenario {
+  const char* name;
+  int channel;
+  const ScenarioStep* steps;
+  size_t count;
+};
+
+// Зависание DS18B20 на 85 °C не попадает в медиану и не сдвигает выход
+static const ScenarioStep STUCK_POWER_ON[] = {
+  {60.0, FILTER_ACCEPTED, 60.0},
+  {60.5, FILTER_ACCEPTED, 60.5},  // Медиана двух - верхнее значение
+  {85.0, FILTER_REJECTED_STUCK, 60.5},
+  {85.0, FILTER_REJECTED_STUCK, 60.5},
+  {61.0, FILTER_ACCEPTED, 60.5}
+};
+
+// 0 °C на подаче - зависание, на улице - обычное показание
+static const ScenarioStep STUCK_ZERO_SUPPLY[] = {
+  {45.0, FILTER_ACCEPTED, 45.0},
+  {0.0, FILTER_REJECTED_STUCK, 45.0},
+  {0.0625, FILTER_REJECTED_STUCK, 45.0},
+  {45.0, FILTER_ACCEPTED, 45.0}
+};
+static const ScenarioStep ZERO_OUTDOOR[] = {
+  {0.5, FILTER_ACCEPTED, 0.5},
+  {0.0, FILTER_ACCEPTED, ANY_OUTPUT},
+  {-0.5, FILTER_ACCEPTED, ANY_OUTPUT},
+  {85.0, FILTER_REJECTED_STUCK, ANY_OUTPUT}
+};
+
+// Выход за диапазон, в том числе -127 °C (датчик не ответил)
+static const ScenarioStep RANGE_SUPPLY[] = {
+  {50.0, FILTER_ACCEPTED, 50.0},
+  {150.5, FILTER_REJECTED_RANGE, 50.0},
+  {-50.5, FILTER_REJECTED_RANGE, 50.0},
+  {-127.0, FILTER_REJECTED_RANGE, 50.0},
+  {150.0, FILTER_ACCEPTED, ANY_OUTPUT}
+};
+static const ScenarioStep RANGE_HOME[] = {
+  {22.0, FILTER_ACCEPTED, 22.0},
+  {55.0, FILTER_REJECTED_RANGE, 22.0},
+  {0.0, FILTER_ACCEPTED, 0.0},  // В доме нет ни медианы, ни ограничения скорости
+  {22.5, FILTER_ACCEPTED, 22.5}
+};
+
+// Одиночный выброс принимается, но медиана 3 не пускает его на выход
+static const ScenarioStep SPIKE_SUPPLY[] = {
+  {60.0, FILTER_ACCEPTED, 60.0},
+  {60.0, FILTER_ACCEPTED, 60.0},
+  {75.0, FILTER_ACCEPTED, 60.0},
+  {60.0, FILTER_ACCEPTED, 60.0},
+  {60.0, FILTER_ACCEPTED, 60.0}
+};
+
+// Ступень 40 -> 60: медиана ждет второе показание, дальше не быстрее 1 °C/с
+// (6 °C за период чтения)
+static const ScenarioStep STEP_SUPPLY[] = {
+  {40.0, FILTER_ACCEPTED, 40.0},
+  {40.0, FILTER_ACCEPTED, 40.0},
+  {60.0, FILTER_ACCEPTED, 40.0},
+  {60.0, FILTER_ACCEPTED, 46.0},
+  {60.0, FILTER_ACCEPTED, 52.0},
+  {60.0, FILTER_ACCEPTED, 58.0},
+  {60.0, FILTER_ACCEPTED, 60.0}
+};
+
+// Обратка догоняет быстрее (2 °C/с)
+static const ScenarioStep STEP_RETURN[] = {
+  {30.0, FILTER_ACCEPTED, 30.0},
+  {30.0, FILTER_ACCEPTED, 30.0},
+  {50.0, FILTER_ACCEPTED, 30.0},
+  {50.0, FILTER_ACCEPTED, 42.0},
+  {50.0, FILTER_ACCEPTED, 50.0}
+};
+
+#define SCENARIO(name, channel, steps) {name, channel, steps, sizeof(steps) / sizeof(steps[0])}
+
+static const Scenario SCENARIOS[] = {
+  SCENARIO("зависание 85 °C", SENSOR_SUPPLY, STUCK_POWER_ON),
+  SCENARIO("0 °C на подаче", SENSOR_SUPPLY, STUCK_ZERO_SUPPLY),
+  SCENARIO("0 °C на улице", SENSOR_OUTDOOR, ZERO_OUTDOOR),
+  SCENARIO("диапазон подачи", SENSOR_SUPPLY, RANGE_SUPPLY),
+  SCENARIO("диапазон в доме", SENSOR_HOME, RANGE_HOME),
+  SCENARIO("одиночный выброс", SENSOR_SUPPLY, SPIKE_SUPPLY),
+  SCENARIO("ступень подачи", SENSOR_SUPPLY, STEP_SUPPLY),
+  SCENARIO("ступень обратки", SENSOR_RETURN, STEP_RETURN)
+};
+
+static void runScenarios() {
+  int scenarioCount = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+  int passed = 0;
+  for (int s = 0; s < scenarioCount; s++) {
+    const Scenario& scenario = SCENARIOS[s];
+    SensorFilter filter;
+    filter.begin(defaultSensorFilterConfig(scenario.channel));
+    bool ok = true;
+    for (size_t i = 0; i < scenario.count; i++) {
+      const ScenarioStep& step = scenario.steps[i];
+      SensorFilterResult result = filter.process(step.raw, (uint32_t)(i + 1) * REPLAY_READ_INTERVAL_MS);
+      bool outputOk = isnan(step.output) || (filter.hasValue() && fabsf(filter.value() - step.output) <= REPLAY_OUTPUT_TOLERANCE);
+      if (result != step.expected || !outputOk) {
+        printf("  [%s/%s] шаг %u: %.4f -> %s, выход %.4f; ожидалось %s, выход %.4f\n", scenario.name,
+               SENSOR_CHANNEL_NAMES[scenario.channel], (unsigned)i + 1, step.raw, resultName(result), filter.value(),
+               resultName(step.expected), step.output);
+        ok = false;
+      }
+    }
+    if (ok) {
+      passed++;
+    } else {
+      failures++;
+    }
+    if (verbose || !ok) {
+      printf("  %-20s %s\n", scenario.name, ok ? "ok" : "FAIL");
+    }
+  }
+  printf("Сценарии: %d из %d прошли\n", passed, scenarioCount);
+}
+
+// ============ 2. Трасса ============
+struct TraceSample {
+  uint32_t ms;
+  float temps[4];  // NAN - датчик не назначен или не ответил (в фильтр не подается)
+};
+
+// Сотые °C из трассы обратно в показание: DS18B20 отдает кратные 1/16 °C,
+// а трасса отбрасывает дробь сотых - исходное значение восстанавливается точно
+static float rawToCelsius(int16_t raw) {
+  if (raw == TRACE_SENSOR_NO_VALUE || raw == REPLAY_DISCONNECTED_RAW) {
+    return NAN;
+  }
+  return roundf(raw / 6.25f) / 16.0f;
+}
+
+static bool loadTrace(const char* path, std::vector<TraceSample>& samples) {
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  size_t pos = 0;
+  TraceRecord record;
+  while (traceDecodeRecord(buf.data(), buf.size(), pos, record)) {
+    if (record.type != TRACE_SENSORS || record.length != 4 * sizeof(int16_t)) {
+      continue;
+    }
+    int16_t raw[4];
+    memcpy(raw, record.data, sizeof(raw));
+    TraceSample sample;
+    sample.ms = record.ms;
+    for (int c = 0; c < 4; c++) {
+      sample.temps[c] = rawToCelsius(raw[c]);
+    }
+    samples.push_back(sample);
+  }
+  return true;
+}
+
+// Решение шлюза по настройкам канала - независимо от реализации фильтра
+static SensorFilterResult expectedGate(const SensorFilterConfig& config, float raw) {
+  if (raw < config.minValid || raw > config.maxValid) {
+    return FILTER_REJECTED_RANGE;
+  }
+  if ((config.rejectZero && fabsf(raw) < 0.1f) || (config.rejectPowerOn && fabsf(raw - 85.0f) < 0.1f)) {
+    return FILTER_REJECTED_STUCK;
+  }
+  return FILTER_ACCEPTED;
+}
+
+static void replayTrace(const char* path, const std::vector<TraceSample>& samples) {
+  printf("\nТрасса %s: показаний %u\n", path, (unsigned)samples.size());
+  printf("  канал     принято диапазон зависание скорость расхождений\n");
+  for (int c = 0; c < 4; c++) {
+    SensorFilterConfig config = defaultSensorFilterConfig(c);
+    SensorFilter filter;
+    filter.begin(config);
+    uint32_t counts[3] = {0, 0, 0};
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      float raw = samples[i].temps[c];
+      if (isnan(raw)) {
+        continue;
+      }
+      SensorFilterResult result = filter.process(raw, samples[i].ms);
+      SensorFilterResult expected = expectedGate(config, raw);
+      counts[result]++;
+      if (result != expected) {
+        if (mismatches < 10) {
+          printf("  [%s] %.3f с: %.4f -> %s, ожидалось %s\n", SENSOR_CHANNEL_NAMES[c], samples[i].ms / 1000.0, raw,
+                 resultName(result), resultName(expected));
+        }
+        mismatches++;
+      }
+    }
+    if (mismatches > 0) {
+      failures++;
+    }
+    printf("  %-8s %8u %8u %9u %8u %11u\n", SENSOR_CHANNEL_NAMES[c], counts[FILTER_ACCEPTED],
+           counts[FILTER_REJECTED_RANGE], counts[FILTER_REJECTED_STUCK], filter.rateLimitedCount, mismatches);
+  }
+}
+
+// ============ 3. Сравнение настроек ============
+struct Variant {
+  const char* name;
+  SensorFilterConfig config;
+};
+
+static std::vector<Variant> buildVariants(int channel) {
+  std::vector<Variant> variants;
+  SensorFilterConfig base = defaultSensorFilterConfig(channel);
+  variants.push_back({"default", base});
+  SensorFilterConfig v = base;
+  v.medianWindow = 1;
+  v.maxRate = 0.0;
+  v.smoother = SMOOTHER_NONE;
+  variants.push_back({"gate-only", v});
+  v = base;
+  v.medianWindow = 5;
+  variants.push_back({"median5", v});
+  v = base;
+  v.maxRate = 0.0;
+  variants.push_back({"no-rate", v});
+  v = base;
+  v.smoother = SMOOTHER_EMA;
+  v.emaAlpha = 0.3;
+  variants.push_back({"ema0.3", v});
+  v = base;
+  v.smoother = SMOOTHER_KALMAN;
+  variants.push_back({"kalman", v});
+  return variants;
+}
+
+// Детерминированный шум, чтобы таблица не менялась от запуска к запуску
+static uint32_t noiseState = 12345;
+static float noise() {
+  noiseState = noiseState * 1664525u + 1013904223u;
+  return ((noiseState >> 8) & 0xFFFF) / 65535.0f - 0.5f;
+}
+
+// Синтетическая подача: 60 °C, через 10 мин ступень до 70 °C, DS18B20-шаг
+// 1/16 °C, шум ±0.25 °C, 2% одиночных выбросов +5..10 °C, 1% зависаний 85 °C
+static void compareOnSynthetic(int channel) {
+  const int sampleCount = 400;
+  const int stepAt = 100;
+  printf("\nНастройки канала %s на синтетике (ступень 60 -> 70 °C, шум, выбросы, зависания):\n",
+         SENSOR_CHANNEL_NAMES[channel]);
+  printf("  вариант      90%% ступени  СКО, °C  макс. ошибка\n");
+  std::vector<Variant> variants = buildVariants(channel);
+  for (const Variant& variant : variants) {
+    noiseState = 12345;
+    SensorFilter filter;
+    filter.begin(variant.config);
+    float sumSq = 0.0;
+    int steady = 0;
+    float maxError = 0.0;
+    int reachedAt = -1;
+    for (int i = 0; i < sampleCount; i++) {
+      float truth = i < stepAt ? 60.0f : 70.0f;
+      float raw = truth + noise() * 0.5f;
+      float r = noise();
+      if (r > 0.49f) {
+        raw = 85.0f;
+      } else if (r > 0.47f) {
+        raw += 5.0f + (r - 0.47f) * 250.0f;
+      }
+      raw = roundf(raw * 16.0f) / 16.0f;
+      filter.process(raw, (uint32_t)(i + 1) * REPLAY_READ_INTERVAL_MS);
+      float out = filter.value();
+      if (i >= stepAt && reachedAt < 0 && out >= 69.0f) {
+        reachedAt = i - stepAt;
+      }
+      // Ошибка - только в установившемся режиме (после ступени - через 30 показаний)
+      if ((i >= 20 && i < stepAt) || i >= stepAt + 30) {
+        float error = out - truth;
+        sumSq += error * error;
+        steady++;
+        if (fabsf(error) > maxError) {
+          maxError = fabsf(error);
+        }
+      }
+    }
+    char reached[24];
+    if (reachedAt >= 0) {
+      snprintf(reached, sizeof(reached), "%d с", (reachedAt + 1) * REPLAY_READ_INTERVAL_MS / 1000);
+    } else {
+      snprintf(reached, sizeof(reached), "нет");
+    }
+    printf("  %-12s %12s %8.3f %13.3f\n", variant.name, reached, sqrtf(sumSq / steady), maxError);
+  }
+}
+
+// На трассе истинное значение неизвестно: шум - СКО второй разности выхода,
+// отставание - средний модуль разности выхода и медианы 5 сырых показаний
+static void compareOnTrace(const std::vector<TraceSample>& samples, int channel) {
+  printf("\nНастройки канала %s на трассе:\n", SENSOR_CHANNEL_NAMES[channel]);
+  printf("  вариант       принято  шум, °C  отставание, °C\n");
+  std::vector<Variant> variants = buildVariants(channel);
+  for (const Variant& variant : variants) {
+    SensorFilter filter;
+    filter.begin(variant.config);
+    SensorFilterConfig referenceConfig = variant.config;
+    referenceConfig.medianWindow = 5;
+    referenceConfig.maxRate = 0.0;
+    referenceConfig.smoother = SMOOTHER_NONE;
+    SensorFilter reference;
+    reference.begin(referenceConfig);
+    std::vector<float> outputs;
+    float lagSum = 0.0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      float raw = samples[i].temps[channel];
+      if (isnan(raw)) {
+        continue;
+      }
+      if (filter.process(raw, samples[i].ms) != FILTER_ACCEPTED) {
+        continue;
+      }
+      reference.process(raw, samples[i].ms);
+      outputs.push_back(filter.value());
+      lagSum += fabsf(filter.value() - reference.value());
+    }
+    float sumSq = 0.0;
+    for (size_t i = 2; i < outputs.size(); i++) {
+      float d2 = outputs[i] - 2 * outputs[i - 1] + outputs[i - 2];
+      sumSq += d2 * d2;
+    }
+    size_t n = outputs.size();
+    printf("  %-12s %9u %8.4f %15.4f\n", variant.name, (unsigned)n, n > 2 ? sqrtf(sumSq / (n - 2)) : 0.0f,
+           n > 0 ? lagSum / n : 0.0f);
+  }
+}
+
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+    } else if (argv[i][0] != '-' && tracePath == nullptr) {
+      tracePath = argv[i];
+    } else {
+      fprintf(stderr, "usage: %s [trace.bin] [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  runScenarios();
+
+  std::vector<TraceSample> samples;
+  if (tracePath != nullptr) {
+    if (!loadTrace(tracePath, samples)) {
+      fprintf(stderr, "Не удалось прочитать %s\n", tracePath);
+      return 2;
+    }
+    replayTrace(tracePath, samples);
+  }
+
+  compareOnSynthetic(SENSOR_SUPPLY);
+  if (!samples.empty()) {
+    compareOnTrace(samples, SENSOR_SUPPLY);
+    compareOnTrace(samples, SENSOR_BOILER);
+  }
+
+  printf("\n%s\n", failures == 0 ? "OK" : "Есть расхождения");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+# Хостовые проверки: сборка инструментов tools/ и прогоны, которые должны
+# проходить перед прошивкой. Запуск из любого каталога:
+#   tools/host_check.sh [каталог сборки, по умолчанию /tmp/kotel-host]
+# Код выхода не 0 - сборка или проверка не прошла.
+
+set -e
+cd "$(dirname "$0")/.."
+OUT="${1:-/tmp/kotel-host}"
+mkdir -p "$OUT"
+
+CXX="${CXX:-g++}"
+CXXFLAGS="-std=c++17 -O2 -Wall -Wextra"
+
+CONTROL_INC="-Ilib/BoilerControl -Ilib/BoilerCommands -Ilib/BoilerSim -Ilib/SensorFilter -Ilib/MqttCommands -Ilib/MqttMessages
+  -Ilib/PayloadWriter -Ilib/TraceRecorder -Itools/hostsim"
+CONTROL_SRC="tools/hostsim/host_firmware.cpp tools/hostsim/host_shims.cpp tools/hostsim/host_trace.cpp
+  lib/BoilerControl/BoilerControl.cpp lib/BoilerCommands/BoilerCommands.cpp lib/BoilerCommands/SettingsLimits.cpp
+  lib/SensorFilter/SensorFilter.cpp lib/MqttCommands/MqttCommands.cpp
+  lib/MqttMessages/MqttMessages.cpp lib/PayloadWriter/PayloadWriter.cpp lib/TraceRecorder/TraceFormat.cpp"
+
+echo "== Сборка"
+$CXX $CXXFLAGS $CONTROL_INC -o "$OUT/week_run" tools/hostsim/week_run.cpp tools/hostsim/host_plant.cpp \
+  lib/BoilerSim/BoilerSim.cpp $CONTROL_SRC
+$CXX $CXXFLAGS $CONTROL_INC -o "$OUT/trace_replay" tools/hostsim/trace_replay.cpp $CONTROL_SRC
+# Счетчик выделений host_bench работает только с обертками malloc/calloc/realloc
+$CXX $CXXFLAGS -Ilib/PayloadWriter -Ilib/MqttCommands -Ilib/MqttMessages -Ilib/SensorFilter -Ilib/MqttOutbox \
+  -Ilib/LatencyHistogram -Ilib/BoilerControl -Ilib/BoilerCommands -Ilib/DisplayFrame -o "$OUT/host_bench" \
+  tools/hostbench/host_bench.cpp lib/PayloadWriter/PayloadWriter.cpp lib/MqttCommands/MqttCommands.cpp \
+  lib/MqttMessages/MqttMessages.cpp lib/SensorFilter/SensorFilter.cpp lib/MqttOutbox/MqttOutbox.cpp \
+  lib/LatencyHistogram/LatencyHistogram.cpp lib/BoilerControl/BoilerControl.cpp \
+  lib/BoilerCommands/SettingsLimits.cpp lib/DisplayFrame/DisplayFrame.cpp \
+  -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+
+# Неделя в каждом режиме - в пределах событий за сутки (week_run DAY_BOUNDS),
+# а ее трасса воспроизводится без расхождений
+for mode in auto comfort; do
+  echo "== Неделя ($mode) и воспроизведение трассы"
+  if ! "$OUT/week_run" --mode "$mode" --trace "$OUT/week_$mode.bin" > "$OUT/week_$mode.txt"; then
+    cat "$OUT/week_$mode.txt"
+    exit 1
+  fi
+  if ! "$OUT/trace_replay" "$OUT/week_$mode.bin" --max-diffs 5 > "$OUT/replay_$mode.txt"; then
+    cat "$OUT/replay_$mode.txt"
+    exit 1
+  fi
+  tail -n 1 "$OUT/replay_$mode.txt"
+done
+
+# Горячие функции - без кучи. Время зависит от машины и здесь не сравнивается
+# (для этого --baseline), а выделение на операцию - ошибка на любой машине
+echo "== Микробенчмарки"
+"$OUT/host_bench" --iterations 20000 > "$OUT/bench.txt"
+cat "$OUT/bench.txt"
+if ! awk 'NR > 1 && $3 > 0 { bad = 1 } END { exit bad }' "$OUT/bench.txt"; then
+  echo "host_bench: выделения памяти в горячих функциях" >&2
+  exit 1
+fi
+
+echo "== OK"
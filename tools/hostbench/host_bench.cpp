@@ -0,0 +1,436 @@
+// Хостовые микробенчмарки горячих функций прошивки: время на операцию и
+// число выделений памяти на операцию. Замеряются библиотеки, которые
+// собираются и на ESP32, и на хосте: сборка MQTT-записей (lib/MqttMessages),
+// разбор входящих команд, фильтр датчиков, очередь исходящих MQTT,
+// гистограмма задержек, история температур и тренд (lib/BoilerControl),
+// измененные ряды экрана (lib/DisplayFrame) и применение настроек по таблицам
+// пределов (lib/BoilerCommands/SettingsLimits). Устройство при замере не
+// участвует - никаких публикаций в брокер и записей во флеш.
+//
+// JSON статуса и настроек для HTTP (ArduinoJson, String) и чтение/запись
+// EEPROM остаются в прошивке: ArduinoJson не лежит в дереве, его ставит
+// PlatformIO. Их части без Arduino замеряются здесь: запись состояния -
+// mqttStateJson (тот же MqttSnapshot), проверка и применение полей -
+// settingsApply.
+//
+// Выделения считаются обертками malloc/calloc/realloc (--wrap компоновщика)
+// и операторами new, переведенными на malloc (выделения внутри самой libc,
+// например в strdup, не видны - прошивка их не использует). Горячие функции прошивки
+// рассчитаны на работу без кучи: любое выделение, которого нет в базовой
+// линии, - регрессия, как и время выше базового на BENCH_TOLERANCE_PERCENT.
+//
+// Сборка (из корня репозитория, одной командой, Linux):
+//   g++ -std=c++17 -O2 -Ilib/PayloadWriter -Ilib/MqttCommands -Ilib/MqttMessages
+//       -Ilib/SensorFilter -Ilib/MqttOutbox -Ilib/LatencyHistogram -Ilib/BoilerControl
+//       -Ilib/BoilerCommands -Ilib/DisplayFrame -o host_bench
+//       tools/hostbench/host_bench.cpp lib/PayloadWriter/PayloadWriter.cpp
+//       lib/MqttCommands/MqttCommands.cpp lib/MqttMessages/MqttMessages.cpp
+//       lib/SensorFilter/SensorFilter.cpp lib/MqttOutbox/MqttOutbox.cpp
+//       lib/LatencyHistogram/LatencyHistogram.cpp lib/BoilerControl/BoilerControl.cpp
+//       lib/BoilerCommands/SettingsLimits.cpp lib/DisplayFrame/DisplayFrame.cpp
+//       -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+// Запуск:
+//   ./host_bench [--iterations 100000] [--save-baseline FILE] [--baseline FILE]
+// С --baseline код выхода 1 при регрессии (для скрипта сборки).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <new>
+
+#include "BoilerControl.h"
+#include "DisplayFrame.h"
+#include "LatencyHistogram.h"
+#include "MqttCommands.h"
+#include "MqttMessages.h"
+#include "MqttOutbox.h"
+#include "PayloadWriter.h"
+#include "SensorFilter.h"
+#include "SettingsLimits.h"
+
+#define BENCH_BUFFER_SIZE 1536  // Как MQTT_BUFFER_SIZE в прошивке
+#define BENCH_MAX 16
+#define BENCH_TOLERANCE_PERCENT 25
+#define BENCH_TOLERANCE_NS 20
+
+// ---- Счетчик выделений ----
+
+static unsigned long allocCount = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  allocCount++;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+  allocCount++;
+  return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  allocCount++;
+  return __real_realloc(ptr, size);
+}
+}
+
+// operator new из libstdc++ вызывает malloc мимо обертки - переводим на свою
+void* operator new(size_t size) {
+  void* ptr = malloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+// ---- Данные как на работающем котле ----
+
+// Имена состояний - из таблиц BoilerControl, как в прошивке
+const MqttEnumNames ENUM_NAMES = {
+  &SYSTEM_STATES[0].apiName, sizeof(SystemStateInfo), SYSTEM_STATE_COUNT,
+  COMFORT_STATE_NAMES, COMFORT_STATE_COUNT
+};
+
+static MqttSnapshot snapshot;
+
+static void fillSnapshot() {
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.names = &ENUM_NAMES;
+  snapshot.supplyTemp = 63.4375f;
+  snapshot.returnTemp = 51.8125f;
+  snapshot.boilerTemp = 66.25f;
+  snapshot.outdoorTemp = -7.5625f;
+  snapshot.homeTemp = 22.9375f;
+  snapshot.setpoint = 60.5f;
+  snapshot.fan = true;
+  snapshot.pump = true;
+  snapshot.systemEnabled = true;
+  snapshot.systemState = 13;
+  snapshot.workMode = 1;
+  snapshot.homeTempSensorLWTOnline = true;
+  snapshot.comfortState = 4;
+  snapshot.targetHomeTemp = 23.5f;
+  snapshot.autoSetpoint = 60.0f;
+  snapshot.minTemp = 45.0f;
+  snapshot.maxTemp = 75.0f;
+  snapshot.hysteresis = 2.0f;
+  snapshot.inertiaTemp = 55.0f;
+  snapshot.inertiaTime = 10;
+  snapshot.overheatTemp = 77.0f;
+  snapshot.heatingTimeout = 30;
+  snapshot.uptimeSec = 183245;
+  snapshot.timestamp = 1792396800u + snapshot.uptimeSec;
+  strcpy(snapshot.time, "14:32:05");
+  strcpy(snapshot.date, "19.10.2026");
+  snapshot.wifiRSSI = -67;
+  strcpy(snapshot.wifiSSID, "Keenetic-4821");
+  strcpy(snapshot.wifiIP, "192.168.1.57");
+  strcpy(snapshot.wifiMAC, "24:6F:28:A1:B2:C3");
+  snapshot.freeMem = 187432;
+  snapshot.heapSize = 298800;
+  snapshot.mlPublishInterval = 10;
+  snapshot.sensorCountBus1 = 2;
+  snapshot.sensorCountBus2 = 2;
+  snapshot.mqttConnected = true;
+}
+
+// Обработчики таблицы MQTT_COMMANDS: разбор payload, как в прошивке, без действий
+static volatile uint32_t handled = 0;
+static void onNumber(MqttBytes payload) {
+  float value;
+  if (payload.toFloat(value)) handled++;
+}
+static void onWord(MqttBytes payload) {
+  if (payload.isAny("1|on|start|reset|comfort|online") || payload.isAny("0|off|stop|auto|offline")) handled++;
+}
+void onMqttSetpoint(MqttBytes payload) { onNumber(payload); }
+void onMqttSensorsReset(MqttBytes payload) { onWord(payload); }
+void onMqttIgnitionStart(MqttBytes payload) { onWord(payload); }
+void onMqttWorkMode(MqttBytes payload) { onWord(payload); }
+void onMqttCoalFeeding(MqttBytes payload) { onWord(payload); }
+void onMqttFan(MqttBytes payload) { onWord(payload); }
+void onMqttComfortTarget(MqttBytes payload) { onNumber(payload); }
+void onEsp01Temperature(MqttBytes payload) { onNumber(payload); }
+void onEsp01Status(MqttBytes payload) { onWord(payload); }
+
+// Обработчики BoilerControl: управление здесь не пересчитывается
+void scheduleControlAt(unsigned long) {}
+void onControlFanRelay(bool) {}
+void onControlEvent(const char*, const char*, const char*) {}
+void onControlFanCycle() {}
+void onControlWorkModeFallback() {}
+void onControlLog(const char*) {}
+
+struct BenchMessage {
+  const char* topic;
+  const char* payload;
+};
+const BenchMessage MESSAGES[] = {
+  {"home/esp01/temperature", "22.81"},
+  {"home/esp01/status", "online"},
+  {"kotel/device1/setpoint/set", "62.5"},
+  {"kotel/device1/fan/set", "on"},
+  {"kotel/device1/state", "x"}  // Чужой топик - мимо таблицы
+};
+const size_t MESSAGE_COUNT = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+
+static uint8_t payloadBuf[BENCH_BUFFER_SIZE];
+static MqttCommandRegistry registry(MQTT_COMMANDS, MQTT_COMMAND_COUNT);
+static SensorFilter filter;
+static MqttOutbox outbox;
+static LatencyHistogram histogram;
+static TemperatureHistory history;
+static volatile int trend = 0;
+
+// Основной экран: строки, как в прошивке, и ряды шрифтов display_check
+static DisplayModel displayModel;
+static char displayLastLines[DISPLAY_LINE_COUNT][DISPLAY_LINE_LENGTH];
+static uint8_t displayLineRows[DISPLAY_LINE_COUNT];
+static volatile size_t displayBytes = 0;
+
+// Тело POST /api/settings/auto после разбора JSON: ключ и число
+struct BenchSetting {
+  const char* key;
+  float value;
+};
+static BenchSetting autoPost[] = {
+  {"setpoint", 62.0f}, {"hysteresis", 2.5f}, {"inertiaTime", 12.0f}, {"heatingTimeout", 40.0f}
+};
+const size_t AUTO_POST_COUNT = sizeof(autoPost) / sizeof(autoPost[0]);
+
+static uint32_t step = 0;  // Номер итерации - входные данные меняются от прохода к проходу
+
+// ---- Бенчмарки ----
+
+struct Bench {
+  const char* name;
+  void (*fn)();
+};
+
+static void benchStateJson() {
+  snapshot.supplyTemp = 40.0f + (step & 511) * 0.0625f;
+  buildMqttPayload(PAYLOAD_JSON, payloadBuf, sizeof(payloadBuf), writeStatePayload, snapshot);
+}
+
+static void benchMLJson() {
+  snapshot.homeTemp = 21.0f + (step & 63) * 0.0625f;
+  buildMqttPayload(PAYLOAD_JSON, payloadBuf, sizeof(payloadBuf), writeMLPayload, snapshot);
+}
+
+static void benchMLMsgpack() {
+  snapshot.homeTemp = 21.0f + (step & 63) * 0.0625f;
+  buildMqttPayload(PAYLOAD_MSGPACK, payloadBuf, sizeof(payloadBuf), writeMLPayload, snapshot);
+}
+
+static void benchMqttDispatch() {
+  const BenchMessage& msg = MESSAGES[step % MESSAGE_COUNT];
+  registry.dispatch(msg.topic, (const uint8_t*)msg.payload, strlen(msg.payload));
+}
+
+static void benchSensorFilter() {
+  // Медленный рост с шумом и редкими выбросами 85°C
+  float raw = (step % 97 == 0) ? 85.0f : 60.0f + (step & 255) * 0.01f + ((step * 7919) % 11) * 0.05f;
+  filter.process(raw, step * 750);
+}
+
+static void benchOutbox() {
+  outbox.push(MQTT_PRIORITY_TELEMETRY, "kotel/device1/simple/temp", "63.4", false, step);
+  MqttOutboxMessage msg;
+  if (outbox.peek(msg)) {
+    outbox.pop();
+  }
+}
+
+static void benchLatencyRecord() {
+  histogram.record((step * 2654435761u) >> 16);
+}
+
+static void benchTempHistory() {
+  // Показание раз в 3 с, тренд - на каждом обновлении экрана
+  addToHistory(&history, 60.0f + (step & 127) * 0.0625f, step * 3000UL);
+  trend = getTemperatureTrend(&history);
+}
+
+static void sendRowsNoop(uint8_t, uint8_t) {}
+
+static void benchDisplayFrame() {
+  // Меняется температура подачи каждый проход, время - реже
+  snprintf(displayModel.lines[0], DISPLAY_LINE_LENGTH, "%.1f°C", 55.0f + (step & 63) * 0.1f);
+  snprintf(displayModel.lines[2], DISPLAY_LINE_LENGTH, "%02u:%02u:%02u", (step / 3600) % 24, (step / 60) % 60,
+           (step / 4) % 60);
+  uint8_t dirty = displayDirtyRows(displayModel, displayLastLines, displayLineRows, false);
+  displayBytes += displaySendDirtyRows(dirty, sendRowsNoop);
+}
+
+static bool lookupAutoPost(const char* key, float& value, void* context) {
+  (void)context;
+  for (size_t i = 0; i < AUTO_POST_COUNT; i++) {
+    if (strcmp(autoPost[i].key, key) == 0) {
+      value = autoPost[i].value;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void benchSettingsApply() {
+  autoPost[0].value = 50.0f + (step & 15);
+  applySettingsNumbers(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), SETTINGS_VALUES(AUTO_SETTINGS_VALUES),
+                       lookupAutoPost, nullptr);
+}
+
+const Bench BENCHES[] = {
+  {"mqttStateJson", benchStateJson},
+  {"mqttMLJson", benchMLJson},
+  {"mqttMLMsgpack", benchMLMsgpack},
+  {"mqttDispatch", benchMqttDispatch},
+  {"sensorFilter", benchSensorFilter},
+  {"mqttOutbox", benchOutbox},
+  {"latencyRecord", benchLatencyRecord},
+  {"tempHistory", benchTempHistory},
+  {"displayFrame", benchDisplayFrame},
+  {"settingsApply", benchSettingsApply}
+};
+const int BENCH_COUNT = sizeof(BENCHES) / sizeof(BENCHES[0]);
+
+struct BenchResult {
+  const char* name;
+  double nsPerOp;
+  double allocsPerOp;
+};
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static BenchResult runBench(const Bench& bench, long iterations) {
+  // Прогрев: первые выделения и кеши не должны попадать в замер
+  for (long i = 0; i < iterations / 10 + 1; i++, step++) {
+    bench.fn();
+  }
+  unsigned long allocsBefore = allocCount;
+  uint64_t start = nowNs();
+  for (long i = 0; i < iterations; i++, step++) {
+    bench.fn();
+  }
+  uint64_t elapsed = nowNs() - start;
+  return {bench.name, (double)elapsed / iterations, (double)(allocCount - allocsBefore) / iterations};
+}
+
+// Базовая линия: строки "name nsPerOp allocsPerOp"
+static int loadBaseline(const char* path, BenchResult* baseline, char names[][32]) {
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    return -1;
+  }
+  int count = 0;
+  while (count < BENCH_MAX &&
+         fscanf(f, "%31s %lf %lf", names[count], &baseline[count].nsPerOp, &baseline[count].allocsPerOp) == 3) {
+    baseline[count].name = names[count];
+    count++;
+  }
+  fclose(f);
+  return count;
+}
+
+int main(int argc, char** argv) {
+  long iterations = 100000;
+  const char* baselinePath = nullptr;
+  const char* savePath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baselinePath = argv[++i];
+    } else if (strcmp(argv[i], "--save-baseline") == 0 && i + 1 < argc) {
+      savePath = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--iterations N] [--save-baseline FILE] [--baseline FILE]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  fillSnapshot();
+  registry.setPrefix("kotel/device1");
+  SensorFilterConfig config;
+  config.smoother = SMOOTHER_KALMAN;
+  filter.begin(config);
+  // Шрифты строк основного экрана (baseline, ascent, descent) - как в display_check
+  const int lineFonts[DISPLAY_LINE_COUNT][3] = {{25, 19, -5}, {40, 11, -3}, {55, 11, -3}, {64, 7, -2}};
+  for (int i = 0; i < DISPLAY_LINE_COUNT; i++) {
+    displayLineRows[i] = displayLineRowsMask(lineFonts[i][0], lineFonts[i][1], lineFonts[i][2]);
+  }
+  displayModel.screen = DISPLAY_SCREEN_MAIN;
+  displayModel.percent = -1;
+  snprintf(displayModel.lines[1], DISPLAY_LINE_LENGTH, "Уст: %.1f°C", 60.5f);
+  snprintf(displayModel.lines[3], DISPLAY_LINE_LENGTH, "Разогрев 2");
+
+  BenchResult results[BENCH_MAX];
+  for (int i = 0; i < BENCH_COUNT; i++) {
+    results[i] = runBench(BENCHES[i], iterations);
+  }
+
+  BenchResult baseline[BENCH_MAX];
+  char baselineNames[BENCH_MAX][32];
+  int baselineCount = 0;
+  if (baselinePath != nullptr) {
+    baselineCount = loadBaseline(baselinePath, baseline, baselineNames);
+    if (baselineCount < 0) {
+      fprintf(stderr, "%s: cannot read baseline\n", baselinePath);
+      return 2;
+    }
+  }
+
+  int regressions = 0;
+  printf("%-14s %10s %11s %12s\n", "bench", "ns/op", "allocs/op", "baseline");
+  for (int i = 0; i < BENCH_COUNT; i++) {
+    const BenchResult& r = results[i];
+    printf("%-14s %10.1f %11.2f", r.name, r.nsPerOp, r.allocsPerOp);
+    for (int b = 0; b < baselineCount; b++) {
+      if (strcmp(baseline[b].name, r.name) != 0) {
+        continue;
+      }
+      double limit = baseline[b].nsPerOp * (100 + BENCH_TOLERANCE_PERCENT) / 100.0;
+      if (limit < baseline[b].nsPerOp + BENCH_TOLERANCE_NS) limit = baseline[b].nsPerOp + BENCH_TOLERANCE_NS;
+      bool slower = r.nsPerOp > limit;
+      bool allocates = r.allocsPerOp > baseline[b].allocsPerOp;
+      printf(" %12.1f%s%s", baseline[b].nsPerOp, slower ? "  SLOWER" : "", allocates ? "  ALLOCS" : "");
+      if (slower || allocates) {
+        regressions++;
+      }
+    }
+    printf("\n");
+  }
+
+  if (savePath != nullptr) {
+    FILE* f = fopen(savePath, "w");
+    if (f == nullptr) {
+      fprintf(stderr, "%s: cannot write baseline\n", savePath);
+      return 2;
+    }
+    for (int i = 0; i < BENCH_COUNT; i++) {
+      fprintf(f, "%s %.1f %.2f\n", results[i].name, results[i].nsPerOp, results[i].allocsPerOp);
+    }
+    fclose(f);
+  }
+
+  if (regressions > 0) {
+    printf("%d regression(s)\n", regressions);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,266 @@
+#include "host_firmware.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "MqttMessages.h"
+
+FakeOneWireBus sensors1;
+FakeOneWireBus sensors2;
+int hostSupplySensor = -1;
+int hostReturnSensor = -1;
+int hostBoilerSensor = -1;
+int hostOutdoorSensor = -1;
+
+float returnTemp = 0.0;
+float boilerTemp = 0.0;
+
+MqttCommandRegistry mqttCommands(MQTT_COMMANDS, MQTT_COMMAND_COUNT);
+HostMqttClient mqttClient;
+static char mqttPrefix[MQTT_COMMAND_PREFIX_MAX + 1] = "";
+
+HostFirmwareHooks hostHooks = {nullptr, nullptr, nullptr, nullptr};
+bool hostVerbose = false;
+bool hostSensorPolling = true;
+
+uint32_t fanCycleCount = 0;
+
+static int tracedWorkMode = 0;  // Режим на момент hostFirmwareSetup() - он же в TRACE_BOOT стенда
+
+// Адреса датчиков: различаются серийным номером, последний байт (CRC)
+// пересчитывает addDevice()
+static const char* const SENSOR_ADDRESSES[4] = {
+  "28FF1A2B3C4D0100", "28FF1A2B3C4D0200", "28FF1A2B3C4D0300", "28FF1A2B3C4D0400"
+};
+
+static void hostLog(const char* line) {
+  if (hostVerbose) {
+    fprintf(stderr, "[%8.1f мин] %s\n", millis() / 60000.0, line);
+  }
+}
+
+static void publishPrefixed(const char* suffix, const char* payload) {
+  if (!mqttClient.connected()) {
+    return;
+  }
+  char topic[128];
+  snprintf(topic, sizeof(topic), "%s/%s", mqttPrefix, suffix);
+  mqttClient.publish(topic, payload);
+}
+
+// ============ Связь BoilerControl и BoilerCommands с "прошивкой" ============
+void onControlFanRelay(bool on) {
+  char line[64];
+  snprintf(line, sizeof(line), "[Реле] Вентилятор: %s", on ? "ВКЛ" : "ВЫКЛ");
+  hostLog(line);
+}
+
+void onControlEvent(const char* name, const char* mqttEvent, const char* details) {
+  char line[192];
+  snprintf(line, sizeof(line), "[Событие] %s: %s", name, details);
+  hostLog(line);
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), "event/%s", mqttEvent);
+  publishPrefixed(suffix, details);
+}
+
+void onControlFanCycle() {
+  fanCycleCount++;
+}
+
+void onControlLog(const char* line) {
+  hostLog(line);
+}
+
+// Реле стенда - только строка в журнале (GPIO нет)
+void onCommandRelay(CommandRelay relay, bool on) {
+  static const char* const RELAY_NAMES[] = {"Вентилятор", "Насос", "Датчики"};
+  char line[64];
+  snprintf(line, sizeof(line), "[Реле] %s: %s", RELAY_NAMES[relay], on ? "ВКЛ" : "ВЫКЛ");
+  hostLog(line);
+}
+
+void onCommandPublish(const char* suffix, const char* payload) {
+  publishPrefixed(suffix, payload);
+}
+
+// Режим работы и включение системы - в ту же EEPROM_ADDR_*, что и прошивка.
+// Настройки Авто/Комфорта прошивка хранит JSON-блоками (ArduinoJson), на
+// стенде они живут только в памяти
+bool onCommandSave(CommandSave what) {
+  switch (what) {
+    case COMMAND_SAVE_WORK_MODE:
+      EEPROM.put(EEPROM_ADDR_WORKMODE, workMode);
+      return EEPROM.commit();
+    case COMMAND_SAVE_SYSTEM:
+      EEPROM.put(EEPROM_ADDR_SYSTEM, systemEnabled);
+      return EEPROM.commit();
+    case COMMAND_SAVE_AUTO:
+    case COMMAND_SAVE_COMFORT:
+      return true;
+  }
+  return false;
+}
+
+void onCoalFeedingChanged(bool active) {
+  (void)active;  // Экрана и модели котла в прошивочной части стенда нет
+}
+
+void onControlDecision(unsigned long now, uint8_t trigger) {
+  if (hostHooks.decision != nullptr) {
+    hostHooks.decision(now, trigger);
+  }
+  char line[120];
+  snprintf(line, sizeof(line), "[Control] trigger=0x%02X: fan=%d pump=%d state=%s comfort=%s", trigger,
+           fanState ? 1 : 0, pumpState ? 1 : 0, SYSTEM_STATES[systemState].apiName, COMFORT_STATE_NAMES[comfortState]);
+  hostLog(line);
+}
+
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
+  if (hostHooks.mqttIn != nullptr) {
+    hostHooks.mqttIn(millis(), topic, payload, length);
+  }
+  dispatchMqttCommand(mqttCommands, topic, payload, length, millis());
+}
+
+void hostMqttDeliver(const char* topic, const char* payload) {
+  char topicCopy[128];
+  snprintf(topicCopy, sizeof(topicCopy), "%s", topic);
+  mqttCallback(topicCopy, (uint8_t*)payload, (unsigned int)strlen(payload));
+}
+
+// ============ Датчики ============
+// Показание одного канала через его фильтр, как в updateTemperatures() прошивки
+static void applyChannel(int channel, float temp, float& value, int16_t* raw, unsigned long now) {
+  if (isnan(temp)) {
+    return;
+  }
+  raw[channel] = (int16_t)(temp * 100);
+  if (temp == DEVICE_DISCONNECTED_C) {
+    return;
+  }
+  if (sensorFilters[channel].process(temp, now) == FILTER_ACCEPTED) {
+    value = sensorFilters[channel].value();
+    if (channel == SENSOR_SUPPLY) {
+      addToHistory(&supplyHistory, value, now);
+    }
+  }
+}
+
+void hostApplySensors(unsigned long now, const float temps[4]) {
+  int16_t raw[4] = {INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN};
+  applyChannel(SENSOR_SUPPLY, temps[SENSOR_SUPPLY], supplyTemp, raw, now);
+  applyChannel(SENSOR_RETURN, temps[SENSOR_RETURN], returnTemp, raw, now);
+  applyChannel(SENSOR_BOILER, temps[SENSOR_BOILER], boilerTemp, raw, now);
+  applyChannel(SENSOR_OUTDOOR, temps[SENSOR_OUTDOOR], outdoorTemp, raw, now);
+  if (hostHooks.sensors != nullptr) {
+    hostHooks.sensors(now, raw);
+  }
+  requestControlEvaluation(CONTROL_TRIGGER_SENSORS);
+}
+
+static float readSensor(FakeOneWireBus& bus, int index) {
+  if (index < 0) {
+    return NAN;
+  }
+  DeviceAddress address;
+  bus.getAddress(address, index);
+  return bus.validAddress(address) ? bus.getTempC(address) : DEVICE_DISCONNECTED_C;
+}
+
+// Асинхронное чтение, как updateTemperatures() прошивки: один вызов запрашивает
+// конвертацию, следующий (через HOST_SENSOR_READ_INTERVAL) читает результат
+static void updateTemperatures(unsigned long now) {
+  static bool requestPending = false;
+  static unsigned long requestTime = 0;
+  if (!requestPending) {
+    sensors1.requestTemperatures();
+    sensors2.requestTemperatures();
+    requestPending = true;
+    requestTime = now;
+    return;
+  }
+  if (now - requestTime < HOST_TEMP_CONVERSION_DELAY) {
+    return;
+  }
+  requestPending = false;
+  float temps[4];
+  temps[SENSOR_SUPPLY] = readSensor(sensors1, hostSupplySensor);
+  temps[SENSOR_RETURN] = readSensor(sensors1, hostReturnSensor);
+  temps[SENSOR_BOILER] = readSensor(sensors2, hostBoilerSensor);
+  temps[SENSOR_OUTDOOR] = readSensor(sensors2, hostOutdoorSensor);
+  hostApplySensors(now, temps);
+}
+
+// ============ setup() / loop() ============
+void hostFirmwareSetup(const char* prefix) {
+  snprintf(mqttPrefix, sizeof(mqttPrefix), "%s", prefix);
+  mqttCommands.setPrefix(mqttPrefix);
+  mqttClient.setCallback(mqttCallback);
+
+  hostSupplySensor = sensors1.addDevice(SENSOR_ADDRESSES[SENSOR_SUPPLY]);
+  hostReturnSensor = sensors1.addDevice(SENSOR_ADDRESSES[SENSOR_RETURN]);
+  hostBoilerSensor = sensors2.addDevice(SENSOR_ADDRESSES[SENSOR_BOILER]);
+  hostOutdoorSensor = sensors2.addDevice(SENSOR_ADDRESSES[SENSOR_OUTDOOR]);
+
+  for (int i = 0; i < SENSOR_CHANNEL_COUNT; i++) {
+    sensorFilters[i].begin(defaultSensorFilterConfig(i));
+  }
+
+  EEPROM.begin(EEPROM_SIZE);
+  uint8_t magic = 0;
+  EEPROM.get(EEPROM_ADDR_MAGIC, magic);
+  int mode = 0;
+  if (magic == EEPROM_MAGIC) {
+    EEPROM.get(EEPROM_ADDR_WORKMODE, mode);
+  } else {
+    EEPROM.put(EEPROM_ADDR_MAGIC, (uint8_t)EEPROM_MAGIC);
+    EEPROM.put(EEPROM_ADDR_WORKMODE, mode);
+    EEPROM.commit();
+  }
+  workMode = (mode == 1) ? 1 : 0;
+  tracedWorkMode = workMode;
+}
+
+// Смены состояний для hostHooks.state - traceStateChanges() прошивки
+static void traceStateChanges(unsigned long now) {
+  static uint8_t lastSystemState = 0xFF;
+  static uint8_t lastComfortState = 0xFF;
+  if (hostHooks.state == nullptr) {
+    return;
+  }
+  if (systemState != lastSystemState) {
+    lastSystemState = systemState;
+    hostHooks.state(now, "system", SYSTEM_STATES[systemState].apiName);
+  }
+  if (comfortState != lastComfortState) {
+    lastComfortState = comfortState;
+    hostHooks.state(now, "comfort", COMFORT_STATE_NAMES[comfortState]);
+  }
+  if (workMode != tracedWorkMode) {
+    tracedWorkMode = workMode;
+    hostHooks.state(now, "mode", WORK_MODE_NAMES[workMode == 1 ? 1 : 0]);
+  }
+}
+
+void hostFirmwareLoop() {
+  unsigned long now = millis();
+
+  if (mqttClient.connected()) {
+    mqttClient.loop();
+  }
+
+  static unsigned long lastTempUpdate = 0;
+  if (hostSensorPolling && (now - lastTempUpdate > HOST_SENSOR_READ_INTERVAL || now < lastTempUpdate)) {
+    lastTempUpdate = now;
+    updateTemperatures(now);
+  }
+
+  // Порядок - как в loop() прошивки: подброс угля, пересчет управления,
+  // затем syncRelays() с таймаутом ручного управления
+  checkCoalFeeding(now);
+  serviceControl(now);
+  checkManualControlTimeout(now);
+  traceStateChanges(now);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "BoilerCommands.h"
+#include "BoilerControl.h"
+#include "MqttCommands.h"
+#include "SensorFilter.h"
+#include "host_shims.h"
+
+// Прошивочная обвязка lib/BoilerControl для хостовых сборок - то, что в
+// src/main.cpp делают setup(), updateTemperatures() и loop(), поверх
+// заглушек host_shims.h. Ни логика управления, ни команды не копируются:
+// работают те же BoilerControl.cpp и BoilerCommands.cpp (режим работы, реле,
+// подброс угля, обработчики MQTT_COMMANDS, пределы настроек, раскладка EEPROM).
+
+#define HOST_SENSOR_READ_INTERVAL 3000   // Как в loop() прошивки
+#define HOST_TEMP_CONVERSION_DELAY 800   // TEMP_CONVERSION_DELAY прошивки
+
+// Датчики DS18B20: шина 1 - подача и обратка, шина 2 - котельная и улица
+extern FakeOneWireBus sensors1;
+extern FakeOneWireBus sensors2;
+// Индексы на шинах, заполняются в hostFirmwareSetup()
+extern int hostSupplySensor, hostReturnSensor, hostBoilerSensor, hostOutdoorSensor;
+
+extern float returnTemp;
+extern float boilerTemp;
+
+extern MqttCommandRegistry mqttCommands;
+extern HostMqttClient mqttClient;
+
+// Наблюдатели стенда (могут быть nullptr)
+struct HostFirmwareHooks {
+  // Сырые показания датчиков в сотых °C (как TRACE_SENSORS прошивки)
+  void (*sensors)(unsigned long now, const int16_t raw[4]);
+  // Входящее MQTT-сообщение до разбора (как TRACE_MQTT_IN)
+  void (*mqttIn)(unsigned long now, const char* topic, const uint8_t* payload, unsigned int length);
+  // Решение управления (как TRACE_CONTROL)
+  void (*decision)(unsigned long now, uint8_t trigger);
+  // Смена systemState/comfortState/workMode: вид и имя (как TRACE_STATE)
+  void (*state)(unsigned long now, const char* kind, const char* name);
+};
+extern HostFirmwareHooks hostHooks;
+extern bool hostVerbose;  // Диагностика BoilerControl в stderr
+extern bool hostSensorPolling;  // false - шины не опрашиваются, показания подает стенд (trace_replay)
+
+extern uint32_t fanCycleCount;
+
+// Прошивочный setup(): адреса датчиков, фильтры, режим работы из EEPROM
+void hostFirmwareSetup(const char* mqttPrefix);
+// Один проход loop() по части управления (время - millis() виртуальных часов)
+void hostFirmwareLoop();
+
+// Показания каналов SENSOR_SUPPLY..SENSOR_OUTDOOR в °C (DEVICE_DISCONNECTED_C -
+// датчик не ответил, NAN - канал не привязан) - через фильтры и в управление,
+// как чтение в updateTemperatures() прошивки
+void hostApplySensors(unsigned long now, const float temps[4]);
+
+// Входящее MQTT-сообщение: из HostMqttClient или стенда (ESP01 без брокера)
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length);
+void hostMqttDeliver(const char* topic, const char* payload);
@@ -0,0 +1,59 @@
+#include "host_plant.h"
+
+#include <stdio.h>
+
+#include "host_firmware.h"
+
+static void applyPlantToSensors(const BoilerSimState& s) {
+  sensors1.setTemperature(hostSupplySensor, s.supplyTemp);
+  sensors1.setTemperature(hostReturnSensor, s.returnTemp);
+  sensors2.setTemperature(hostBoilerSensor, s.boilerTemp);
+  sensors2.setTemperature(hostOutdoorSensor, s.outdoorTemp);
+}
+
+void hostPlantBegin(BoilerSim& plant, const BoilerSimParams& params) {
+  plant.begin(params);
+  plant.addCoal();
+  applyPlantToSensors(plant.state());
+}
+
+void hostPlantStep(BoilerSim& plant, unsigned long dtMs, bool esp01ViaBroker) {
+  static bool lastCoalFeeding = false;
+  if (coalFeedingActive && !lastCoalFeeding) {
+    plant.addCoal();  // Подброс: закладка добавляется, пока вентилятор стоит
+  }
+  lastCoalFeeding = coalFeedingActive;
+
+  static unsigned long pendingMs = 0;
+  pendingMs += dtMs;
+  if (pendingMs >= HOST_PLANT_STEP_MS) {
+    plant.step(pendingMs / 1000.0f, fanState, pumpState);
+    pendingMs = 0;
+    applyPlantToSensors(plant.state());
+  }
+  const BoilerSimState& s = plant.state();
+
+  static unsigned long lastEsp01 = 0;
+  static bool esp01Online = false;
+  if (esp01Online && millis() - lastEsp01 < HOST_PLANT_ESP01_INTERVAL) {
+    return;
+  }
+  lastEsp01 = millis();
+  char value[16];
+  snprintf(value, sizeof(value), "%.2f", s.houseTemp);
+  if (esp01ViaBroker) {
+    if (!mqttClient.connected()) {
+      return;
+    }
+    if (!esp01Online) {
+      mqttClient.publish("home/esp01/status", "online", true);
+    }
+    mqttClient.publish("home/esp01/temperature", value);
+  } else {
+    if (!esp01Online) {
+      hostMqttDeliver("home/esp01/status", "online");
+    }
+    hostMqttDeliver("home/esp01/temperature", value);
+  }
+  esp01Online = true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "BoilerSim.h"
+
+// Объект управления для стендов tools/hostsim: модель котла BoilerSim на тех
+// же виртуальных часах, что и millis() контроллера, - шаг модели равен шагу
+// часов, поэтому таймауты разогрева, проверка прогорания, розжиг и выдержки
+// Комфорта идут в одном масштабе с теплом котла и дома.
+//  - температуры модели выставляются датчикам на шинах OneWire;
+//  - ESP01 раз в минуту присылает температуру дома (через брокер или
+//    напрямую в mqttCallback, как входящее сообщение);
+//  - подброс угля (фронт coalFeedingActive) добавляет закладку в топку.
+
+#define HOST_PLANT_ESP01_INTERVAL 60000  // ESP01 шлет температуру дома раз в минуту
+// Модель шагает целыми секундами (ее внутренний подшаг): при шаге в 10 мс
+// приращения температуры дома за шаг меньше точности float
+#define HOST_PLANT_STEP_MS 1000
+
+// Начальные показания на шине до первого пересчета управления
+void hostPlantBegin(BoilerSim& plant, const BoilerSimParams& params);
+// Шаг модели на dtMs виртуального времени (вызывать до hostClockAdvance);
+// dtMs копится до HOST_PLANT_STEP_MS
+void hostPlantStep(BoilerSim& plant, unsigned long dtMs, bool esp01ViaBroker);
@@ -0,0 +1,417 @@
+#include "host_shims.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// ============ Виртуальные часы ============
+static uint64_t clockMicros = 0;
+
+unsigned long millis() {
+  return (unsigned long)(uint32_t)(clockMicros / 1000);  // 32 бита, как на ESP32
+}
+
+unsigned long micros() {
+  return (unsigned long)(uint32_t)clockMicros;
+}
+
+void hostClockAdvance(unsigned long ms) {
+  clockMicros += (uint64_t)ms * 1000;
+}
+
+uint64_t hostClockMicros() {
+  return clockMicros;
+}
+
+unsigned long hostRealMillis() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)(ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL);
+}
+
+// ============ EEPROM ============
+HostEeprom EEPROM;
+
+bool HostEeprom::begin(size_t size) {
+  if (size <= _size) {
+    return true;
+  }
+  uint8_t* data = (uint8_t*)realloc(_data, size);
+  if (data == nullptr) {
+    return false;
+  }
+  memset(data + _size, 0xFF, size - _size);  // Стертая флеш-память
+  _data = data;
+  _size = size;
+  return true;
+}
+
+bool HostEeprom::open(const char* path) {
+  _path = path;
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr) {
+    return false;  // Образа еще нет - создастся при первом commit()
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  bool ok = size > 0 && begin((size_t)size) && fread(_data, 1, (size_t)size, f) == (size_t)size;
+  fclose(f);
+  return ok;
+}
+
+bool HostEeprom::commit() {
+  commitCount++;
+  if (_path == nullptr || _size == 0) {
+    return true;
+  }
+  FILE* f = fopen(_path, "wb");
+  if (f == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(_data, 1, _size, f) == _size;
+  fclose(f);
+  return ok;
+}
+
+uint8_t HostEeprom::read(int address) const {
+  return (address >= 0 && (size_t)address < _size) ? _data[address] : 0xFF;
+}
+
+void HostEeprom::write(int address, uint8_t value) {
+  if (address >= 0 && (size_t)address < _size) {
+    _data[address] = value;
+  }
+}
+
+// ============ OneWire / DS18B20 ============
+// CRC-8 Dallas/Maxim (полином x^8 + x^5 + x^4 + 1)
+uint8_t oneWireCrc8(const uint8_t* data, size_t len) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      uint8_t mix = (crc ^ byte) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0x8C;
+      }
+      byte >>= 1;
+    }
+  }
+  return crc;
+}
+
+bool parseDeviceAddress(const char* hex, uint8_t* address) {
+  if (strlen(hex) != 16) {
+    return false;
+  }
+  for (int i = 0; i < 8; i++) {
+    char pair[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+    char* end = nullptr;
+    address[i] = (uint8_t)strtoul(pair, &end, 16);
+    if (*end != '\0') {
+      return false;
+    }
+  }
+  return true;
+}
+
+int FakeOneWireBus::addDevice(const char* hex) {
+  if (_count >= HOST_ONEWIRE_MAX_DEVICES) {
+    return -1;
+  }
+  Device& d = _devices[_count];
+  if (!parseDeviceAddress(hex, d.address)) {
+    return -1;
+  }
+  d.address[7] = oneWireCrc8(d.address, 7);
+  d.temperature = 20.0;
+  d.scratchpad = 85.0;  // Значение DS18B20 до первой конвертации
+  d.fault = FAKE_SENSOR_OK;
+  return _count++;
+}
+
+void FakeOneWireBus::setTemperature(int index, float celsius) {
+  if (index >= 0 && index < _count) {
+    _devices[index].temperature = celsius;
+  }
+}
+
+void FakeOneWireBus::setFault(int index, FakeSensorFault fault) {
+  if (index >= 0 && index < _count) {
+    _devices[index].fault = fault;
+  }
+}
+
+bool FakeOneWireBus::getAddress(uint8_t* address, uint8_t index) const {
+  if (index >= _count) {
+    return false;
+  }
+  memcpy(address, _devices[index].address, 8);
+  return true;
+}
+
+bool FakeOneWireBus::validAddress(const uint8_t* address) const {
+  return oneWireCrc8(address, 7) == address[7];
+}
+
+void FakeOneWireBus::requestTemperatures() {
+  conversions++;
+  for (int i = 0; i < _count; i++) {
+    Device& d = _devices[i];
+    switch (d.fault) {
+      case FAKE_SENSOR_POWER_ON:
+        d.scratchpad = 85.0;
+        break;
+      case FAKE_SENSOR_STUCK_ZERO:
+        d.scratchpad = 0.0;
+        break;
+      default:
+        d.scratchpad = roundf(d.temperature * 16.0f) / 16.0f;  // 12 бит: шаг 0.0625°C
+        break;
+    }
+  }
+}
+
+float FakeOneWireBus::getTempC(const uint8_t* address) const {
+  for (int i = 0; i < _count; i++) {
+    const Device& d = _devices[i];
+    if (memcmp(d.address, address, 8) == 0) {
+      return d.fault == FAKE_SENSOR_DISCONNECTED ? DEVICE_DISCONNECTED_C : d.scratchpad;
+    }
+  }
+  return DEVICE_DISCONNECTED_C;
+}
+
+// ============ MQTT ============
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_PINGREQ 0xC0
+#define MQTT_DISCONNECT 0xE0
+
+// Длина "remaining length" в формате MQTT; 0 - не влезла
+static size_t encodeLength(uint8_t* out, size_t length) {
+  size_t n = 0;
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) {
+      digit |= 0x80;
+    }
+    out[n++] = digit;
+  } while (length > 0 && n < 4);
+  return length > 0 ? 0 : n;
+}
+
+static size_t putString(uint8_t* out, const char* s, size_t len) {
+  out[0] = (uint8_t)(len >> 8);
+  out[1] = (uint8_t)len;
+  memcpy(out + 2, s, len);
+  return len + 2;
+}
+
+void HostMqttClient::setServer(const char* host, uint16_t port) {
+  snprintf(_host, sizeof(_host), "%s", host);
+  _port = port;
+}
+
+bool HostMqttClient::sendPacket(uint8_t header, const uint8_t* body, size_t length) {
+  if (_fd < 0) {
+    return false;
+  }
+  uint8_t head[5];
+  head[0] = header;
+  size_t headLen = encodeLength(head + 1, length);
+  if (headLen == 0) {
+    return false;
+  }
+  // Сокет блокирующий: пакеты стенда короткие
+  if (send(_fd, head, headLen + 1, MSG_NOSIGNAL) != (ssize_t)(headLen + 1) ||
+      (length > 0 && send(_fd, body, length, MSG_NOSIGNAL) != (ssize_t)length)) {
+    disconnect();
+    return false;
+  }
+  _lastOutbound = hostRealMillis();
+  return true;
+}
+
+bool HostMqttClient::connect(const char* clientId) {
+  disconnect();
+  char port[8];
+  snprintf(port, sizeof(port), "%u", _port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* res = nullptr;
+  if (getaddrinfo(_host, port, &hints, &res) != 0 || res == nullptr) {
+    return false;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0 || ::connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+    if (fd >= 0) close(fd);
+    freeaddrinfo(res);
+    return false;
+  }
+  freeaddrinfo(res);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  _fd = fd;
+  _rxLen = 0;
+
+  uint8_t body[128];
+  size_t n = putString(body, "MQTT", 4);
+  body[n++] = 4;     // Уровень протокола 3.1.1
+  body[n++] = 0x02;  // Clean session
+  body[n++] = 0;
+  body[n++] = HOST_MQTT_KEEPALIVE_S;
+  size_t idLen = strlen(clientId);
+  if (idLen > sizeof(body) - n - 2) {
+    idLen = sizeof(body) - n - 2;
+  }
+  n += putString(body + n, clientId, idLen);
+  if (!sendPacket(MQTT_CONNECT, body, n)) {
+    return false;
+  }
+
+  // CONNACK: 0x20 0x02 flags rc
+  struct pollfd pfd = {_fd, POLLIN, 0};
+  uint8_t ack[4];
+  size_t got = 0;
+  while (got < sizeof(ack) && poll(&pfd, 1, 3000) > 0) {
+    ssize_t r = recv(_fd, ack + got, sizeof(ack) - got, 0);
+    if (r <= 0) {
+      break;
+    }
+    got += (size_t)r;
+  }
+  if (got < sizeof(ack) || ack[0] != MQTT_CONNACK || ack[3] != 0) {
+    disconnect();
+    return false;
+  }
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+  return true;
+}
+
+void HostMqttClient::disconnect() {
+  if (_fd >= 0) {
+    uint8_t head[2] = {MQTT_DISCONNECT, 0};
+    send(_fd, head, sizeof(head), MSG_NOSIGNAL);
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+bool HostMqttClient::subscribe(const char* topic) {
+  uint8_t body[HOST_MQTT_BUFFER];
+  size_t len = strlen(topic);
+  if (len + 5 > sizeof(body)) {
+    return false;
+  }
+  uint16_t id = _packetId++;
+  body[0] = (uint8_t)(id >> 8);
+  body[1] = (uint8_t)id;
+  size_t n = 2 + putString(body + 2, topic, len);
+  body[n++] = 0;  // QoS 0
+  return sendPacket(MQTT_SUBSCRIBE, body, n);
+}
+
+bool HostMqttClient::publish(const char* topic, const uint8_t* payload, size_t length, bool retain) {
+  uint8_t body[HOST_MQTT_BUFFER];
+  size_t topicLen = strlen(topic);
+  if (topicLen + 2 + length > sizeof(body)) {
+    return false;
+  }
+  size_t n = putString(body, topic, topicLen);
+  memcpy(body + n, payload, length);
+  if (!sendPacket(MQTT_PUBLISH | (retain ? 0x01 : 0), body, n + length)) {
+    return false;
+  }
+  sent++;
+  return true;
+}
+
+bool HostMqttClient::handlePacket(uint8_t header, uint8_t* body, size_t length) {
+  if ((header & 0xF0) != MQTT_PUBLISH || length < 2) {
+    return true;  // SUBACK, PINGRESP - не нужны
+  }
+  size_t topicLen = ((size_t)body[0] << 8) | body[1];
+  size_t offset = 2 + topicLen;
+  if ((header & 0x06) != 0) {
+    offset += 2;  // QoS > 0: идентификатор пакета (подписка на QoS 0, но брокер может прислать)
+  }
+  if (offset > length) {
+    return false;
+  }
+  // Топик завершаем нулем на месте: первый байт длины уже прочитан
+  char* topic = (char*)body + 1;
+  memmove(topic, body + 2, topicLen);
+  topic[topicLen] = '\0';
+  received++;
+  if (_callback != nullptr) {
+    _callback(topic, body + offset, (unsigned int)(length - offset));
+  }
+  return true;
+}
+
+bool HostMqttClient::loop() {
+  if (_fd < 0) {
+    return false;
+  }
+  ssize_t r = recv(_fd, _rx + _rxLen, sizeof(_rx) - _rxLen, 0);
+  if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    disconnect();
+    return false;
+  }
+  if (r > 0) {
+    _rxLen += (size_t)r;
+  }
+  // Разбор всех целых пакетов в буфере
+  while (_rxLen >= 2) {
+    size_t length = 0;
+    size_t multiplier = 1;
+    size_t pos = 1;
+    bool complete = false;
+    while (pos < _rxLen && pos <= 4) {
+      uint8_t digit = _rx[pos++];
+      length += (digit & 0x7F) * multiplier;
+      multiplier *= 128;
+      if ((digit & 0x80) == 0) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      break;
+    }
+    if (pos + length > sizeof(_rx)) {
+      disconnect();  // Пакет больше буфера стенда
+      return false;
+    }
+    if (_rxLen < pos + length) {
+      break;
+    }
+    if (!handlePacket(_rx[0], _rx + pos, length)) {
+      disconnect();
+      return false;
+    }
+    memmove(_rx, _rx + pos + length, _rxLen - pos - length);
+    _rxLen -= pos + length;
+  }
+  if (hostRealMillis() - _lastOutbound > HOST_MQTT_KEEPALIVE_S * 1000UL / 2) {
+    sendPacket(MQTT_PINGREQ, nullptr, 0);
+  }
+  return connected();
+}
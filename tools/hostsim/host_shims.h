@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Заглушки окружения ESP32 для хостовых сборок tools/hostsim: прошивочная
+// логика (lib/BoilerControl, SensorFilter, MqttCommands) работает поверх них
+// без Arduino.
+//  - виртуальные часы millis()/micros(): время двигает сам стенд, поэтому
+//    неделя работы контроллера проходит за секунды, а таймеры управления
+//    идут в том же масштабе, что и модель котла;
+//  - EEPROM в памяти (с необязательным файлом-образом);
+//  - шина OneWire с DS18B20: адреса с CRC, 12-битная дискретизация,
+//    неисправности "отвалился" (-127), "сброс питания" (85) и "зависание" (0);
+//  - клиент MQTT 3.1.1 поверх POSIX-сокета (QoS 0), интерфейс как у PubSubClient.
+
+// ============ Виртуальные часы ============
+unsigned long millis();
+unsigned long micros();
+void hostClockAdvance(unsigned long ms);
+uint64_t hostClockMicros();  // Без переполнения (для стенда)
+
+// Реальные монотонные часы - для сети (keep-alive брокера идет в реальном времени)
+unsigned long hostRealMillis();
+
+// ============ EEPROM ============
+class HostEeprom {
+ public:
+  // Как EEPROM.begin на ESP32: содержимое сохраняется между begin/end
+  bool begin(size_t size);
+  void end() {}
+  bool commit();
+  uint8_t read(int address) const;
+  void write(int address, uint8_t value);
+  size_t length() const { return _size; }
+
+  template <typename T>
+  T& get(int address, T& value) const {
+    if (address >= 0 && address + sizeof(T) <= _size) {
+      memcpy(&value, _data + address, sizeof(T));
+    }
+    return value;
+  }
+  template <typename T>
+  const T& put(int address, const T& value) {
+    if (address >= 0 && address + sizeof(T) <= _size) {
+      memcpy(_data + address, &value, sizeof(T));
+    }
+    return value;
+  }
+
+  // Образ EEPROM на диске: читается при open, пишется при каждом commit()
+  bool open(const char* path);
+
+  uint32_t commitCount = 0;
+
+ private:
+  uint8_t* _data = nullptr;
+  size_t _size = 0;
+  const char* _path = nullptr;
+};
+
+extern HostEeprom EEPROM;
+
+// ============ OneWire / DS18B20 ============
+typedef uint8_t DeviceAddress[8];
+#define DEVICE_DISCONNECTED_C -127.0
+#define HOST_ONEWIRE_MAX_DEVICES 8
+
+enum FakeSensorFault : uint8_t {
+  FAKE_SENSOR_OK = 0,
+  FAKE_SENSOR_DISCONNECTED,  // Не отвечает на шине: -127
+  FAKE_SENSOR_POWER_ON,      // Сброс питания: 85.0 до следующей конвертации
+  FAKE_SENSOR_STUCK_ZERO     // Зависание: 0.0
+};
+
+// Шина с датчиками DS18B20; API - часть DallasTemperature, которую зовет прошивка
+class FakeOneWireBus {
+ public:
+  // Адрес - 16 hex-символов, как в sensorMapping ("28FF1A2B3C4D5E01");
+  // байт CRC пересчитывается. -1 - шина заполнена или адрес неверный
+  int addDevice(const char* hex);
+  void setTemperature(int index, float celsius);
+  void setFault(int index, FakeSensorFault fault);
+
+  uint8_t getDeviceCount() const { return _count; }
+  bool getAddress(uint8_t* address, uint8_t index) const;
+  // Как в DallasTemperature: только проверка CRC адреса
+  bool validAddress(const uint8_t* address) const;
+  // Фиксирует текущие температуры (конвертация 750 мс - ее выжидает прошивка)
+  void requestTemperatures();
+  float getTempC(const uint8_t* address) const;
+
+  uint32_t conversions = 0;
+
+ private:
+  struct Device {
+    DeviceAddress address;
+    float temperature;
+    float scratchpad;  // Результат последней конвертации
+    FakeSensorFault fault;
+  };
+  Device _devices[HOST_ONEWIRE_MAX_DEVICES];
+  uint8_t _count = 0;
+};
+
+uint8_t oneWireCrc8(const uint8_t* data, size_t len);
+// "28FF..." -> 8 байт; false - не 16 hex-символов
+bool parseDeviceAddress(const char* hex, uint8_t* address);
+
+// ============ MQTT ============
+#define HOST_MQTT_BUFFER 1024
+#define HOST_MQTT_KEEPALIVE_S 15
+
+class HostMqttClient {
+ public:
+  typedef void (*Callback)(char* topic, uint8_t* payload, unsigned int length);
+
+  void setServer(const char* host, uint16_t port);
+  void setCallback(Callback callback) { _callback = callback; }
+  // Блокирующее подключение (на хосте это допустимо), CONNACK ждем до 3 с
+  bool connect(const char* clientId);
+  bool connected() const { return _fd >= 0; }
+  void disconnect();
+  bool subscribe(const char* topic);
+  bool publish(const char* topic, const uint8_t* payload, size_t length, bool retain = false);
+  bool publish(const char* topic, const char* payload, bool retain = false) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), retain);
+  }
+  // Прием входящих PUBLISH и PINGREQ по keep-alive; false - соединение потеряно
+  bool loop();
+
+  uint32_t received = 0;
+  uint32_t sent = 0;
+
+ private:
+  bool sendPacket(uint8_t header, const uint8_t* body, size_t length);
+  bool handlePacket(uint8_t header, uint8_t* body, size_t length);
+
+  char _host[64] = "";
+  uint16_t _port = 1883;
+  int _fd = -1;
+  Callback _callback = nullptr;
+  uint16_t _packetId = 1;
+  unsigned long _lastOutbound = 0;
+  uint8_t _rx[HOST_MQTT_BUFFER];
+  size_t _rxLen = 0;
+};
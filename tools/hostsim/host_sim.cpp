@@ -0,0 +1,312 @@
+// Хостовая сборка контроллера котла для Linux (g++): логика управления из
+// lib/BoilerControl - та же, что в прошивке, - работает поверх заглушек
+// host_shims.h: виртуальные часы millis()/micros(), EEPROM в памяти (или в
+// файле-образе), шина OneWire с DS18B20, HTTP на NbHttpServer (POSIX-сокеты)
+// и клиент MQTT. Температуры на шине задает модель котла BoilerSim, ESP01
+// с температурой дома - сам стенд (локально или через брокер), см. host_plant.h.
+//
+// Сборка (из корня репозитория, одной командой):
+//   g++ -std=c++17 -O2 -Wall -Wextra -Ilib/BoilerControl -Ilib/BoilerCommands -Ilib/BoilerSim
+//       -Ilib/SensorFilter -Ilib/MqttCommands -Ilib/MqttMessages -Ilib/PayloadWriter -Ilib/NbHttpServer
+//       -Itools/hostsim -o host_sim tools/hostsim/host_sim.cpp tools/hostsim/host_firmware.cpp
+//       tools/hostsim/host_plant.cpp tools/hostsim/host_shims.cpp lib/BoilerControl/BoilerControl.cpp
+//       lib/BoilerCommands/BoilerCommands.cpp lib/BoilerCommands/SettingsLimits.cpp lib/BoilerSim/BoilerSim.cpp
+//       lib/SensorFilter/SensorFilter.cpp
+//       lib/MqttCommands/MqttCommands.cpp lib/MqttMessages/MqttMessages.cpp lib/PayloadWriter/PayloadWriter.cpp
+//       lib/NbHttpServer/NbHttpServer.cpp lib/NbHttpServer/NbSocket.cpp
+// Запуск:
+//   ./host_sim [--speed 60] [--hours 0] [--port 8080] [--mqtt host:port] [--prefix kotel]
+//              [--mode auto|comfort] [--eeprom eeprom.bin] [--verbose]
+// --speed - во сколько раз виртуальное время быстрее реального (0 - без
+// ожидания), --hours - остановиться через столько виртуальных часов
+// (0 - работать до Ctrl+C). HTTP: GET /api/status, GET/POST /api/system/mode
+// ({"mode":1}), POST /api/system/ignition, GET/POST /api/coalFeeding,
+// POST /api/setpoint?value=60. MQTT: команды из MQTT_COMMANDS, <prefix>/state
+// раз в 30 с виртуального времени.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+
+#include "BoilerSim.h"
+#include "MqttMessages.h"
+#include "NbHttpServer.h"
+#include "NbSocket.h"
+#include "host_firmware.h"
+#include "host_plant.h"
+
+#define SIM_LOOP_STEP_MS 10             // Шаг виртуальных часов за проход loop()
+#define SIM_STATE_INTERVAL 30000        // <prefix>/state
+#define SIM_MQTT_RETRY_MS 5000          // Реальное время между попытками подключения
+
+static BoilerSim plant;
+static NbHttpServer* server = nullptr;
+static char prefix[MQTT_COMMAND_PREFIX_MAX + 1] = "kotel";
+static volatile bool stopRequested = false;
+
+static const MqttEnumNames ENUM_NAMES = {
+  &SYSTEM_STATES[0].apiName, sizeof(SystemStateInfo), SYSTEM_STATE_COUNT,
+  COMFORT_STATE_NAMES, COMFORT_STATE_COUNT
+};
+
+static void captureSnapshot(MqttSnapshot& s) {
+  memset(&s, 0, sizeof(s));
+  s.names = &ENUM_NAMES;
+  s.supplyTemp = supplyTemp;
+  s.returnTemp = returnTemp;
+  s.boilerTemp = boilerTemp;
+  s.outdoorTemp = outdoorTemp;
+  s.homeTemp = homeTemp;
+  s.setpoint = autoSettings.setpoint;
+  s.fan = fanState;
+  s.pump = pumpState;
+  s.systemEnabled = systemEnabled;
+  s.systemState = systemState;
+  s.workMode = workMode;
+  s.homeTempSensorLWTOnline = homeTempSensorLWTOnline;
+  s.comfortState = comfortState;
+  s.targetHomeTemp = comfortSettings.targetHomeTemp;
+  s.autoSetpoint = autoSettings.setpoint;
+  s.minTemp = autoSettings.minTemp;
+  s.maxTemp = autoSettings.maxTemp;
+  s.hysteresis = autoSettings.hysteresis;
+  s.inertiaTemp = autoSettings.inertiaTemp;
+  s.inertiaTime = autoSettings.inertiaTime;
+  s.overheatTemp = autoSettings.overheatTemp;
+  s.heatingTimeout = autoSettings.heatingTimeout;
+  s.coalFeedingActive = coalFeedingActive;
+  s.uptimeSec = millis() / 1000;
+  snprintf(s.wifiSSID, sizeof(s.wifiSSID), "host");
+  snprintf(s.wifiIP, sizeof(s.wifiIP), "127.0.0.1");
+  snprintf(s.wifiMAC, sizeof(s.wifiMAC), "00:00:00:00:00:00");
+  s.sensorCountBus1 = sensors1.getDeviceCount();
+  s.sensorCountBus2 = sensors2.getDeviceCount();
+  s.mqttConnected = mqttClient.connected();
+}
+
+// ============ HTTP ============
+static void handleStatus() {
+  MqttSnapshot s;
+  captureSnapshot(s);
+  uint8_t buf[1024];
+  size_t len = buildMqttPayload(PAYLOAD_JSON, buf, sizeof(buf), writeStatePayload, s);
+  server->send(200, "application/json", std::string((const char*)buf, len));
+}
+
+static void handleWorkModeGet() {
+  char json[48];
+  snprintf(json, sizeof(json), "{\"mode\":%d}", workMode);
+  server->send(200, "application/json", json);
+}
+
+// Тело {"mode":1} - разбор без JSON-библиотеки, как узкий случай прошивки
+static void handleWorkModePost() {
+  std::string body = server->arg("plain");
+  size_t key = body.find("\"mode\"");
+  size_t colon = key == std::string::npos ? key : body.find(':', key);
+  if (colon == std::string::npos) {
+    server->send(400, "application/json", "{\"error\":\"Missing mode parameter\"}");
+    return;
+  }
+  int mode = atoi(body.c_str() + colon + 1);
+  if (mode != 0 && mode != 1) {
+    server->send(400, "application/json", "{\"error\":\"Invalid mode\"}");
+    return;
+  }
+  if (!applyWorkMode(mode, millis())) {
+    server->send(400, "application/json", "{\"error\":\"Home temperature sensor offline. Cannot switch to Comfort mode.\"}");
+    return;
+  }
+  requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+  char json[48];
+  snprintf(json, sizeof(json), "{\"success\":true,\"mode\":%d}", workMode);
+  server->send(200, "application/json", json);
+}
+
+static void handleIgnition() {
+  if (requestIgnition(millis())) {
+    requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+    server->send(200, "application/json", "{\"success\":true,\"message\":\"Розжиг запущен\"}");
+  } else {
+    server->send(400, "application/json", "{\"success\":false,\"message\":\"Розжиг недоступен. Котел не погас.\"}");
+  }
+}
+
+static void handleCoalFeeding() {
+  if (server->method() == HTTP_POST) {
+    if (coalFeedingActive) {
+      stopCoalFeeding();
+    } else {
+      startCoalFeeding(millis());
+    }
+    requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+  }
+  char json[48];
+  snprintf(json, sizeof(json), "{\"coalFeeding\":%s}", coalFeedingActive ? "true" : "false");
+  server->send(200, "application/json", json);
+}
+
+static void handleSetpoint() {
+  float value = atof(server->arg("value").c_str());
+  if (workMode == 1 || !settingNumberAllowed(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), "setpoint", value)) {
+    server->send(400, "application/json", "{\"error\":\"Invalid value\"}");
+    return;
+  }
+  AutoSettings old = autoSettings;
+  autoSettings.setpoint = value;
+  onAutoSettingsChanged(old);
+  requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+  char json[64];
+  snprintf(json, sizeof(json), "{\"success\":true,\"setpoint\":%.1f}", value);
+  server->send(200, "application/json", json);
+}
+
+// ============ MQTT ============
+static void mqttMaintain() {
+  static unsigned long lastAttempt = 0;
+  if (mqttClient.connected()) {
+    return;
+  }
+  unsigned long real = hostRealMillis();
+  if (lastAttempt != 0 && real - lastAttempt < SIM_MQTT_RETRY_MS) {
+    return;
+  }
+  lastAttempt = real;
+  if (!mqttClient.connect("kotel-host")) {
+    fprintf(stderr, "[MQTT] Брокер недоступен\n");
+    return;
+  }
+  char topic[128];
+  for (size_t i = 0; i < mqttCommands.size(); i++) {
+    if (mqttCommands.topic(i, topic, sizeof(topic))) {
+      mqttClient.subscribe(topic);
+    }
+  }
+  fprintf(stderr, "[MQTT] Подключено, подписок: %u\n", (unsigned)mqttCommands.size());
+}
+
+static void publishState() {
+  MqttSnapshot s;
+  captureSnapshot(s);
+  uint8_t buf[HOST_MQTT_BUFFER - 64];
+  size_t len = buildMqttPayload(PAYLOAD_JSON, buf, sizeof(buf), writeStatePayload, s);
+  char topic[96];
+  snprintf(topic, sizeof(topic), "%s/state", prefix);
+  if (len > 0) {
+    mqttClient.publish(topic, buf, len);
+  }
+}
+
+static void onSignal(int) {
+  stopRequested = true;
+}
+
+int main(int argc, char** argv) {
+  double speed = 60.0;
+  double hours = 0.0;
+  uint16_t port = 8080;
+  const char* mqttServer = nullptr;
+  const char* eepromPath = nullptr;
+  int startMode = -1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      speed = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--hours") == 0 && i + 1 < argc) {
+      hours = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      port = (uint16_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mqtt") == 0 && i + 1 < argc) {
+      mqttServer = argv[++i];
+    } else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+      snprintf(prefix, sizeof(prefix), "%s", argv[++i]);
+    } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+      startMode = strcmp(argv[++i], "comfort") == 0 ? 1 : 0;
+    } else if (strcmp(argv[i], "--eeprom") == 0 && i + 1 < argc) {
+      eepromPath = argv[++i];
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      hostVerbose = true;
+    } else {
+      fprintf(stderr, "usage: %s [--speed 60] [--hours 0] [--port 8080] [--mqtt host:port] [--prefix kotel]\n"
+                      "          [--mode auto|comfort] [--eeprom eeprom.bin] [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  if (eepromPath != nullptr) {
+    EEPROM.open(eepromPath);
+  }
+  hostFirmwareSetup(prefix);
+  if (mqttServer != nullptr) {
+    std::string hostPort = mqttServer;
+    size_t colon = hostPort.find(':');
+    uint16_t mqttPort = colon == std::string::npos ? 1883 : (uint16_t)atoi(hostPort.c_str() + colon + 1);
+    mqttClient.setServer(hostPort.substr(0, colon).c_str(), mqttPort);
+  }
+
+  // Первые показания до старта управления, иначе первый пересчет увидит 0°C
+  hostPlantBegin(plant, BoilerSimParams());
+
+  static NbHttpServer httpServer(port);
+  server = &httpServer;
+  server->on("/api/status", HTTP_GET, handleStatus);
+  server->on("/api/system/mode", HTTP_GET, handleWorkModeGet);
+  server->on("/api/system/mode", HTTP_POST, handleWorkModePost);
+  server->on("/api/system/ignition", HTTP_POST, handleIgnition);
+  server->on("/api/coalFeeding", HTTP_GET, handleCoalFeeding);
+  server->on("/api/coalFeeding", HTTP_POST, handleCoalFeeding);
+  server->on("/api/setpoint", HTTP_POST, handleSetpoint);
+  server->onNotFound([]() { server->send(404, "text/plain", "Not Found"); });
+  if (port != 0) {
+    server->begin();
+    fprintf(stderr, "[Host] HTTP на порту %u, скорость x%.0f\n", port, speed);
+  }
+
+  unsigned long limitMs = (unsigned long)(hours * 3600000.0);
+  unsigned long realStart = hostRealMillis();
+  unsigned long lastState = 0;
+  bool modeApplied = startMode < 0;
+  while (!stopRequested && (limitMs == 0 || millis() < limitMs)) {
+    if (port != 0) {
+      server->handleClient();
+    }
+    if (mqttServer != nullptr) {
+      mqttMaintain();
+    }
+    hostPlantStep(plant, SIM_LOOP_STEP_MS, mqttServer != nullptr);
+    hostFirmwareLoop();
+    // Режим из командной строки - когда ESP01 уже сообщил о себе (Комфорт требует датчик дома)
+    if (!modeApplied && homeTempSensorLWTOnline) {
+      modeApplied = applyWorkMode(startMode, millis());
+    }
+    if (mqttClient.connected() && millis() - lastState >= SIM_STATE_INTERVAL) {
+      lastState = millis();
+      publishState();
+    }
+
+    hostClockAdvance(SIM_LOOP_STEP_MS);
+    if (speed > 0) {
+      // Виртуальное время не обгоняет реальное больше чем в speed раз
+      unsigned long due = realStart + (unsigned long)(millis() / speed);
+      while (hostRealMillis() < due && !stopRequested) {
+        nbYield();
+      }
+    }
+  }
+
+  const BoilerSimState& s = plant.state();
+  printf("Виртуальное время: %.2f ч\n", millis() / 3600000.0);
+  printf("Пересчетов управления: %lu, решений: %lu, циклов вентилятора: %u\n",
+         controlEvaluations, controlDecisions, fanCycleCount);
+  printf("Состояние: %s / %s, вентилятор %d, насос %d\n", SYSTEM_STATES[systemState].apiName,
+         COMFORT_STATE_NAMES[comfortState], fanState ? 1 : 0, pumpState ? 1 : 0);
+  printf("Подача %.1f°C, дом %.1f°C, улица %.1f°C, сожжено угля %.1f кг\n",
+         supplyTemp, homeTemp, outdoorTemp, s.coalBurnedKg);
+  printf("Конвертаций DS18B20: %u, записей EEPROM: %u, MQTT: отправлено %u, принято %u\n",
+         sensors1.conversions, EEPROM.commitCount, mqttClient.sent, mqttClient.received);
+  return 0;
+}
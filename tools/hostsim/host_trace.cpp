@@ -0,0 +1,103 @@
+#include "host_trace.h"
+
+#include <string.h>
+
+#include "host_firmware.h"
+
+bool HostTraceFile::open(const char* path) {
+  close();
+  _file = fopen(path, "wb");
+  return _file != nullptr;
+}
+
+void HostTraceFile::close() {
+  if (_file != nullptr) {
+    fclose(_file);
+    _file = nullptr;
+  }
+}
+
+void HostTraceFile::record(TraceType type, const uint8_t* data, size_t len) {
+  TraceChunker chunker(type, data, len);
+  writeChunks(chunker);
+}
+
+void HostTraceFile::recordPair(TraceType type, const char* first, const char* second, size_t secondLen) {
+  TraceChunker chunker(type, (const uint8_t*)first, strlen(first) + 1, (const uint8_t*)second, secondLen);
+  writeChunks(chunker);
+}
+
+void HostTraceFile::writeChunks(TraceChunker& chunker) {
+  if (_file == nullptr) {
+    return;
+  }
+  uint8_t buf[TRACE_RECORD_HEADER + TRACE_MAX_PAYLOAD];
+  uint32_t now = millis();
+  size_t written;
+  while ((written = chunker.next(buf, now)) > 0) {
+    bytes += fwrite(buf, 1, written, _file);
+  }
+  recordCount++;
+}
+
+bool hostTraceLoad(const char* path, std::vector<HostTraceEntry>& entries, uint32_t& orphans) {
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  fclose(f);
+
+  entries.clear();
+  orphans = 0;
+  size_t pos = 0;
+  TraceRecord record;
+  while (traceDecodeRecord(buf.data(), buf.size(), pos, record)) {
+    if (record.type == TRACE_CONTINUATION) {
+      if (entries.empty()) {
+        orphans++;
+      } else {
+        entries.back().data.append((const char*)record.data, record.length);
+      }
+      continue;
+    }
+    entries.push_back({record.ms, record.type, std::string((const char*)record.data, record.length)});
+  }
+  return true;
+}
+
+static HostTraceFile* attachedTrace = nullptr;
+
+static void traceSensors(unsigned long now, const int16_t raw[4]) {
+  (void)now;
+  attachedTrace->record(TRACE_SENSORS, (const uint8_t*)raw, 4 * sizeof(int16_t));
+}
+
+static void traceMqttIn(unsigned long now, const char* topic, const uint8_t* payload, unsigned int length) {
+  (void)now;
+  attachedTrace->recordPair(TRACE_MQTT_IN, topic, (const char*)payload, length);
+}
+
+static void traceDecision(unsigned long now, uint8_t trigger) {
+  (void)now;
+  uint8_t payload[5] = {trigger, (uint8_t)fanState, (uint8_t)pumpState, (uint8_t)systemState, (uint8_t)comfortState};
+  attachedTrace->record(TRACE_CONTROL, payload, sizeof(payload));
+}
+
+static void traceState(unsigned long now, const char* kind, const char* name) {
+  (void)now;
+  attachedTrace->recordPair(TRACE_STATE, kind, name, strlen(name));
+}
+
+void hostTraceAttach(HostTraceFile* trace) {
+  attachedTrace = trace;
+  hostHooks.sensors = trace != nullptr ? traceSensors : nullptr;
+  hostHooks.mqttIn = trace != nullptr ? traceMqttIn : nullptr;
+  hostHooks.decision = trace != nullptr ? traceDecision : nullptr;
+  hostHooks.state = trace != nullptr ? traceState : nullptr;
+}
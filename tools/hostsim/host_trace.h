@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "TraceFormat.h"
+
+// Трасса стенда в файл - в формате TraceRecorder прошивки (TraceFormat.h),
+// поэтому ее читают те же tools/trace_decode.py и tools/hostsim/trace_replay.
+// Время записей - millis() виртуальных часов.
+class HostTraceFile {
+ public:
+  bool open(const char* path);
+  void close();
+  bool isOpen() const { return _file != nullptr; }
+
+  void record(TraceType type, const uint8_t* data, size_t len);
+  void recordPair(TraceType type, const char* first, const char* second, size_t secondLen);
+
+  uint32_t recordCount = 0;
+  uint32_t bytes = 0;
+
+ private:
+  void writeChunks(TraceChunker& chunker);
+
+  FILE* _file = nullptr;
+};
+
+// Запись трассы с собранными продолжениями
+struct HostTraceEntry {
+  uint32_t ms;
+  uint8_t type;
+  std::string data;
+
+  // Для пар (MQTT, HTTP): первая и вторая строки
+  std::string first() const { return data.substr(0, data.find('\0')); }
+  std::string second() const {
+    size_t zero = data.find('\0');
+    return zero == std::string::npos ? std::string() : data.substr(zero + 1);
+  }
+};
+
+// Трасса из файла целиком (с устройства - GET /api/trace, или со стенда).
+// Продолжение без начала (начало осталось в перезаписанном файле кольца)
+// пропускается; orphans - сколько таких
+bool hostTraceLoad(const char* path, std::vector<HostTraceEntry>& entries, uint32_t& orphans);
+
+// Подключает файл к hostHooks: TRACE_SENSORS, TRACE_MQTT_IN, TRACE_CONTROL и
+// TRACE_STATE пишутся там же, где их пишет прошивка. TRACE_BOOT с режимом
+// работы пишет стенд после hostFirmwareSetup()
+void hostTraceAttach(HostTraceFile* trace);
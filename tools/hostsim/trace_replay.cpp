@@ -0,0 +1,518 @@
+// Воспроизведение трассы контроллера на хосте и сравнение решений.
+// Входы из трассы - показания датчиков (TRACE_SENSORS), входящие MQTT и
+// HTTP-команды - подаются в lib/BoilerControl на виртуальных часах в те же
+// моменты millis(), а решения управления (TRACE_CONTROL) сравниваются с
+// записанными: вентилятор, насос, systemState и comfortState в пределах
+// --tolerance мс. Так проверяется, что правка логики не меняет поведение на
+// реальной трассе с объекта (GET /api/trace) или на прогоне week_run.
+//
+// Трасса с устройства начинается с середины работы (кольцо перезаписывается),
+// поэтому начальное состояние контроллера неизвестно: первые решения могут
+// расходиться - для этого --warmup. Перезагрузка (TRACE_BOOT) делит трассу на
+// отрезки, воспроизводится один (--segment, по умолчанию последний).
+//
+// Режим работы берется из трассы: TRACE_BOOT хранит режим на момент начала
+// записи, TRACE_STATE "mode" - его смены. Для старых трасс без режима
+// --mode включается после первого "online" датчика дома, как в week_run:
+// без него Комфорт сразу откатывается в Авто.
+//
+// Сборка (из корня репозитория, одной командой):
+//   g++ -std=c++17 -O2 -Wall -Wextra -Ilib/BoilerControl -Ilib/BoilerCommands -Ilib/SensorFilter
+//       -Ilib/MqttCommands -Ilib/MqttMessages -Ilib/PayloadWriter -Ilib/TraceRecorder -Itools/hostsim
+//       -o trace_replay tools/hostsim/trace_replay.cpp tools/hostsim/host_firmware.cpp
+//       tools/hostsim/host_shims.cpp tools/hostsim/host_trace.cpp lib/BoilerControl/BoilerControl.cpp
+//       lib/BoilerCommands/BoilerCommands.cpp lib/BoilerCommands/SettingsLimits.cpp
+//       lib/SensorFilter/SensorFilter.cpp lib/MqttCommands/MqttCommands.cpp
+//       lib/MqttMessages/MqttMessages.cpp lib/PayloadWriter/PayloadWriter.cpp lib/TraceRecorder/TraceFormat.cpp
+// Запуск:
+//   ./trace_replay trace.bin [--prefix kotel] [--mode auto|comfort (если в трассе нет)] [--setpoint 60]
+//                  [--segment N] [--tolerance 1000] [--warmup 0] [--max-diffs 20]
+//                  [--out replay.bin] [--verbose]
+// Код выхода: 0 - решения совпали, 1 - есть расхождения, 2 - ошибка.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "host_firmware.h"
+#include "host_trace.h"
+
+#define REPLAY_LOOP_STEP_MS 10  // Шаг виртуальных часов между записями
+#define REPLAY_DISCONNECTED_RAW -12700  // -127 °C в сотых
+
+// Решение управления из трассы или воспроизведения
+struct Decision {
+  uint32_t ms;
+  uint8_t trigger;
+  uint8_t fan;
+  uint8_t pump;
+  uint8_t systemState;
+  uint8_t comfortState;
+};
+
+static std::vector<Decision> replayed;
+static HostTraceFile outTrace;
+static uint32_t httpApplied = 0;
+static uint32_t httpSkipped = 0;
+
+static void onReplayDecision(unsigned long now, uint8_t trigger) {
+  Decision d = {(uint32_t)now, trigger, (uint8_t)fanState, (uint8_t)pumpState, (uint8_t)systemState,
+                (uint8_t)comfortState};
+  replayed.push_back(d);
+  if (outTrace.isOpen()) {
+    uint8_t payload[5] = {d.trigger, d.fan, d.pump, d.systemState, d.comfortState};
+    outTrace.record(TRACE_CONTROL, payload, sizeof(payload));
+  }
+}
+
+static void onReplaySensors(unsigned long now, const int16_t raw[4]) {
+  (void)now;
+  outTrace.record(TRACE_SENSORS, (const uint8_t*)raw, 4 * sizeof(int16_t));
+}
+
+static void onReplayState(unsigned long now, const char* kind, const char* name) {
+  (void)now;
+  outTrace.recordPair(TRACE_STATE, kind, name, strlen(name));
+}
+
+static void onReplayMqttIn(unsigned long now, const char* topic, const uint8_t* payload, unsigned int length) {
+  (void)now;
+  outTrace.recordPair(TRACE_MQTT_IN, topic, (const char*)payload, length);
+}
+
+// ============ Разбор тел HTTP-команд (без JSON-библиотеки) ============
+// Число (или true/false) поля key в JSON; вложенные объекты не различаются -
+// для плоских тел настроек этого достаточно
+static bool jsonNumber(const std::string& json, const char* key, float& out) {
+  std::string quoted = std::string("\"") + key + "\"";
+  size_t pos = json.find(quoted);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  pos = json.find(':', pos + quoted.size());
+  if (pos == std::string::npos) {
+    return false;
+  }
+  const char* p = json.c_str() + pos + 1;
+  while (*p == ' ') {
+    p++;
+  }
+  if (strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0) {
+    out = *p == 't' ? 1.0f : 0.0f;
+    return true;
+  }
+  char* end;
+  out = strtof(p, &end);
+  return end != p;
+}
+
+// Вложенный объект "key":{...} (для POST /api/settings/all); пустая строка - нет
+static std::string jsonObject(const std::string& json, const char* key) {
+  std::string quoted = std::string("\"") + key + "\"";
+  size_t pos = json.find(quoted);
+  if (pos == std::string::npos) {
+    return std::string();
+  }
+  size_t start = json.find('{', pos + quoted.size());
+  if (start == std::string::npos) {
+    return std::string();
+  }
+  int depth = 0;
+  for (size_t i = start; i < json.size(); i++) {
+    if (json[i] == '{') {
+      depth++;
+    } else if (json[i] == '}' && --depth == 0) {
+      return json.substr(start, i - start + 1);
+    }
+  }
+  return std::string();
+}
+
+// Параметр тела формы "a=1&b=2" (так traceHttpCommand() записывает аргументы)
+static bool formArg(const std::string& body, const char* key, std::string& out) {
+  std::string prefix = std::string(key) + "=";
+  size_t pos = 0;
+  while (pos <= body.size()) {
+    size_t end = body.find('&', pos);
+    if (end == std::string::npos) {
+      end = body.size();
+    }
+    if (body.compare(pos, prefix.size(), prefix) == 0) {
+      out = body.substr(pos + prefix.size(), end - pos - prefix.size());
+      return true;
+    }
+    pos = end + 1;
+  }
+  return false;
+}
+
+static bool jsonLookup(const char* key, float& value, void* context) {
+  return jsonNumber(*(const std::string*)context, key, value);
+}
+
+// Пределы и поля - те же таблицы lib/BoilerCommands, что у POST настроек прошивки
+static bool applyComfortSettings(const std::string& json) {
+  ComfortSettings old = comfortSettings;
+  if (applySettingsNumbers(SETTINGS_LIMITS(COMFORT_SETTINGS_LIMITS), SETTINGS_VALUES(COMFORT_SETTINGS_VALUES),
+                           jsonLookup, (void*)&json) != nullptr) {
+    return false;
+  }
+  onComfortSettingsChanged(old);
+  return true;
+}
+
+static bool applyAutoSettings(const std::string& json) {
+  AutoSettings old = autoSettings;
+  if (applySettingsNumbers(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), SETTINGS_VALUES(AUTO_SETTINGS_VALUES),
+                           jsonLookup, (void*)&json) != nullptr) {
+    return false;
+  }
+  onAutoSettingsChanged(old);
+  return true;
+}
+
+// HTTP-команда из трассы - то, что делает соответствующий обработчик прошивки
+// с состоянием управления; остальные маршруты (WiFi, MQTT, датчики) на решения
+// не влияют и пропускаются
+static void replayHttp(const std::string& uri, const std::string& body) {
+  std::string arg;
+  bool applied = true;
+  float value;
+  if (uri == "/api/setpoint") {
+    if (formArg(body, "value", arg) && workMode != 1) {
+      value = atof(arg.c_str());
+      if (settingNumberAllowed(SETTINGS_LIMITS(AUTO_SETTINGS_LIMITS), "setpoint", value)) {
+        AutoSettings old = autoSettings;
+        autoSettings.setpoint = value;
+        onAutoSettingsChanged(old);
+      }
+    }
+  } else if (uri == "/api/control") {
+    std::string device, state, manual;
+    if (formArg(body, "device", device) && formArg(body, "state", state)) {
+      bool on = atoi(state.c_str()) == 1;
+      bool isManual = formArg(body, "manual", manual) && atoi(manual.c_str()) == 1;
+      if (device == "fan") {
+        applyFanControl(on, isManual, millis());
+      } else if (device == "pump") {
+        applyPumpControl(on, isManual, millis());
+      } else if (device == "sensors") {
+        applySensorsRelay(on, true, millis());
+      }
+    }
+  } else if (uri == "/api/system/enable") {
+    if (formArg(body, "enabled", arg)) {
+      applySystemEnabled(atoi(arg.c_str()) == 1);
+    }
+  } else if (uri == "/api/system/mode") {
+    if (jsonNumber(body, "mode", value) && (value == 0 || value == 1)) {
+      applyWorkMode((int)value, millis());
+    }
+  } else if (uri == "/api/system/ignition") {
+    requestIgnition(millis());
+  } else if (uri == "/api/coalFeeding") {
+    if (coalFeedingActive) {
+      stopCoalFeeding();
+    } else {
+      startCoalFeeding(millis());
+    }
+  } else if (uri == "/api/settings/auto") {
+    applyAutoSettings(body);
+  } else if (uri == "/api/settings/comfort") {
+    applyComfortSettings(body);
+  } else if (uri == "/api/settings/all") {
+    // Группы применяются вместе: ошибка в любой - ничего не меняется
+    std::string autoJson = jsonObject(body, "auto");
+    std::string comfortJson = jsonObject(body, "comfort");
+    AutoSettings oldAuto = autoSettings;
+    if (!autoJson.empty() && !applyAutoSettings(autoJson)) {
+      autoSettings = oldAuto;
+    } else if (!comfortJson.empty() && !applyComfortSettings(comfortJson)) {
+      autoSettings = oldAuto;
+    }
+  } else {
+    applied = false;
+  }
+  if (applied) {
+    httpApplied++;
+  } else {
+    httpSkipped++;
+  }
+  requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+}
+
+// ============ Воспроизведение ============
+// Сотые °C из трассы обратно в показание: DS18B20 отдает кратные 1/16 °C, а
+// трасса отбрасывает дробь сотых, поэтому исходное значение восстанавливается
+// точно и фильтры видят то же, что на устройстве
+static float rawToCelsius(int16_t raw) {
+  if (raw == TRACE_SENSOR_NO_VALUE) {
+    return NAN;
+  }
+  if (raw == REPLAY_DISCONNECTED_RAW) {
+    return DEVICE_DISCONNECTED_C;
+  }
+  return roundf(raw / 6.25f) / 16.0f;
+}
+
+static void advanceTo(uint32_t ms) {
+  while (millis() + REPLAY_LOOP_STEP_MS <= ms) {
+    hostClockAdvance(REPLAY_LOOP_STEP_MS);
+    hostFirmwareLoop();
+  }
+  if (millis() < ms) {
+    hostClockAdvance(ms - millis());
+  }
+}
+
+static void describeDecision(const char* label, const Decision& d) {
+  printf("  %-10s %10.3f с  fan=%d pump=%d state=%s comfort=%s trigger=0x%02X\n", label, d.ms / 1000.0, d.fan,
+         d.pump, d.systemState < SYSTEM_STATE_COUNT ? SYSTEM_STATES[d.systemState].apiName : "?",
+         d.comfortState < COMFORT_STATE_COUNT ? COMFORT_STATE_NAMES[d.comfortState] : "?", d.trigger);
+}
+
+static bool sameOutputs(const Decision& a, const Decision& b) {
+  return a.fan == b.fan && a.pump == b.pump && a.systemState == b.systemState && a.comfortState == b.comfortState;
+}
+
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  const char* outPath = nullptr;
+  const char* prefix = "kotel";
+  int startMode = -1;  // -1 - из трассы, иначе Авто
+  float startSetpoint = 0.0;
+  int segment = 0;  // 0 - последний
+  uint32_t toleranceMs = 1000;
+  uint32_t warmupMs = 0;
+  int maxDiffs = 20;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+      prefix = argv[++i];
+    } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+      startMode = strcmp(argv[++i], "comfort") == 0 ? 1 : 0;
+    } else if (strcmp(argv[i], "--setpoint") == 0 && i + 1 < argc) {
+      startSetpoint = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--segment") == 0 && i + 1 < argc) {
+      segment = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      toleranceMs = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmupMs = (uint32_t)(atof(argv[++i]) * 60000);
+    } else if (strcmp(argv[i], "--max-diffs") == 0 && i + 1 < argc) {
+      maxDiffs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      outPath = argv[++i];
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      hostVerbose = true;
+    } else if (argv[i][0] != '-' && tracePath == nullptr) {
+      tracePath = argv[i];
+    } else {
+      tracePath = nullptr;
+      break;
+    }
+  }
+  if (tracePath == nullptr) {
+    fprintf(stderr, "usage: %s trace.bin [--prefix kotel] [--mode auto|comfort] [--setpoint 60]\n"
+                    "          [--segment N] [--tolerance 1000] [--warmup 0] [--max-diffs 20]\n"
+                    "          [--out replay.bin] [--verbose]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<HostTraceEntry> entries;
+  uint32_t orphans = 0;
+  if (!hostTraceLoad(tracePath, entries, orphans)) {
+    fprintf(stderr, "Не удалось прочитать %s\n", tracePath);
+    return 2;
+  }
+
+  // Отрезки между перезагрузками: TRACE_BOOT или шаг времени назад
+  std::vector<size_t> segmentStarts;
+  segmentStarts.push_back(0);
+  for (size_t i = 1; i < entries.size(); i++) {
+    if (entries[i].type == TRACE_BOOT || entries[i].ms < entries[i - 1].ms) {
+      segmentStarts.push_back(i);
+    }
+  }
+  int segmentCount = (int)segmentStarts.size();
+  if (segment == 0) {
+    segment = segmentCount;
+  }
+  if (segment < 1 || segment > segmentCount) {
+    fprintf(stderr, "В трассе отрезков: %d\n", segmentCount);
+    return 2;
+  }
+  size_t first = segmentStarts[segment - 1];
+  size_t last = segment < segmentCount ? segmentStarts[segment] : entries.size();
+  if (first >= last) {
+    fprintf(stderr, "Отрезок %d пуст\n", segment);
+    return 2;
+  }
+
+  // Режим из TRACE_BOOT отрезка; если его нет - --mode после "online" ESP01
+  const char* modeSource = "трасса";
+  int pendingMode = -1;
+  hostSensorPolling = false;
+  hostFirmwareSetup(prefix);
+  workMode = 0;
+  if (entries[first].type == TRACE_BOOT && !entries[first].second().empty()) {
+    workMode = entries[first].second() == WORK_MODE_NAMES[1] ? 1 : 0;
+  } else if (startMode == 1) {
+    pendingMode = 1;
+    modeSource = "--mode после online датчика дома";
+  } else {
+    modeSource = startMode == 0 ? "--mode" : "нет в трассе, Авто";
+  }
+  if (startSetpoint > 0) {
+    autoSettings.setpoint = startSetpoint;
+  }
+  hostHooks.decision = onReplayDecision;
+  if (outPath != nullptr) {
+    if (!outTrace.open(outPath)) {
+      fprintf(stderr, "Не удалось открыть %s\n", outPath);
+      return 2;
+    }
+    hostHooks.sensors = onReplaySensors;
+    hostHooks.mqttIn = onReplayMqttIn;
+    hostHooks.state = onReplayState;
+  }
+
+  // Виртуальные часы - с момента первой записи отрезка, как millis() на устройстве
+  uint32_t startMs = entries[first].ms;
+  hostClockAdvance(startMs);
+  std::vector<Decision> recorded;
+  uint32_t sensorRecords = 0;
+  uint32_t mqttRecords = 0;
+  uint32_t modeRecords = 0;
+  uint32_t modeRejected = 0;
+  for (size_t i = first; i < last; i++) {
+    const HostTraceEntry& e = entries[i];
+    advanceTo(e.ms);
+    if (e.type == TRACE_SENSORS && e.data.size() == 4 * sizeof(int16_t)) {
+      int16_t raw[4];
+      memcpy(raw, e.data.data(), sizeof(raw));
+      float temps[4];
+      for (int c = 0; c < 4; c++) {
+        temps[c] = rawToCelsius(raw[c]);
+      }
+      hostApplySensors(e.ms, temps);
+      sensorRecords++;
+    } else if (e.type == TRACE_MQTT_IN) {
+      std::string topic = e.first();
+      std::string payload = e.second();
+      mqttCallback(&topic[0], (uint8_t*)&payload[0], (unsigned int)payload.size());
+      mqttRecords++;
+    } else if (e.type == TRACE_HTTP) {
+      if (outTrace.isOpen()) {
+        outTrace.record(TRACE_HTTP, (const uint8_t*)e.data.data(), e.data.size());
+      }
+      replayHttp(e.first(), e.second());
+    } else if (e.type == TRACE_BOOT) {
+      if (outTrace.isOpen()) {
+        outTrace.record(TRACE_BOOT, (const uint8_t*)e.data.data(), e.data.size());
+      }
+    } else if (e.type == TRACE_STATE && e.first() == "mode") {
+      // Смена режима на устройстве; если ее уже вызвал воспроизведенный вход
+      // (команда, откат Комфорта в Авто), режим совпадает и делать нечего
+      int mode = e.second() == WORK_MODE_NAMES[1] ? 1 : 0;
+      modeRecords++;
+      if (mode != workMode) {
+        if (!applyWorkMode(mode, millis())) {
+          modeRejected++;
+        }
+        requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+      }
+    } else if (e.type == TRACE_CONTROL && e.data.size() >= 5) {
+      const uint8_t* p = (const uint8_t*)e.data.data();
+      recorded.push_back({e.ms, p[0], p[1], p[2], p[3], p[4]});
+    }
+    // Пересчет в том же проходе loop(), что и вход (как на устройстве)
+    hostFirmwareLoop();
+    if (pendingMode >= 0 && homeTempSensorLWTOnline) {
+      // Как week_run: после прохода loop(), пересчет - в следующем
+      applyWorkMode(pendingMode, millis());
+      requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+      pendingMode = -1;
+    }
+  }
+  outTrace.close();
+
+  // Сравнение последовательностей: совпадение - те же выходы в пределах
+  // допуска по времени; при расхождении вперед сдвигается более раннее решение
+  size_t a = 0;
+  size_t b = 0;
+  uint32_t matched = 0;
+  uint32_t onlyRecorded = 0;
+  uint32_t onlyReplayed = 0;
+  uint32_t maxShift = 0;
+  int shown = 0;
+  while (a < recorded.size() || b < replayed.size()) {
+    if (a < recorded.size() && recorded[a].ms < startMs + warmupMs) {
+      a++;
+      continue;
+    }
+    if (b < replayed.size() && replayed[b].ms < startMs + warmupMs) {
+      b++;
+      continue;
+    }
+    if (a < recorded.size() && b < replayed.size()) {
+      const Decision& r = recorded[a];
+      const Decision& p = replayed[b];
+      uint32_t shift = r.ms > p.ms ? r.ms - p.ms : p.ms - r.ms;
+      if (sameOutputs(r, p) && shift <= toleranceMs) {
+        if (shift > maxShift) {
+          maxShift = shift;
+        }
+        matched++;
+        a++;
+        b++;
+        continue;
+      }
+      bool recordedFirst = r.ms <= p.ms;
+      if (shown < maxDiffs) {
+        printf("Расхождение:\n");
+        describeDecision("трасса", r);
+        describeDecision("повтор", p);
+        shown++;
+      }
+      if (recordedFirst) {
+        onlyRecorded++;
+        a++;
+      } else {
+        onlyReplayed++;
+        b++;
+      }
+    } else if (a < recorded.size()) {
+      if (shown < maxDiffs) {
+        printf("Только в трассе:\n");
+        describeDecision("трасса", recorded[a]);
+        shown++;
+      }
+      onlyRecorded++;
+      a++;
+    } else {
+      if (shown < maxDiffs) {
+        printf("Только в повторе:\n");
+        describeDecision("повтор", replayed[b]);
+        shown++;
+      }
+      onlyReplayed++;
+      b++;
+    }
+  }
+
+  printf("Трасса: %s, записей %u (продолжений без начала: %u), отрезок %d из %d, %.1f мин\n", tracePath,
+         (unsigned)entries.size(), orphans, segment, segmentCount, (millis() - startMs) / 60000.0);
+  printf("Входы: показаний %u, MQTT %u, HTTP %u (пропущено маршрутов: %u)\n", sensorRecords, mqttRecords,
+         httpApplied, httpSkipped);
+  printf("Режим: %s, смен режима в трассе %u (не применилось: %u)\n", modeSource, modeRecords, modeRejected);
+  printf("Решения: в трассе %u, в повторе %u; совпало %u (сдвиг до %u мс), только в трассе %u, только в повторе %u\n",
+         (unsigned)recorded.size(), (unsigned)replayed.size(), matched, maxShift, onlyRecorded, onlyReplayed);
+  if (outPath != nullptr) {
+    printf("Повтор записан: %s (%u записей)\n", outPath, outTrace.recordCount);
+  }
+  return onlyRecorded == 0 && onlyReplayed == 0 ? 0 : 1;
+}
@@ -0,0 +1,300 @@
+// Неделя работы контроллера за секунды: логика lib/BoilerControl на
+// виртуальных часах host_shims.h против модели котла и дома BoilerSim
+// (host_plant.h). Часы контроллера и модели - одни и те же, поэтому
+// таймаут разогрева, проверка прогорания, розжиг и выдержки Комфорта
+// срабатывают в том же масштабе, что и тепловые процессы.
+//
+// Истопник заходит днем (7:00-23:00) раз в 15 минут: при остатке угля
+// меньше --reload-kg включает подброс по MQTT (coalFeeding/set) на 5 минут,
+// а если котел погас - запускает розжиг (ignition/start), при необходимости
+// после подброса. В последний час перед уходом он закладывает уголь на ночь,
+// если в топке меньше --night-kg: иначе котел гаснет каждую ночь и прогон
+// проверяет уже не регулирование, а истопника.
+//
+// Сборка (из корня репозитория, одной командой):
+//   g++ -std=c++17 -O2 -Wall -Wextra -Ilib/BoilerControl -Ilib/BoilerCommands -Ilib/BoilerSim
+//       -Ilib/SensorFilter -Ilib/MqttCommands -Ilib/MqttMessages -Ilib/PayloadWriter -Ilib/TraceRecorder
+//       -Itools/hostsim -o week_run tools/hostsim/week_run.cpp tools/hostsim/host_firmware.cpp
+//       tools/hostsim/host_plant.cpp tools/hostsim/host_shims.cpp tools/hostsim/host_trace.cpp
+//       lib/BoilerControl/BoilerControl.cpp lib/BoilerCommands/BoilerCommands.cpp
+//       lib/BoilerCommands/SettingsLimits.cpp lib/BoilerSim/BoilerSim.cpp lib/SensorFilter/SensorFilter.cpp
+//       lib/MqttCommands/MqttCommands.cpp lib/MqttMessages/MqttMessages.cpp lib/PayloadWriter/PayloadWriter.cpp
+//       lib/TraceRecorder/TraceFormat.cpp
+// Запуск:
+//   ./week_run [--days 7] [--mode auto|comfort] [--trace week.bin] [--csv week.csv]
+//              [--csv-interval 60] [--reload-kg 5] [--night-kg 20] [--verbose]
+// --trace - трасса в формате TraceRecorder (показания, входящие MQTT, решения):
+// python3 tools/trace_decode.py week.bin; --csv - строки модели
+// (BOILER_SIM_TRACE_HEADER + состояние контроллера) каждые --csv-interval секунд.
+// Код выхода: 0 - сутки в пределах DAY_BOUNDS, 1 - событий аварий или решений
+// за сутки больше (зацикливание логики), 2 - ошибка аргументов.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BoilerSim.h"
+#include "host_firmware.h"
+#include "host_plant.h"
+#include "host_trace.h"
+
+#define WEEK_LOOP_STEP_MS 10                      // Шаг виртуальных часов за проход loop()
+#define WEEK_DAY_MS (24UL * 60 * 60 * 1000)
+#define WEEK_MAX_DAYS 14                          // millis() 32-битный: ~49 суток, с запасом
+#define OPERATOR_CHECK_INTERVAL (15UL * 60 * 1000)
+#define OPERATOR_FEED_DURATION (5UL * 60 * 1000)
+#define OPERATOR_DAY_START_H 7
+#define OPERATOR_DAY_END_H 23
+
+static const char* const PREFIX = "kotel";
+
+// Итоги за сутки
+struct DayStats {
+  float houseMin;
+  float houseMax;
+  double houseSum;
+  uint32_t houseSamples;
+  float supplyMax;
+  float coalBurnedStart;
+  uint32_t fanOnSeconds;
+  uint32_t reloads;
+  uint32_t ignitions;
+  uint32_t decisions;
+  uint32_t stateEntries[SYSTEM_STATE_COUNT];
+};
+
+static DayStats days[WEEK_MAX_DAYS];
+
+// Пределы за сутки: одно прогорание с погасанием еще нормально (ночь без
+// истопника), десятки входов в аварию - состояние скачет по кругу
+#define WEEK_MAX_DECISIONS_PER_DAY 250
+struct DayBound {
+  const char* name;
+  uint8_t state;
+  uint32_t maxEntries;
+};
+static const DayBound DAY_BOUNDS[] = {
+  {"таймаут", STATE_HEATING_TIMEOUT, 2}, {"прогорел", STATE_COAL_BURNED, 2}, {"погас", STATE_EXTINGUISHED, 1},
+  {"ош.розжига", STATE_IGNITION_FAILED, 1}, {"перегрев", STATE_OVERHEAT, 1}
+};
+
+// Выход суток за пределы - в stderr; false - есть нарушения
+static bool checkDayBounds(int d, const DayStats& day) {
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(DAY_BOUNDS) / sizeof(DAY_BOUNDS[0]); i++) {
+    uint32_t entries = day.stateEntries[DAY_BOUNDS[i].state];
+    if (entries > DAY_BOUNDS[i].maxEntries) {
+      fprintf(stderr, "День %d: %s %u раз (допустимо %u)\n", d + 1, DAY_BOUNDS[i].name, entries,
+              DAY_BOUNDS[i].maxEntries);
+      ok = false;
+    }
+  }
+  if (day.decisions > WEEK_MAX_DECISIONS_PER_DAY) {
+    fprintf(stderr, "День %d: решений %u (допустимо %u)\n", d + 1, day.decisions, WEEK_MAX_DECISIONS_PER_DAY);
+    ok = false;
+  }
+  return ok;
+}
+static float operatorReloadKg = 5.0;
+static float operatorNightKg = 20.0;  // Запас на ночь (8 ч тления и разогревов)
+
+static void sendCommand(const char* suffix, const char* payload) {
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s/%s", PREFIX, suffix);
+  hostMqttDeliver(topic, payload);
+}
+
+// Истопник: решения по показаниям модели (уголь в топке он видит сам)
+static void operatorVisit(const BoilerSimState& s, DayStats& day) {
+  static unsigned long lastVisit = 0;
+  static unsigned long feedStart = 0;
+  unsigned long now = millis();
+  if (coalFeedingActive && feedStart != 0) {
+    if (now - feedStart < OPERATOR_FEED_DURATION) {
+      return;
+    }
+    feedStart = 0;
+    sendCommand("coalFeeding/set", "0");
+    if (boilerExtinguished || systemState == STATE_EXTINGUISHED || systemState == STATE_IGNITION_FAILED) {
+      sendCommand("ignition/start", "1");
+      day.ignitions++;
+    }
+    return;
+  }
+  if (lastVisit != 0 && now - lastVisit < OPERATOR_CHECK_INTERVAL) {
+    return;
+  }
+  lastVisit = now;
+  int hour = (int)(s.timeS / 3600.0) % 24;
+  if (hour < OPERATOR_DAY_START_H || hour >= OPERATOR_DAY_END_H) {
+    return;
+  }
+  // Последний заход дня - закладка на ночь
+  float reloadKg = hour == OPERATOR_DAY_END_H - 1 ? operatorNightKg : operatorReloadKg;
+  if (s.coalKg < reloadKg && !coalFeedingActive) {
+    sendCommand("coalFeeding/set", "1");
+    feedStart = now;
+    day.reloads++;
+  } else if (systemState == STATE_EXTINGUISHED || systemState == STATE_IGNITION_FAILED) {
+    // Угля хватает, но котел погас - сразу розжиг
+    sendCommand("ignition/start", "1");
+    day.ignitions++;
+  }
+}
+
+int main(int argc, char** argv) {
+  int dayCount = 7;
+  int startMode = 0;
+  const char* tracePath = nullptr;
+  const char* csvPath = nullptr;
+  unsigned long csvIntervalMs = 60000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+      dayCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+      startMode = strcmp(argv[++i], "comfort") == 0 ? 1 : 0;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+      csvPath = argv[++i];
+    } else if (strcmp(argv[i], "--csv-interval") == 0 && i + 1 < argc) {
+      csvIntervalMs = (unsigned long)(atof(argv[++i]) * 1000);
+    } else if (strcmp(argv[i], "--reload-kg") == 0 && i + 1 < argc) {
+      operatorReloadKg = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--night-kg") == 0 && i + 1 < argc) {
+      operatorNightKg = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      hostVerbose = true;
+    } else {
+      fprintf(stderr, "usage: %s [--days 7] [--mode auto|comfort] [--trace week.bin] [--csv week.csv]\n"
+                      "          [--csv-interval 60] [--reload-kg 5] [--night-kg 20] [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (dayCount < 1 || dayCount > WEEK_MAX_DAYS || csvIntervalMs == 0) {
+    fprintf(stderr, "--days 1..%d, --csv-interval > 0\n", WEEK_MAX_DAYS);
+    return 2;
+  }
+
+  HostTraceFile trace;
+  if (tracePath != nullptr) {
+    if (!trace.open(tracePath)) {
+      fprintf(stderr, "Не удалось открыть %s\n", tracePath);
+      return 1;
+    }
+    hostTraceAttach(&trace);
+  }
+  FILE* csv = nullptr;
+  if (csvPath != nullptr) {
+    csv = fopen(csvPath, "w");
+    if (csv == nullptr) {
+      fprintf(stderr, "Не удалось открыть %s\n", csvPath);
+      return 1;
+    }
+    fprintf(csv, "%s,state,comfort\n", BOILER_SIM_TRACE_HEADER);
+  }
+
+  hostFirmwareSetup(PREFIX);
+  if (trace.isOpen()) {
+    // Как startStorage() прошивки: версия и режим на момент начала записи
+    const char* mode = WORK_MODE_NAMES[workMode];
+    trace.recordPair(TRACE_BOOT, "hostsim-week", mode, strlen(mode));
+  }
+  BoilerSim plant;
+  hostPlantBegin(plant, BoilerSimParams());
+
+  memset(days, 0, sizeof(days));
+  for (int d = 0; d < dayCount; d++) {
+    days[d].houseMin = 1000.0;
+    days[d].houseMax = -1000.0;
+  }
+
+  unsigned long endMs = (unsigned long)dayCount * WEEK_DAY_MS;
+  unsigned long nextCsv = 0;
+  unsigned long nextSample = 0;
+  unsigned long fanMs = 0;
+  uint8_t lastState = systemState;
+  unsigned long lastDecisions = 0;
+  int currentDay = 0;
+  bool modeApplied = startMode == 0;
+  unsigned long realStart = hostRealMillis();
+  while (millis() < endMs) {
+    int d = (int)(millis() / WEEK_DAY_MS);
+    if (d != currentDay) {
+      currentDay = d;
+      days[d].coalBurnedStart = plant.state().coalBurnedKg;
+    }
+    DayStats& day = days[d];
+
+    hostPlantStep(plant, WEEK_LOOP_STEP_MS, false);
+    hostFirmwareLoop();
+    const BoilerSimState& s = plant.state();
+    if (!modeApplied && homeTempSensorLWTOnline) {
+      // Комфорт требует датчик дома - включаем после первого сообщения ESP01
+      modeApplied = applyWorkMode(startMode, millis());
+      requestControlEvaluation(CONTROL_TRIGGER_COMMAND);
+    }
+    operatorVisit(s, day);
+
+    if (systemState != lastState) {
+      lastState = systemState;
+      day.stateEntries[systemState]++;
+    }
+    day.decisions += controlDecisions - lastDecisions;
+    lastDecisions = controlDecisions;
+    if (fanState) {
+      fanMs += WEEK_LOOP_STEP_MS;
+      if (fanMs >= 1000) {
+        day.fanOnSeconds += fanMs / 1000;
+        fanMs %= 1000;
+      }
+    }
+    if (millis() >= nextSample) {
+      nextSample += 60000;
+      if (s.houseTemp < day.houseMin) day.houseMin = s.houseTemp;
+      if (s.houseTemp > day.houseMax) day.houseMax = s.houseTemp;
+      if (s.supplyTemp > day.supplyMax) day.supplyMax = s.supplyTemp;
+      day.houseSum += s.houseTemp;
+      day.houseSamples++;
+    }
+    if (csv != nullptr && millis() >= nextCsv) {
+      nextCsv += csvIntervalMs;
+      char line[160];
+      plant.formatTrace(line, sizeof(line), fanState, pumpState);
+      fprintf(csv, "%s,%s,%s\n", line, SYSTEM_STATES[systemState].apiName, COMFORT_STATE_NAMES[comfortState]);
+    }
+
+    hostClockAdvance(WEEK_LOOP_STEP_MS);
+  }
+  unsigned long realMs = hostRealMillis() - realStart;
+
+  printf("Режим: %s, дней: %d, прогон занял %.2f с\n", startMode == 1 ? "Комфорт" : "Авто", dayCount, realMs / 1000.0);
+  printf("день  дом мин/ср/макс °C   подача макс  уголь кг  вент. ч  подбросов  розжигов  решений"
+         "  таймаут  прогорел  погас  ош.розжига  перегрев\n");
+  float coalEnd = plant.state().coalBurnedKg;
+  bool boundsOk = true;
+  for (int d = 0; d < dayCount; d++) {
+    const DayStats& day = days[d];
+    float coalNext = d + 1 < dayCount ? days[d + 1].coalBurnedStart : coalEnd;
+    printf("%4d  %5.1f/%5.1f/%5.1f     %8.1f  %8.1f  %7.1f  %9u  %8u  %7u  %7u  %8u  %5u  %10u  %8u\n", d + 1,
+           day.houseMin, day.houseSamples ? day.houseSum / day.houseSamples : 0.0, day.houseMax, day.supplyMax,
+           coalNext - day.coalBurnedStart, day.fanOnSeconds / 3600.0, day.reloads, day.ignitions, day.decisions,
+           day.stateEntries[STATE_HEATING_TIMEOUT], day.stateEntries[STATE_COAL_BURNED],
+           day.stateEntries[STATE_EXTINGUISHED], day.stateEntries[STATE_IGNITION_FAILED],
+           day.stateEntries[STATE_OVERHEAT]);
+    if (!checkDayBounds(d, day)) {
+      boundsOk = false;
+    }
+  }
+  printf("Пересчетов управления: %lu, решений: %lu, циклов вентилятора: %u\n",
+         controlEvaluations, controlDecisions, fanCycleCount);
+  if (trace.isOpen()) {
+    printf("Трасса: %s, записей %u, %u байт\n", tracePath, trace.recordCount, trace.bytes);
+    trace.close();
+  }
+  if (csv != nullptr) {
+    fclose(csv);
+    printf("CSV: %s\n", csvPath);
+  }
+  return boundsOk ? 0 : 1;
+}
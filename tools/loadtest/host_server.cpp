@@ -0,0 +1,288 @@
+// Хостовый стенд веб-слоя прошивки для нагрузочных тестов (tools/loadtest/loadtest.py).
+//
+// Тот же NbHttpServer, что и на ESP32, поверх POSIX-сокетов. Маршруты, которые
+// гоняет нагрузка, отдают ответы размером и формой как у прошивки; index.html
+// читается из data/. loop() устроен как в прошивке: веб, затем такт управления
+// (шаг модели котла BoilerSim каждые 100 мс), затем delay(1). Профиль этапов -
+// в том же формате, что /api/diagnostics/profile прошивки, плюс опоздание
+// тактов управления относительно расписания.
+//
+// Сборку и запуск делает loadtest.py (--build-only - только собрать); команда
+// та же, что в нем: g++ -std=c++17 -O2 с -I на lib/NbHttpServer,
+// lib/LatencyHistogram, lib/BoilerSim и их .cpp.
+// Запуск:
+//   ./host_server [--port 8080] [--www data] [--handler-us 0]
+// --handler-us добавляет каждому обработчику занятое ожидание - грубая поправка
+// на то, что ESP32 собирает JSON в десятки раз медленнее хоста.
+
+#include <memory>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+
+#include "BoilerSim.h"
+#include "LatencyHistogram.h"
+#include "NbHttpServer.h"
+#include "NbSocket.h"
+
+#define CONTROL_TICK_MS 100
+
+enum LoopStage { LOOP_STAGE_WEB, LOOP_STAGE_CONTROL, LOOP_STAGE_TOTAL, LOOP_STAGE_COUNT };
+const char* const LOOP_STAGE_NAMES[LOOP_STAGE_COUNT] = {"web", "control", "total"};
+
+NbHttpServer* server = nullptr;
+LatencyHistogram loopStageHistograms[LOOP_STAGE_COUNT];
+LatencyHistogram tickLateness;  // Опоздание такта управления, мкс
+BoilerSim sim;
+bool fanOn = false;
+bool pumpOn = true;
+unsigned long handlerCostUs = 0;
+std::string wwwRoot = "data";
+bool wifiScanning = false;
+unsigned long wifiScanStart = 0;
+
+static uint64_t micros64() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Поправка на скорость ESP32: обработчик занимает loop не меньше handlerCostUs
+static void spendHandlerCost() {
+  uint64_t until = micros64() + handlerCostUs;
+  while (handlerCostUs > 0 && micros64() < until) {
+  }
+}
+
+static void appendf(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string& out, const char* fmt, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+static void sendJson(const std::string& json) {
+  spendHandlerCost();
+  server->send(200, "application/json", json);
+}
+
+// ---------------------------------------------------------------------------
+// Ответы по форме прошивки
+
+void handleStatus() {
+  const BoilerSimState& s = sim.state();
+  std::string json;
+  appendf(json, "{\"supplyTemp\":%.2f,\"returnTemp\":%.2f,\"boilerTemp\":%.2f,\"outsideTemp\":%.2f,"
+          "\"homeTemp\":%.2f,\"setpoint\":60.00,\"fanState\":%s,\"pumpState\":%s,",
+          s.supplyTemp, s.returnTemp, s.boilerTemp, s.outdoorTemp, s.houseTemp,
+          fanOn ? "true" : "false", pumpOn ? "true" : "false");
+  appendf(json, "\"systemEnabled\":true,\"systemState\":\"heating\",\"comfortState\":\"normal\","
+          "\"workMode\":\"auto\",\"manualControl\":false,\"wifiRSSI\":-61,\"mqttConnected\":true,"
+          "\"uptime\":%lu,\"freeHeap\":143210,\"bootCount\":17,\"coalFeeding\":false,",
+          nbMillis() / 1000);
+  appendf(json, "\"fanStats\":{\"onTime\":%lu,\"cycles\":%u},\"sensors\":{\"errors\":0,\"lastRead\":%lu},"
+          "\"time\":\"2026-01-14 12:00:00\",\"version\":\"host\"}",
+          nbMillis() / 3000, 42u, nbMillis() % 2000);
+  sendJson(json);
+}
+
+void handleSettingsAll() {
+  std::string json = "{";
+  appendf(json, "\"auto\":{\"setpoint\":60.0,\"hysteresis\":2.0,\"pumpOnTemp\":40.0,\"pumpOffTemp\":35.0,"
+          "\"fanMaxTime\":1800,\"fanPause\":300,\"extinctionTemp\":30.0,\"overheatTemp\":90.0},");
+  json += "\"comfort\":{\"enabled\":true,\"schedule\":[";
+  for (int i = 0; i < 7; i++) {
+    appendf(json, "%s{\"day\":%d,\"from\":\"06:00\",\"to\":\"23:00\",\"temp\":22.0,\"night\":19.5}", i ? "," : "", i);
+  }
+  json += "]},";
+  appendf(json, "\"mqtt\":{\"enabled\":true,\"server\":\"192.168.1.10\",\"port\":1883,\"user\":\"kotel\","
+          "\"prefix\":\"kotel\",\"useTLS\":false,\"interval\":10},");
+  appendf(json, "\"relay\":{\"fanPin\":26,\"pumpPin\":27,\"activeLow\":true,\"manual\":false},");
+  appendf(json, "\"ntp\":{\"enabled\":true,\"server\":\"pool.ntp.org\",\"timezone\":3},");
+  appendf(json, "\"ml\":{\"enabled\":false,\"learningRate\":0.01},");
+  appendf(json, "\"update\":{\"autoCheck\":true,\"interval\":86400000,\"url\":\"https://example.invalid/kotel\"},");
+  appendf(json, "\"wifi\":{\"ssid\":\"home\",\"backupSSID\":\"dacha\"},");
+  appendf(json, "\"sensors\":{\"supply\":\"28FF1A2B3C4D5E01\",\"return\":\"28FF1A2B3C4D5E02\","
+          "\"boiler\":\"28FF1A2B3C4D5E03\",\"outside\":\"28FF1A2B3C4D5E04\"}}");
+  server->sendHeader("ETag", "\"1\"");
+  sendJson(json);
+}
+
+void handleSmallJson(const char* json) {
+  sendJson(json);
+}
+
+void handleWiFiScan() {
+  if (!wifiScanning) {
+    wifiScanning = true;
+    wifiScanStart = nbMillis();
+  }
+  sendJson("{\"scanning\":true,\"message\":\"Сканирование запущено\"}");
+}
+
+// Асинхронное сканирование на ESP32 идет ~3 с
+void handleWiFiScanResults() {
+  if (wifiScanning && nbMillis() - wifiScanStart < 3000) {
+    sendJson("{\"scanning\":true,\"message\":\"Сканирование в процессе...\"}");
+    return;
+  }
+  wifiScanning = false;
+  std::string json = "{\"networks\":[";
+  for (int i = 0; i < 20; i++) {
+    appendf(json, "%s{\"ssid\":\"network-%02d\",\"rssi\":%d,\"channel\":%d,\"encryption\":\"WPA2\",\"bssid\":\"AA:BB:CC:DD:EE:%02X\"}",
+            i ? "," : "", i, -40 - i * 3, 1 + i % 13, i);
+  }
+  json += "],\"count\":20,\"success\":true,\"scanning\":false}";
+  sendJson(json);
+}
+
+void handleTimers() {
+  std::string json = "{\"timers\":[";
+  for (int i = 0; i < 24; i++) {
+    appendf(json, "%s{\"name\":\"timer%02dLongDescriptiveName\",\"active\":%s,\"remaining\":%d,"
+            "\"remainingFormatted\":\"%dм %dс\",\"interval\":%d,\"lastRun\":%lu,\"description\":\"Таймер подсистемы номер %d\"}",
+            i ? "," : "", i, i % 2 ? "true" : "false", i * 1000, i, i * 7 % 60, 60000, nbMillis() - i * 100, i);
+  }
+  appendf(json, "],\"now\":%lu}", nbMillis());
+  sendJson(json);
+}
+
+void handleBootLog() {
+  std::string json = "{\"entries\":[";
+  for (int i = 0; i < 20; i++) {
+    appendf(json, "%s{\"bootCount\":%d,\"timestamp\":%d,\"reason\":\"%s\",\"fastBoot\":%s,\"setupMs\":%d,"
+            "\"datetime\":\"2026-01-%02d 0%d:1%d:00\"}",
+            i ? "," : "", 100 + i, 1768000000 + i * 3600, i % 3 ? "POWERON" : "TASK_WDT",
+            i % 3 ? "false" : "true", 900 + i, 1 + i, i % 10, i % 10);
+  }
+  json += "],\"total\":20,\"currentBootCount\":119}";
+  sendJson(json);
+}
+
+// index.html из data/ - тем же потоком кусками, что streamFile на ESP32
+void handleWebInterface() {
+  std::string path = wwwRoot + "/index.html";
+  FILE* raw = fopen(path.c_str(), "rb");
+  if (raw == nullptr) {
+    server->send(200, "text/html; charset=utf-8", "<html><body>index.html не найден</body></html>");
+    return;
+  }
+  fseek(raw, 0, SEEK_END);
+  size_t size = ftell(raw);
+  fseek(raw, 0, SEEK_SET);
+  std::shared_ptr<FILE> file(raw, fclose);
+  spendHandlerCost();
+  server->sendHeader("Cache-Control", "public, max-age=3600");
+  server->sendChunks(200, "text/html; charset=utf-8", size, [file](uint8_t* buf, size_t maxLen) -> size_t {
+    return fread(buf, 1, maxLen, file.get());
+  });
+}
+
+// Профиль в формате прошивки (+ tickLateness), ?reset=1 - обнулить после выдачи
+void handleLoopProfile() {
+  std::string json = "{\"stages\":{";
+  for (int i = 0; i < LOOP_STAGE_COUNT; i++) {
+    const LatencyHistogram& h = loopStageHistograms[i];
+    appendf(json, "%s\"%s\":{\"count\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u,\"avg\":%u}",
+            i ? "," : "", LOOP_STAGE_NAMES[i], h.count(), h.percentile(50), h.percentile(99), h.max(),
+            h.count() > 0 ? (uint32_t)(h.total() / h.count()) : 0);
+  }
+  appendf(json, "},\"tickLateness\":{\"count\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}}",
+          tickLateness.count(), tickLateness.percentile(50), tickLateness.percentile(99), tickLateness.max());
+  server->send(200, "application/json", json);
+  if (server->arg("reset") == "1") {
+    for (int i = 0; i < LOOP_STAGE_COUNT; i++) {
+      loopStageHistograms[i].reset();
+    }
+    tickLateness.reset();
+  }
+}
+
+void handleDiagnostics() {
+  const NbHttpStats& s = server->stats();
+  std::string json;
+  appendf(json, "{\"http\":{\"active\":%u,\"maxActive\":%u,\"accepted\":%u,\"requests\":%u,\"timeouts\":%u,"
+          "\"rejected\":%u,\"evicted\":%u,\"errors\":%u}}",
+          s.active, s.maxActive, s.accepted, s.requests, s.timeouts, s.rejected, s.evicted, s.errors);
+  server->send(200, "application/json", json);
+}
+
+// ---------------------------------------------------------------------------
+
+// Такт управления: шаг модели и простое решение по вентилятору и насосу
+static void controlTick() {
+  sim.step(CONTROL_TICK_MS / 1000.0, fanOn, pumpOn);
+  const BoilerSimState& s = sim.state();
+  if (s.coalKg < 1.0) {
+    sim.addCoal();
+  }
+  fanOn = s.boilerTemp < 58.0 || (fanOn && s.boilerTemp < 62.0);
+  pumpOn = s.boilerTemp > 40.0;
+}
+
+int main(int argc, char** argv) {
+  uint16_t port = 8080;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--www") == 0 && i + 1 < argc) {
+      wwwRoot = argv[++i];
+    } else if (strcmp(argv[i], "--handler-us") == 0 && i + 1 < argc) {
+      handlerCostUs = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--port 8080] [--www data] [--handler-us 0]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  static NbHttpServer httpServer(port);
+  server = &httpServer;
+  BoilerSimParams params;
+  sim.begin(params, 55.0);
+  sim.addCoal();
+
+  server->on("/", HTTP_GET, handleWebInterface);
+  server->on("/api/status", HTTP_GET, handleStatus);
+  server->on("/api/settings/all", HTTP_GET, handleSettingsAll);
+  server->on("/api/system/mode", HTTP_GET, []() { handleSmallJson("{\"mode\":\"auto\",\"manual\":false}"); });
+  server->on("/api/ntp/time", HTTP_GET, []() { handleSmallJson("{\"time\":\"12:00:00\",\"date\":\"2026-01-14\",\"synced\":true}"); });
+  server->on("/api/wifi/info", HTTP_GET, []() {
+    handleSmallJson("{\"ssid\":\"home\",\"rssi\":-61,\"ip\":\"192.168.1.50\",\"mac\":\"AA:BB:CC:DD:EE:FF\",\"channel\":6,\"stage\":\"primary\"}");
+  });
+  server->on("/api/wifi/scan", HTTP_GET, handleWiFiScan);
+  server->on("/api/wifi/scan/results", HTTP_GET, handleWiFiScanResults);
+  server->on("/api/system/timers", HTTP_GET, handleTimers);
+  server->on("/api/system/log", HTTP_GET, handleBootLog);
+  server->on("/api/diagnostics", HTTP_GET, handleDiagnostics);
+  server->on("/api/diagnostics/profile", HTTP_GET, handleLoopProfile);
+  server->onNotFound([]() { server->send(404, "text/plain", "Not Found"); });
+  server->begin();
+  fprintf(stderr, "[Host] NbHttpServer на порту %u, handler-us %lu\n", port, handlerCostUs);
+
+  uint64_t nextTick = micros64() + CONTROL_TICK_MS * 1000ULL;
+  while (true) {
+    uint64_t loopStart = micros64();
+    server->handleClient();
+    uint64_t webEnd = micros64();
+    loopStageHistograms[LOOP_STAGE_WEB].record(webEnd - loopStart);
+
+    if (webEnd >= nextTick) {
+      tickLateness.record(webEnd - nextTick);
+      controlTick();
+      nextTick += CONTROL_TICK_MS * 1000ULL;
+      if (nextTick < webEnd) {
+        nextTick = webEnd + CONTROL_TICK_MS * 1000ULL;  // Пропущенные такты не догоняем
+      }
+    }
+    uint64_t controlEnd = micros64();
+    loopStageHistograms[LOOP_STAGE_CONTROL].record(controlEnd - webEnd);
+    loopStageHistograms[LOOP_STAGE_TOTAL].record(controlEnd - loopStart);
+    nbYield();  // delay(1) в конце loop() прошивки
+  }
+}
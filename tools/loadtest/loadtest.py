@@ -0,0 +1,424 @@
+#!/usr/bin/env python3
+"""Нагрузочные сценарии веб-API контроллера: пропускная способность, задержки
+ответов и задержка тактов управления под нагрузкой.
+
+По умолчанию собирает хостовый стенд (tools/loadtest/host_server.cpp - тот же
+NbHttpServer на POSIX-сокетах) и гоняет сценарии против него. С --url - против
+живого контроллера (задержка такта там - этап total профиля loop()).
+
+Использование:
+    python3 tools/loadtest/loadtest.py                        # все сценарии на хосте
+    python3 tools/loadtest/loadtest.py -s dashboard,slowloris -d 20
+    python3 tools/loadtest/loadtest.py --handler-us 3000      # поправка на скорость ESP32
+    python3 tools/loadtest/loadtest.py --url http://kotel.local -s dashboard
+    python3 tools/loadtest/loadtest.py --json before.json     # сохранить базу
+    python3 tools/loadtest/loadtest.py --compare before.json  # сравнить с базой
+
+Сценарии:
+    dashboard  - панели опрашивают /api/status без пауз
+    settings   - загрузка страницы: index.html, /api/settings/all и запросы вкладок
+    wifiscan   - запуск сканирования WiFi и опрос результатов
+    large      - большие ответы /api/system/timers и /api/system/log
+    slowloris  - медленные клиенты держат соединения, панели опрашивают статус
+    mixed      - все вместе с реальными интервалами веб-интерфейса
+"""
+
+import argparse
+import asyncio
+import json
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+from urllib.parse import urlparse
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+HOST_SOURCES = [
+    "tools/loadtest/host_server.cpp",
+    "lib/NbHttpServer/NbHttpServer.cpp",
+    "lib/NbHttpServer/NbSocket.cpp",
+    "lib/LatencyHistogram/LatencyHistogram.cpp",
+    "lib/BoilerSim/BoilerSim.cpp",
+]
+HOST_INCLUDES = ["lib/NbHttpServer", "lib/LatencyHistogram", "lib/BoilerSim"]
+
+PAGE_LOAD = ["/", "/api/settings/all", "/api/status", "/api/system/mode", "/api/ntp/time", "/api/wifi/info"]
+REQUEST_TIMEOUT = 15.0
+
+
+class HttpError(Exception):
+    pass
+
+
+class Connection:
+    """Keep-alive соединение HTTP/1.1 с минимальным разбором ответа."""
+
+    def __init__(self, host, port):
+        self.host = host
+        self.port = port
+        self.reader = None
+        self.writer = None
+        self.connects = 0
+
+    async def open(self):
+        self.reader, self.writer = await asyncio.open_connection(self.host, self.port)
+        self.connects += 1
+
+    def close(self):
+        if self.writer is not None:
+            self.writer.close()
+        self.reader = self.writer = None
+
+    async def request(self, path, method="GET"):
+        # Сервер мог закрыть простаивающее соединение - GET повторяется один раз
+        for attempt in range(2):
+            reused = self.writer is not None
+            if not reused:
+                await self.open()
+            try:
+                return await asyncio.wait_for(self._exchange(method, path), REQUEST_TIMEOUT)
+            except (ConnectionError, asyncio.IncompleteReadError, HttpError):
+                self.close()
+                if not reused or attempt == 1:
+                    raise
+            except asyncio.TimeoutError:
+                self.close()
+                raise
+        raise HttpError("unreachable")
+
+    async def _exchange(self, method, path):
+        self.writer.write(("%s %s HTTP/1.1\r\nHost: %s\r\nContent-Length: 0\r\n\r\n"
+                           % (method, path, self.host)).encode())
+        await self.writer.drain()
+        status_line = await self.reader.readline()
+        if not status_line:
+            raise HttpError("connection closed")
+        status = int(status_line.split()[1])
+        headers = {}
+        while True:
+            line = await self.reader.readline()
+            if line in (b"\r\n", b"\n", b""):
+                break
+            name, _, value = line.decode("latin-1").partition(":")
+            headers[name.strip().lower()] = value.strip()
+        if headers.get("transfer-encoding", "").lower() == "chunked":
+            body = bytearray()
+            while True:
+                size = int((await self.reader.readline()).strip(), 16)
+                if size == 0:
+                    await self.reader.readline()
+                    break
+                body += await self.reader.readexactly(size)
+                await self.reader.readline()
+            body = bytes(body)
+        else:
+            body = await self.reader.readexactly(int(headers.get("content-length", "0")))
+        if headers.get("connection", "").lower() == "close":
+            self.close()
+        return status, body
+
+
+class Stats:
+    def __init__(self):
+        self.latencies = []  # мс
+        self.errors = 0
+        self.bytes = 0
+        self.pages = []      # Загрузка страницы целиком, мс
+
+    def add(self, started, body):
+        self.latencies.append((time.perf_counter() - started) * 1000.0)
+        self.bytes += len(body)
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    rank = max(0, min(len(ordered) - 1, int(round(p / 100.0 * len(ordered) + 0.5)) - 1))
+    return ordered[rank]
+
+
+async def timed_get(conn, path, stats):
+    started = time.perf_counter()
+    try:
+        status, body = await conn.request(path)
+    except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, HttpError, ValueError):
+        stats.errors += 1
+        return None
+    if status >= 400:
+        stats.errors += 1
+        return None
+    stats.add(started, body)
+    return body
+
+
+# ---------------------------------------------------------------------------
+# Клиенты сценариев
+
+
+async def poller(target, paths, interval, deadline, stats):
+    conn = Connection(*target)
+    i = 0
+    while time.monotonic() < deadline:
+        await timed_get(conn, paths[i % len(paths)], stats)
+        i += 1
+        if interval > 0:
+            await asyncio.sleep(interval)
+    conn.close()
+
+
+async def page_loader(target, pause, deadline, stats):
+    # Браузер грузит страницу по двум соединениям: документ и API параллельно
+    while time.monotonic() < deadline:
+        started = time.perf_counter()
+        doc = Connection(*target)
+        api = Connection(*target)
+
+        async def fetch_api():
+            for path in PAGE_LOAD[1:]:
+                await timed_get(api, path, stats)
+
+        await asyncio.gather(timed_get(doc, PAGE_LOAD[0], stats), fetch_api())
+        stats.pages.append((time.perf_counter() - started) * 1000.0)
+        doc.close()
+        api.close()
+        await asyncio.sleep(pause)
+
+
+async def wifi_scanner(target, deadline, stats):
+    conn = Connection(*target)
+    while time.monotonic() < deadline:
+        await timed_get(conn, "/api/wifi/scan", stats)
+        while time.monotonic() < deadline:
+            await asyncio.sleep(0.5)
+            body = await timed_get(conn, "/api/wifi/scan/results", stats)
+            if body is not None and b'"scanning":false' in body:
+                break
+    conn.close()
+
+
+async def slow_client(target, deadline, counters):
+    # Заголовки по строке в секунду, запрос не заканчивается никогда
+    while time.monotonic() < deadline:
+        try:
+            reader, writer = await asyncio.open_connection(*target)
+        except OSError:
+            await asyncio.sleep(0.5)
+            continue
+        counters["connects"] += 1
+        started = time.monotonic()
+        try:
+            writer.write(b"GET /api/status HTTP/1.1\r\nHost: x\r\n")
+            i = 0
+            while time.monotonic() < deadline:
+                await asyncio.sleep(1.0)
+                writer.write(b"X-Slow-%d: y\r\n" % i)
+                await writer.drain()
+                i += 1
+                if reader.at_eof():
+                    break
+        except (ConnectionError, OSError):
+            pass
+        counters["held"].append(time.monotonic() - started)
+        writer.close()
+
+
+def scenario_tasks(name, target, deadline, stats, counters):
+    if name == "dashboard":
+        return [poller(target, ["/api/status"], 0, deadline, stats) for _ in range(4)]
+    if name == "settings":
+        return [page_loader(target, 0.5, deadline, stats) for _ in range(2)]
+    if name == "wifiscan":
+        return [wifi_scanner(target, deadline, stats) for _ in range(2)]
+    if name == "large":
+        return [poller(target, ["/api/system/timers", "/api/system/log"], 0, deadline, stats) for _ in range(3)]
+    if name == "slowloris":
+        return ([slow_client(target, deadline, counters) for _ in range(8)] +
+                [poller(target, ["/api/status"], 0.2, deadline, stats) for _ in range(2)])
+    if name == "mixed":
+        # Интервалы как у веб-интерфейса: статус раз в 3 с на каждой открытой вкладке
+        return ([poller(target, ["/api/status"], 3.0, deadline, stats) for _ in range(3)] +
+                [page_loader(target, 5.0, deadline, stats),
+                 wifi_scanner(target, deadline, stats),
+                 poller(target, ["/api/system/timers", "/api/system/log"], 2.0, deadline, stats),
+                 slow_client(target, deadline, counters)])
+    raise SystemExit("неизвестный сценарий: %s" % name)
+
+
+SCENARIOS = ["dashboard", "settings", "wifiscan", "large", "slowloris", "mixed"]
+
+
+# ---------------------------------------------------------------------------
+# Прогон
+
+
+async def fetch_json(target, path):
+    conn = Connection(*target)
+    try:
+        status, body = await conn.request(path)
+        return json.loads(body) if status == 200 else {}
+    except (OSError, asyncio.TimeoutError, HttpError, ValueError):
+        return {}
+    finally:
+        conn.close()
+
+
+async def run_scenario(name, target, duration):
+    await fetch_json(target, "/api/diagnostics/profile?reset=1")
+    http_before = (await fetch_json(target, "/api/diagnostics")).get("http", {})
+    stats = Stats()
+    counters = {"connects": 0, "held": []}
+    started = time.monotonic()
+    deadline = started + duration
+    await asyncio.gather(*scenario_tasks(name, target, deadline, stats, counters))
+    elapsed = time.monotonic() - started
+    profile = await fetch_json(target, "/api/diagnostics/profile")
+    http_after = (await fetch_json(target, "/api/diagnostics")).get("http", {})
+
+    lat = stats.latencies
+    total = profile.get("stages", {}).get("total", {})
+    result = {
+        "scenario": name,
+        "requests": len(lat),
+        "errors": stats.errors,
+        "rps": len(lat) / elapsed if elapsed > 0 else 0.0,
+        "kbps": stats.bytes / 1024.0 / elapsed if elapsed > 0 else 0.0,
+        "p50": percentile(lat, 50),
+        "p90": percentile(lat, 90),
+        "p99": percentile(lat, 99),
+        "max": max(lat) if lat else 0.0,
+        # Профиль прошивки в мкс, здесь - мс
+        "loopP99": total.get("p99", 0) / 1000.0,
+        "loopMax": total.get("max", 0) / 1000.0,
+        "http": {k: http_after.get(k, 0) - http_before.get(k, 0)
+                 for k in ("accepted", "timeouts", "rejected", "evicted", "errors")},
+    }
+    tick = profile.get("tickLateness")
+    if tick:
+        result["tickP50"] = tick.get("p50", 0) / 1000.0
+        result["tickP99"] = tick.get("p99", 0) / 1000.0
+        result["tickMax"] = tick.get("max", 0) / 1000.0
+    if stats.pages:
+        result["pageP50"] = percentile(stats.pages, 50)
+        result["pageMax"] = max(stats.pages)
+    if counters["connects"]:
+        result["slowConnects"] = counters["connects"]
+        result["slowHeldAvg"] = sum(counters["held"]) / max(1, len(counters["held"]))
+    return result
+
+
+def print_results(results, baseline):
+    base = {r["scenario"]: r for r in baseline}
+    print("%-10s %7s %5s %8s %8s %8s %8s %8s %9s %9s" %
+          ("scenario", "req", "err", "req/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "tick p99", "tick max"))
+    for r in results:
+        tick_p99 = r.get("tickP99", r["loopP99"])
+        tick_max = r.get("tickMax", r["loopMax"])
+        print("%-10s %7d %5d %8.1f %8.2f %8.2f %8.2f %8.2f %9.2f %9.2f" %
+              (r["scenario"], r["requests"], r["errors"], r["rps"], r["p50"], r["p90"], r["p99"], r["max"],
+               tick_p99, tick_max))
+        b = base.get(r["scenario"])
+        if b:
+            print("%-10s %7s %5s %+7.0f%% %+7.0f%% %8s %+7.0f%% %8s %+8.0f%%" %
+                  ("  vs base", "", "", pct(r["rps"], b["rps"]), pct(r["p50"], b["p50"]), "",
+                   pct(r["p99"], b["p99"]), "", pct(tick_p99, b.get("tickP99", b["loopP99"]))))
+        extras = []
+        server_counts = " ".join("%s=%d" % (k, v) for k, v in r["http"].items() if v)
+        if server_counts:
+            extras.append("server " + server_counts)
+        if "pageP50" in r:
+            extras.append("page p50 %.1f ms max %.1f ms" % (r["pageP50"], r["pageMax"]))
+        if "slowConnects" in r:
+            extras.append("slow clients: %d connects, held %.1f s avg" % (r["slowConnects"], r["slowHeldAvg"]))
+        if extras:
+            print("%-10s %s" % ("", "; ".join(extras)))
+    print("tick - опоздание такта управления (хост) или этап total профиля loop() (контроллер), мс")
+
+
+def pct(value, base):
+    return (value - base) * 100.0 / base if base else 0.0
+
+
+def build_host(output):
+    cmd = ["g++", "-std=c++17", "-O2"]
+    cmd += ["-I" + os.path.join(REPO_ROOT, d) for d in HOST_INCLUDES]
+    cmd += [os.path.join(REPO_ROOT, s) for s in HOST_SOURCES]
+    cmd += ["-o", output]
+    subprocess.run(cmd, check=True)
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def start_host(binary, handler_us):
+    port = free_port()
+    proc = subprocess.Popen([binary, "--port", str(port), "--www", os.path.join(REPO_ROOT, "data"),
+                             "--handler-us", str(handler_us)])
+    for _ in range(100):
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.1).close()
+            return proc, ("127.0.0.1", port)
+        except OSError:
+            time.sleep(0.05)
+    proc.kill()
+    raise SystemExit("хостовый стенд не запустился")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Нагрузочные сценарии веб-API контроллера")
+    parser.add_argument("-s", "--scenarios", default=",".join(SCENARIOS), help="через запятую: " + ", ".join(SCENARIOS))
+    parser.add_argument("-d", "--duration", type=float, default=10.0, help="секунд на сценарий")
+    parser.add_argument("--url", help="живой контроллер вместо хостового стенда, например http://kotel.local")
+    parser.add_argument("--handler-us", type=int, default=0, help="занятое ожидание в обработчиках стенда, мкс")
+    parser.add_argument("--json", help="сохранить результаты в файл")
+    parser.add_argument("--compare", help="сравнить с сохраненными результатами")
+    parser.add_argument("--build-only", metavar="PATH", help="только собрать стенд в PATH")
+    args = parser.parse_args()
+
+    if args.build_only:
+        build_host(args.build_only)
+        return
+
+    proc = None
+    tmpdir = None
+    if args.url:
+        parsed = urlparse(args.url)
+        target = (parsed.hostname, parsed.port or 80)
+    else:
+        tmpdir = tempfile.TemporaryDirectory()
+        binary = os.path.join(tmpdir.name, "host_server")
+        build_host(binary)
+        proc, target = start_host(binary, args.handler_us)
+
+    baseline = []
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)["results"]
+
+    results = []
+    try:
+        for name in args.scenarios.split(","):
+            name = name.strip()
+            print("[%s] %.0f с..." % (name, args.duration), file=sys.stderr)
+            results.append(asyncio.run(run_scenario(name, target, args.duration)))
+    finally:
+        if proc is not None:
+            proc.terminate()
+            proc.wait()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+
+    print_results(results, baseline)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"target": args.url or "host", "handlerUs": args.handler_us,
+                       "duration": args.duration, "results": results}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
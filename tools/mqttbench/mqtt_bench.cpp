@@ -0,0 +1,360 @@
+// Хостовый замер MQTT-слоя прошивки: сериализация исходящих (JSON против
+// MessagePack) и разбор входящих команд (таблица MqttCommandRegistry против
+// прежнего разбора через String).
+//
+// Записи <prefix>/state и <prefix>/ml/data собираются теми же функциями, что
+// и на ESP32 (writeStatePayload и writeMLPayload из lib/MqttMessages), над
+// снимком с типичными для работающего котла значениями. Для каждой записи и
+// кодирования печатается размер сообщения и время сборки; для схем - размер.
+//
+// Входящие: таблица MQTT_COMMANDS прошивки (lib/MqttMessages), обработчики
+// здесь разбирают payload так же (число или слово), но только считают
+// вызовы. Прежний mqttCallback воспроизведен со строкой, которая, как String
+// Arduino, перевыделяет память на каждый добавленный байт. Печатается время
+// на сообщение и число выделений памяти.
+//
+// Сборка (из корня репозитория, одной командой):
+//   g++ -std=c++17 -O2 -Ilib/PayloadWriter -Ilib/MqttCommands -Ilib/MqttMessages
+//       -o mqtt_bench tools/mqttbench/mqtt_bench.cpp lib/PayloadWriter/PayloadWriter.cpp
+//       lib/MqttCommands/MqttCommands.cpp lib/MqttMessages/MqttMessages.cpp
+// Запуск:
+//   ./mqtt_bench [--iterations 200000] [--dump]
+// --dump печатает сами сообщения: JSON и схему текстом, MessagePack в hex.
+// Время на хосте в десятки раз меньше, чем на ESP32, - смотреть на соотношение;
+// на устройстве то же меряет POST /api/bench/run (mqttMLJson, mqttMLMsgpack) в сборке с DEVICE_BENCH.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MqttCommands.h"
+#include "MqttMessages.h"
+#include "PayloadWriter.h"
+
+#define BENCH_BUFFER_SIZE 1536  // Как MQTT_BUFFER_SIZE в прошивке
+
+// Имена как в SYSTEM_STATES и COMFORT_STATE_NAMES прошивки
+const char* const SYSTEM_STATE_NAMES[] = {
+  "IDLE", "HEATING", "HEATING_TIMEOUT", "COAL_BURNED", "OVERHEAT", "HIGH_TEMP", "КОТЕЛ_ПОГАС", "РОЗЖИГ",
+  "ОШИБКА_РОЗЖИГА", "Ожидание", "Разогрев 1", "Ожидание охлаждения", "Ожидание прогрева", "Разогрев 2",
+  "Комфорт", "Поддержание"
+};
+const char* const COMFORT_STATE_NAMES[] = {
+  "WAIT", "HEATING_1", "WAIT_COOLING", "WAIT_HEATING", "HEATING_2", "COMFORT", "MAINTAIN", "OVERHEAT"
+};
+const MqttEnumNames ENUM_NAMES = {
+  SYSTEM_STATE_NAMES, sizeof(const char*), sizeof(SYSTEM_STATE_NAMES) / sizeof(SYSTEM_STATE_NAMES[0]),
+  COMFORT_STATE_NAMES, sizeof(COMFORT_STATE_NAMES) / sizeof(COMFORT_STATE_NAMES[0])
+};
+
+// Работающий котел в режиме Комфорт, разогрев 2
+static MqttSnapshot typicalSnapshot() {
+  MqttSnapshot s = {};
+  s.names = &ENUM_NAMES;
+  s.supplyTemp = 63.4375f;
+  s.returnTemp = 51.8125f;
+  s.boilerTemp = 66.25f;
+  s.outdoorTemp = -7.5625f;
+  s.homeTemp = 22.9375f;
+  s.setpoint = 60.5f;
+  s.fan = true;
+  s.pump = true;
+  s.systemEnabled = true;
+  s.systemState = 13;
+  s.workMode = 1;
+  s.homeTempSensorLWTOnline = true;
+  s.comfortState = 4;
+  s.targetHomeTemp = 23.5f;
+  s.autoSetpoint = 60.0f;
+  s.minTemp = 45.0f;
+  s.maxTemp = 75.0f;
+  s.hysteresis = 2.0f;
+  s.inertiaTemp = 55.0f;
+  s.inertiaTime = 10;
+  s.overheatTemp = 77.0f;
+  s.heatingTimeout = 30;
+  s.uptimeSec = 183245;
+  s.timestamp = 1792396800u + s.uptimeSec;
+  strcpy(s.time, "14:32:05");
+  strcpy(s.date, "19.10.2026");
+  s.wifiRSSI = -67;
+  strcpy(s.wifiSSID, "Keenetic-4821");
+  strcpy(s.wifiIP, "192.168.1.57");
+  strcpy(s.wifiMAC, "24:6F:28:A1:B2:C3");
+  s.freeMem = 187432;
+  s.heapSize = 298800;
+  s.mlPublishInterval = 10;
+  s.sensorCountBus1 = 2;
+  s.sensorCountBus2 = 2;
+  s.mqttConnected = true;
+  return s;
+}
+
+// Показания меняются от прохода к проходу, чтобы форматирование чисел не кэшировалось
+MqttSnapshot snapshot = typicalSnapshot();
+
+struct BenchRecord {
+  const char* name;
+  const char* schemaName;  // Топик словаря относительно префикса
+  MqttPayloadFill fill;
+};
+
+const BenchRecord RECORDS[] = {
+  {"state", "schema/state", writeStatePayload},
+  {"ml/data", "schema/ml", writeMLPayload}
+};
+
+// Входящие команды
+
+uint32_t handled = 0;
+uint32_t legacyAllocs = 0;
+
+static void onNumber(MqttBytes payload) {
+  float value;
+  if (payload.toFloat(value) && value > -100.0f) {
+    handled++;
+  }
+}
+
+static void onWord(MqttBytes payload) {
+  if (payload.isAny("1|on|start|reset|comfort|online") || payload.isAny("0|off|stop|auto|offline")) {
+    handled++;
+  }
+}
+
+// Обработчики таблицы MQTT_COMMANDS: только разбор и счет
+void onMqttSetpoint(MqttBytes payload) { onNumber(payload); }
+void onMqttSensorsReset(MqttBytes payload) { onWord(payload); }
+void onMqttIgnitionStart(MqttBytes payload) { onWord(payload); }
+void onMqttWorkMode(MqttBytes payload) { onWord(payload); }
+void onMqttCoalFeeding(MqttBytes payload) { onWord(payload); }
+void onMqttFan(MqttBytes payload) { onWord(payload); }
+void onMqttComfortTarget(MqttBytes payload) { onNumber(payload); }
+void onEsp01Temperature(MqttBytes payload) { onNumber(payload); }
+void onEsp01Status(MqttBytes payload) { onWord(payload); }
+
+struct BenchMessage {
+  const char* topic;
+  const char* payload;
+};
+
+// Поток, как на объекте: в основном температура ESP01, изредка команды
+const BenchMessage MESSAGES[] = {
+  {"home/esp01/temperature", "22.81"},
+  {"home/esp01/temperature", "22.75"},
+  {"home/esp01/status", "online"},
+  {"kotel/device1/setpoint/set", "62.5"},
+  {"kotel/device1/fan/set", "on"},
+  {"kotel/device1/targetHomeTemp/set", "23.5"},
+  {"kotel/device1/coalFeeding/set", "1"},
+  {"home/esp01/temperature", "22.69"}
+};
+const size_t MESSAGE_COUNT = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+
+// Строка с выделением памяти на каждое добавление, как String Arduino
+class LegacyString {
+ public:
+  LegacyString() = default;
+  LegacyString(const char* s) { append(s, strlen(s)); }
+  LegacyString(const LegacyString& other) { append(other._buf, other._len); }
+  ~LegacyString() { free(_buf); }
+  LegacyString& operator=(const LegacyString&) = delete;
+
+  void append(const char* s, size_t n) {
+    _buf = (char*)realloc(_buf, _len + n + 1);
+    legacyAllocs++;
+    memcpy(_buf + _len, s, n);
+    _len += n;
+    _buf[_len] = '\0';
+  }
+  LegacyString& operator+=(char c) {
+    append(&c, 1);
+    return *this;
+  }
+  LegacyString operator+(const char* s) const {
+    LegacyString out(*this);
+    out.append(s, strlen(s));
+    return out;
+  }
+  bool operator==(const char* s) const { return _len == strlen(s) && memcmp(_buf, s, _len) == 0; }
+  bool operator==(const LegacyString& o) const { return _len == o._len && memcmp(_buf, o._buf, _len) == 0; }
+  float toFloat() const { return _buf != nullptr ? strtof(_buf, nullptr) : 0.0f; }
+
+ private:
+  char* _buf = nullptr;
+  size_t _len = 0;
+};
+
+// Прежний mqttCallback: копии топика и payload, три топика из префикса на сообщение
+static void legacyCallback(const LegacyString& prefix, const char* topic, const uint8_t* payload, size_t length) {
+  LegacyString topicStr(topic);
+  LegacyString message;
+  for (size_t i = 0; i < length; i++) {
+    message += (char)payload[i];
+  }
+  LegacyString setpointTopic = prefix + "/setpoint/set";
+  if (topicStr == setpointTopic && message.toFloat() > 0) {
+    handled++;
+  }
+  if (topicStr == "home/esp01/temperature" && message.toFloat() > -100.0f) {
+    handled++;
+  }
+  if (topicStr == "home/esp01/status" && (message == "online" || message == "offline")) {
+    handled++;
+  }
+  LegacyString sensorsRelayTopic = prefix + "/sensors/reset";
+  if (topicStr == sensorsRelayTopic && (message == "1" || message == "0")) {
+    handled++;
+  }
+  LegacyString ignitionStartTopic = prefix + "/ignition/start";
+  if (topicStr == ignitionStartTopic && message == "1") {
+    handled++;
+  }
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void advanceReadings() {
+  snapshot.supplyTemp += 0.0625f;
+  if (snapshot.supplyTemp > 80.0f) snapshot.supplyTemp = 40.0f;
+  snapshot.homeTemp = snapshot.homeTemp > 24.0f ? 21.0f : snapshot.homeTemp + 0.0625f;
+  snapshot.uptimeSec++;
+  snapshot.timestamp++;
+  snapshot.freeMem ^= 0x1F0;
+}
+
+static size_t build(PayloadFormat format, uint8_t* buf, const BenchRecord& record) {
+  return buildMqttPayload(format, buf, BENCH_BUFFER_SIZE, record.fill, snapshot);
+}
+
+static void dump(PayloadFormat format, const uint8_t* buf, size_t len) {
+  if (format == PAYLOAD_MSGPACK) {
+    for (size_t i = 0; i < len; i++) {
+      printf("%02x%s", buf[i], (i % 32 == 31 || i + 1 == len) ? "\n" : " ");
+    }
+  } else {
+    printf("%.*s\n", (int)len, (const char*)buf);
+  }
+}
+
+int main(int argc, char** argv) {
+  long iterations = 200000;
+  bool dumpPayloads = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--dump") == 0) {
+      dumpPayloads = true;
+    } else {
+      fprintf(stderr, "usage: %s [--iterations N] [--dump]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  static uint8_t buf[BENCH_BUFFER_SIZE];
+  const char* const formatNames[] = {"json", "msgpack"};
+
+  printf("%-8s %-8s %7s %7s %10s\n", "record", "format", "fields", "bytes", "ns/op");
+  for (const BenchRecord& record : RECORDS) {
+    size_t jsonBytes = 0;
+    for (int f = PAYLOAD_JSON; f <= PAYLOAD_MSGPACK; f++) {
+      PayloadFormat format = (PayloadFormat)f;
+      size_t len = build(format, buf, record);
+      if (len == 0) {
+        fprintf(stderr, "%s: payload does not fit %d bytes\n", record.name, BENCH_BUFFER_SIZE);
+        return 1;
+      }
+      // Прогрев, затем замер
+      volatile size_t sink = 0;
+      for (long i = 0; i < iterations / 10; i++) {
+        sink += build(format, buf, record);
+      }
+      uint64_t start = nowNs();
+      for (long i = 0; i < iterations; i++) {
+        advanceReadings();
+        sink += build(format, buf, record);
+      }
+      double nsPerOp = (double)(nowNs() - start) / iterations;
+      (void)sink;
+
+      PayloadWriter counter(format, buf, BENCH_BUFFER_SIZE);
+      record.fill(counter, snapshot);
+      len = counter.finish();
+      printf("%-8s %-8s %7u %7zu %10.1f", record.name, formatNames[f], counter.fieldCount(), len, nsPerOp);
+      if (format == PAYLOAD_JSON) {
+        jsonBytes = len;
+        printf("\n");
+      } else {
+        printf("   (%.0f%% of json)\n", 100.0 * len / jsonBytes);
+      }
+      if (dumpPayloads) {
+        dump(format, buf, len);
+      }
+    }
+  }
+
+  printf("\n%-14s %7s\n", "schema", "bytes");
+  for (const BenchRecord& record : RECORDS) {
+    size_t len = build(PAYLOAD_SCHEMA, buf, record);
+    if (len == 0) {
+      fprintf(stderr, "%s: does not fit %d bytes\n", record.schemaName, BENCH_BUFFER_SIZE);
+      return 1;
+    }
+    printf("%-14s %7zu\n", record.schemaName, len);
+    if (dumpPayloads) {
+      dump(PAYLOAD_SCHEMA, buf, len);
+    }
+  }
+
+  // Разбор входящих: одинаковый поток сообщений через таблицу и через прежний код
+  MqttCommandRegistry registry(MQTT_COMMANDS, MQTT_COMMAND_COUNT);
+  registry.setPrefix("kotel/device1");
+  size_t payloadLens[MESSAGE_COUNT];
+  for (size_t m = 0; m < MESSAGE_COUNT; m++) {
+    payloadLens[m] = strlen(MESSAGES[m].payload);
+  }
+
+  handled = 0;
+  for (size_t m = 0; m < MESSAGE_COUNT; m++) {
+    registry.dispatch(MESSAGES[m].topic, (const uint8_t*)MESSAGES[m].payload, payloadLens[m]);
+  }
+  if (handled != MESSAGE_COUNT || registry.unknown() != 0) {
+    fprintf(stderr, "registry: handled %u of %zu messages\n", handled, MESSAGE_COUNT);
+    return 1;
+  }
+  if (registry.dispatch("kotel/device1/state", (const uint8_t*)"x", 1) != nullptr ||
+      registry.dispatch("kotel/device10/fan/set", (const uint8_t*)"on", 2) != nullptr) {
+    fprintf(stderr, "registry: foreign topic matched\n");
+    return 1;
+  }
+
+  long messages = iterations * 4;
+  uint64_t start = nowNs();
+  for (long i = 0; i < messages; i++) {
+    const BenchMessage& msg = MESSAGES[i % MESSAGE_COUNT];
+    registry.dispatch(msg.topic, (const uint8_t*)msg.payload, payloadLens[i % MESSAGE_COUNT]);
+  }
+  double registryNs = (double)(nowNs() - start) / messages;
+
+  LegacyString prefix("kotel/device1");
+  legacyAllocs = 0;
+  start = nowNs();
+  for (long i = 0; i < messages; i++) {
+    const BenchMessage& msg = MESSAGES[i % MESSAGE_COUNT];
+    legacyCallback(prefix, msg.topic, (const uint8_t*)msg.payload, payloadLens[i % MESSAGE_COUNT]);
+  }
+  double legacyNs = (double)(nowNs() - start) / messages;
+
+  printf("\n%-9s %10s %12s\n", "dispatch", "ns/msg", "allocs/msg");
+  printf("%-9s %10.1f %12.1f\n", "registry", registryNs, 0.0);
+  printf("%-9s %10.1f %12.1f\n", "string", legacyNs, (double)legacyAllocs / messages);
+  return 0;
+}
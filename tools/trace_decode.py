@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Расшифровка трассы контроллера (GET /api/trace) в текст или CSV.
+
+Использование:
+    curl -o trace.bin http://kotel.local/api/trace
+    python3 tools/trace_decode.py trace.bin            # читаемый журнал
+    python3 tools/trace_decode.py trace.bin --csv      # CSV для таблиц
+
+Формат записи (см. lib/TraceRecorder/TraceFormat.h):
+    uint32 millis | uint8 тип | uint8 длина | данные
+Записи TRACE_CONTINUATION дописываются к данным предыдущей записи.
+"""
+
+import argparse
+import struct
+import sys
+
+TRACE_BOOT = 1
+TRACE_SENSORS = 2
+TRACE_MQTT_IN = 3
+TRACE_HTTP = 4
+TRACE_RELAY = 5
+TRACE_STATE = 6
+TRACE_CONTROL = 7
+TRACE_CONTINUATION = 8
+
+TYPE_NAMES = {
+    TRACE_BOOT: "boot",
+    TRACE_SENSORS: "sensors",
+    TRACE_MQTT_IN: "mqtt",
+    TRACE_HTTP: "http",
+    TRACE_RELAY: "relay",
+    TRACE_STATE: "state",
+    TRACE_CONTROL: "control",
+}
+
+SENSOR_NAMES = ("supply", "return", "boiler", "outside")
+CONTROL_TRIGGER_NAMES = ("sensors", "home", "command", "timer")
+NO_VALUE = -32768
+
+
+def read_physical(data):
+    pos = 0
+    while pos + 6 <= len(data):
+        ms, rtype, length = struct.unpack_from("<IBB", data, pos)
+        payload = data[pos + 6:pos + 6 + length]
+        if (rtype not in TYPE_NAMES and rtype != TRACE_CONTINUATION) or len(payload) != length:
+            # Обрыв записи при сбросе питания - дальше читать нечего
+            break
+        yield ms, rtype, payload
+        pos += 6 + length
+
+
+def read_records(data):
+    current = None
+    for ms, rtype, payload in read_physical(data):
+        if rtype == TRACE_CONTINUATION:
+            # Продолжение без начала - начало осталось в перезаписанном файле кольца
+            if current is not None:
+                current[2] += payload
+            continue
+        if current is not None:
+            yield current[0], current[1], bytes(current[2])
+        current = [ms, rtype, bytearray(payload)]
+    if current is not None:
+        yield current[0], current[1], bytes(current[2])
+
+
+def split_pair(payload):
+    first, _, second = payload.partition(b"\0")
+    return first.decode("utf-8", "replace"), second.decode("utf-8", "replace")
+
+
+def describe(rtype, payload):
+    if rtype == TRACE_BOOT:
+        version, mode = split_pair(payload)
+        return "firmware=%s mode=%s" % (version, mode) if mode else "firmware=" + version
+    if rtype == TRACE_SENSORS:
+        values = struct.unpack("<4h", payload)
+        parts = []
+        for name, raw in zip(SENSOR_NAMES, values):
+            if raw != NO_VALUE:
+                parts.append("%s=%.2f" % (name, raw / 100.0))
+        return " ".join(parts)
+    if rtype in (TRACE_MQTT_IN, TRACE_HTTP, TRACE_STATE):
+        first, second = split_pair(payload)
+        return "%s %s" % (first, second)
+    if rtype == TRACE_RELAY:
+        pin, level = payload[0], payload[1]
+        return "pin=%d level=%d" % (pin, level)
+    if rtype == TRACE_CONTROL:
+        trigger, fan, pump, system_state, comfort_state = payload[:5]
+        names = [n for i, n in enumerate(CONTROL_TRIGGER_NAMES) if trigger & (1 << i)]
+        return "trigger=%s fan=%d pump=%d system=%d comfort=%d" % (
+            "+".join(names), fan, pump, system_state, comfort_state)
+    return payload.hex()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", help="файл, скачанный с /api/trace")
+    parser.add_argument("--csv", action="store_true", help="вывод в CSV")
+    args = parser.parse_args()
+
+    with open(args.trace, "rb") as f:
+        data = f.read()
+
+    out = sys.stdout
+    if args.csv:
+        out.write("ms,type,detail\n")
+    for ms, rtype, payload in read_records(data):
+        detail = describe(rtype, payload)
+        if args.csv:
+            out.write('%d,%s,"%s"\n' % (ms, TYPE_NAMES[rtype], detail.replace('"', '""')))
+        else:
+            out.write("%10.3f  %-8s %s\n" % (ms / 1000.0, TYPE_NAMES[rtype], detail))
+
+
+if __name__ == "__main__":
+    main()